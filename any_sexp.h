@@ -28,6 +28,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 typedef enum {
     ANY_SEXP_TAG_ERROR  = 0xf,
@@ -36,16 +37,43 @@ typedef enum {
     ANY_SEXP_TAG_SYMBOL = 1 << 1,
     ANY_SEXP_TAG_STRING = 1 << 2,
     ANY_SEXP_TAG_NUMBER = 1 << 3,
+    ANY_SEXP_TAG_OBJECT = ANY_SEXP_TAG_CONS | ANY_SEXP_TAG_SYMBOL,
+    ANY_SEXP_TAG_FLOAT  = ANY_SEXP_TAG_CONS | ANY_SEXP_TAG_NUMBER,
 } any_sexp_tag_t;
 
+// Representations
+//
+// By default a value is a pointer with the tag in its 4 highest bits, and the
+// numbers are stored in the other bits. The floats do not fit, so they are
+// allocated, and the pointers should fit in 60 bits.
+//
+// With ANY_SEXP_NAN_BOXING the floats are stored in the value as well, which
+// is the bits of the double plus ANY_SEXP_NAN_OFFSET. All the NaNs are
+// stored as the same one, so no double reaches the values below the offset,
+// which are taken by the others: a pointer or a number in the lowest 48
+// bits, and the tag in the 3 above them (see ANY_SEXP_NAN_TAGS). Nil is 0
+// in every representation.
+//
+// With ANY_SEXP_LOW_TAGGING the tag is in the lowest bits instead, which are
+// free in the pointers as the objects are aligned to 16 bytes. The numbers
+// are odd, with the value in the 63 bits above, and the others have an even
+// code in their 4 lowest bits (see ANY_SEXP_LOW_TAGS), so the numbers are
+// untagged with a shift and the conses with an offset. The floats are
+// allocated, as by default.
+//
+// With ANY_SEXP_NO_BOXING a value is a struct of the tag and a union, twice
+// as big as a pointer.
+//
 #ifdef ANY_SEXP_NO_BOXING
 
 typedef struct any_sexp {
     any_sexp_tag_t tag;
     union {
         struct any_sexp_cons *cons;
+        struct any_sexp_object *object;
         char *symbol;
         intptr_t number;
+        double real;
     };
 } any_sexp_t;
 
@@ -54,12 +82,128 @@ typedef struct any_sexp {
 
 #define ANY_SEXP_GET_TAG(sexp)    ((uintptr_t)(sexp).tag)
 #define ANY_SEXP_GET_CONS(sexp)   ((sexp).cons)
+#define ANY_SEXP_GET_OBJECT(sexp) ((sexp).object)
 #define ANY_SEXP_GET_SYMBOL(sexp) ((sexp).symbol)
 #define ANY_SEXP_GET_STRING(sexp) ((sexp).symbol)
 #define ANY_SEXP_GET_NUMBER(sexp) ((sexp).number)
+#define ANY_SEXP_GET_FLOAT(sexp)  ((sexp).real)
+
+#define ANY_SEXP_NUMBER_MAX INTPTR_MAX
+#define ANY_SEXP_NUMBER_MIN INTPTR_MIN
+
+#elif defined(ANY_SEXP_NAN_BOXING)
+
+#if UINTPTR_MAX != UINT64_MAX
+#error "ANY_SEXP_NAN_BOXING needs 64-bit pointers"
+#endif
+
+typedef void *any_sexp_t;
+
+#define ANY_SEXP_NAN_OFFSET ((uintptr_t)1 << 51)
+#define ANY_SEXP_NAN_QUIET  ((uintptr_t)0x7ff8 << 48)
+
+// The tags of the values below the offset, a nibble for each of the 8 codes
+// stored in the bits from ANY_SEXP_BIT_SHIFT, and the codes of the tags, a
+// nibble for each tag (6 is not used)
+#define ANY_SEXP_NAN_TAGS  ((uintptr_t)0xff843210)
+#define ANY_SEXP_NAN_CODES ((uintptr_t)0x7666666566643210)
+
+#define ANY_SEXP_BIT_SHIFT 48
+#define ANY_SEXP_BIT_SIGN  ((uintptr_t)1 << (ANY_SEXP_BIT_SHIFT - 1))
+
+#define ANY_SEXP_ERROR (any_sexp_t)((uintptr_t)7 << ANY_SEXP_BIT_SHIFT)
+#define ANY_SEXP_NIL   (any_sexp_t)NULL
+
+#define ANY_SEXP_UNTAG(sexp) (any_sexp_t)((uintptr_t)(sexp) & (((uintptr_t)1 << ANY_SEXP_BIT_SHIFT) - 1))
+
+#define ANY_SEXP_TAG(sexp, tag)   (any_sexp_t)((uintptr_t)(sexp) | ((ANY_SEXP_NAN_CODES >> 4 * (tag)) & 0x7) << ANY_SEXP_BIT_SHIFT)
+#define ANY_SEXP_GET_TAG(sexp)    (any_sexp_nan_tag((uintptr_t)(sexp)))
+#define ANY_SEXP_GET_CONS(sexp)   ((any_sexp_cons_t *)ANY_SEXP_UNTAG(sexp))
+#define ANY_SEXP_GET_OBJECT(sexp) ((any_sexp_object_t *)ANY_SEXP_UNTAG(sexp))
+#define ANY_SEXP_GET_SYMBOL(sexp) (((char *)ANY_SEXP_UNTAG(sexp)))
+#define ANY_SEXP_GET_STRING(sexp) (((char *)ANY_SEXP_UNTAG(sexp)))
+#define ANY_SEXP_GET_NUMBER(sexp) ((intptr_t)((uintptr_t)(sexp) << (64 - ANY_SEXP_BIT_SHIFT)) >> (64 - ANY_SEXP_BIT_SHIFT))
+#define ANY_SEXP_GET_FLOAT(sexp)  (any_sexp_float_unbox(sexp))
+
+#define ANY_SEXP_NUMBER_MAX ((intptr_t)(ANY_SEXP_BIT_SIGN - 1))
+#define ANY_SEXP_NUMBER_MIN (-ANY_SEXP_NUMBER_MAX - 1)
+
+// NOTE: A function, so the value is evaluated once
+static inline uintptr_t any_sexp_nan_tag(uintptr_t bits)
+{
+    return bits >= ANY_SEXP_NAN_OFFSET
+         ? (uintptr_t)ANY_SEXP_TAG_FLOAT
+         : (ANY_SEXP_NAN_TAGS >> 4 * (bits >> ANY_SEXP_BIT_SHIFT)) & 0xf;
+}
+
+static inline double any_sexp_float_unbox(any_sexp_t sexp)
+{
+    uintptr_t bits = (uintptr_t)sexp - ANY_SEXP_NAN_OFFSET;
+    double value;
+
+    memcpy(&value, &bits, sizeof(double));
+    return value;
+}
+
+#elif defined(ANY_SEXP_LOW_TAGGING)
+
+#if UINTPTR_MAX != UINT64_MAX
+#error "ANY_SEXP_LOW_TAGGING needs 64-bit pointers"
+#endif
+
+#define ANY_SEXP_FLOAT_BOXED
+
+typedef void *any_sexp_t;
+
+// The tags of the values, a nibble for each of their 4 lowest bits (the odd
+// ones are numbers), and the codes of the tags, a nibble for each tag (the
+// numbers have none)
+#define ANY_SEXP_LOW_TAGS  ((uintptr_t)0x8f8f898384828180)
+#define ANY_SEXP_LOW_CODES ((uintptr_t)0xe00000a000068420)
+#define ANY_SEXP_LOW_CONS  ((uintptr_t)0x2)
+
+#define ANY_SEXP_ERROR (any_sexp_t)(uintptr_t)0xe
+#define ANY_SEXP_NIL   (any_sexp_t)NULL
+
+#define ANY_SEXP_UNTAG(sexp) (any_sexp_t)((uintptr_t)(sexp) & ~(uintptr_t)0xf)
+
+#define ANY_SEXP_TAG(sexp, tag)   (any_sexp_t)((uintptr_t)(sexp) | ((ANY_SEXP_LOW_CODES >> 4 * (tag)) & 0xf))
+#define ANY_SEXP_GET_TAG(sexp)    (any_sexp_low_tag((uintptr_t)(sexp)))
+#define ANY_SEXP_GET_CONS(sexp)   ((any_sexp_cons_t *)((uintptr_t)(sexp) - ANY_SEXP_LOW_CONS))
+#define ANY_SEXP_GET_OBJECT(sexp) ((any_sexp_object_t *)ANY_SEXP_UNTAG(sexp))
+#define ANY_SEXP_GET_SYMBOL(sexp) (((char *)ANY_SEXP_UNTAG(sexp)))
+#define ANY_SEXP_GET_STRING(sexp) (((char *)ANY_SEXP_UNTAG(sexp)))
+#define ANY_SEXP_GET_NUMBER(sexp) ((intptr_t)(uintptr_t)(sexp) >> 1)
+#define ANY_SEXP_GET_FLOAT(sexp)  (*(double *)ANY_SEXP_UNTAG(sexp))
+
+#define ANY_SEXP_NUMBER_MAX (INTPTR_MAX >> 1)
+#define ANY_SEXP_NUMBER_MIN (INTPTR_MIN >> 1)
+
+// NOTE: A function, so the value is evaluated once
+static inline uintptr_t any_sexp_low_tag(uintptr_t bits)
+{
+    return (ANY_SEXP_LOW_TAGS >> 4 * (bits & 0xf)) & 0xf;
+}
+
+// NOTE: A single test for a constant tag, which the lookup of the tag in
+//       ANY_SEXP_LOW_TAGS does not fold to
+static inline bool any_sexp_low_is_tag(uintptr_t bits, any_sexp_tag_t tag)
+{
+    if (tag == ANY_SEXP_TAG_NUMBER)
+        return bits & 1;
+
+    if (tag == ANY_SEXP_TAG_NIL)
+        return bits == 0;
+
+    return (bits & 0xf) == ((ANY_SEXP_LOW_CODES >> 4 * tag) & 0xf);
+}
+
+#define ANY_SEXP_IS_TAG(sexp, tag) (any_sexp_low_is_tag((uintptr_t)(sexp), (tag)))
 
 #else
 
+#define ANY_SEXP_FLOAT_BOXED
+
 typedef void *any_sexp_t;
 
 #define ANY_SEXP_ERROR (any_sexp_t)UINTPTR_MAX
@@ -72,9 +216,15 @@ typedef void *any_sexp_t;
 #define ANY_SEXP_TAG(sexp, tag)   (any_sexp_t)((uintptr_t)(sexp) | ((uintptr_t)tag << ANY_SEXP_BIT_SHIFT))
 #define ANY_SEXP_GET_TAG(sexp)    (((uintptr_t)(sexp) >> ANY_SEXP_BIT_SHIFT) & 0xf)
 #define ANY_SEXP_GET_CONS(sexp)   ((any_sexp_cons_t *)ANY_SEXP_UNTAG(sexp))
+#define ANY_SEXP_GET_OBJECT(sexp) ((any_sexp_object_t *)ANY_SEXP_UNTAG(sexp))
 #define ANY_SEXP_GET_SYMBOL(sexp) (((char *)ANY_SEXP_UNTAG(sexp)))
 #define ANY_SEXP_GET_STRING(sexp) (((char *)ANY_SEXP_UNTAG(sexp)))
 #define ANY_SEXP_GET_NUMBER(sexp) (any_sexp_number_untag(sexp))
+#define ANY_SEXP_GET_FLOAT(sexp)  (*(double *)ANY_SEXP_UNTAG(sexp))
+
+// NOTE: The numbers keep the bits left by the tag, the sign included
+#define ANY_SEXP_NUMBER_MAX ((intptr_t)(ANY_SEXP_BIT_SIGN - 1))
+#define ANY_SEXP_NUMBER_MIN (-ANY_SEXP_NUMBER_MAX - 1)
 
 static inline intptr_t any_sexp_number_untag(any_sexp_t sexp)
 {
@@ -89,13 +239,29 @@ static inline intptr_t any_sexp_number_untag(any_sexp_t sexp)
 
 #endif
 
+#ifndef ANY_SEXP_IS_TAG
 #define ANY_SEXP_IS_TAG(sexp, tag) (ANY_SEXP_GET_TAG(sexp) == (tag))
+#endif
 #define ANY_SEXP_IS_ERROR(sexp)    (ANY_SEXP_IS_TAG(sexp, ANY_SEXP_TAG_ERROR))
 #define ANY_SEXP_IS_NIL(sexp)      (ANY_SEXP_IS_TAG(sexp, ANY_SEXP_TAG_NIL))
 #define ANY_SEXP_IS_CONS(sexp)     (ANY_SEXP_IS_TAG(sexp, ANY_SEXP_TAG_CONS))
 #define ANY_SEXP_IS_SYMBOL(sexp)   (ANY_SEXP_IS_TAG(sexp, ANY_SEXP_TAG_SYMBOL))
 #define ANY_SEXP_IS_STRING(sexp)   (ANY_SEXP_IS_TAG(sexp, ANY_SEXP_TAG_STRING))
 #define ANY_SEXP_IS_NUMBER(sexp)   (ANY_SEXP_IS_TAG(sexp, ANY_SEXP_TAG_NUMBER))
+#define ANY_SEXP_IS_OBJECT(sexp)   (ANY_SEXP_IS_TAG(sexp, ANY_SEXP_TAG_OBJECT))
+#define ANY_SEXP_IS_FLOAT(sexp)    (ANY_SEXP_IS_TAG(sexp, ANY_SEXP_TAG_FLOAT))
+
+// Whether an integer can be stored in a number without losing bits
+#define ANY_SEXP_NUMBER_FITS(value) ((value) >= ANY_SEXP_NUMBER_MIN && (value) <= ANY_SEXP_NUMBER_MAX)
+
+// Identity comparison, like eq? in scheme.
+// Since symbols are interned, two symbols with the same name are always eq.
+//
+#ifdef ANY_SEXP_NO_BOXING
+#define ANY_SEXP_IS_EQ(a, b) ((a).tag == (b).tag && (a).number == (b).number)
+#else
+#define ANY_SEXP_IS_EQ(a, b) ((a) == (b))
+#endif
 
 #define ANY_SEXP_GET_CAR(sexp) (ANY_SEXP_GET_CONS(sexp)->car)
 #define ANY_SEXP_GET_CDR(sexp) (ANY_SEXP_GET_CONS(sexp)->cdr)
@@ -105,20 +271,54 @@ typedef struct any_sexp_cons {
     any_sexp_t cdr;
 } any_sexp_cons_t;
 
+// Objects
+//
+// The values that are not lists, like the closures of an interpreter, can be
+// stored in objects: vectors of values with a kind chosen by the user. The
+// library copies, dumps and loads them, but does not look inside them
+// otherwise, and they are written by ANY_SEXP_WRITE_OBJECT(writer, sexp) if
+// it is defined where the implementation is.
+//
+typedef struct any_sexp_object {
+    uint32_t kind;
+    uint32_t length;
+    any_sexp_t values[];
+} any_sexp_object_t;
+
 typedef int (*any_sexp_getchar_t)(void *stream);
 
 typedef int (*any_sexp_putchar_t)(int c, FILE *stream);
 
+typedef size_t (*any_sexp_putdata_t)(const void *data, size_t size, size_t count, FILE *stream);
+
 #ifndef ANY_SEXP_NO_READER
 
+// Initial size of the buffer for the tokens that are not read in place,
+// which grows as needed
 #ifndef ANY_SEXP_READER_BUFFER_LENGTH
 #define ANY_SEXP_READER_BUFFER_LENGTH 512
 #endif
 
+#ifndef ANY_SEXP_READER_BLOCK_LENGTH
+#define ANY_SEXP_READER_BLOCK_LENGTH (64 * 1024)
+#endif
+
+// The input is read either with getc, one character at a time, or directly
+// from the memory between cursor and end. The memory is a buffer given by
+// the user, a mapped file, or a block refilled from file.
+//
 typedef struct {
     any_sexp_getchar_t getc;
     void *stream;
     int c;
+
+    const char *cursor;
+    const char *end;
+
+    FILE *file;
+    char *block;
+    void *mapping;
+    size_t mapping_length;
 } any_sexp_reader_t;
 
 typedef struct {
@@ -133,8 +333,22 @@ void any_sexp_reader_string_init(any_sexp_reader_t *reader, any_sexp_reader_stri
 
 void any_sexp_reader_file_init(any_sexp_reader_t *reader, FILE *file);
 
+// Reads a contiguous buffer in place, which should outlive the reader
+void any_sexp_reader_buffer_init(any_sexp_reader_t *reader, const char *source, size_t length);
+
+// Maps a regular file in memory, or reads it in blocks if it can not be
+// mapped, while the other files (pipes, sockets, terminals) are read with
+// fgetc as in any_sexp_reader_file_init. The reader should be closed.
+//
+void any_sexp_reader_open(any_sexp_reader_t *reader, FILE *file);
+
+void any_sexp_reader_close(any_sexp_reader_t *reader);
+
 bool any_sexp_reader_end(any_sexp_reader_t *reader);
 
+// NOTE: The numbers out of range are passed to
+//       ANY_SEXP_READ_BIG_NUMBER(token, length) if it is defined where the
+//       implementation is, which returns the value to read instead
 any_sexp_t any_sexp_read(any_sexp_reader_t *reader);
 
 #endif
@@ -145,16 +359,32 @@ any_sexp_t any_sexp_read(any_sexp_reader_t *reader);
 #define ANY_SEXP_WRITER_DEFAULT 0
 #endif
 
+#ifndef ANY_SEXP_WRITER_BUFFER_LENGTH
+#define ANY_SEXP_WRITER_BUFFER_LENGTH 4096
+#endif
+
 #define ANY_SEXP_WRITER_BARE_STRING (1 << 0)
 
+// The output is collected in the buffer of the writer, and it is passed to
+// the stream only when the buffer is full or by any_sexp_writer_flush, with
+// putdata if given or else one character at a time with putc.
+//
 typedef struct {
     any_sexp_putchar_t putc;
+    any_sexp_putdata_t putdata;
     void *stream;
     int flags;
+    size_t length;
+    char buffer[ANY_SEXP_WRITER_BUFFER_LENGTH];
 } any_sexp_writer_t;
 
 void any_sexp_writer_init(any_sexp_writer_t *writer, any_sexp_putchar_t putc, void *stream, int flags);
 
+void any_sexp_writer_file_init(any_sexp_writer_t *writer, FILE *file, int flags);
+
+int any_sexp_writer_flush(any_sexp_writer_t *writer);
+
+// NOTE: The output may be left in the buffer, until the writer is flushed
 int any_sexp_write(any_sexp_writer_t *writer, any_sexp_t sexp);
 
 int any_sexp_fprint(FILE *file, any_sexp_t sexp);
@@ -163,20 +393,132 @@ int any_sexp_print(any_sexp_t sexp);
 
 #endif
 
+#if !defined(ANY_SEXP_NO_BINARY) && !defined(ANY_SEXP_NO_WRITER)
+
+// Binary format
+//
+// A stream starts with ANY_SEXP_BINARY_MAGIC and a version byte, followed
+// by the dumped s-expressions. Each value is an opcode byte and its operands:
+//
+//    NIL
+//    LIST n x1 ... xn tail   n cells, tail is the cdr of the last one
+//    NUMBER z                zigzag varint
+//    STRING n bytes          n is a varint
+//    SYMBOL n bytes          interned, the next entry of the symbol table
+//    SYMBOL_REF i            entry i of the symbol table
+//    UNINTERNED n bytes      uninterned, the next entry of the symbol table
+//    SHARE x                 x is the next entry of the shared table
+//    SHARED_REF i            entry i of the shared table
+//    OBJECT kind n x1 ... xn
+//    FLOAT bits              the 8 bytes of the double, little endian
+//
+// The symbol table grows along the whole stream, so a symbol is spelled only
+// once, while the shared table, used for the conses, the strings and the
+// objects reachable more than once, is local to each s-expression. The
+// entries are numbered after the value is complete, so cyclic structures can
+// not be dumped.
+//
+#define ANY_SEXP_BINARY_MAGIC   "\0sxb"
+#define ANY_SEXP_BINARY_VERSION 3
+
+typedef enum {
+    ANY_SEXP_BINARY_NIL,
+    ANY_SEXP_BINARY_LIST,
+    ANY_SEXP_BINARY_NUMBER,
+    ANY_SEXP_BINARY_STRING,
+    ANY_SEXP_BINARY_SYMBOL,
+    ANY_SEXP_BINARY_SYMBOL_REF,
+    ANY_SEXP_BINARY_UNINTERNED,
+    ANY_SEXP_BINARY_SHARE,
+    ANY_SEXP_BINARY_SHARED_REF,
+    ANY_SEXP_BINARY_OBJECT,
+    ANY_SEXP_BINARY_FLOAT,
+} any_sexp_binary_op_t;
+
+// Open addressing table from pointers to indices
+typedef struct {
+    const void **keys;
+    size_t *values;
+    size_t capacity;
+    size_t count;
+} any_sexp_binary_table_t;
+
+typedef struct {
+    any_sexp_writer_t *writer;
+    any_sexp_binary_table_t symbols;
+    any_sexp_binary_table_t shared;
+    size_t shared_count;
+} any_sexp_dumper_t;
+
+// Writes the header, the output is left in the buffer of the writer
+int any_sexp_dumper_init(any_sexp_dumper_t *dumper, any_sexp_writer_t *writer);
+
+int any_sexp_dump(any_sexp_dumper_t *dumper, any_sexp_t sexp);
+
+// Adds a symbol to the symbol table without writing it, for the symbols that
+// the loader adds as well in the same order (see any_sexp_loader_symbol)
+int any_sexp_dumper_symbol(any_sexp_dumper_t *dumper, any_sexp_t symbol);
+
+void any_sexp_dumper_free(any_sexp_dumper_t *dumper);
+
+typedef struct {
+    const unsigned char *cursor;
+    const unsigned char *end;
+
+    any_sexp_t *symbols;
+    size_t symbols_length;
+    size_t symbols_capacity;
+
+    any_sexp_t *shared;
+    size_t shared_length;
+    size_t shared_capacity;
+
+    void *mapping;
+    size_t mapping_length;
+    void *data;
+} any_sexp_loader_t;
+
+// Loads from a buffer in place, which should outlive the loader. Returns
+// false if the header is not valid.
+bool any_sexp_loader_init(any_sexp_loader_t *loader, const void *data, size_t length);
+
+// Maps a regular file in memory, or reads it all
+bool any_sexp_loader_open(any_sexp_loader_t *loader, FILE *file);
+
+bool any_sexp_loader_end(any_sexp_loader_t *loader);
+
+any_sexp_t any_sexp_load(any_sexp_loader_t *loader);
+
+bool any_sexp_loader_symbol(any_sexp_loader_t *loader, any_sexp_t symbol);
+
+void any_sexp_loader_close(any_sexp_loader_t *loader);
+
+#endif
+
 any_sexp_t any_sexp_error(void);
 
 any_sexp_t any_sexp_nil(void);
 
 any_sexp_t any_sexp_symbol(const char *symbol, size_t length);
 
+any_sexp_t any_sexp_symbol_uninterned(const char *symbol, size_t length);
+
+bool any_sexp_symbol_interned(any_sexp_t sexp);
+
 any_sexp_t any_sexp_string(const char *string, size_t length);
 
 any_sexp_t any_sexp_number(intptr_t value);
 
+// Allocates the double unless ANY_SEXP_NAN_BOXING or ANY_SEXP_NO_BOXING
+any_sexp_t any_sexp_float(double value);
+
 any_sexp_t any_sexp_quote(any_sexp_t sexp);
 
 any_sexp_t any_sexp_cons(any_sexp_t car, any_sexp_t cdr);
 
+// Allocates an object with length values, all nil
+any_sexp_t any_sexp_object(uint32_t kind, size_t length);
+
 any_sexp_t any_sexp_car(any_sexp_t sexp);
 
 any_sexp_t any_sexp_cdr(any_sexp_t sexp);
@@ -198,6 +540,9 @@ void any_sexp_free_list(any_sexp_t sexp);
 #ifdef ANY_SEXP_IMPLEMENT
 
 #include <ctype.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
 
 #ifndef ANY_SEXP_MALLOC
 #include <stdlib.h>
@@ -205,6 +550,13 @@ void any_sexp_free_list(any_sexp_t sexp);
 #define ANY_SEXP_FREE free
 #endif
 
+// NOTE: The intern table and the interned symbols live as long as the
+//       program, so they can be allocated apart from the other objects
+#ifndef ANY_SEXP_INTERN_MALLOC
+#define ANY_SEXP_INTERN_MALLOC ANY_SEXP_MALLOC
+#define ANY_SEXP_INTERN_FREE ANY_SEXP_FREE
+#endif
+
 #ifndef ANY_SEXP_CHAR_COMMENT
 #define ANY_SEXP_CHAR_COMMENT ';'
 #endif
@@ -233,8 +585,32 @@ void any_sexp_free_list(any_sexp_t sexp);
 #define ANY_SEXP_QUOTE_SYMBOL "quote"
 #endif
 
+#include <stdlib.h>
+
+#if !defined(ANY_SEXP_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define ANY_SEXP_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #ifndef ANY_SEXP_NO_READER
 
+#if !defined(ANY_SEXP_NO_SIMD) && defined(__SSE2__)
+#define ANY_SEXP_READER_SSE2
+#include <emmintrin.h>
+#endif
+
+// NOTE: These are the ones of the C locale, checked without calling ctype
+static inline bool any_sexp_isspace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool any_sexp_isdigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
 // For the scheme specification these are the extended characters
 // to be accepted in addition to the alphanumeric ones in a symbol.
 //     ! $ % & * + - . / : < = > ? @ ^ _ ~
@@ -263,51 +639,207 @@ static inline bool any_sexp_issym(char c)
     return c != EOF
         && c != ANY_SEXP_CHAR_OPEN
         && c != ANY_SEXP_CHAR_CLOSE
-        && !isspace(c);
+        && !any_sexp_isspace(c);
+}
+
+// Scanning
+//
+// The tokens in memory are scanned 16 bytes at a time with SSE2, comparing
+// each byte with all the delimiters at once, and the remaining bytes one at
+// a time. The delimiters are the ones of any_sexp_issym, with the spaces of
+// the C locale.
+//
+#if defined(ANY_SEXP_READER_SSE2)
+
+typedef __m128i any_sexp_vector_t;
+
+#define ANY_SEXP_VECTOR_LENGTH 16
+#define ANY_SEXP_VECTOR_BITS   0xffffu
+#define ANY_SEXP_VECTOR_LOAD(p)     _mm_loadu_si128((const __m128i *)(p))
+#define ANY_SEXP_VECTOR_SET(c)      _mm_set1_epi8(c)
+#define ANY_SEXP_VECTOR_EQ(a, b)    _mm_cmpeq_epi8(a, b)
+#define ANY_SEXP_VECTOR_GT(a, b)    _mm_cmpgt_epi8(a, b)
+#define ANY_SEXP_VECTOR_OR(a, b)    _mm_or_si128(a, b)
+#define ANY_SEXP_VECTOR_AND(a, b)   _mm_and_si128(a, b)
+#define ANY_SEXP_VECTOR_MASK(v)     ((uint32_t)_mm_movemask_epi8(v))
+
+#endif
+
+#ifdef ANY_SEXP_VECTOR_LENGTH
+
+// Bit mask of the spaces, from '\t' to '\r' and ' '
+static inline uint32_t any_sexp_vector_spaces(any_sexp_vector_t v)
+{
+    any_sexp_vector_t control = ANY_SEXP_VECTOR_AND(ANY_SEXP_VECTOR_GT(v, ANY_SEXP_VECTOR_SET('\t' - 1)),
+                                                    ANY_SEXP_VECTOR_GT(ANY_SEXP_VECTOR_SET('\r' + 1), v));
+
+    return ANY_SEXP_VECTOR_MASK(ANY_SEXP_VECTOR_OR(control, ANY_SEXP_VECTOR_EQ(v, ANY_SEXP_VECTOR_SET(' '))));
+}
+
+// Bit mask of the bytes that end a symbol
+static inline uint32_t any_sexp_vector_delimiters(any_sexp_vector_t v)
+{
+    any_sexp_vector_t d = ANY_SEXP_VECTOR_OR(ANY_SEXP_VECTOR_EQ(v, ANY_SEXP_VECTOR_SET(ANY_SEXP_CHAR_OPEN)),
+                                             ANY_SEXP_VECTOR_EQ(v, ANY_SEXP_VECTOR_SET(ANY_SEXP_CHAR_CLOSE)));
+
+    d = ANY_SEXP_VECTOR_OR(d, ANY_SEXP_VECTOR_EQ(v, ANY_SEXP_VECTOR_SET(ANY_SEXP_CHAR_STRING)));
+    d = ANY_SEXP_VECTOR_OR(d, ANY_SEXP_VECTOR_EQ(v, ANY_SEXP_VECTOR_SET(ANY_SEXP_CHAR_QUOTE)));
+    d = ANY_SEXP_VECTOR_OR(d, ANY_SEXP_VECTOR_EQ(v, ANY_SEXP_VECTOR_SET((char)EOF)));
+
+#ifndef ANY_SEXP_NO_COMMENT
+    d = ANY_SEXP_VECTOR_OR(d, ANY_SEXP_VECTOR_EQ(v, ANY_SEXP_VECTOR_SET(ANY_SEXP_CHAR_COMMENT)));
+#endif
+
+    return ANY_SEXP_VECTOR_MASK(d) | any_sexp_vector_spaces(v);
+}
+
+// Bit mask of the bytes that are not decimal digits
+static inline uint32_t any_sexp_vector_nondigits(any_sexp_vector_t v)
+{
+    any_sexp_vector_t digits = ANY_SEXP_VECTOR_AND(ANY_SEXP_VECTOR_GT(v, ANY_SEXP_VECTOR_SET('0' - 1)),
+                                                   ANY_SEXP_VECTOR_GT(ANY_SEXP_VECTOR_SET('9' + 1), v));
+
+    return ~ANY_SEXP_VECTOR_MASK(digits) & ANY_SEXP_VECTOR_BITS;
+}
+
+#endif
+
+// Returns the end of the symbol starting at p, and clears digits if any of
+// its characters is not a decimal digit
+static inline const char *any_sexp_scan_symbol(const char *p, const char *end, bool *digits)
+{
+    bool all = true;
+
+#ifdef ANY_SEXP_VECTOR_LENGTH
+    for (; p + ANY_SEXP_VECTOR_LENGTH <= end; p += ANY_SEXP_VECTOR_LENGTH) {
+        any_sexp_vector_t v = ANY_SEXP_VECTOR_LOAD(p);
+        uint32_t delimiters = any_sexp_vector_delimiters(v);
+        uint32_t nondigits = any_sexp_vector_nondigits(v);
+
+        if (delimiters != 0) {
+            // NOTE: Only the bytes before the first delimiter are checked
+            nondigits &= (delimiters & -delimiters) - 1;
+            *digits = *digits && all && nondigits == 0;
+            return p + __builtin_ctz(delimiters);
+        }
+
+        all = all && nondigits == 0;
+    }
+#endif
+
+    for (; p < end && any_sexp_issym(*p); p++)
+        all = all && any_sexp_isdigit(*p);
+
+    *digits = *digits && all;
+    return p;
+}
+
+// Returns the first character from p that is not a space
+static inline const char *any_sexp_scan_spaces(const char *p, const char *end)
+{
+#ifdef ANY_SEXP_VECTOR_LENGTH
+    for (; p + ANY_SEXP_VECTOR_LENGTH <= end; p += ANY_SEXP_VECTOR_LENGTH) {
+        uint32_t others = ~any_sexp_vector_spaces(ANY_SEXP_VECTOR_LOAD(p)) & ANY_SEXP_VECTOR_BITS;
+        if (others != 0)
+            return p + __builtin_ctz(others);
+    }
+#endif
+
+    while (p < end && any_sexp_isspace(*p))
+        p++;
+
+    return p;
+}
+
+// Returns the next character of a file read in blocks
+static char any_sexp_reader_refill(any_sexp_reader_t *reader)
+{
+    if (reader->block == NULL)
+        return EOF;
+
+    size_t length = fread(reader->block, 1, ANY_SEXP_READER_BLOCK_LENGTH, reader->file);
+    if (length == 0)
+        return EOF;
+
+    reader->cursor = reader->block;
+    reader->end = reader->block + length;
+    return *reader->cursor++;
 }
 
 static inline char any_sexp_reader_advance(any_sexp_reader_t *reader)
 {
-    reader->c = reader->getc(reader->stream);
+    if (reader->cursor < reader->end)
+        reader->c = *reader->cursor++;
+    else if (reader->getc != NULL)
+        reader->c = reader->getc(reader->stream);
+    else
+        reader->c = any_sexp_reader_refill(reader);
+
     return reader->c;
 }
 
+// Returns true if the characters after the current one are in memory, so
+// that the tokens can be scanned in place
+static inline bool any_sexp_reader_in_place(any_sexp_reader_t *reader)
+{
+    return reader->getc == NULL && reader->c != EOF;
+}
+
+// Returns true if a token scanned in place up to p is complete, that is, if
+// it does not continue in the next block
+static inline bool any_sexp_reader_complete(any_sexp_reader_t *reader, const char *p)
+{
+    return p < reader->end || reader->block == NULL;
+}
+
 static void any_sexp_reader_skip(any_sexp_reader_t *reader)
 {
     while (!any_sexp_reader_end(reader)) {
 #ifndef ANY_SEXP_NO_COMMENT
         if (reader->c == ANY_SEXP_CHAR_COMMENT) {
-            while (!any_sexp_reader_end(reader) && reader->c != '\n')
+            while (!any_sexp_reader_end(reader) && reader->c != '\n') {
+                // The rest of the line in memory is skipped at once
+                if (any_sexp_reader_in_place(reader)) {
+                    const char *newline = memchr(reader->cursor, '\n', reader->end - reader->cursor);
+                    reader->cursor = newline != NULL ? newline : reader->end;
+                }
+
                 any_sexp_reader_advance(reader);
+            }
         }
 #endif
-        if (!isspace(reader->c))
+        if (!any_sexp_isspace(reader->c))
             return;
 
+        if (any_sexp_reader_in_place(reader))
+            reader->cursor = any_sexp_scan_spaces(reader->cursor, reader->end);
+
         any_sexp_reader_advance(reader);
     }
 }
 
-static char any_sexp_reader_string_getc(any_sexp_reader_string_t *string)
-{
-    return string->cursor < string->length
-         ? string->source[string->cursor++]
-         : EOF;
-}
-
 void any_sexp_reader_init(any_sexp_reader_t *reader, any_sexp_getchar_t getc, void *stream)
 {
+    memset(reader, 0, sizeof(any_sexp_reader_t));
     reader->getc = getc;
     reader->stream = stream;
     any_sexp_reader_advance(reader);
 }
 
+void any_sexp_reader_buffer_init(any_sexp_reader_t *reader, const char *source, size_t length)
+{
+    memset(reader, 0, sizeof(any_sexp_reader_t));
+    reader->cursor = source;
+    reader->end = source + length;
+    any_sexp_reader_advance(reader);
+}
+
 void any_sexp_reader_string_init(any_sexp_reader_t *reader, any_sexp_reader_string_t *string, const char *source, size_t length)
 {
     string->source = source;
     string->length = length;
     string->cursor = 0;
-    any_sexp_reader_init(reader, (any_sexp_getchar_t)any_sexp_reader_string_getc, string);
+    any_sexp_reader_buffer_init(reader, source, length);
 }
 
 void any_sexp_reader_file_init(any_sexp_reader_t *reader, FILE *file)
@@ -315,237 +847,1525 @@ void any_sexp_reader_file_init(any_sexp_reader_t *reader, FILE *file)
     any_sexp_reader_init(reader, (any_sexp_getchar_t)fgetc, file);
 }
 
-bool any_sexp_reader_end(any_sexp_reader_t *reader)
-{
-    return reader->c == EOF;
-}
-
-any_sexp_t any_sexp_read(any_sexp_reader_t *reader)
+void any_sexp_reader_open(any_sexp_reader_t *reader, FILE *file)
 {
-    char buffer[ANY_SEXP_READER_BUFFER_LENGTH + 1];
-
-    any_sexp_reader_skip(reader);
-
-    // Symbol | Number
-    if (any_sexp_issym(reader->c)) {
-        size_t length = 0;
-        bool number = true;
+#ifdef ANY_SEXP_MMAP
+    struct stat st;
+    if (fstat(fileno(file), &st) || !S_ISREG(st.st_mode)) {
+        any_sexp_reader_file_init(reader, file);
+        return;
+    }
 
-        do {
-            if (length < ANY_SEXP_READER_BUFFER_LENGTH) {
-                number = number && ((length == 0 && reader->c == '-') || isdigit(reader->c));
-                buffer[length++] = reader->c;
-            }
+    // NOTE: The mapping starts from the beginning of the file, which may
+    //       have been partially read already
+    long offset = ftell(file);
+    size_t length = st.st_size;
 
-            any_sexp_reader_advance(reader);
-        } while (any_sexp_issym(reader->c));
+    if (offset >= 0 && (size_t)offset <= length && length > 0) {
+        void *mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(file), 0);
 
-        buffer[length] = '\0';
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, length, MADV_SEQUENTIAL);
 
-        if (number && !(length == 1 && buffer[0] == '-')) {
-            intptr_t value = strtol(buffer, NULL, 10);
-            return any_sexp_number(value);
+            any_sexp_reader_buffer_init(reader, (char *)mapping + offset, length - offset);
+            reader->mapping = mapping;
+            reader->mapping_length = length;
+            return;
         }
+    }
+#endif
 
-        return any_sexp_symbol(buffer, length);
+    memset(reader, 0, sizeof(any_sexp_reader_t));
+    reader->file = file;
+    reader->block = malloc(ANY_SEXP_READER_BLOCK_LENGTH);
+
+    if (reader->block == NULL) {
+        any_sexp_reader_file_init(reader, file);
+        return;
     }
 
-    // String
-    if (reader->c == ANY_SEXP_CHAR_STRING) {
-        any_sexp_reader_advance(reader);
+    any_sexp_reader_advance(reader);
+}
 
-        size_t length = 0;
-        char prev = '\0';
+void any_sexp_reader_close(any_sexp_reader_t *reader)
+{
+#ifdef ANY_SEXP_MMAP
+    if (reader->mapping != NULL)
+        munmap(reader->mapping, reader->mapping_length);
+#endif
 
-        while (!any_sexp_reader_end(reader)) {
-            if (reader->c == ANY_SEXP_CHAR_STRING && prev != ANY_SEXP_CHAR_ESCAPE)
-                break;
+    free(reader->block);
 
-            if (length < ANY_SEXP_READER_BUFFER_LENGTH)
-                buffer[length++] = reader->c;
+    reader->mapping = NULL;
+    reader->block = NULL;
+    reader->cursor = reader->end = NULL;
+    reader->c = EOF;
+}
 
-            prev = reader->c;
-            any_sexp_reader_advance(reader);
-        }
+bool any_sexp_reader_end(any_sexp_reader_t *reader)
+{
+    return reader->c == EOF;
+}
 
-        any_sexp_reader_advance(reader);
-        return any_sexp_string(buffer, length);
-    }
+// Parses the digits of a number, saturating like strtol when it is out of
+// the range of the numbers, unless ANY_SEXP_READ_BIG_NUMBER is defined
+static any_sexp_t any_sexp_reader_number(const char *token, size_t length)
+{
+    bool sign = token[0] == '-';
+    uintptr_t limit = sign ? (uintptr_t)ANY_SEXP_NUMBER_MAX + 1 : (uintptr_t)ANY_SEXP_NUMBER_MAX;
+    uintptr_t value = 0;
+
+    for (size_t i = sign; i < length; i++) {
+        unsigned digit = token[i] - '0';
+        if (value > (limit - digit) / 10) {
+#ifdef ANY_SEXP_READ_BIG_NUMBER
+            return ANY_SEXP_READ_BIG_NUMBER(token, length);
+#else
+            value = limit;
+            break;
+#endif
+        }
 
-#ifndef ANY_SEXP_NO_QUOTE
-    // Quote
-    if (reader->c == ANY_SEXP_CHAR_QUOTE) {
-        any_sexp_reader_advance(reader);
-        return any_sexp_quote(any_sexp_read(reader));
+        value = 10 * value + digit;
     }
-#endif
 
-    // List
-    if (reader->c == ANY_SEXP_CHAR_OPEN) {
-        any_sexp_reader_advance(reader);
+    return any_sexp_number(sign ? (intptr_t)-value : (intptr_t)value);
+}
 
-        any_sexp_t sexp = ANY_SEXP_NIL;
+// Parses a float: an optional minus sign, digits with a point or an
+// exponent or both, or one of +inf.0, -inf.0 and +nan.0
+static bool any_sexp_reader_float(const char *token, size_t length, double *value)
+{
+    if (length == 6 && (!memcmp(token, "+inf.0", 6) || !memcmp(token, "-inf.0", 6))) {
+        *value = token[0] == '-' ? -INFINITY : INFINITY;
+        return true;
+    }
 
-        while (!any_sexp_reader_end(reader)) {
-            any_sexp_reader_skip(reader);
+    if (length == 6 && !memcmp(token, "+nan.0", 6)) {
+        *value = NAN;
+        return true;
+    }
 
-            if (reader->c == ANY_SEXP_CHAR_CLOSE)
-                break;
+    size_t i = token[0] == '-', digits = 0;
+    bool point = false, exponent = false;
 
-            any_sexp_t sub = any_sexp_read(reader);
-            sexp = any_sexp_cons(sub, sexp); // reversed
+    for (; i < length && any_sexp_isdigit(token[i]); i++)
+        digits++;
 
-            if (ANY_SEXP_IS_ERROR(sub) || ANY_SEXP_IS_ERROR(sexp)) {
-                any_sexp_free(sexp);
-                return ANY_SEXP_ERROR;
-            }
-        }
+    if (i < length && token[i] == '.') {
+        point = true;
 
-        any_sexp_reader_advance(reader);
-        return any_sexp_reverse(sexp);
+        for (i++; i < length && any_sexp_isdigit(token[i]); i++)
+            digits++;
     }
 
-    return ANY_SEXP_ERROR;
-}
+    if (digits == 0)
+        return false;
 
-#endif
+    if (i < length && (token[i] == 'e' || token[i] == 'E')) {
+        exponent = true;
 
-#ifndef ANY_SEXP_NO_WRITER
+        if (++i < length && (token[i] == '+' || token[i] == '-'))
+            i++;
+
+        size_t start = i;
+        while (i < length && any_sexp_isdigit(token[i]))
+            i++;
+
+        if (i == start)
+            return false;
+    }
+
+    if (i != length || !(point || exponent))
+        return false;
+
+    // NOTE: strtod needs the token terminated
+    char local[64];
+    char *copy = length < sizeof(local) ? local : malloc(length + 1);
+    if (copy == NULL)
+        return false;
+
+    memcpy(copy, token, length);
+    copy[length] = '\0';
+    *value = strtod(copy, NULL);
+
+    if (copy != local)
+        free(copy);
+
+    return true;
+}
+
+// The token is a number if digits is true, that is, if all its characters
+// after an optional minus sign are decimal digits, or else a float or a
+// symbol
+static any_sexp_t any_sexp_reader_atom(const char *token, size_t length, bool digits)
+{
+    if (digits && length > (token[0] == '-'))
+        return any_sexp_reader_number(token, length);
+
+    double value;
+    if (any_sexp_reader_float(token, length, &value))
+        return any_sexp_float(value);
+
+    return any_sexp_symbol(token, length);
+}
+
+// Buffer of a token read one character at a time, which starts on the stack
+// and moves to the heap when it grows
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    char local[ANY_SEXP_READER_BUFFER_LENGTH];
+} any_sexp_reader_token_t;
+
+static inline void any_sexp_reader_token_init(any_sexp_reader_token_t *token)
+{
+    token->data = token->local;
+    token->length = 0;
+    token->capacity = ANY_SEXP_READER_BUFFER_LENGTH;
+}
+
+static bool any_sexp_reader_token_grow(any_sexp_reader_token_t *token)
+{
+    size_t capacity = 2 * token->capacity;
+    char *data = token->data == token->local
+               ? malloc(capacity)
+               : realloc(token->data, capacity);
+
+    if (data == NULL)
+        return false;
+
+    if (token->data == token->local)
+        memcpy(data, token->local, token->length);
+
+    token->data = data;
+    token->capacity = capacity;
+    return true;
+}
+
+static inline bool any_sexp_reader_token_push(any_sexp_reader_token_t *token, char c)
+{
+    if (token->length == token->capacity && !any_sexp_reader_token_grow(token))
+        return false;
+
+    token->data[token->length++] = c;
+    return true;
+}
+
+static inline void any_sexp_reader_token_free(any_sexp_reader_token_t *token)
+{
+    if (token->data != token->local)
+        free(token->data);
+}
+
+// Reads a symbol, a number or a string
+static any_sexp_t any_sexp_read_atom(any_sexp_reader_t *reader)
+{
+    // Symbol | Number
+    if (any_sexp_issym(reader->c)) {
+        if (any_sexp_reader_in_place(reader)) {
+            const char *start = reader->cursor - 1;
+            bool digits = true;
+
+            const char *p = any_sexp_scan_symbol(*start == '-' ? reader->cursor : start, reader->end, &digits);
+
+            // NOTE: The token is read before the block is refilled
+            if (any_sexp_reader_complete(reader, p)) {
+                any_sexp_t sexp = any_sexp_reader_atom(start, p - start, digits);
+                reader->cursor = p;
+                any_sexp_reader_advance(reader);
+                return sexp;
+            }
+        }
+
+        any_sexp_reader_token_t token;
+        any_sexp_reader_token_init(&token);
+        bool digits = true;
+
+        do {
+            digits = digits && ((token.length == 0 && reader->c == '-') || any_sexp_isdigit(reader->c));
+
+            if (!any_sexp_reader_token_push(&token, reader->c)) {
+                any_sexp_reader_token_free(&token);
+                return ANY_SEXP_ERROR;
+            }
+
+            any_sexp_reader_advance(reader);
+        } while (any_sexp_issym(reader->c));
+
+        any_sexp_t sexp = any_sexp_reader_atom(token.data, token.length, digits);
+        any_sexp_reader_token_free(&token);
+        return sexp;
+    }
+
+    // String
+    if (reader->c == ANY_SEXP_CHAR_STRING) {
+        if (any_sexp_reader_in_place(reader)) {
+            const char *start = reader->cursor, *p = start;
+
+            // The closing quote is the first one not escaped
+            while ((p = memchr(p, ANY_SEXP_CHAR_STRING, reader->end - p)) != NULL) {
+                if (p == start || p[-1] != ANY_SEXP_CHAR_ESCAPE)
+                    break;
+
+                p++;
+            }
+
+            if (p == NULL)
+                p = reader->end;
+
+            if (any_sexp_reader_complete(reader, p)) {
+                any_sexp_t sexp = any_sexp_string(start, p - start);
+
+                // NOTE: Past the closing quote
+                reader->cursor = p < reader->end ? p + 1 : p;
+                any_sexp_reader_advance(reader);
+                return sexp;
+            }
+        }
+
+        any_sexp_reader_advance(reader);
+
+        any_sexp_reader_token_t token;
+        any_sexp_reader_token_init(&token);
+        char prev = '\0';
+
+        while (!any_sexp_reader_end(reader)) {
+            if (reader->c == ANY_SEXP_CHAR_STRING && prev != ANY_SEXP_CHAR_ESCAPE)
+                break;
+
+            if (!any_sexp_reader_token_push(&token, reader->c)) {
+                any_sexp_reader_token_free(&token);
+                return ANY_SEXP_ERROR;
+            }
+
+            prev = reader->c;
+            any_sexp_reader_advance(reader);
+        }
+
+        any_sexp_reader_advance(reader);
+
+        any_sexp_t sexp = any_sexp_string(token.data, token.length);
+        any_sexp_reader_token_free(&token);
+        return sexp;
+    }
+
+    return ANY_SEXP_ERROR;
+}
+
+// The lists and the quotes being read, from the outermost. Each of them has
+// the location where its next element goes, which is the cdr of its last
+// cell for a list, and the car of the quoted value for a quote.
+//
+#ifndef ANY_SEXP_READER_STACK_LENGTH
+#define ANY_SEXP_READER_STACK_LENGTH 32
+#endif
+
+typedef struct {
+    any_sexp_t *next;
+    bool quote;
+} any_sexp_reader_frame_t;
+
+typedef struct {
+    any_sexp_reader_frame_t *frames;
+    size_t length;
+    size_t capacity;
+    any_sexp_reader_frame_t local[ANY_SEXP_READER_STACK_LENGTH];
+} any_sexp_reader_stack_t;
+
+static bool any_sexp_reader_push(any_sexp_reader_stack_t *stack, any_sexp_t *next, bool quote)
+{
+    if (stack->length == stack->capacity) {
+        size_t capacity = 2 * stack->capacity;
+        any_sexp_reader_frame_t *frames = stack->frames == stack->local
+                                        ? malloc(capacity * sizeof(any_sexp_reader_frame_t))
+                                        : realloc(stack->frames, capacity * sizeof(any_sexp_reader_frame_t));
+        if (frames == NULL)
+            return false;
+
+        if (stack->frames == stack->local)
+            memcpy(frames, stack->local, sizeof(stack->local));
+
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+
+    stack->frames[stack->length++] = (any_sexp_reader_frame_t) { next, quote };
+    return true;
+}
+
+// Returns the location of the next element of the innermost list or quote,
+// appending a cell to the list, or of the whole s-expression
+static any_sexp_t *any_sexp_reader_slot(any_sexp_reader_stack_t *stack, any_sexp_t *root)
+{
+    if (stack->length == 0)
+        return root;
+
+    any_sexp_reader_frame_t *frame = &stack->frames[stack->length - 1];
+
+    // NOTE: A quote takes a single element
+    if (frame->quote) {
+        stack->length--;
+        return frame->next;
+    }
+
+    any_sexp_t cell = any_sexp_cons(ANY_SEXP_NIL, ANY_SEXP_NIL);
+    if (ANY_SEXP_IS_ERROR(cell))
+        return NULL;
+
+    *frame->next = cell;
+    frame->next = &ANY_SEXP_GET_CDR(cell);
+    return &ANY_SEXP_GET_CAR(cell);
+}
+
+// Frees a partially read s-expression, without recursion since it can be
+// nested arbitrarily. The lists in the car are rotated into the spine.
+static void any_sexp_reader_free(any_sexp_t sexp)
+{
+    while (ANY_SEXP_IS_CONS(sexp)) {
+        any_sexp_t car = ANY_SEXP_GET_CAR(sexp);
+
+        if (ANY_SEXP_IS_CONS(car)) {
+            ANY_SEXP_GET_CAR(sexp) = ANY_SEXP_GET_CDR(car);
+            ANY_SEXP_GET_CDR(car) = sexp;
+            sexp = car;
+            continue;
+        }
+
+        any_sexp_t cdr = ANY_SEXP_GET_CDR(sexp);
+        any_sexp_free(car);
+        any_sexp_free(sexp);
+        sexp = cdr;
+    }
+
+    any_sexp_free(sexp);
+}
+
+// NOTE: The lists are read without recursion, so the nesting is limited only
+//       by the memory. The cells are appended in the order they are read,
+//       and they are reachable from root while the lists are incomplete
+any_sexp_t any_sexp_read(any_sexp_reader_t *reader)
+{
+    any_sexp_reader_stack_t stack = {
+        .frames = stack.local,
+        .length = 0,
+        .capacity = ANY_SEXP_READER_STACK_LENGTH,
+    };
+
+    any_sexp_t root = ANY_SEXP_NIL;
+
+    while (true) {
+        any_sexp_reader_skip(reader);
+
+        // NOTE: The lists still open at the end of the input are closed
+        if (any_sexp_reader_end(reader)) {
+            bool quote = false;
+            for (size_t i = 0; i < stack.length; i++)
+                quote = quote || stack.frames[i].quote;
+
+            if (stack.length == 0 || quote)
+                goto error;
+
+            break;
+        }
+
+        if (reader->c == ANY_SEXP_CHAR_CLOSE) {
+            if (stack.length == 0 || stack.frames[stack.length - 1].quote)
+                goto error;
+
+            any_sexp_reader_advance(reader);
+            if (--stack.length == 0)
+                break;
+
+            continue;
+        }
+
+        any_sexp_t *slot = any_sexp_reader_slot(&stack, &root);
+        if (slot == NULL)
+            goto error;
+
+        // List
+        if (reader->c == ANY_SEXP_CHAR_OPEN) {
+            any_sexp_reader_advance(reader);
+
+            if (!any_sexp_reader_push(&stack, slot, false))
+                goto error;
+
+            continue;
+        }
+
+#ifndef ANY_SEXP_NO_QUOTE
+        // Quote
+        if (reader->c == ANY_SEXP_CHAR_QUOTE) {
+            any_sexp_reader_advance(reader);
+
+            any_sexp_t quote = any_sexp_quote(ANY_SEXP_NIL);
+            if (ANY_SEXP_IS_ERROR(quote))
+                goto error;
+
+            *slot = quote;
+            if (!any_sexp_reader_push(&stack, &ANY_SEXP_GET_CAR(ANY_SEXP_GET_CDR(quote)), true))
+                goto error;
+
+            continue;
+        }
+#endif
+
+        any_sexp_t atom = any_sexp_read_atom(reader);
+        if (ANY_SEXP_IS_ERROR(atom))
+            goto error;
+
+        *slot = atom;
+        if (stack.length == 0)
+            break;
+    }
+
+    if (stack.frames != stack.local)
+        free(stack.frames);
+
+    return root;
+
+error:
+    if (stack.frames != stack.local)
+        free(stack.frames);
+
+    any_sexp_reader_free(root);
+    return ANY_SEXP_ERROR;
+}
+
+#endif
+
+#ifndef ANY_SEXP_NO_WRITER
+
+int any_sexp_writer_flush(any_sexp_writer_t *writer)
+{
+    size_t length = writer->length;
+    writer->length = 0;
+
+    if (writer->putdata != NULL)
+        return writer->putdata(writer->buffer, 1, length, writer->stream) == length ? 0 : EOF;
+
+    for (size_t i = 0; i < length; i++) {
+        if (writer->putc(writer->buffer[i], writer->stream) == EOF)
+            return EOF;
+    }
+
+    return 0;
+}
+
+static inline int any_sexp_writer_putc(any_sexp_writer_t *writer, char c)
+{
+    if (writer->length == ANY_SEXP_WRITER_BUFFER_LENGTH && any_sexp_writer_flush(writer) == EOF)
+        return EOF;
+
+    writer->buffer[writer->length++] = c;
+    return 1;
+}
+
+static int any_sexp_writer_putn(any_sexp_writer_t *writer, const char *string, size_t length)
+{
+    if (writer->length + length > ANY_SEXP_WRITER_BUFFER_LENGTH) {
+        if (any_sexp_writer_flush(writer) == EOF)
+            return EOF;
+
+        // NOTE: Bigger than the buffer, so it is passed as it is
+        if (length > ANY_SEXP_WRITER_BUFFER_LENGTH) {
+            if (writer->putdata != NULL)
+                return writer->putdata(string, 1, length, writer->stream) == length ? (int)length : EOF;
+
+            for (size_t i = 0; i < length; i++) {
+                if (writer->putc(string[i], writer->stream) == EOF)
+                    return EOF;
+            }
+
+            return length;
+        }
+    }
+
+    memcpy(writer->buffer + writer->length, string, length);
+    writer->length += length;
+    return length;
+}
 
 static int any_sexp_writer_puts(any_sexp_writer_t *writer, const char *string)
 {
-    int i;
-    for (i = 0; string[i] != '\0'; i++) {
-        if (writer->putc(string[i], writer->stream) == EOF)
-            return EOF;
+    return any_sexp_writer_putn(writer, string, strlen(string));
+}
+
+static int any_sexp_writer_putnum(any_sexp_writer_t *writer, uintptr_t value)
+{
+    static const char digits[201] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+    // The digits are written from the end, two at a time
+    char buffer[24];
+    char *end = buffer + sizeof(buffer), *start = end;
+
+    while (value >= 100) {
+        size_t i = 2 * (value % 100);
+        value /= 100;
+        *--start = digits[i + 1];
+        *--start = digits[i];
+    }
+
+    if (value >= 10) {
+        *--start = digits[2 * value + 1];
+        *--start = digits[2 * value];
+    } else
+        *--start = '0' + value;
+
+    return any_sexp_writer_putn(writer, start, end - start);
+}
+
+// Writes the shortest of the %g forms that reads back as the same double,
+// with a point if it has neither one nor an exponent, so that it reads back
+// as a float. The infinities and NaN are written as in scheme.
+static int any_sexp_writer_putfloat(any_sexp_writer_t *writer, double value)
+{
+    if (value != value)
+        return any_sexp_writer_puts(writer, "+nan.0");
+
+    if (value - value != 0)
+        return any_sexp_writer_puts(writer, value > 0 ? "+inf.0" : "-inf.0");
+
+    char buffer[32];
+    int length = 0;
+
+    // NOTE: A normal double has more than 15 significant digits, so a
+    //       shorter form that reads back is the nearest one at 15 digits as
+    //       well, which %g writes without the trailing zeros. Only the
+    //       subnormals have fewer bits, so their search starts at 1.
+    int precision = value > -DBL_MIN && value < DBL_MIN ? 1 : 15;
+
+    for (; precision <= 17; precision++) {
+        length = snprintf(buffer, sizeof(buffer) - 2, "%.*g", precision, value);
+        if (strtod(buffer, NULL) == value)
+            break;
+    }
+
+    if (strpbrk(buffer, ".e") == NULL) {
+        buffer[length++] = '.';
+        buffer[length++] = '0';
+    }
+
+    return any_sexp_writer_putn(writer, buffer, length);
+}
+
+void any_sexp_writer_init(any_sexp_writer_t *writer, any_sexp_putchar_t putc, void *stream, int flags)
+{
+    writer->putc = putc;
+    writer->putdata = NULL;
+    writer->stream = stream;
+    writer->flags = flags;
+    writer->length = 0;
+}
+
+void any_sexp_writer_file_init(any_sexp_writer_t *writer, FILE *file, int flags)
+{
+    any_sexp_writer_init(writer, (any_sexp_putchar_t)fputc, file, flags);
+    writer->putdata = (any_sexp_putdata_t)fwrite;
+}
+
+int any_sexp_write(any_sexp_writer_t *writer, any_sexp_t sexp)
+{
+    switch (ANY_SEXP_GET_TAG(sexp)) {
+        case ANY_SEXP_TAG_ERROR:
+            return any_sexp_writer_puts(writer, "<error>");
+
+        case ANY_SEXP_TAG_NIL: {
+            const char nil[3] = { ANY_SEXP_CHAR_OPEN, ANY_SEXP_CHAR_CLOSE, '\0' };
+            return any_sexp_writer_puts(writer, nil);
+        }
+
+        case ANY_SEXP_TAG_CONS: {
+            any_sexp_t car = any_sexp_car(sexp), cdr = any_sexp_cdr(sexp);
+
+#ifndef ANY_SEXP_NO_QUOTE
+            if (ANY_SEXP_IS_SYMBOL(car) && ANY_SEXP_IS_NIL(any_sexp_cdr(cdr)) &&
+                !strcmp(ANY_SEXP_GET_SYMBOL(car), ANY_SEXP_QUOTE_SYMBOL)) {
+
+                if (any_sexp_writer_putc(writer, ANY_SEXP_CHAR_QUOTE) == EOF)
+                    return EOF;
+
+                return any_sexp_write(writer, any_sexp_car(cdr));
+            }
+#endif
+
+            if (any_sexp_writer_putc(writer, ANY_SEXP_CHAR_OPEN) == EOF)
+                return EOF;
+
+            int c = 2, tmp;
+            while (true) {
+                tmp = any_sexp_write(writer, car);
+                if (tmp == EOF)
+                    return EOF;
+                c += tmp;
+
+                if (ANY_SEXP_IS_CONS(cdr)) {
+                    if (any_sexp_writer_putc(writer, ' ') == EOF)
+                        return EOF;
+
+                    car = any_sexp_car(cdr);
+                    cdr = any_sexp_cdr(cdr);
+                    c++;
+                } else if (!ANY_SEXP_IS_NIL(cdr)) {
+                    if (any_sexp_writer_puts(writer, " . ") == EOF)
+                        return EOF;
+
+                    car = cdr;
+                    cdr = ANY_SEXP_NIL;
+                    c += 3;
+                } else
+                    break;
+            }
+
+            if (any_sexp_writer_putc(writer, ANY_SEXP_CHAR_CLOSE) == EOF)
+                return EOF;
+
+            return c;
+        }
+
+        case ANY_SEXP_TAG_SYMBOL:
+            return any_sexp_writer_puts(writer, ANY_SEXP_GET_SYMBOL(sexp));
+
+        case ANY_SEXP_TAG_STRING: {
+            bool bare = (writer->flags & ANY_SEXP_WRITER_BARE_STRING) != 0;
+
+            if (!bare && any_sexp_writer_putc(writer, ANY_SEXP_CHAR_STRING) == EOF)
+                return EOF;
+
+            int c = any_sexp_writer_puts(writer, ANY_SEXP_GET_STRING(sexp));
+            if (c == EOF)
+                return EOF;
+
+            if (!bare && any_sexp_writer_putc(writer, ANY_SEXP_CHAR_STRING) == EOF)
+                return EOF;
+
+            return c + 2 * bare;
+        }
+
+        case ANY_SEXP_TAG_NUMBER: {
+            intptr_t value = ANY_SEXP_GET_NUMBER(sexp);
+            bool sign = value < 0;
+
+            // NOTE: Negated as unsigned, which works for the minimum too
+            uintptr_t magnitude = sign ? -(uintptr_t)value : (uintptr_t)value;
+            if (sign && any_sexp_writer_putc(writer, '-') == EOF)
+                return EOF;
+
+            int c = any_sexp_writer_putnum(writer, magnitude);
+            return c == EOF ? EOF : sign + c;
+        }
+
+        case ANY_SEXP_TAG_FLOAT:
+            return any_sexp_writer_putfloat(writer, ANY_SEXP_GET_FLOAT(sexp));
+
+        case ANY_SEXP_TAG_OBJECT:
+#ifdef ANY_SEXP_WRITE_OBJECT
+            return ANY_SEXP_WRITE_OBJECT(writer, sexp);
+#else
+            return any_sexp_writer_puts(writer, "<object>");
+#endif
+    }
+
+    return 0;
+}
+
+int any_sexp_fprint(FILE *file, any_sexp_t sexp)
+{
+    any_sexp_writer_t writer;
+    any_sexp_writer_file_init(&writer, file, ANY_SEXP_WRITER_DEFAULT);
+
+    int c = any_sexp_write(&writer, sexp);
+    if (any_sexp_writer_flush(&writer) == EOF)
+        return EOF;
+
+    return c;
+}
+
+int any_sexp_print(any_sexp_t sexp)
+{
+    return any_sexp_fprint(stdout, sexp);
+}
+
+#endif
+
+#if !defined(ANY_SEXP_NO_BINARY) && !defined(ANY_SEXP_NO_WRITER)
+
+// The values of the shared table of the dumper, besides the indices
+#define ANY_SEXP_BINARY_ONCE    0
+#define ANY_SEXP_BINARY_TWICE   1
+#define ANY_SEXP_BINARY_DUMPING 2
+#define ANY_SEXP_BINARY_INDEX   3
+
+static size_t any_sexp_binary_slot(any_sexp_binary_table_t *table, const void *key)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = (((uintptr_t)key >> 3) * 11400714819323198485llu >> 32) & mask;
+
+    while (table->keys[i] != NULL && table->keys[i] != key)
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+// Returns the value of key, or inserts it with value if it is missing
+static size_t *any_sexp_binary_lookup(any_sexp_binary_table_t *table, const void *key, size_t value, bool *found)
+{
+    // Keep the load factor below 1/2
+    if (2 * (table->count + 1) > table->capacity) {
+        any_sexp_binary_table_t resized = {
+            .keys = calloc(table->capacity == 0 ? 256 : 2 * table->capacity, sizeof(void *)),
+            .values = malloc((table->capacity == 0 ? 256 : 2 * table->capacity) * sizeof(size_t)),
+            .capacity = table->capacity == 0 ? 256 : 2 * table->capacity,
+            .count = table->count,
+        };
+
+        if (resized.keys == NULL || resized.values == NULL) {
+            free(resized.keys);
+            free(resized.values);
+            return NULL;
+        }
+
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->keys[i] == NULL)
+                continue;
+
+            size_t j = any_sexp_binary_slot(&resized, table->keys[i]);
+            resized.keys[j] = table->keys[i];
+            resized.values[j] = table->values[i];
+        }
+
+        free(table->keys);
+        free(table->values);
+        *table = resized;
+    }
+
+    size_t i = any_sexp_binary_slot(table, key);
+    *found = table->keys[i] != NULL;
+
+    if (!*found) {
+        table->keys[i] = key;
+        table->values[i] = value;
+        table->count++;
+    }
+
+    return &table->values[i];
+}
+
+static void any_sexp_binary_table_clear(any_sexp_binary_table_t *table)
+{
+    if (table->count > 0)
+        memset(table->keys, 0, table->capacity * sizeof(void *));
+
+    table->count = 0;
+}
+
+static void any_sexp_binary_table_free(any_sexp_binary_table_t *table)
+{
+    free(table->keys);
+    free(table->values);
+    memset(table, 0, sizeof(any_sexp_binary_table_t));
+}
+
+#ifndef ANY_SEXP_BINARY_STACK_LENGTH
+#define ANY_SEXP_BINARY_STACK_LENGTH 32
+#endif
+
+// A list, an object or a shared value being dumped or loaded. The dumper
+// keeps in sexp the next cell of a list, the object or the shared value,
+// while the loader keeps in next the location of the next value. The count
+// is the number of cells left of a list, or the index of the next value of
+// an object.
+typedef struct {
+    any_sexp_binary_op_t op;
+    any_sexp_t sexp;
+    any_sexp_t tail;
+    any_sexp_t *next;
+    size_t count;
+} any_sexp_binary_frame_t;
+
+typedef struct {
+    any_sexp_binary_frame_t *frames;
+    size_t length;
+    size_t capacity;
+    any_sexp_binary_frame_t local[ANY_SEXP_BINARY_STACK_LENGTH];
+} any_sexp_binary_stack_t;
+
+#define ANY_SEXP_BINARY_STACK_INIT(stack) \
+    ((stack).frames = (stack).local, (stack).length = 0, (stack).capacity = ANY_SEXP_BINARY_STACK_LENGTH)
+
+static bool any_sexp_binary_push(any_sexp_binary_stack_t *stack, any_sexp_binary_frame_t frame)
+{
+    if (stack->length == stack->capacity) {
+        size_t capacity = 2 * stack->capacity;
+        any_sexp_binary_frame_t *frames = stack->frames == stack->local
+                                        ? malloc(capacity * sizeof(any_sexp_binary_frame_t))
+                                        : realloc(stack->frames, capacity * sizeof(any_sexp_binary_frame_t));
+        if (frames == NULL)
+            return false;
+
+        if (stack->frames == stack->local)
+            memcpy(frames, stack->local, sizeof(stack->local));
+
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+
+    stack->frames[stack->length++] = frame;
+    return true;
+}
+
+static void any_sexp_binary_stack_free(any_sexp_binary_stack_t *stack)
+{
+    if (stack->frames != stack->local)
+        free(stack->frames);
+}
+
+// Conses, strings and objects are identified by their address, while the
+// symbols are in the symbol table
+static inline const void *any_sexp_binary_identity(any_sexp_t sexp)
+{
+    switch (ANY_SEXP_GET_TAG(sexp)) {
+        case ANY_SEXP_TAG_CONS:
+            return ANY_SEXP_GET_CONS(sexp);
+
+        case ANY_SEXP_TAG_OBJECT:
+            return ANY_SEXP_GET_OBJECT(sexp);
+
+        case ANY_SEXP_TAG_STRING:
+            return ANY_SEXP_GET_STRING(sexp);
+
+        default:
+            return NULL;
+    }
+}
+
+static inline bool any_sexp_dumper_is_shared(any_sexp_dumper_t *dumper, any_sexp_t sexp)
+{
+    const void *identity = any_sexp_binary_identity(sexp);
+    if (identity == NULL || dumper->shared.count == 0)
+        return false;
+
+    size_t i = any_sexp_binary_slot(&dumper->shared, identity);
+    return dumper->shared.keys[i] != NULL && dumper->shared.values[i] != ANY_SEXP_BINARY_ONCE;
+}
+
+// Finds the values reachable more than once. The cars and the values of the
+// objects wait on the stack while the cdrs are followed.
+static int any_sexp_dumper_count(any_sexp_dumper_t *dumper, any_sexp_binary_stack_t *stack, any_sexp_t sexp)
+{
+    while (true) {
+        const void *identity = any_sexp_binary_identity(sexp);
+
+        if (identity != NULL) {
+            bool found;
+            size_t *value = any_sexp_binary_lookup(&dumper->shared, identity, ANY_SEXP_BINARY_ONCE, &found);
+            if (value == NULL)
+                return EOF;
+
+            if (found)
+                *value = ANY_SEXP_BINARY_TWICE;
+            else if (ANY_SEXP_IS_CONS(sexp)) {
+                any_sexp_t car = ANY_SEXP_GET_CAR(sexp);
+                any_sexp_t cdr = ANY_SEXP_GET_CDR(sexp);
+
+                // NOTE: The car is pushed only if both need to be followed
+                if (any_sexp_binary_identity(car) == NULL)
+                    sexp = cdr;
+                else if (any_sexp_binary_identity(cdr) == NULL)
+                    sexp = car;
+                else {
+                    if (!any_sexp_binary_push(stack, (any_sexp_binary_frame_t) { .sexp = car }))
+                        return EOF;
+
+                    sexp = cdr;
+                }
+
+                continue;
+            } else if (ANY_SEXP_IS_OBJECT(sexp)) {
+                any_sexp_object_t *object = ANY_SEXP_GET_OBJECT(sexp);
+
+                for (size_t i = 0; i < object->length; i++) {
+                    if (any_sexp_binary_identity(object->values[i]) != NULL &&
+                        !any_sexp_binary_push(stack, (any_sexp_binary_frame_t) { .sexp = object->values[i] }))
+                        return EOF;
+                }
+            }
+        }
+
+        if (stack->length == 0)
+            return 0;
+
+        sexp = stack->frames[--stack->length].sexp;
+    }
+}
+
+static int any_sexp_dumper_varint(any_sexp_dumper_t *dumper, uintmax_t value)
+{
+    char bytes[10];
+    size_t length = 0;
+
+    while (value >= 0x80) {
+        bytes[length++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+
+    bytes[length++] = (char)value;
+    return any_sexp_writer_putn(dumper->writer, bytes, length);
+}
+
+static int any_sexp_dumper_op(any_sexp_dumper_t *dumper, any_sexp_binary_op_t op, uintmax_t operand)
+{
+    if (any_sexp_writer_putc(dumper->writer, op) == EOF)
+        return EOF;
+
+    return any_sexp_dumper_varint(dumper, operand);
+}
+
+static int any_sexp_dumper_bytes(any_sexp_dumper_t *dumper, any_sexp_binary_op_t op, const char *bytes)
+{
+    size_t length = strlen(bytes);
+
+    if (any_sexp_dumper_op(dumper, op, length) == EOF)
+        return EOF;
+
+    return any_sexp_writer_putn(dumper->writer, bytes, length);
+}
+
+// Writes an atom, or the header of a list or of an object and pushes it, so
+// that its values are dumped next
+static int any_sexp_dumper_plain(any_sexp_dumper_t *dumper, any_sexp_binary_stack_t *stack, any_sexp_t sexp)
+{
+    switch (ANY_SEXP_GET_TAG(sexp)) {
+        case ANY_SEXP_TAG_NIL:
+            return any_sexp_writer_putc(dumper->writer, ANY_SEXP_BINARY_NIL);
+
+        case ANY_SEXP_TAG_CONS: {
+            // NOTE: The list stops before a shared cell, which is dumped as
+            //       its tail
+            size_t count = 1;
+            any_sexp_t tail = ANY_SEXP_GET_CDR(sexp);
+
+            while (ANY_SEXP_IS_CONS(tail) && !any_sexp_dumper_is_shared(dumper, tail)) {
+                tail = ANY_SEXP_GET_CDR(tail);
+                count++;
+            }
+
+            if (any_sexp_dumper_op(dumper, ANY_SEXP_BINARY_LIST, count) == EOF)
+                return EOF;
+
+            any_sexp_binary_frame_t frame = { ANY_SEXP_BINARY_LIST, sexp, tail, NULL, count };
+            return any_sexp_binary_push(stack, frame) ? 0 : EOF;
+        }
+
+        case ANY_SEXP_TAG_NUMBER: {
+            intmax_t value = ANY_SEXP_GET_NUMBER(sexp);
+            uintmax_t zigzag = ((uintmax_t)value << 1) ^ (uintmax_t)(value >> (8 * sizeof(intmax_t) - 1));
+            return any_sexp_dumper_op(dumper, ANY_SEXP_BINARY_NUMBER, zigzag);
+        }
+
+        case ANY_SEXP_TAG_FLOAT: {
+            double value = ANY_SEXP_GET_FLOAT(sexp);
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(double));
+
+            char bytes[9] = { ANY_SEXP_BINARY_FLOAT };
+            for (int i = 0; i < 8; i++)
+                bytes[i + 1] = (char)(bits >> 8 * i);
+
+            return any_sexp_writer_putn(dumper->writer, bytes, sizeof(bytes));
+        }
+
+        case ANY_SEXP_TAG_STRING:
+            return any_sexp_dumper_bytes(dumper, ANY_SEXP_BINARY_STRING, ANY_SEXP_GET_STRING(sexp));
+
+        case ANY_SEXP_TAG_SYMBOL: {
+            bool found;
+            size_t *index = any_sexp_binary_lookup(&dumper->symbols, ANY_SEXP_GET_SYMBOL(sexp), dumper->symbols.count, &found);
+            if (index == NULL)
+                return EOF;
+
+            if (found)
+                return any_sexp_dumper_op(dumper, ANY_SEXP_BINARY_SYMBOL_REF, *index);
+
+            // NOTE: The intern table is searched once per symbol
+            return any_sexp_dumper_bytes(dumper,
+                                         any_sexp_symbol_interned(sexp) ? ANY_SEXP_BINARY_SYMBOL : ANY_SEXP_BINARY_UNINTERNED,
+                                         ANY_SEXP_GET_SYMBOL(sexp));
+        }
+
+        case ANY_SEXP_TAG_OBJECT: {
+            any_sexp_object_t *object = ANY_SEXP_GET_OBJECT(sexp);
+
+            if (any_sexp_dumper_op(dumper, ANY_SEXP_BINARY_OBJECT, object->kind) == EOF ||
+                any_sexp_dumper_varint(dumper, object->length) == EOF)
+                return EOF;
+
+            if (object->length == 0)
+                return 0;
+
+            any_sexp_binary_frame_t frame = { ANY_SEXP_BINARY_OBJECT, sexp, ANY_SEXP_NIL, NULL, 0 };
+            return any_sexp_binary_push(stack, frame) ? 0 : EOF;
+        }
+
+        // NOTE: The errors can not be dumped
+        default:
+            return EOF;
+    }
+}
+
+static int any_sexp_dumper_value(any_sexp_dumper_t *dumper, any_sexp_binary_stack_t *stack, any_sexp_t sexp)
+{
+    if (!any_sexp_dumper_is_shared(dumper, sexp))
+        return any_sexp_dumper_plain(dumper, stack, sexp);
+
+    bool found;
+    size_t *value = any_sexp_binary_lookup(&dumper->shared, any_sexp_binary_identity(sexp), 0, &found);
+
+    switch (*value) {
+        case ANY_SEXP_BINARY_DUMPING:
+            return EOF; // cycle
+
+        case ANY_SEXP_BINARY_TWICE: {
+            *value = ANY_SEXP_BINARY_DUMPING;
+
+            // NOTE: The value is numbered when its frame is popped
+            any_sexp_binary_frame_t frame = { ANY_SEXP_BINARY_SHARE, sexp, ANY_SEXP_NIL, NULL, 0 };
+            if (any_sexp_writer_putc(dumper->writer, ANY_SEXP_BINARY_SHARE) == EOF ||
+                !any_sexp_binary_push(stack, frame))
+                return EOF;
+
+            return any_sexp_dumper_plain(dumper, stack, sexp);
+        }
+
+        default:
+            return any_sexp_dumper_op(dumper, ANY_SEXP_BINARY_SHARED_REF, *value - ANY_SEXP_BINARY_INDEX);
+    }
+}
+
+// NOTE: The values are dumped without recursion, so the nesting is limited
+//       only by the memory, as for any_sexp_read
+static int any_sexp_dumper_all(any_sexp_dumper_t *dumper, any_sexp_binary_stack_t *stack, any_sexp_t sexp)
+{
+    if (any_sexp_dumper_count(dumper, stack, sexp) == EOF ||
+        any_sexp_dumper_value(dumper, stack, sexp) == EOF)
+        return EOF;
+
+    while (stack->length > 0) {
+        any_sexp_binary_frame_t *frame = &stack->frames[stack->length - 1];
+        any_sexp_t next;
+
+        switch (frame->op) {
+            case ANY_SEXP_BINARY_LIST:
+                // NOTE: The atoms push nothing, so they are dumped in a row
+                while (frame->count > 0 && any_sexp_binary_identity(ANY_SEXP_GET_CAR(frame->sexp)) == NULL) {
+                    if (any_sexp_dumper_plain(dumper, stack, ANY_SEXP_GET_CAR(frame->sexp)) == EOF)
+                        return EOF;
+
+                    frame->sexp = ANY_SEXP_GET_CDR(frame->sexp);
+                    frame->count--;
+                }
+
+                if (frame->count == 0) {
+                    next = frame->tail;
+                    stack->length--;
+                    break;
+                }
+
+                next = ANY_SEXP_GET_CAR(frame->sexp);
+                frame->sexp = ANY_SEXP_GET_CDR(frame->sexp);
+                frame->count--;
+                break;
+
+            case ANY_SEXP_BINARY_OBJECT: {
+                any_sexp_object_t *object = ANY_SEXP_GET_OBJECT(frame->sexp);
+                next = object->values[frame->count++];
+
+                if (frame->count == object->length)
+                    stack->length--;
+                break;
+            }
+
+            // The shared value is complete
+            default: {
+                bool found;
+                size_t *value = any_sexp_binary_lookup(&dumper->shared, any_sexp_binary_identity(frame->sexp), 0, &found);
+                *value = ANY_SEXP_BINARY_INDEX + dumper->shared_count++;
+                stack->length--;
+                continue;
+            }
+        }
+
+        if (any_sexp_dumper_value(dumper, stack, next) == EOF)
+            return EOF;
+    }
+
+    return 0;
+}
+
+int any_sexp_dumper_init(any_sexp_dumper_t *dumper, any_sexp_writer_t *writer)
+{
+    memset(dumper, 0, sizeof(any_sexp_dumper_t));
+    dumper->writer = writer;
+
+    if (any_sexp_writer_putn(writer, ANY_SEXP_BINARY_MAGIC, 4) == EOF)
+        return EOF;
+
+    return any_sexp_writer_putc(writer, ANY_SEXP_BINARY_VERSION);
+}
+
+int any_sexp_dump(any_sexp_dumper_t *dumper, any_sexp_t sexp)
+{
+    any_sexp_binary_table_clear(&dumper->shared);
+    dumper->shared_count = 0;
+
+    any_sexp_binary_stack_t stack;
+    ANY_SEXP_BINARY_STACK_INIT(stack);
+
+    int result = any_sexp_dumper_all(dumper, &stack, sexp);
+    any_sexp_binary_stack_free(&stack);
+    return result;
+}
+
+int any_sexp_dumper_symbol(any_sexp_dumper_t *dumper, any_sexp_t symbol)
+{
+    bool found;
+    size_t *index = any_sexp_binary_lookup(&dumper->symbols, ANY_SEXP_GET_SYMBOL(symbol), dumper->symbols.count, &found);
+    return index == NULL ? EOF : 0;
+}
+
+void any_sexp_dumper_free(any_sexp_dumper_t *dumper)
+{
+    any_sexp_binary_table_free(&dumper->symbols);
+    any_sexp_binary_table_free(&dumper->shared);
+}
+
+static bool any_sexp_loader_varint(any_sexp_loader_t *loader, uintmax_t *value)
+{
+    *value = 0;
+
+    for (unsigned shift = 0; loader->cursor < loader->end && shift < 8 * sizeof(uintmax_t); shift += 7) {
+        unsigned char byte = *loader->cursor++;
+        *value |= (uintmax_t)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// Returns the bytes of a string or a symbol, checking that they are in the
+// input
+static const char *any_sexp_loader_bytes(any_sexp_loader_t *loader, size_t *length)
+{
+    uintmax_t value;
+    if (!any_sexp_loader_varint(loader, &value) || value > (uintmax_t)(loader->end - loader->cursor))
+        return NULL;
+
+    const char *bytes = (const char *)loader->cursor;
+    loader->cursor += value;
+    *length = value;
+    return bytes;
+}
+
+static bool any_sexp_loader_push(any_sexp_t **array, size_t *length, size_t *capacity, any_sexp_t sexp)
+{
+    if (*length == *capacity) {
+        size_t resized = *capacity == 0 ? 256 : 2 * *capacity;
+        any_sexp_t *values = realloc(*array, resized * sizeof(any_sexp_t));
+        if (values == NULL)
+            return false;
+
+        *array = values;
+        *capacity = resized;
     }
-    return i;
+
+    (*array)[(*length)++] = sexp;
+    return true;
 }
 
-static int any_sexp_writer_putnum(any_sexp_writer_t *writer, intptr_t value)
+// Returns an atom, or a list or an object that is pushed on the stack, so
+// that its values are loaded next. The value is stored at slot.
+static any_sexp_t any_sexp_loader_value(any_sexp_loader_t *loader, any_sexp_binary_stack_t *stack, any_sexp_t *slot)
 {
-    int c = 0;
-    if (value > 9) {
-        c = any_sexp_writer_putnum(writer, value / 10);
-        value %= 10;
+    if (loader->cursor == loader->end)
+        return ANY_SEXP_ERROR;
+
+    // NOTE: A shared value is the value that follows, which is added to the
+    //       shared table when its frame is popped
+    any_sexp_binary_op_t op;
+    while ((op = *loader->cursor++) == ANY_SEXP_BINARY_SHARE) {
+        any_sexp_binary_frame_t frame = { ANY_SEXP_BINARY_SHARE, ANY_SEXP_NIL, ANY_SEXP_NIL, slot, 0 };
+        if (loader->cursor == loader->end || !any_sexp_binary_push(stack, frame))
+            return ANY_SEXP_ERROR;
     }
 
-    if (writer->putc('0' + value, writer->stream) == EOF)
-        return EOF;
+    uintmax_t operand;
+    const char *bytes;
+    size_t length;
+
+    switch (op) {
+        case ANY_SEXP_BINARY_NIL:
+            return ANY_SEXP_NIL;
+
+        case ANY_SEXP_BINARY_LIST: {
+            if (!any_sexp_loader_varint(loader, &operand) || operand == 0)
+                return ANY_SEXP_ERROR;
+
+            // NOTE: The cells are appended at slot by any_sexp_loader_slot,
+            //       so the list is built in order
+            any_sexp_binary_frame_t frame = { ANY_SEXP_BINARY_LIST, ANY_SEXP_NIL, ANY_SEXP_NIL, slot, operand };
+            return any_sexp_binary_push(stack, frame) ? ANY_SEXP_NIL : ANY_SEXP_ERROR;
+        }
+
+        case ANY_SEXP_BINARY_NUMBER: {
+            if (!any_sexp_loader_varint(loader, &operand))
+                return ANY_SEXP_ERROR;
+
+            // NOTE: The range depends on the representation of the dumper,
+            //       so a number out of the range of this one is an error
+            intptr_t number = (intptr_t)(operand >> 1) ^ -(intptr_t)(operand & 1);
+            if (!ANY_SEXP_NUMBER_FITS(number))
+                return ANY_SEXP_ERROR;
+
+            return any_sexp_number(number);
+        }
+
+        case ANY_SEXP_BINARY_FLOAT: {
+            if (loader->end - loader->cursor < 8)
+                return ANY_SEXP_ERROR;
+
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; i++)
+                bits |= (uint64_t)loader->cursor[i] << 8 * i;
+
+            loader->cursor += 8;
+
+            double value;
+            memcpy(&value, &bits, sizeof(double));
+            return any_sexp_float(value);
+        }
+
+        case ANY_SEXP_BINARY_STRING:
+            bytes = any_sexp_loader_bytes(loader, &length);
+            return bytes == NULL ? ANY_SEXP_ERROR : any_sexp_string(bytes, length);
+
+        case ANY_SEXP_BINARY_SYMBOL:
+        case ANY_SEXP_BINARY_UNINTERNED: {
+            bytes = any_sexp_loader_bytes(loader, &length);
+            if (bytes == NULL)
+                return ANY_SEXP_ERROR;
+
+            any_sexp_t symbol = op == ANY_SEXP_BINARY_SYMBOL
+                              ? any_sexp_symbol(bytes, length)
+                              : any_sexp_symbol_uninterned(bytes, length);
+            if (ANY_SEXP_IS_ERROR(symbol) ||
+                !any_sexp_loader_push(&loader->symbols, &loader->symbols_length, &loader->symbols_capacity, symbol))
+                return ANY_SEXP_ERROR;
+
+            return symbol;
+        }
+
+        case ANY_SEXP_BINARY_SYMBOL_REF:
+            if (!any_sexp_loader_varint(loader, &operand) || operand >= loader->symbols_length)
+                return ANY_SEXP_ERROR;
+
+            return loader->symbols[operand];
+
+        case ANY_SEXP_BINARY_SHARED_REF:
+            if (!any_sexp_loader_varint(loader, &operand) || operand >= loader->shared_length)
+                return ANY_SEXP_ERROR;
+
+            return loader->shared[operand];
+
+        case ANY_SEXP_BINARY_OBJECT: {
+            uintmax_t kind;
+            if (!any_sexp_loader_varint(loader, &kind) || kind > UINT32_MAX ||
+                !any_sexp_loader_varint(loader, &operand) || operand > (uintmax_t)(loader->end - loader->cursor))
+                return ANY_SEXP_ERROR;
+
+            // NOTE: Each value takes at least a byte, which bounds the length
+            any_sexp_t sexp = any_sexp_object(kind, operand);
+            if (ANY_SEXP_IS_ERROR(sexp))
+                return ANY_SEXP_ERROR;
+
+            any_sexp_binary_frame_t frame = { ANY_SEXP_BINARY_OBJECT, sexp, ANY_SEXP_NIL, NULL, 0 };
+            return operand == 0 || any_sexp_binary_push(stack, frame) ? sexp : ANY_SEXP_ERROR;
+        }
+
+        // NOTE: Skipped above
+        case ANY_SEXP_BINARY_SHARE:
+            break;
+    }
 
-    return c + 1;
+    return ANY_SEXP_ERROR;
 }
 
-void any_sexp_writer_init(any_sexp_writer_t *writer, any_sexp_putchar_t putc, void *stream, int flags)
+bool any_sexp_loader_init(any_sexp_loader_t *loader, const void *data, size_t length)
 {
-    writer->putc = putc;
-    writer->stream = stream;
-    writer->flags = flags;
+    memset(loader, 0, sizeof(any_sexp_loader_t));
+    loader->cursor = data;
+    loader->end = loader->cursor + length;
+
+    if (length < 5 || memcmp(data, ANY_SEXP_BINARY_MAGIC, 4) || loader->cursor[4] != ANY_SEXP_BINARY_VERSION)
+        return false;
+
+    loader->cursor += 5;
+    return true;
 }
 
-int any_sexp_write(any_sexp_writer_t *writer, any_sexp_t sexp)
+bool any_sexp_loader_open(any_sexp_loader_t *loader, FILE *file)
 {
-    switch (ANY_SEXP_GET_TAG(sexp)) {
-        case ANY_SEXP_TAG_ERROR:
-            return any_sexp_writer_puts(writer, "<error>");
-
-        case ANY_SEXP_TAG_NIL: {
-            const char nil[3] = { ANY_SEXP_CHAR_OPEN, ANY_SEXP_CHAR_CLOSE, '\0' };
-            return any_sexp_writer_puts(writer, nil);
-        }
+    long offset = ftell(file);
+    if (offset < 0 || fseek(file, 0, SEEK_END))
+        return false;
 
-        case ANY_SEXP_TAG_CONS: {
-            any_sexp_t car = any_sexp_car(sexp), cdr = any_sexp_cdr(sexp);
+    long end = ftell(file);
+    if (end < offset || fseek(file, offset, SEEK_SET))
+        return false;
 
-#ifndef ANY_SEXP_NO_QUOTE
-            if (ANY_SEXP_IS_SYMBOL(car) && ANY_SEXP_IS_NIL(any_sexp_cdr(cdr)) &&
-                !strcmp(ANY_SEXP_GET_SYMBOL(car), ANY_SEXP_QUOTE_SYMBOL)) {
+    size_t length = end - offset;
 
-                if (writer->putc(ANY_SEXP_CHAR_QUOTE, writer->stream) == EOF)
-                    return EOF;
+#ifdef ANY_SEXP_MMAP
+    struct stat st;
+    if (length > 0 && !fstat(fileno(file), &st) && S_ISREG(st.st_mode)) {
+        void *mapping = mmap(NULL, end, PROT_READ, MAP_PRIVATE, fileno(file), 0);
 
-                return any_sexp_write(writer, any_sexp_car(cdr));
-            }
+        if (mapping != MAP_FAILED) {
+            bool valid = any_sexp_loader_init(loader, (char *)mapping + offset, length);
+            loader->mapping = mapping;
+            loader->mapping_length = end;
+            return valid;
+        }
+    }
 #endif
 
-            if (writer->putc(ANY_SEXP_CHAR_OPEN, writer->stream) == EOF)
-                return EOF;
+    void *data = malloc(length);
+    if (data == NULL || fread(data, 1, length, file) != length) {
+        free(data);
+        memset(loader, 0, sizeof(any_sexp_loader_t));
+        return false;
+    }
 
-            int c = 2, tmp;
-            while (true) {
-                tmp = any_sexp_write(writer, car);
-                if (tmp == EOF)
-                    return EOF;
-                c += tmp;
+    bool valid = any_sexp_loader_init(loader, data, length);
+    loader->data = data;
+    return valid;
+}
 
-                if (ANY_SEXP_IS_CONS(cdr)) {
-                    if (writer->putc(' ', writer->stream) == EOF)
-                        return EOF;
+bool any_sexp_loader_end(any_sexp_loader_t *loader)
+{
+    return loader->cursor == loader->end;
+}
 
-                    car = any_sexp_car(cdr);
-                    cdr = any_sexp_cdr(cdr);
-                    c++;
-                } else if (!ANY_SEXP_IS_NIL(cdr)) {
-                    if (any_sexp_writer_puts(writer, " . ") == EOF)
-                        return EOF;
+// Returns the location of the next value of the innermost list or object,
+// appending a cell to the list, and pops the values that are complete. The
+// shared ones are added to the shared table. Returns root when the whole
+// s-expression is complete.
+static any_sexp_t *any_sexp_loader_slot(any_sexp_loader_t *loader, any_sexp_binary_stack_t *stack, any_sexp_t *root)
+{
+    while (stack->length > 0) {
+        any_sexp_binary_frame_t *frame = &stack->frames[stack->length - 1];
+
+        switch (frame->op) {
+            case ANY_SEXP_BINARY_LIST: {
+                // NOTE: The tail is the cdr of the last cell
+                if (frame->count == 0) {
+                    stack->length--;
+                    return frame->next;
+                }
+
+                any_sexp_t cell = any_sexp_cons(ANY_SEXP_NIL, ANY_SEXP_NIL);
+                if (ANY_SEXP_IS_ERROR(cell))
+                    return NULL;
+
+                *frame->next = cell;
+                frame->next = &ANY_SEXP_GET_CDR(cell);
+                frame->count--;
+                return &ANY_SEXP_GET_CAR(cell);
+            }
 
-                    car = cdr;
-                    cdr = ANY_SEXP_NIL;
-                    c += 3;
-                } else
-                    break;
+            case ANY_SEXP_BINARY_OBJECT: {
+                any_sexp_object_t *object = ANY_SEXP_GET_OBJECT(frame->sexp);
+                any_sexp_t *next = &object->values[frame->count++];
+
+                if (frame->count == object->length)
+                    stack->length--;
+
+                return next;
             }
 
-            if (writer->putc(ANY_SEXP_CHAR_CLOSE, writer->stream) == EOF)
-                return EOF;
+            default:
+                if (!any_sexp_loader_push(&loader->shared, &loader->shared_length, &loader->shared_capacity, *frame->next))
+                    return NULL;
 
-            return c;
+                stack->length--;
+                break;
         }
+    }
 
-        case ANY_SEXP_TAG_SYMBOL:
-            return any_sexp_writer_puts(writer, ANY_SEXP_GET_SYMBOL(sexp));
-
-        case ANY_SEXP_TAG_STRING: {
-            bool bare = (writer->flags & ANY_SEXP_WRITER_BARE_STRING) != 0;
+    return root;
+}
 
-            if (!bare && writer->putc(ANY_SEXP_CHAR_STRING, writer->stream) == EOF)
-                return EOF;
+// NOTE: The values are loaded without recursion, so the nesting is limited
+//       only by the memory. As in any_sexp_read, the values are reachable
+//       from root while they are incomplete
+any_sexp_t any_sexp_load(any_sexp_loader_t *loader)
+{
+    any_sexp_binary_stack_t stack;
+    ANY_SEXP_BINARY_STACK_INIT(stack);
 
-            int c = any_sexp_writer_puts(writer, ANY_SEXP_GET_STRING(sexp));
-            if (c == EOF)
-                return EOF;
+    any_sexp_t root = ANY_SEXP_NIL, *slot = &root;
+    any_sexp_t result = ANY_SEXP_ERROR;
+    loader->shared_length = 0;
 
-            if (!bare && writer->putc(ANY_SEXP_CHAR_STRING, writer->stream) == EOF)
-                return EOF;
+    while (true) {
+        any_sexp_t sexp = any_sexp_loader_value(loader, &stack, slot);
+        if (ANY_SEXP_IS_ERROR(sexp))
+            break;
 
-            return c + 2 * bare;
-        }
+        *slot = sexp;
+        slot = any_sexp_loader_slot(loader, &stack, &root);
+        if (slot == NULL)
+            break;
 
-        case ANY_SEXP_TAG_NUMBER: {
-            intptr_t value = ANY_SEXP_GET_NUMBER(sexp);
-            bool sign = value < 0;
-            if (sign) {
-                value = -value;
-                if (writer->putc('-', writer->stream) == EOF)
-                    return EOF;
-            }
-            return sign + any_sexp_writer_putnum(writer, value);
+        if (slot == &root) {
+            result = root;
+            break;
         }
     }
 
-    return 0;
+    any_sexp_binary_stack_free(&stack);
+    return result;
 }
 
-int any_sexp_fprint(FILE *file, any_sexp_t sexp)
+bool any_sexp_loader_symbol(any_sexp_loader_t *loader, any_sexp_t symbol)
 {
-    any_sexp_writer_t writer;
-    any_sexp_writer_init(&writer, (any_sexp_putchar_t)fputc, file, ANY_SEXP_WRITER_DEFAULT);
-    return any_sexp_write(&writer, sexp);
+    return any_sexp_loader_push(&loader->symbols, &loader->symbols_length, &loader->symbols_capacity, symbol);
 }
 
-int any_sexp_print(any_sexp_t sexp)
+void any_sexp_loader_close(any_sexp_loader_t *loader)
 {
-    return any_sexp_fprint(stdout, sexp);
+#ifdef ANY_SEXP_MMAP
+    if (loader->mapping != NULL)
+        munmap(loader->mapping, loader->mapping_length);
+#endif
+
+    free(loader->data);
+    free(loader->symbols);
+    free(loader->shared);
+    memset(loader, 0, sizeof(any_sexp_loader_t));
 }
 
 #endif
@@ -574,52 +2394,196 @@ any_sexp_t any_sexp_nil(void)
 #endif
 }
 
-any_sexp_t any_sexp_symbol(const char *symbol, size_t length)
+// Symbol interning
+//
+// Every symbol created with any_sexp_symbol is looked up in a global table,
+// so that each name is allocated only once and symbols can be compared by
+// identity (see ANY_SEXP_IS_EQ). The table uses open addressing with linear
+// probing and keeps the hash of each entry to skip most string comparisons.
+//
+// Symbols created with any_sexp_symbol_uninterned are never added to the
+// table and thus are distinct from any other symbol (like gensym).
+//
+
+#ifndef ANY_SEXP_INTERN_CAPACITY
+#define ANY_SEXP_INTERN_CAPACITY 256
+#endif
+
+static struct {
+    char **symbols;
+    uint32_t *hashes;
+    size_t capacity;
+    size_t count;
+} any_sexp_intern_table;
+
+static inline uint32_t any_sexp_hash(const char *string, size_t length)
 {
-    if (symbol == NULL)
-        return ANY_SEXP_ERROR;
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
+static char *any_sexp_symbol_alloc(const char *symbol, size_t length)
+{
     char *copy = ANY_SEXP_MALLOC(length + 1);
     if (copy == NULL)
-        return ANY_SEXP_ERROR;
+        return NULL;
 
     memcpy(copy, symbol, length);
     copy[length] = '\0';
+    return copy;
+}
+
+static bool any_sexp_intern_resize(size_t capacity)
+{
+    char **symbols = ANY_SEXP_INTERN_MALLOC(capacity * sizeof(char *));
+    uint32_t *hashes = ANY_SEXP_INTERN_MALLOC(capacity * sizeof(uint32_t));
+
+    if (symbols == NULL || hashes == NULL) {
+        ANY_SEXP_INTERN_FREE(symbols);
+        ANY_SEXP_INTERN_FREE(hashes);
+        return false;
+    }
+
+    memset(symbols, 0, capacity * sizeof(char *));
+
+    for (size_t i = 0; i < any_sexp_intern_table.capacity; i++) {
+        char *symbol = any_sexp_intern_table.symbols[i];
+        if (symbol == NULL)
+            continue;
+
+        uint32_t hash = any_sexp_intern_table.hashes[i];
+        size_t j = hash & (capacity - 1);
+        while (symbols[j] != NULL)
+            j = (j + 1) & (capacity - 1);
+
+        symbols[j] = symbol;
+        hashes[j] = hash;
+    }
+
+    ANY_SEXP_INTERN_FREE(any_sexp_intern_table.symbols);
+    ANY_SEXP_INTERN_FREE(any_sexp_intern_table.hashes);
+
+    any_sexp_intern_table.symbols = symbols;
+    any_sexp_intern_table.hashes = hashes;
+    any_sexp_intern_table.capacity = capacity;
+    return true;
+}
+
+// Returns the slot where the symbol is (or should be) stored
+static size_t any_sexp_intern_find(const char *symbol, size_t length, uint32_t hash)
+{
+    size_t mask = any_sexp_intern_table.capacity - 1;
+    size_t i = hash & mask;
+
+    while (any_sexp_intern_table.symbols[i] != NULL) {
+        const char *entry = any_sexp_intern_table.symbols[i];
+        if (any_sexp_intern_table.hashes[i] == hash &&
+            !memcmp(entry, symbol, length) && entry[length] == '\0')
+            break;
+
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+static char *any_sexp_intern(const char *symbol, size_t length)
+{
+    // Keep the load factor below 1/2
+    if (2 * (any_sexp_intern_table.count + 1) > any_sexp_intern_table.capacity) {
+        size_t capacity = any_sexp_intern_table.capacity == 0
+                        ? ANY_SEXP_INTERN_CAPACITY
+                        : 2 * any_sexp_intern_table.capacity;
+
+        if (!any_sexp_intern_resize(capacity))
+            return NULL;
+    }
+
+    uint32_t hash = any_sexp_hash(symbol, length);
+    size_t i = any_sexp_intern_find(symbol, length, hash);
+
+    if (any_sexp_intern_table.symbols[i] == NULL) {
+        char *copy = ANY_SEXP_INTERN_MALLOC(length + 1);
+        if (copy == NULL)
+            return NULL;
+
+        memcpy(copy, symbol, length);
+        copy[length] = '\0';
+
+        any_sexp_intern_table.symbols[i] = copy;
+        any_sexp_intern_table.hashes[i] = hash;
+        any_sexp_intern_table.count++;
+    }
+
+    return any_sexp_intern_table.symbols[i];
+}
+
+static inline any_sexp_t any_sexp_symbol_box(char *symbol, any_sexp_tag_t tag)
+{
+    if (symbol == NULL)
+        return ANY_SEXP_ERROR;
 
 #ifndef ANY_SEXP_NO_BOXING
-    return ANY_SEXP_TAG(copy, ANY_SEXP_TAG_SYMBOL);
+    return ANY_SEXP_TAG(symbol, tag);
 #else
     any_sexp_t sexp = {
-        .tag = ANY_SEXP_TAG_SYMBOL,
-        .symbol = copy,
+        .tag = tag,
+        .symbol = symbol,
     };
     return sexp;
 #endif
 }
 
-any_sexp_t any_sexp_string(const char *string, size_t length)
+any_sexp_t any_sexp_symbol(const char *symbol, size_t length)
 {
+    if (symbol == NULL)
+        return ANY_SEXP_ERROR;
+
+    return any_sexp_symbol_box(any_sexp_intern(symbol, length), ANY_SEXP_TAG_SYMBOL);
+}
 
-    any_sexp_t sexp = any_sexp_symbol(string, length);
-    if (ANY_SEXP_IS_ERROR(sexp))
+any_sexp_t any_sexp_symbol_uninterned(const char *symbol, size_t length)
+{
+    if (symbol == NULL)
         return ANY_SEXP_ERROR;
 
-    // Override the tag
-#ifndef ANY_SEXP_NO_BOXING
-    return ANY_SEXP_TAG(ANY_SEXP_UNTAG(sexp), ANY_SEXP_TAG_STRING);
-#else
-    sexp.tag = ANY_SEXP_TAG_STRING;
-    return sexp;
-#endif
+    return any_sexp_symbol_box(any_sexp_symbol_alloc(symbol, length), ANY_SEXP_TAG_SYMBOL);
+}
+
+bool any_sexp_symbol_interned(any_sexp_t sexp)
+{
+    if (!ANY_SEXP_IS_SYMBOL(sexp) || any_sexp_intern_table.capacity == 0)
+        return false;
+
+    const char *symbol = ANY_SEXP_GET_SYMBOL(sexp);
+    size_t length = strlen(symbol);
+    size_t i = any_sexp_intern_find(symbol, length, any_sexp_hash(symbol, length));
+
+    return any_sexp_intern_table.symbols[i] == symbol;
+}
+
+any_sexp_t any_sexp_string(const char *string, size_t length)
+{
+    if (string == NULL)
+        return ANY_SEXP_ERROR;
+
+    return any_sexp_symbol_box(any_sexp_symbol_alloc(string, length), ANY_SEXP_TAG_STRING);
 }
 
 any_sexp_t any_sexp_number(intptr_t value)
 {
-#ifndef ANY_SEXP_NO_BOXING
+#if defined(ANY_SEXP_LOW_TAGGING)
+    return (any_sexp_t)((uintptr_t)value << 1 | 1);
+#elif !defined(ANY_SEXP_NO_BOXING)
     // Handle the sign bit!
 
     uintptr_t sexp = *(uintptr_t *)&value;
-    sexp &= ~((uintptr_t)0x1f << (ANY_SEXP_BIT_SHIFT - 1));
+    sexp &= ANY_SEXP_BIT_SIGN - 1;
 
     if (value < 0)
         sexp |= ANY_SEXP_BIT_SIGN;
@@ -634,6 +2598,30 @@ any_sexp_t any_sexp_number(intptr_t value)
 #endif
 }
 
+any_sexp_t any_sexp_float(double value)
+{
+#if defined(ANY_SEXP_NO_BOXING)
+    any_sexp_t sexp = {
+        .tag = ANY_SEXP_TAG_FLOAT,
+        .real = value,
+    };
+    return sexp;
+#elif defined(ANY_SEXP_NAN_BOXING)
+    uintptr_t bits = ANY_SEXP_NAN_QUIET;
+    if (value == value)
+        memcpy(&bits, &value, sizeof(double));
+
+    return (any_sexp_t)(bits + ANY_SEXP_NAN_OFFSET);
+#else
+    double *box = ANY_SEXP_MALLOC(sizeof(double));
+    if (box == NULL)
+        return ANY_SEXP_ERROR;
+
+    *box = value;
+    return ANY_SEXP_TAG(box, ANY_SEXP_TAG_FLOAT);
+#endif
+}
+
 any_sexp_t any_sexp_quote(any_sexp_t sexp)
 {
     any_sexp_t quote = any_sexp_symbol(ANY_SEXP_QUOTE_SYMBOL, strlen(ANY_SEXP_QUOTE_SYMBOL));
@@ -660,6 +2648,32 @@ any_sexp_t any_sexp_cons(any_sexp_t car, any_sexp_t cdr)
 #endif
 }
 
+any_sexp_t any_sexp_object(uint32_t kind, size_t length)
+{
+    if (length > UINT32_MAX)
+        return ANY_SEXP_ERROR;
+
+    any_sexp_object_t *object = ANY_SEXP_MALLOC(sizeof(any_sexp_object_t) + length * sizeof(any_sexp_t));
+    if (object == NULL)
+        return ANY_SEXP_ERROR;
+
+    object->kind = kind;
+    object->length = length;
+
+    for (size_t i = 0; i < length; i++)
+        object->values[i] = ANY_SEXP_NIL;
+
+#ifndef ANY_SEXP_NO_BOXING
+    return ANY_SEXP_TAG(object, ANY_SEXP_TAG_OBJECT);
+#else
+    any_sexp_t sexp = {
+        .tag = ANY_SEXP_TAG_OBJECT,
+        .object = object,
+    };
+    return sexp;
+#endif
+}
+
 any_sexp_t any_sexp_car(any_sexp_t sexp)
 {
     if (!ANY_SEXP_IS_CONS(sexp))
@@ -686,8 +2700,8 @@ any_sexp_t any_sexp_reverse(any_sexp_t sexp)
                prev = ANY_SEXP_NIL,
                next = ANY_SEXP_NIL;
 
-    while (ANY_SEXP_GET_CONS(cons) != NULL) {
-        if (!ANY_SEXP_IS_NIL(cons) && !ANY_SEXP_IS_CONS(cons))
+    while (!ANY_SEXP_IS_NIL(cons)) {
+        if (!ANY_SEXP_IS_CONS(cons))
             return ANY_SEXP_ERROR;
 
         memcpy(&next, &ANY_SEXP_GET_CDR(cons), sizeof(any_sexp_t));
@@ -719,16 +2733,14 @@ any_sexp_t any_sexp_copy(any_sexp_t sexp)
         case ANY_SEXP_TAG_CONS:
             return any_sexp_cons(any_sexp_car(sexp), any_sexp_cdr(sexp));
 
-        case ANY_SEXP_TAG_SYMBOL: {
-            char *symbol = ANY_SEXP_GET_SYMBOL(sexp);
-            return any_sexp_symbol(symbol, strlen(symbol));
-        }
-
         case ANY_SEXP_TAG_STRING: {
             char *string = ANY_SEXP_GET_STRING(sexp);
             return any_sexp_string(string, strlen(string));
         }
 
+        case ANY_SEXP_TAG_FLOAT:
+            return any_sexp_float(ANY_SEXP_GET_FLOAT(sexp));
+
         default:
             return sexp;
     }
@@ -757,7 +2769,22 @@ void any_sexp_free(any_sexp_t sexp)
             ANY_SEXP_FREE(ANY_SEXP_GET_CONS(sexp));
             break;
 
+        case ANY_SEXP_TAG_OBJECT:
+            ANY_SEXP_FREE(ANY_SEXP_GET_OBJECT(sexp));
+            break;
+
+        case ANY_SEXP_TAG_FLOAT:
+#ifdef ANY_SEXP_FLOAT_BOXED
+            ANY_SEXP_FREE(&ANY_SEXP_GET_FLOAT(sexp));
+#endif
+            break;
+
+        // NOTE: Interned symbols are owned by the intern table
         case ANY_SEXP_TAG_SYMBOL:
+            if (any_sexp_symbol_interned(sexp))
+                break;
+            // fallthrough
+
         case ANY_SEXP_TAG_STRING:
             ANY_SEXP_FREE(ANY_SEXP_GET_SYMBOL(sexp));
             break;
@@ -0,0 +1,530 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+// NOTE: The allocator does not log s-expressions
+#define ANY_LOG_NO_GENERIC
+#include "any_log.h"
+
+// Size classes, the first is the one of the cons cells
+static const size_t arena_classes[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 2048,
+};
+
+#define ARENA_CLASSES (sizeof(arena_classes) / sizeof(arena_classes[0]))
+
+// Class of the pages with a single object
+#define ARENA_LARGE ARENA_CLASSES
+
+// NOTE: Enough bits for the objects of the smallest class
+#define ARENA_BITMAP_WORDS (ARENA_PAGE_SIZE / 16 / 64)
+
+typedef struct arena_page {
+    struct arena_page *prev;
+    struct arena_page *next;
+    arena_t *arena;
+    size_t class;
+    size_t size;
+
+    // Objects that fit in the page, that were handed out by the bump
+    // pointer and that are still allocated
+    size_t capacity;
+    size_t top;
+    size_t count;
+
+    uint64_t allocated[ARENA_BITMAP_WORDS];
+    uint64_t marked[ARENA_BITMAP_WORDS];
+} arena_page_t;
+
+// NOTE: Rounded up to keep the objects aligned to 16 bytes
+#define ARENA_HEADER_SIZE ((sizeof(arena_page_t) + 15) & ~(size_t)15)
+
+#define ARENA_PAGE(ptr) ((arena_page_t *)((uintptr_t)(ptr) & ~(uintptr_t)(ARENA_PAGE_SIZE - 1)))
+
+#define ARENA_BIT_GET(bitmap, i)   (((bitmap)[(i) / 64] >> ((i) % 64)) & 1)
+#define ARENA_BIT_SET(bitmap, i)   ((bitmap)[(i) / 64] |= (uint64_t)1 << ((i) % 64))
+#define ARENA_BIT_CLEAR(bitmap, i) ((bitmap)[(i) / 64] &= ~((uint64_t)1 << ((i) % 64)))
+
+typedef struct arena_free {
+    struct arena_free *next;
+} arena_free_t;
+
+struct arena {
+    arena_page_t *pages;
+    size_t allocated;
+
+    struct {
+        arena_free_t *free;
+        arena_page_t *page;
+    } classes[ARENA_CLASSES];
+
+    struct arena *prev;
+    struct arena *next;
+};
+
+static arena_t arena_default = { 0 };
+
+static arena_t *arena_current = &arena_default;
+
+// All the arenas, for the sweep
+static arena_t *arenas = &arena_default;
+
+// Bytes allocated in all the arenas
+static size_t arena_total = 0;
+
+// Page set
+//
+// Open addressing hash table of the pages of all the arenas, used to tell
+// whether an address points in the heap (see arena_find).
+
+static struct {
+    arena_page_t **pages;
+    size_t capacity;
+    size_t used;
+} arena_page_set;
+
+// Marks the slots of the removed pages, so that probing continues
+#define ARENA_PAGE_REMOVED ((arena_page_t *)1)
+
+static inline size_t arena_page_hash(arena_page_t *page)
+{
+    uint64_t key = (uintptr_t)page / ARENA_PAGE_SIZE;
+    return (key * 11400714819323198485llu) >> 32;
+}
+
+static size_t arena_page_slot(arena_page_t *page)
+{
+    size_t mask = arena_page_set.capacity - 1;
+    size_t i = arena_page_hash(page) & mask;
+
+    while (arena_page_set.pages[i] != NULL && arena_page_set.pages[i] != page)
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+static void arena_page_set_resize(size_t capacity)
+{
+    arena_page_t **pages = arena_page_set.pages;
+    size_t old_capacity = arena_page_set.capacity;
+
+    arena_page_set.pages = calloc(capacity, sizeof(arena_page_t *));
+    if (arena_page_set.pages == NULL)
+        log_panic("Failed to allocate the page set");
+
+    arena_page_set.capacity = capacity;
+    arena_page_set.used = 0;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (pages[i] == NULL || pages[i] == ARENA_PAGE_REMOVED)
+            continue;
+
+        arena_page_set.pages[arena_page_slot(pages[i])] = pages[i];
+        arena_page_set.used++;
+    }
+
+    free(pages);
+}
+
+static void arena_page_set_add(arena_page_t *page)
+{
+    // Keep the load factor (with the removed slots) below 1/2
+    if (2 * (arena_page_set.used + 1) > arena_page_set.capacity)
+        arena_page_set_resize(arena_page_set.capacity == 0 ? 256 : 2 * arena_page_set.capacity);
+
+    arena_page_set.pages[arena_page_slot(page)] = page;
+    arena_page_set.used++;
+}
+
+static void arena_page_set_remove(arena_page_t *page)
+{
+    size_t i = arena_page_slot(page);
+    if (arena_page_set.pages[i] == page)
+        arena_page_set.pages[i] = ARENA_PAGE_REMOVED;
+}
+
+static inline bool arena_page_set_contains(arena_page_t *page)
+{
+    return page != NULL
+        && arena_page_set.capacity != 0
+        && arena_page_set.pages[arena_page_slot(page)] == page;
+}
+
+// Large pages
+//
+// Array of the large pages sorted by address. A large page spans several
+// ARENA_PAGE_SIZE blocks and only the first one is in the page set, so the
+// pointers past it are found by searching the range that contains them.
+
+static struct {
+    arena_page_t **pages;
+    size_t length;
+    size_t capacity;
+} arena_large;
+
+// Index of the first large page after ptr
+static size_t arena_large_search(const void *ptr)
+{
+    size_t low = 0, high = arena_large.length;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if ((const char *)arena_large.pages[middle] <= (const char *)ptr)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+static void arena_large_add(arena_page_t *page)
+{
+    if (arena_large.length == arena_large.capacity) {
+        arena_large.capacity = arena_large.capacity == 0 ? 64 : 2 * arena_large.capacity;
+        arena_large.pages = realloc(arena_large.pages, arena_large.capacity * sizeof(arena_page_t *));
+        if (arena_large.pages == NULL)
+            log_panic("Failed to allocate the large pages");
+    }
+
+    size_t i = arena_large_search(page);
+    memmove(arena_large.pages + i + 1, arena_large.pages + i, (arena_large.length - i) * sizeof(arena_page_t *));
+    arena_large.pages[i] = page;
+    arena_large.length++;
+}
+
+static void arena_large_remove(arena_page_t *page)
+{
+    size_t i = arena_large_search(page);
+    if (i == 0 || arena_large.pages[i - 1] != page)
+        return;
+
+    memmove(arena_large.pages + i - 1, arena_large.pages + i, (arena_large.length - i) * sizeof(arena_page_t *));
+    arena_large.length--;
+}
+
+// Returns the large page whose range contains ptr, or NULL
+static arena_page_t *arena_large_find(const void *ptr)
+{
+    size_t i = arena_large_search(ptr);
+    if (i == 0)
+        return NULL;
+
+    arena_page_t *page = arena_large.pages[i - 1];
+    return (const char *)ptr < (const char *)page + page->size ? page : NULL;
+}
+
+// Pages
+
+static inline size_t arena_class(size_t size)
+{
+    // NOTE: Most of the allocations are cons cells
+    if (size <= arena_classes[0])
+        return 0;
+
+    size_t class = 1;
+    while (class < ARENA_CLASSES && arena_classes[class] < size)
+        class++;
+
+    return class;
+}
+
+static inline size_t arena_class_size(arena_page_t *page)
+{
+    return page->class == ARENA_LARGE
+         ? page->size - ARENA_HEADER_SIZE
+         : arena_classes[page->class];
+}
+
+static inline char *arena_page_objects(arena_page_t *page)
+{
+    return (char *)page + ARENA_HEADER_SIZE;
+}
+
+static inline size_t arena_page_index(arena_page_t *page, const void *ptr)
+{
+    size_t offset = (const char *)ptr - arena_page_objects(page);
+
+    switch (page->class) {
+        case 0:
+            return offset / 16;
+
+        case ARENA_LARGE:
+            return 0;
+
+        default:
+            return offset / arena_classes[page->class];
+    }
+}
+
+static arena_page_t *arena_page_new(arena_t *arena, size_t class, size_t size)
+{
+    arena_page_t *page = aligned_alloc(ARENA_PAGE_SIZE, size);
+    if (page == NULL)
+        log_panic("Failed to allocate an arena page");
+
+    memset(page, 0, ARENA_HEADER_SIZE);
+
+    page->next = arena->pages;
+    page->arena = arena;
+    page->class = class;
+    page->size = size;
+    page->capacity = class == ARENA_LARGE ? 1 : (ARENA_PAGE_SIZE - ARENA_HEADER_SIZE) / arena_classes[class];
+
+    if (arena->pages != NULL)
+        arena->pages->prev = page;
+
+    arena->pages = page;
+    arena_page_set_add(page);
+
+    if (class == ARENA_LARGE)
+        arena_large_add(page);
+
+    return page;
+}
+
+static void arena_page_free(arena_page_t *page)
+{
+    arena_t *arena = page->arena;
+
+    if (page->prev != NULL)
+        page->prev->next = page->next;
+    else
+        arena->pages = page->next;
+
+    if (page->next != NULL)
+        page->next->prev = page->prev;
+
+    arena_page_set_remove(page);
+
+    if (page->class == ARENA_LARGE)
+        arena_large_remove(page);
+
+    free(page);
+}
+
+static void *arena_malloc_large(arena_t *arena, size_t size)
+{
+    // NOTE: aligned_alloc wants a multiple of the alignment
+    size_t total = (ARENA_HEADER_SIZE + size + ARENA_PAGE_SIZE - 1) & ~(size_t)(ARENA_PAGE_SIZE - 1);
+
+    arena_page_t *page = arena_page_new(arena, ARENA_LARGE, total);
+    page->top = page->count = 1;
+    ARENA_BIT_SET(page->allocated, 0);
+
+    arena->allocated += arena_class_size(page);
+    arena_total += arena_class_size(page);
+    return arena_page_objects(page);
+}
+
+void *arena_malloc(size_t size)
+{
+    arena_t *arena = arena_current;
+    size_t class = arena_class(size);
+
+    if (class == ARENA_LARGE)
+        return arena_malloc_large(arena, size);
+
+    arena->allocated += arena_classes[class];
+    arena_total += arena_classes[class];
+
+    void *ptr = arena->classes[class].free;
+    if (ptr != NULL)
+        arena->classes[class].free = arena->classes[class].free->next;
+    else {
+        arena_page_t *page = arena->classes[class].page;
+        if (page == NULL || page->top == page->capacity) {
+            page = arena_page_new(arena, class, ARENA_PAGE_SIZE);
+            arena->classes[class].page = page;
+        }
+
+        ptr = arena_page_objects(page) + page->top++ * arena_classes[class];
+    }
+
+    arena_page_t *page = ARENA_PAGE(ptr);
+    ARENA_BIT_SET(page->allocated, arena_page_index(page, ptr));
+    page->count++;
+    return ptr;
+}
+
+void arena_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    arena_page_t *page = ARENA_PAGE(ptr);
+    arena_t *arena = page->arena;
+
+    arena->allocated -= arena_class_size(page);
+    arena_total -= arena_class_size(page);
+
+    if (page->class == ARENA_LARGE) {
+        arena_page_free(page);
+        return;
+    }
+
+    ARENA_BIT_CLEAR(page->allocated, arena_page_index(page, ptr));
+    page->count--;
+
+    arena_free_t *cell = ptr;
+    cell->next = arena->classes[page->class].free;
+    arena->classes[page->class].free = cell;
+}
+
+arena_t *arena_create()
+{
+    arena_t *arena = calloc(1, sizeof(arena_t));
+    if (arena == NULL)
+        log_panic("Failed to allocate an arena");
+
+    arena->next = arenas;
+    arenas->prev = arena;
+    arenas = arena;
+    return arena;
+}
+
+arena_t *arena_select(arena_t *arena)
+{
+    arena_t *previous = arena_current;
+    arena_current = arena == NULL ? &arena_default : arena;
+    return previous;
+}
+
+void arena_release(arena_t *arena)
+{
+    while (arena->pages != NULL)
+        arena_page_free(arena->pages);
+
+    arena_total -= arena->allocated;
+    arena->allocated = 0;
+    memset(arena->classes, 0, sizeof(arena->classes));
+}
+
+void arena_destroy(arena_t *arena)
+{
+    if (arena_current == arena)
+        arena_current = &arena_default;
+
+    arena_release(arena);
+    if (arena == &arena_default)
+        return;
+
+    if (arena->prev != NULL)
+        arena->prev->next = arena->next;
+    else
+        arenas = arena->next;
+
+    if (arena->next != NULL)
+        arena->next->prev = arena->prev;
+
+    free(arena);
+}
+
+size_t arena_allocated(arena_t *arena)
+{
+    return arena == NULL ? arena_total : arena->allocated;
+}
+
+// Tracing
+
+void *arena_find(const void *ptr)
+{
+    arena_page_t *page = ARENA_PAGE(ptr);
+
+    // NOTE: The pointers past the first block of a large page are looked up
+    // by range, the others miss both
+    if (!arena_page_set_contains(page) && (page = arena_large_find(ptr)) == NULL)
+        return NULL;
+
+    char *objects = arena_page_objects(page);
+    if ((const char *)ptr < objects)
+        return NULL;
+
+    size_t i = arena_page_index(page, ptr);
+    if (i >= page->top || !ARENA_BIT_GET(page->allocated, i))
+        return NULL;
+
+    return objects + i * (page->class == ARENA_LARGE ? 0 : arena_classes[page->class]);
+}
+
+bool arena_mark(void *object)
+{
+    arena_page_t *page = ARENA_PAGE(object);
+    size_t i = arena_page_index(page, object);
+
+    if (ARENA_BIT_GET(page->marked, i))
+        return false;
+
+    ARENA_BIT_SET(page->marked, i);
+    return true;
+}
+
+bool arena_is_marked(void *object)
+{
+    arena_page_t *page = ARENA_PAGE(object);
+    return ARENA_BIT_GET(page->marked, arena_page_index(page, object));
+}
+
+size_t arena_object_size(void *object)
+{
+    return arena_class_size(ARENA_PAGE(object));
+}
+
+// Frees the objects not marked, rebuilding the free lists of the arena and
+// releasing the pages left empty
+static size_t arena_sweep_arena(arena_t *arena)
+{
+    size_t freed = 0;
+
+    for (size_t class = 0; class < ARENA_CLASSES; class++)
+        arena->classes[class].free = NULL;
+
+    arena_page_t *page = arena->pages;
+    while (page != NULL) {
+        arena_page_t *next = page->next;
+        size_t size = arena_class_size(page);
+
+        for (size_t w = 0; w < ARENA_BITMAP_WORDS; w++) {
+            size_t dead = __builtin_popcountll(page->allocated[w] & ~page->marked[w]);
+
+            page->allocated[w] &= page->marked[w];
+            page->marked[w] = 0;
+            page->count -= dead;
+            freed += dead * size;
+        }
+
+        bool current = page->class != ARENA_LARGE && arena->classes[page->class].page == page;
+
+        if (page->count == 0 && !current)
+            arena_page_free(page);
+        else if (page->class != ARENA_LARGE) {
+            char *objects = arena_page_objects(page);
+
+            for (size_t i = 0; i < page->top; i++) {
+                if (ARENA_BIT_GET(page->allocated, i))
+                    continue;
+
+                arena_free_t *cell = (arena_free_t *)(objects + i * size);
+                cell->next = arena->classes[page->class].free;
+                arena->classes[page->class].free = cell;
+            }
+        }
+
+        page = next;
+    }
+
+    arena->allocated -= freed;
+    return freed;
+}
+
+size_t arena_sweep()
+{
+    size_t freed = 0;
+    for (arena_t *arena = arenas; arena != NULL; arena = arena->next)
+        freed += arena_sweep_arena(arena);
+
+    arena_total -= freed;
+    return freed;
+}
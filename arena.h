@@ -0,0 +1,61 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Arena allocator
+//
+// Allocator for the s-expressions, wired in any_sexp with ANY_SEXP_MALLOC and
+// ANY_SEXP_FREE (see eval.c). The small objects are grouped in size classes,
+// and each class takes its objects from pages of ARENA_PAGE_SIZE bytes with
+// a bump pointer, reusing the freed ones first. The bigger objects get a
+// page of their own.
+//
+// The pages are aligned to their size and start with a header, so the class
+// of an object is found from its address, without a header per object. The
+// header also keeps the bitmaps of the allocated and marked objects, which
+// are used by the garbage collector (see gc.h).
+//
+// Every page belongs to an arena, which can be released at once when none of
+// its objects are referenced anymore.
+
+#define ARENA_PAGE_SIZE (64 * 1024)
+
+typedef struct arena arena_t;
+
+// Allocates from the current arena
+void *arena_malloc(size_t size);
+
+void arena_free(void *ptr);
+
+arena_t *arena_create();
+
+// Changes the arena used for the allocations, returns the previous one
+arena_t *arena_select(arena_t *arena);
+
+// Frees all the pages of the arena, which can be used again
+void arena_release(arena_t *arena);
+
+// Frees the arena itself
+void arena_destroy(arena_t *arena);
+
+// Bytes used by the objects of the arena, or of all the arenas if NULL
+size_t arena_allocated(arena_t *arena);
+
+// Returns the start of the allocated object containing ptr, or NULL if ptr
+// does not point in the heap
+void *arena_find(const void *ptr);
+
+// Returns true if the object was not marked
+bool arena_mark(void *object);
+
+bool arena_is_marked(void *object);
+
+size_t arena_object_size(void *object);
+
+// Frees the objects not marked in all the arenas and clears the marks,
+// returns the number of bytes freed
+size_t arena_sweep();
+
+#endif
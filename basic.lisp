@@ -6,8 +6,9 @@
      (lambda (g)
        (f (lambda (&rest) (apply (g g) &rest)))))))
 
+; NOTE: letrec is native, so rec is called directly instead of through Y
 (defmacro lambdarec (rec args body)
-  (list 'Y (list 'lambda (list rec) (list 'lambda args body))))
+  (list 'letrec (list (list rec (list 'lambda args body))) rec))
 
 ;; Tagging
 
@@ -21,6 +22,8 @@
 
 (define symbol-tag (tag? 'x))
 
+(define float-tag (tag? 0.5))
+
 (defmacro nil? (x)
     (list '= (list 'tag? x) 'nil-tag))
 
@@ -36,6 +39,9 @@
 (defmacro number? (x)
     (list '= (list 'tag? x) 'number-tag))
 
+(defmacro float? (x)
+    (list '= (list 'tag? x) 'float-tag))
+
 ;; Booleans
 
 (define nil '())
@@ -59,7 +65,7 @@
   (list 'if a '() (list* 'begin &rest)))
 
 (define cond-list
-  (lambdarec f (l)
+  (lambda (l)
     (if (nil? l)
       '()
       (let ((b (car (car l)))
@@ -67,7 +73,7 @@
           (list 'if
                 (if (and (symbol? b) (= b 'else)) t b)
                 v
-                (f (cdr l)))))))
+                (cond-list (cdr l)))))))
 
 ; (cond
 ;   (b v)
@@ -92,14 +98,5 @@
       ((symbol? x) (print "symbol-tag"))
       ((string? x) (print "string-tag"))
       ((number? x) (print "number-tag"))
+      ((float? x) (print "float-tag"))
       (else (error "Impossible")))))
-
-(define equal?
-  (lambdarec f (a b)
-    (cond
-      ((not (= (tag? a) (tag? b))) nil)
-      ((cons? a)
-       (and
-         (f (car a) (car b))
-         (f (cdr a) (cdr b))))
-      (else (= a b)))))
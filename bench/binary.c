@@ -0,0 +1,352 @@
+// Throughput of the binary format
+//
+// Reads the s-expressions of a file (or of generated data if none is given),
+// then writes them as text and dumps them in the binary format, and reports
+// the MB/s of the writer, of the dumper, of the reader and of the loader
+// (relative to the size of the text). The loaded s-expressions are checked
+// to be the same as the ones read, and so are a list and a quote nested a
+// million times.
+//
+//    make bench && ./bench/binary [file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ANY_SEXP_IMPLEMENT
+#include "../any_sexp.h"
+
+#define BENCH_RUNS 5
+#define BENCH_DEPTH (1024 * 1024)
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *bench_generate(size_t *length)
+{
+    size_t capacity = 64 * 1024 * 1024;
+    char *source = malloc(capacity);
+    if (source == NULL)
+        return NULL;
+
+    size_t used = 0;
+    for (int i = 0; used + 256 < capacity; i++) {
+        used += snprintf(source + used, capacity - used,
+                         "(define (item-%d x)\n"
+                         "  (list 'alpha \"some string %d\" %d -%d (nested (list of symbols)) x))\n",
+                         i, i, i * 7919, i);
+    }
+
+    *length = used;
+    return source;
+}
+
+static char *bench_load(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(*length);
+    if (source != NULL && fread(source, 1, *length, file) != *length) {
+        free(source);
+        source = NULL;
+    }
+
+    fclose(file);
+    return source;
+}
+
+// Returns the contents of a temporary file
+static char *bench_contents(FILE *file, size_t *length)
+{
+    *length = ftell(file);
+    rewind(file);
+
+    char *contents = malloc(*length);
+    if (contents != NULL && fread(contents, 1, *length, file) != *length) {
+        free(contents);
+        contents = NULL;
+    }
+
+    fclose(file);
+    return contents;
+}
+
+static bool bench_equal_atoms(any_sexp_t a, any_sexp_t b)
+{
+    if (ANY_SEXP_GET_TAG(a) != ANY_SEXP_GET_TAG(b))
+        return false;
+
+    switch (ANY_SEXP_GET_TAG(a)) {
+        case ANY_SEXP_TAG_NIL:
+            return true;
+
+        case ANY_SEXP_TAG_NUMBER:
+            return ANY_SEXP_GET_NUMBER(a) == ANY_SEXP_GET_NUMBER(b);
+
+        case ANY_SEXP_TAG_SYMBOL:
+        case ANY_SEXP_TAG_STRING:
+            return !strcmp(ANY_SEXP_GET_SYMBOL(a), ANY_SEXP_GET_SYMBOL(b));
+
+        default:
+            return false;
+    }
+}
+
+// NOTE: The cars wait on a stack, so the nesting is not limited by the C
+//       stack
+static bool bench_equal(any_sexp_t a, any_sexp_t b)
+{
+    any_sexp_t *stack = NULL;
+    size_t length = 0, capacity = 0;
+    bool equal = true;
+
+    while (equal) {
+        if (ANY_SEXP_IS_CONS(a) && ANY_SEXP_IS_CONS(b)) {
+            if (length + 2 > capacity) {
+                capacity = capacity == 0 ? 1024 : 2 * capacity;
+                stack = realloc(stack, capacity * sizeof(any_sexp_t));
+                if (stack == NULL)
+                    return false;
+            }
+
+            stack[length++] = ANY_SEXP_GET_CAR(a);
+            stack[length++] = ANY_SEXP_GET_CAR(b);
+            a = ANY_SEXP_GET_CDR(a);
+            b = ANY_SEXP_GET_CDR(b);
+            continue;
+        }
+
+        equal = bench_equal_atoms(a, b);
+        if (length == 0)
+            break;
+
+        b = stack[--length];
+        a = stack[--length];
+    }
+
+    free(stack);
+    return equal;
+}
+
+// Checks that a list and a quote nested BENCH_DEPTH times are loaded the same
+// as they are read, since the reader, the dumper and the loader do not
+// recurse on the car
+static bool bench_deep()
+{
+    char *source = malloc(3 * BENCH_DEPTH + 8);
+    if (source == NULL)
+        return false;
+
+    size_t length = 0;
+    memset(source + length, '(', BENCH_DEPTH);
+    length += BENCH_DEPTH;
+    source[length++] = 'x';
+    memset(source + length, ')', BENCH_DEPTH);
+    length += BENCH_DEPTH;
+    source[length++] = ' ';
+    memset(source + length, '\'', BENCH_DEPTH);
+    length += BENCH_DEPTH;
+    source[length++] = 'y';
+
+    any_sexp_reader_t reader;
+    any_sexp_reader_buffer_init(&reader, source, length);
+    any_sexp_t sexps[2] = { any_sexp_read(&reader), any_sexp_read(&reader) };
+
+    FILE *file = tmpfile();
+    any_sexp_writer_t writer;
+    any_sexp_dumper_t dumper;
+    any_sexp_writer_file_init(&writer, file, ANY_SEXP_WRITER_DEFAULT);
+
+    bool equal = any_sexp_dumper_init(&dumper, &writer) != EOF &&
+                 any_sexp_dump(&dumper, sexps[0]) != EOF &&
+                 any_sexp_dump(&dumper, sexps[1]) != EOF &&
+                 any_sexp_writer_flush(&writer) != EOF;
+
+    any_sexp_dumper_free(&dumper);
+    free(source);
+
+    size_t binary_length;
+    char *binary = bench_contents(file, &binary_length);
+    any_sexp_loader_t loader;
+
+    if (equal && binary != NULL && any_sexp_loader_init(&loader, binary, binary_length)) {
+        for (int i = 0; i < 2 && equal; i++)
+            equal = bench_equal(sexps[i], any_sexp_load(&loader));
+
+        equal = equal && any_sexp_loader_end(&loader);
+        any_sexp_loader_close(&loader);
+    } else
+        equal = false;
+
+    free(binary);
+    return equal;
+}
+
+static double bench_rate(size_t length, double start)
+{
+    return length / (bench_now() - start) / (1024 * 1024);
+}
+
+static void bench_free(any_sexp_t *sexps, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        any_sexp_free_list(sexps[i]);
+}
+
+int main(int argc, char **argv)
+{
+    size_t length;
+    char *source = argc > 1 ? bench_load(argv[1], &length) : bench_generate(&length);
+    if (source == NULL) {
+        fprintf(stderr, "Failed to load the input\n");
+        return 1;
+    }
+
+    if (!bench_deep()) {
+        fprintf(stderr, "The nested expressions differ after loading\n");
+        return 1;
+    }
+
+    size_t count = 0, capacity = 1024;
+    any_sexp_t *sexps = malloc(capacity * sizeof(any_sexp_t));
+    any_sexp_t *loaded = NULL;
+    double read = 0, write = 0, dump = 0, load = 0;
+    size_t text_length = 0, binary_length = 0;
+    char *binary = NULL;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        any_sexp_reader_t reader;
+        any_sexp_reader_buffer_init(&reader, source, length);
+
+        double start = bench_now();
+        for (count = 0; true; count++) {
+            any_sexp_t sexp = any_sexp_read(&reader);
+            if (ANY_SEXP_IS_ERROR(sexp))
+                break;
+
+            if (count == capacity)
+                sexps = realloc(sexps, (capacity *= 2) * sizeof(any_sexp_t));
+            sexps[count] = sexp;
+        }
+
+        double rate = bench_rate(length, start);
+        if (rate > read)
+            read = rate;
+
+        if (run < BENCH_RUNS - 1)
+            bench_free(sexps, count);
+    }
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        FILE *file = tmpfile();
+        any_sexp_writer_t writer;
+        any_sexp_writer_file_init(&writer, file, ANY_SEXP_WRITER_DEFAULT);
+
+        double start = bench_now();
+        for (size_t i = 0; i < count; i++) {
+            any_sexp_write(&writer, sexps[i]);
+            any_sexp_writer_putc(&writer, '\n');
+        }
+        any_sexp_writer_flush(&writer);
+
+        double rate = bench_rate(length, start);
+        if (rate > write)
+            write = rate;
+
+        text_length = ftell(file);
+        fclose(file);
+    }
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        FILE *file = tmpfile();
+        any_sexp_writer_t writer;
+        any_sexp_dumper_t dumper;
+        any_sexp_writer_file_init(&writer, file, ANY_SEXP_WRITER_DEFAULT);
+
+        double start = bench_now();
+        any_sexp_dumper_init(&dumper, &writer);
+        for (size_t i = 0; i < count; i++) {
+            if (any_sexp_dump(&dumper, sexps[i]) == EOF) {
+                fprintf(stderr, "Failed to dump expression %zu\n", i);
+                return 1;
+            }
+        }
+        any_sexp_writer_flush(&writer);
+
+        double rate = bench_rate(length, start);
+        if (rate > dump)
+            dump = rate;
+
+        any_sexp_dumper_free(&dumper);
+        free(binary);
+        binary = bench_contents(file, &binary_length);
+    }
+
+    loaded = malloc(count * sizeof(any_sexp_t) + 1);
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        any_sexp_loader_t loader;
+        size_t i = 0;
+
+        double start = bench_now();
+        if (!any_sexp_loader_init(&loader, binary, binary_length)) {
+            fprintf(stderr, "Invalid header\n");
+            return 1;
+        }
+
+        for (; !any_sexp_loader_end(&loader); i++) {
+            loaded[i] = any_sexp_load(&loader);
+            if (ANY_SEXP_IS_ERROR(loaded[i]) || i == count) {
+                fprintf(stderr, "Failed to load expression %zu\n", i);
+                return 1;
+            }
+        }
+
+        double rate = bench_rate(length, start);
+        if (rate > load)
+            load = rate;
+
+        any_sexp_loader_close(&loader);
+
+        if (i != count) {
+            fprintf(stderr, "Loaded %zu expressions of %zu\n", i, count);
+            return 1;
+        }
+
+        if (run < BENCH_RUNS - 1)
+            bench_free(loaded, count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!bench_equal(sexps[i], loaded[i])) {
+            fprintf(stderr, "Expression %zu differs after loading\n", i);
+            return 1;
+        }
+    }
+
+    printf("input: %.1f MB, text: %.1f MB, binary: %.1f MB (%zu expressions)\n",
+           length / (1024.0 * 1024), text_length / (1024.0 * 1024),
+           binary_length / (1024.0 * 1024), count);
+    printf("read:  %8.1f MB/s\n", read);
+    printf("write: %8.1f MB/s\n", write);
+    printf("load:  %8.1f MB/s\n", load);
+    printf("dump:  %8.1f MB/s\n", dump);
+
+    bench_free(sexps, count);
+    bench_free(loaded, count);
+    free(sexps);
+    free(loaded);
+    free(binary);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,204 @@
+// Cost of the representations of the values
+//
+// Builds a list of numbers and walks it, dispatches on the tags of a vector
+// of mixed values, and adds tagged numbers, then reports the nanoseconds of
+// each operation. The program is built once for each representation:
+//
+//    make bench && for l in high low nan struct; do ./bench/layout-$l; done
+//
+// bench/layout-high is the default, with the tag in the highest bits,
+// bench/layout-low is built with ANY_SEXP_LOW_TAGGING, bench/layout-nan with
+// ANY_SEXP_NAN_BOXING and bench/layout-struct with ANY_SEXP_NO_BOXING.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ANY_SEXP_IMPLEMENT
+#include "../any_sexp.h"
+
+#define BENCH_RUNS   5
+#define BENCH_LENGTH (1024 * 1024)
+#define BENCH_WALKS  32
+
+#if defined(ANY_SEXP_NO_BOXING)
+#define BENCH_LAYOUT "struct"
+#elif defined(ANY_SEXP_NAN_BOXING)
+#define BENCH_LAYOUT "nan"
+#elif defined(ANY_SEXP_LOW_TAGGING)
+#define BENCH_LAYOUT "low"
+#else
+#define BENCH_LAYOUT "high"
+#endif
+
+// Keeps the results, so the loops are not optimized away
+static volatile intptr_t bench_sink;
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Nanoseconds for each of count operations
+static double bench_ns(size_t count, double start)
+{
+    return (bench_now() - start) * 1e9 / count;
+}
+
+static void bench_min(double *best, double ns)
+{
+    if (*best == 0 || ns < *best)
+        *best = ns;
+}
+
+static any_sexp_t bench_list(size_t length)
+{
+    any_sexp_t list = ANY_SEXP_NIL;
+    for (size_t i = 0; i < length; i++) {
+        list = any_sexp_cons(any_sexp_number(i), list);
+        if (ANY_SEXP_IS_ERROR(list))
+            return ANY_SEXP_ERROR;
+    }
+
+    return list;
+}
+
+// NOTE: any_sexp_free_list recurses on the cdr, too deep for the list
+static void bench_free_list(any_sexp_t list)
+{
+    while (ANY_SEXP_IS_CONS(list)) {
+        any_sexp_t cdr = ANY_SEXP_GET_CDR(list);
+        any_sexp_free(list);
+        list = cdr;
+    }
+}
+
+static intptr_t bench_walk(any_sexp_t list)
+{
+    intptr_t sum = 0;
+    for (; ANY_SEXP_IS_CONS(list); list = ANY_SEXP_GET_CDR(list)) {
+        any_sexp_t car = ANY_SEXP_GET_CAR(list);
+        if (ANY_SEXP_IS_NUMBER(car))
+            sum += ANY_SEXP_GET_NUMBER(car);
+    }
+
+    return sum;
+}
+
+static intptr_t bench_dispatch(const any_sexp_t *values, size_t count)
+{
+    intptr_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        switch (ANY_SEXP_GET_TAG(values[i])) {
+            case ANY_SEXP_TAG_NIL:
+                sum += 1;
+                break;
+
+            case ANY_SEXP_TAG_CONS:
+                sum += ANY_SEXP_IS_NIL(ANY_SEXP_GET_CDR(values[i]));
+                break;
+
+            case ANY_SEXP_TAG_SYMBOL:
+            case ANY_SEXP_TAG_STRING:
+                sum += ANY_SEXP_GET_SYMBOL(values[i])[0];
+                break;
+
+            case ANY_SEXP_TAG_NUMBER:
+                sum += ANY_SEXP_GET_NUMBER(values[i]);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return sum;
+}
+
+// NOTE: The step is signed and the sum stays below 2^32 without a mask, so the
+// compiler cannot prove the sign of the numbers and skip the sign handling of
+// a layout when it untags them, and it is read again each time, so the loop
+// is not folded into a multiplication
+static any_sexp_t bench_add(any_sexp_t a, volatile any_sexp_t b, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        a = any_sexp_number(ANY_SEXP_GET_NUMBER(a) + ANY_SEXP_GET_NUMBER(b));
+
+    return a;
+}
+
+int main()
+{
+    const char *names[] = { "alpha", "beta", "gamma", "delta" };
+    double cons = 0, walk = 0, dispatch = 0, add = 0;
+
+    any_sexp_t *values = malloc(BENCH_LENGTH * sizeof(any_sexp_t));
+    if (values == NULL) {
+        fprintf(stderr, "Failed to allocate the values\n");
+        return 1;
+    }
+
+    // NOTE: The kinds are shuffled, so the branches are not predicted
+    srand(42);
+    for (size_t i = 0; i < BENCH_LENGTH; i++) {
+        const char *name = names[rand() % 4];
+
+        switch (rand() % 5) {
+            case 0:  values[i] = ANY_SEXP_NIL; break;
+            case 1:  values[i] = any_sexp_cons(ANY_SEXP_NIL, ANY_SEXP_NIL); break;
+            case 2:  values[i] = any_sexp_symbol(name, strlen(name)); break;
+            case 3:  values[i] = any_sexp_string(name, strlen(name)); break;
+            default: values[i] = any_sexp_number(rand()); break;
+        }
+
+        if (ANY_SEXP_IS_ERROR(values[i])) {
+            fprintf(stderr, "Failed to allocate value %zu\n", i);
+            return 1;
+        }
+    }
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now();
+        any_sexp_t list = bench_list(BENCH_LENGTH);
+        if (ANY_SEXP_IS_ERROR(list)) {
+            fprintf(stderr, "Failed to build the list\n");
+            return 1;
+        }
+        bench_min(&cons, bench_ns(BENCH_LENGTH, start));
+
+        start = bench_now();
+        for (int i = 0; i < BENCH_WALKS; i++)
+            bench_sink += bench_walk(list);
+        bench_min(&walk, bench_ns((size_t)BENCH_LENGTH * BENCH_WALKS, start));
+
+        start = bench_now();
+        for (int i = 0; i < BENCH_WALKS; i++)
+            bench_sink += bench_dispatch(values, BENCH_LENGTH);
+        bench_min(&dispatch, bench_ns((size_t)BENCH_LENGTH * BENCH_WALKS, start));
+
+        start = bench_now();
+        any_sexp_t sum = bench_add(any_sexp_number(run), any_sexp_number((bench_sink & 0xff) - 0x80), (size_t)BENCH_LENGTH * BENCH_WALKS);
+        bench_sink += ANY_SEXP_GET_NUMBER(sum);
+        bench_min(&add, bench_ns((size_t)BENCH_LENGTH * BENCH_WALKS, start));
+
+        bench_free_list(list);
+    }
+
+    printf("layout: %s (%zu bytes, numbers of %d bits)\n",
+           BENCH_LAYOUT, sizeof(any_sexp_t), 64 - __builtin_clzll((unsigned long long)ANY_SEXP_NUMBER_MAX) + 1);
+    printf("cons:     %6.2f ns\n", cons);
+    printf("walk:     %6.2f ns\n", walk);
+    printf("dispatch: %6.2f ns\n", dispatch);
+    printf("add:      %6.2f ns\n", add);
+
+    for (size_t i = 0; i < BENCH_LENGTH; i++) {
+        if (ANY_SEXP_IS_CONS(values[i]) || ANY_SEXP_IS_STRING(values[i]))
+            any_sexp_free(values[i]);
+    }
+
+    free(values);
+    return 0;
+}
@@ -0,0 +1,198 @@
+// Throughput of the reader
+//
+// Reads the s-expressions of a file (or of generated data if none is given)
+// with the callback reader, one character at a time as before, and in place
+// with the buffer reader, and reports the MB/s of both. The throughput of
+// the scanner alone, without building the s-expressions, is reported too.
+//
+//    make bench && ./bench/read [file]
+//
+// bench/read-scalar is built with ANY_SEXP_NO_SIMD, for comparison.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ANY_SEXP_IMPLEMENT
+#include "../any_sexp.h"
+
+#define BENCH_RUNS 5
+
+typedef struct {
+    const char *source;
+    size_t length;
+    size_t cursor;
+} bench_stream_t;
+
+static int bench_getc(bench_stream_t *stream)
+{
+    return stream->cursor < stream->length
+         ? stream->source[stream->cursor++]
+         : EOF;
+}
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *bench_generate(size_t *length)
+{
+    size_t capacity = 64 * 1024 * 1024;
+    char *source = malloc(capacity);
+    if (source == NULL)
+        return NULL;
+
+    size_t used = 0;
+    for (int i = 0; used + 256 < capacity; i++) {
+        used += snprintf(source + used, capacity - used,
+                         "(define (item-%d x) ; comment\n"
+                         "  (list 'alpha \"some string %d\" %d -%d (nested (list of symbols)) x))\n",
+                         i, i, i * 7919, i);
+    }
+
+    *length = used;
+    return source;
+}
+
+static char *bench_load(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(*length);
+    if (source != NULL && fread(source, 1, *length, file) != *length) {
+        free(source);
+        source = NULL;
+    }
+
+    fclose(file);
+    return source;
+}
+
+static size_t bench_read_all(any_sexp_reader_t *reader)
+{
+    size_t count = 0;
+
+    while (true) {
+        any_sexp_t sexp = any_sexp_read(reader);
+        if (ANY_SEXP_IS_ERROR(sexp))
+            break;
+
+        any_sexp_free_list(sexp);
+        count++;
+    }
+
+    return count;
+}
+
+// Splits the input in tokens as any_sexp_read does, parsing the numbers
+static size_t bench_scan_all(const char *p, const char *end)
+{
+    size_t count = 0;
+    intptr_t sum = 0;
+
+    while (p < end) {
+        if (any_sexp_isspace(*p)) {
+            p = any_sexp_scan_spaces(p, end);
+        } else if (*p == ANY_SEXP_CHAR_COMMENT) {
+            const char *newline = memchr(p, '\n', end - p);
+            p = newline != NULL ? newline : end;
+        } else if (*p == ANY_SEXP_CHAR_STRING) {
+            const char *quote = memchr(p + 1, ANY_SEXP_CHAR_STRING, end - p - 1);
+            p = quote != NULL ? quote + 1 : end;
+            count++;
+        } else if (any_sexp_issym(*p)) {
+            bool digits = true;
+            const char *start = p;
+
+            p = any_sexp_scan_symbol(*p == '-' ? p + 1 : p, end, &digits);
+            if (digits && p - start > (*start == '-'))
+                sum += ANY_SEXP_GET_NUMBER(any_sexp_reader_number(start, p - start));
+
+            count++;
+        } else
+            p++;
+    }
+
+    // NOTE: So that the parsing is not optimized away
+    return count + (sum & 1);
+}
+
+static double bench_scan(const char *source, size_t length, size_t *count)
+{
+    double best = 0;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now();
+        *count = bench_scan_all(source, source + length);
+
+        double rate = length / (bench_now() - start) / (1024 * 1024);
+        if (rate > best)
+            best = rate;
+    }
+
+    return best;
+}
+
+static double bench_run(const char *source, size_t length, bool in_place, size_t *count)
+{
+    double best = 0;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        any_sexp_reader_t reader;
+        bench_stream_t stream = { source, length, 0 };
+
+        double start = bench_now();
+
+        if (in_place)
+            any_sexp_reader_buffer_init(&reader, source, length);
+        else
+            any_sexp_reader_init(&reader, (any_sexp_getchar_t)bench_getc, &stream);
+
+        *count = bench_read_all(&reader);
+
+        double rate = length / (bench_now() - start) / (1024 * 1024);
+        if (rate > best)
+            best = rate;
+    }
+
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    size_t length;
+    char *source = argc > 1 ? bench_load(argv[1], &length) : bench_generate(&length);
+    if (source == NULL) {
+        fprintf(stderr, "Failed to load the input\n");
+        return 1;
+    }
+
+#if defined(ANY_SEXP_READER_SSE2)
+    const char *scanner = "sse2";
+#else
+    const char *scanner = "scalar";
+#endif
+
+    size_t expressions, tokens;
+    double callback = bench_run(source, length, false, &expressions);
+    double in_place = bench_run(source, length, true, &expressions);
+    double scan = bench_scan(source, length, &tokens);
+
+    printf("input: %.1f MB, scanner: %s\n", length / (1024.0 * 1024), scanner);
+    printf("callback: %8.1f MB/s\n", callback);
+    printf("in place: %8.1f MB/s (%zu expressions)\n", in_place, expressions);
+    printf("scanner:  %8.1f MB/s (%zu tokens)\n", scan, tokens);
+
+    free(source);
+    return 0;
+}
@@ -0,0 +1,501 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bignum.h"
+#include "any_log.h"
+
+#define BIGNUM_BASE ((uint64_t)1 << 32)
+
+// The decimal digits are converted 9 at a time, the most that fit in a limb
+#define BIGNUM_DECIMAL_BASE   1000000000
+#define BIGNUM_DECIMAL_DIGITS 9
+
+// Integer unpacked from a number or a bignum, the magnitude has no leading
+// zeros, so zero has no limbs
+typedef struct {
+    uint32_t *limbs;
+    size_t length;
+    bool negative;
+} bignum_t;
+
+static uint32_t *bignum_alloc(size_t length)
+{
+    uint32_t *limbs = malloc((length > 0 ? length : 1) * sizeof(uint32_t));
+    if (limbs == NULL)
+        log_panic("Failed to allocate a bignum");
+
+    return limbs;
+}
+
+static bignum_t bignum_unpack(any_sexp_t sexp)
+{
+    bignum_t n;
+
+    if (ANY_SEXP_IS_NUMBER(sexp)) {
+        intptr_t value = ANY_SEXP_GET_NUMBER(sexp);
+        uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+        n.negative = value < 0;
+        n.limbs = bignum_alloc(sizeof(uint64_t) / sizeof(uint32_t));
+        n.length = 0;
+
+        for (; magnitude != 0; magnitude >>= 32)
+            n.limbs[n.length++] = (uint32_t)magnitude;
+
+        return n;
+    }
+
+    any_sexp_object_t *object = ANY_SEXP_GET_OBJECT(sexp);
+
+    n.negative = ANY_SEXP_GET_NUMBER(object->values[0]) < 0;
+    n.length = object->length - 1;
+    n.limbs = bignum_alloc(n.length);
+
+    for (size_t i = 0; i < n.length; i++)
+        n.limbs[i] = (uint32_t)ANY_SEXP_GET_NUMBER(object->values[i + 1]);
+
+    return n;
+}
+
+// Returns a number if the integer fits, or else a bignum, and frees the limbs
+static any_sexp_t bignum_pack(bignum_t n)
+{
+    while (n.length > 0 && n.limbs[n.length - 1] == 0)
+        n.length--;
+
+    if (n.length <= sizeof(uint64_t) / sizeof(uint32_t)) {
+        uint64_t magnitude = 0;
+        for (size_t i = n.length; i-- > 0;)
+            magnitude = magnitude << 32 | n.limbs[i];
+
+        uint64_t limit = n.negative ? (uint64_t)ANY_SEXP_NUMBER_MAX + 1 : (uint64_t)ANY_SEXP_NUMBER_MAX;
+        if (magnitude <= limit) {
+            free(n.limbs);
+            return any_sexp_number(n.negative ? (intptr_t)-magnitude : (intptr_t)magnitude);
+        }
+    }
+
+    any_sexp_t sexp = any_sexp_object(EVAL_OBJECT_BIGNUM, n.length + 1);
+    if (!ANY_SEXP_IS_ERROR(sexp)) {
+        any_sexp_t *values = EVAL_VALUES(sexp);
+
+        values[0] = any_sexp_number(n.negative ? -1 : 1);
+        for (size_t i = 0; i < n.length; i++)
+            values[i + 1] = any_sexp_number(n.limbs[i]);
+    }
+
+    free(n.limbs);
+    return sexp;
+}
+
+// Magnitudes
+//
+// The functions below work on the limbs, the least significant first. The
+// lengths may include leading zeros, except where noted.
+
+// NOTE: Without leading zeros
+static int bignum_compare_limbs(const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    if (an != bn)
+        return an < bn ? -1 : 1;
+
+    for (size_t i = an; i-- > 0;) {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// r += a, where r has rn >= an limbs, returns the carry out of r
+static uint32_t bignum_add_limbs(uint32_t *r, size_t rn, const uint32_t *a, size_t an)
+{
+    uint64_t carry = 0;
+    size_t i = 0;
+
+    for (; i < an; i++) {
+        carry += (uint64_t)r[i] + a[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    for (; carry != 0 && i < rn; i++) {
+        carry += r[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    return (uint32_t)carry;
+}
+
+// r -= a, where r has rn >= an limbs, returns the borrow out of r
+static uint32_t bignum_subtract_limbs(uint32_t *r, size_t rn, const uint32_t *a, size_t an)
+{
+    uint32_t borrow = 0;
+    size_t i = 0;
+
+    for (; i < an; i++) {
+        uint64_t difference = (uint64_t)r[i] - a[i] - borrow;
+        r[i] = (uint32_t)difference;
+        borrow = difference >> 63;
+    }
+
+    for (; borrow != 0 && i < rn; i++) {
+        borrow = r[i] == 0;
+        r[i]--;
+    }
+
+    return borrow;
+}
+
+// r = a * b, where r has an + bn limbs
+static void bignum_schoolbook(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    memset(r, 0, (an + bn) * sizeof(uint32_t));
+
+    for (size_t i = 0; i < an; i++) {
+        uint64_t carry = 0;
+
+        // NOTE: The product and the two limbs added fit in 64 bits
+        for (size_t j = 0; j < bn; j++) {
+            carry += (uint64_t)a[i] * b[j] + r[i + j];
+            r[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+
+        r[i + bn] = (uint32_t)carry;
+    }
+}
+
+// r = a * b, where r has an + bn limbs
+static void bignum_multiply_limbs(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    if (an < bn) {
+        const uint32_t *t = a;
+        a = b;
+        b = t;
+
+        size_t tn = an;
+        an = bn;
+        bn = tn;
+    }
+
+    if (bn < BIGNUM_KARATSUBA_LIMBS) {
+        bignum_schoolbook(r, a, an, b, bn);
+        return;
+    }
+
+    // The longer operand is cut in slices as long as the shorter one, so
+    // that the halves of the products are balanced
+    if (an >= 2 * bn) {
+        uint32_t *product = bignum_alloc(2 * bn);
+        memset(r, 0, (an + bn) * sizeof(uint32_t));
+
+        for (size_t i = 0; i < an; i += bn) {
+            size_t length = an - i < bn ? an - i : bn;
+
+            bignum_multiply_limbs(product, a + i, length, b, bn);
+            bignum_add_limbs(r + i, an + bn - i, product, length + bn);
+        }
+
+        free(product);
+        return;
+    }
+
+    // With a = a1 B^m + a0 and b = b1 B^m + b0, the product is
+    //
+    //     z2 B^2m + (z1 - z2 - z0) B^m + z0
+    //
+    // where z2 = a1 b1, z0 = a0 b0 and z1 = (a1 + a0) (b1 + b0). z0 and z2
+    // are computed in place, as they fill r without overlapping.
+    size_t m = an / 2;
+    size_t a1n = an - m;
+    size_t b1n = bn - m;
+
+    bignum_multiply_limbs(r, a, m, b, m);
+    bignum_multiply_limbs(r + 2 * m, a + m, a1n, b + m, b1n);
+
+    size_t sn = a1n + 1;
+    size_t tn = (b1n > m ? b1n : m) + 1;
+
+    uint32_t *s = bignum_alloc(2 * (sn + tn));
+    uint32_t *t = s + sn;
+    uint32_t *z1 = t + tn;
+
+    memcpy(s, a + m, a1n * sizeof(uint32_t));
+    s[a1n] = 0;
+    bignum_add_limbs(s, sn, a, m);
+
+    memset(t, 0, tn * sizeof(uint32_t));
+    memcpy(t, b + m, b1n * sizeof(uint32_t));
+    bignum_add_limbs(t, tn, b, m);
+
+    bignum_multiply_limbs(z1, s, sn, t, tn);
+    bignum_subtract_limbs(z1, sn + tn, r, 2 * m);
+    bignum_subtract_limbs(z1, sn + tn, r + 2 * m, a1n + b1n);
+
+    // NOTE: The limbs of z1 past the end of r are zeros
+    size_t rest = an + bn - m;
+    bignum_add_limbs(r + m, rest, z1, sn + tn < rest ? sn + tn : rest);
+
+    free(s);
+}
+
+// q = u / v, where q has m - n + 1 limbs, and u and v have m >= n and n
+// limbs without leading zeros
+//
+// NOTE: This is the algorithm D of Knuth (The Art of Computer Programming,
+//       4.3.1), with v shifted so that its top bit is set, and then each
+//       estimate of the limbs of q is too big by 2 at most.
+static void bignum_divide_limbs(uint32_t *q, const uint32_t *u, size_t m, const uint32_t *v, size_t n)
+{
+    if (n == 1) {
+        uint64_t remainder = 0;
+
+        for (size_t i = m; i-- > 0;) {
+            remainder = remainder << 32 | u[i];
+            q[i] = (uint32_t)(remainder / v[0]);
+            remainder %= v[0];
+        }
+
+        return;
+    }
+
+    int shift = __builtin_clz(v[n - 1]);
+    uint32_t *vn = bignum_alloc(n);
+    uint32_t *un = bignum_alloc(m + 1);
+
+    for (size_t i = n - 1; i > 0; i--)
+        vn[i] = v[i] << shift | (uint32_t)((uint64_t)v[i - 1] >> (32 - shift));
+    vn[0] = v[0] << shift;
+
+    un[m] = (uint32_t)((uint64_t)u[m - 1] >> (32 - shift));
+    for (size_t i = m - 1; i > 0; i--)
+        un[i] = u[i] << shift | (uint32_t)((uint64_t)u[i - 1] >> (32 - shift));
+    un[0] = u[0] << shift;
+
+    for (size_t j = m - n + 1; j-- > 0;) {
+        uint64_t numerator = (uint64_t)un[j + n] << 32 | un[j + n - 1];
+        uint64_t qhat = numerator / vn[n - 1];
+        uint64_t rhat = numerator % vn[n - 1];
+
+        while (qhat >= BIGNUM_BASE || qhat * vn[n - 2] > (rhat << 32 | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= BIGNUM_BASE)
+                break;
+        }
+
+        // Subtracts qhat v from the current limbs of u
+        int64_t borrow = 0, t;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t product = qhat * vn[i];
+            t = (int64_t)un[i + j] - borrow - (int64_t)(product & 0xffffffff);
+            un[i + j] = (uint32_t)t;
+            borrow = (int64_t)(product >> 32) - (t >> 32);
+        }
+
+        t = (int64_t)un[j + n] - borrow;
+        un[j + n] = (uint32_t)t;
+        q[j] = (uint32_t)qhat;
+
+        // The estimate was too big by one, v is added back
+        if (t < 0) {
+            q[j]--;
+            un[j + n] += bignum_add_limbs(un + j, n, vn, n);
+        }
+    }
+
+    free(vn);
+    free(un);
+}
+
+// a + b, or a - b when subtract is true
+static any_sexp_t bignum_sum(any_sexp_t a, any_sexp_t b, bool subtract)
+{
+    bignum_t x = bignum_unpack(a);
+    bignum_t y = bignum_unpack(b);
+    y.negative ^= subtract;
+
+    size_t length = (x.length > y.length ? x.length : y.length) + 1;
+    bignum_t r = { bignum_alloc(length), length, false };
+
+    // Adds the magnitudes if the signs are the same, or else subtracts the
+    // smaller from the bigger one
+    if (x.negative == y.negative || bignum_compare_limbs(x.limbs, x.length, y.limbs, y.length) >= 0) {
+        r.negative = x.negative;
+    } else {
+        bignum_t t = x;
+        x = y;
+        y = t;
+        r.negative = x.negative;
+    }
+
+    memset(r.limbs, 0, length * sizeof(uint32_t));
+    memcpy(r.limbs, x.limbs, x.length * sizeof(uint32_t));
+
+    if (x.negative == y.negative)
+        bignum_add_limbs(r.limbs, length, y.limbs, y.length);
+    else
+        bignum_subtract_limbs(r.limbs, length, y.limbs, y.length);
+
+    free(x.limbs);
+    free(y.limbs);
+    return bignum_pack(r);
+}
+
+any_sexp_t bignum_add(any_sexp_t a, any_sexp_t b)
+{
+    return bignum_sum(a, b, false);
+}
+
+any_sexp_t bignum_subtract(any_sexp_t a, any_sexp_t b)
+{
+    return bignum_sum(a, b, true);
+}
+
+any_sexp_t bignum_multiply(any_sexp_t a, any_sexp_t b)
+{
+    bignum_t x = bignum_unpack(a);
+    bignum_t y = bignum_unpack(b);
+
+    bignum_t r = {
+        .limbs = bignum_alloc(x.length + y.length),
+        .length = x.length + y.length,
+        .negative = x.negative != y.negative,
+    };
+
+    bignum_multiply_limbs(r.limbs, x.limbs, x.length, y.limbs, y.length);
+
+    free(x.limbs);
+    free(y.limbs);
+    return bignum_pack(r);
+}
+
+any_sexp_t bignum_divide(any_sexp_t a, any_sexp_t b)
+{
+    bignum_t x = bignum_unpack(a);
+    bignum_t y = bignum_unpack(b);
+
+    bignum_t r = { NULL, 0, x.negative != y.negative };
+
+    if (bignum_compare_limbs(x.limbs, x.length, y.limbs, y.length) < 0) {
+        r.limbs = bignum_alloc(0);
+    } else {
+        r.length = x.length - y.length + 1;
+        r.limbs = bignum_alloc(r.length);
+        bignum_divide_limbs(r.limbs, x.limbs, x.length, y.limbs, y.length);
+    }
+
+    free(x.limbs);
+    free(y.limbs);
+    return bignum_pack(r);
+}
+
+int bignum_compare(any_sexp_t a, any_sexp_t b)
+{
+    bignum_t x = bignum_unpack(a);
+    bignum_t y = bignum_unpack(b);
+
+    int order = x.negative != y.negative
+              ? (x.negative ? -1 : 1)
+              : bignum_compare_limbs(x.limbs, x.length, y.limbs, y.length) * (x.negative ? -1 : 1);
+
+    free(x.limbs);
+    free(y.limbs);
+    return order;
+}
+
+double bignum_to_double(any_sexp_t sexp)
+{
+    any_sexp_object_t *object = ANY_SEXP_GET_OBJECT(sexp);
+    double value = 0;
+
+    for (size_t i = object->length - 1; i > 0; i--)
+        value = value * BIGNUM_BASE + (uint32_t)ANY_SEXP_GET_NUMBER(object->values[i]);
+
+    return ANY_SEXP_GET_NUMBER(object->values[0]) < 0 ? -value : value;
+}
+
+any_sexp_t bignum_read(const char *token, size_t length)
+{
+    bool negative = token[0] == '-';
+
+    // NOTE: A limb takes more than 9 digits
+    bignum_t n = {
+        .limbs = bignum_alloc((length - negative) / BIGNUM_DECIMAL_DIGITS + 1),
+        .length = 0,
+        .negative = negative,
+    };
+
+    for (size_t i = negative; i < length;) {
+        size_t end = i + BIGNUM_DECIMAL_DIGITS < length ? i + BIGNUM_DECIMAL_DIGITS : length;
+        uint64_t carry = 0;
+        uint32_t scale = 1;
+
+        for (; i < end; i++) {
+            carry = 10 * carry + (token[i] - '0');
+            scale *= 10;
+        }
+
+        // n = n scale + digits
+        for (size_t j = 0; j < n.length; j++) {
+            carry += (uint64_t)n.limbs[j] * scale;
+            n.limbs[j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+
+        if (carry != 0)
+            n.limbs[n.length++] = (uint32_t)carry;
+    }
+
+    return bignum_pack(n);
+}
+
+char *bignum_format(any_sexp_t sexp, size_t *length)
+{
+    bignum_t n = bignum_unpack(sexp);
+
+    // NOTE: A limb gives less than 10 digits, and the last group of 9 is
+    //       padded with zeros
+    size_t capacity = 10 * n.length + BIGNUM_DECIMAL_DIGITS + 2;
+    char *digits = malloc(capacity);
+    if (digits == NULL) {
+        free(n.limbs);
+        return NULL;
+    }
+
+    // The digits are written backwards from the end, 9 at a time, from the
+    // remainders of the divisions by BIGNUM_DECIMAL_BASE
+    char *p = digits + capacity;
+    *--p = '\0';
+
+    do {
+        uint64_t remainder = 0;
+        for (size_t i = n.length; i-- > 0;) {
+            remainder = remainder << 32 | n.limbs[i];
+            n.limbs[i] = (uint32_t)(remainder / BIGNUM_DECIMAL_BASE);
+            remainder %= BIGNUM_DECIMAL_BASE;
+        }
+
+        while (n.length > 0 && n.limbs[n.length - 1] == 0)
+            n.length--;
+
+        for (int i = 0; i < BIGNUM_DECIMAL_DIGITS; i++) {
+            *--p = '0' + remainder % 10;
+            remainder /= 10;
+        }
+    } while (n.length > 0);
+
+    while (p[0] == '0' && p[1] != '\0')
+        p++;
+
+    if (n.negative)
+        *--p = '-';
+
+    *length = digits + capacity - 1 - p;
+    memmove(digits, p, *length + 1);
+
+    free(n.limbs);
+    return digits;
+}
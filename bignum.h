@@ -0,0 +1,71 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include "eval.h"
+
+// Bignums
+//
+// The integers out of the range of the numbers (see ANY_SEXP_NUMBER_MAX)
+// are objects of kind EVAL_OBJECT_BIGNUM:
+//
+//     [sign limb0 limb1 ...]
+//
+// sign is 1 or -1, and the magnitude is stored in limbs of 32 bits, the
+// least significant first, each one in a number. The library dumps, loads
+// and copies them as any other object, and the collector traces them
+// without knowing what they hold.
+//
+// The arithmetic of eval checks the overflow of the numbers, and calls the
+// functions below when it overflows or an argument is a bignum. They take
+// any two integers, and the results are normalized: a result in the range
+// of the numbers is always a number, so a bignum never equals a number.
+//
+// The products of big operands are computed with Karatsuba, which splits
+// each operand in two halves and needs three products of the halves instead
+// of four, down to BIGNUM_KARATSUBA_LIMBS where the schoolbook method is
+// faster.
+
+#ifndef BIGNUM_KARATSUBA_LIMBS
+#define BIGNUM_KARATSUBA_LIMBS 32
+#endif
+
+static inline bool bignum_is_bignum(any_sexp_t sexp)
+{
+    return ANY_SEXP_IS_OBJECT(sexp) && ANY_SEXP_GET_OBJECT(sexp)->kind == EVAL_OBJECT_BIGNUM;
+}
+
+// Numbers and bignums
+static inline bool bignum_is_integer(any_sexp_t sexp)
+{
+    return ANY_SEXP_IS_NUMBER(sexp) || bignum_is_bignum(sexp);
+}
+
+// The tag seen by tag?, which is the one of the numbers for the bignums
+static inline any_sexp_t bignum_tag(any_sexp_t sexp)
+{
+    return any_sexp_number(bignum_is_bignum(sexp) ? ANY_SEXP_TAG_NUMBER : ANY_SEXP_GET_TAG(sexp));
+}
+
+any_sexp_t bignum_add(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t bignum_subtract(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t bignum_multiply(any_sexp_t a, any_sexp_t b);
+
+// Truncated towards zero like in C, b should not be zero
+any_sexp_t bignum_divide(any_sexp_t a, any_sexp_t b);
+
+// Returns -1, 0 or 1 as a is less, equal or greater than b
+int bignum_compare(any_sexp_t a, any_sexp_t b);
+
+// NOTE: Rounded at each limb, so it may be off by one in the last place
+double bignum_to_double(any_sexp_t sexp);
+
+// Parses an optional minus sign and decimal digits (see
+// ANY_SEXP_READ_BIG_NUMBER)
+any_sexp_t bignum_read(const char *token, size_t length);
+
+// Returns the decimal digits, to be freed, or NULL if out of memory
+char *bignum_format(any_sexp_t sexp, size_t *length);
+
+#endif
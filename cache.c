@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+// NOTE: The cache does not log s-expressions
+#define ANY_LOG_NO_GENERIC
+#include "any_log.h"
+
+static char *cache_directory = NULL;
+
+#define CACHE_DAY (24 * 60 * 60)
+
+// NOTE: The time of the last pruning is the one of the file "pruned". The
+//       time an entry was last read is its access time, which is updated
+//       at least once a day by the default mounts (relatime), otherwise the
+//       entries are removed after CACHE_UNUSED_DAYS from their creation.
+static void cache_prune()
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/pruned", cache_directory);
+
+    time_t now = time(NULL);
+    struct stat status;
+
+    if (!stat(path, &status) && now - status.st_mtime < CACHE_DAY)
+        return;
+
+    FILE *stamp = fopen(path, "w");
+    if (stamp == NULL)
+        return;
+
+    fclose(stamp);
+
+    DIR *directory = opendir(cache_directory);
+    if (directory == NULL)
+        return;
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%d.sxb", CACHE_VERSION);
+    size_t suffix_length = strlen(suffix);
+
+    size_t removed = 0;
+    struct dirent *file;
+
+    while ((file = readdir(directory)) != NULL) {
+        const char *name = file->d_name;
+        size_t length = strlen(name);
+
+        // Only the files named after a hash are entries
+        if (length < 17 || name[16] != '-' || strspn(name, "0123456789abcdef") != 16)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", cache_directory, name);
+        if (stat(path, &status))
+            continue;
+
+        bool stale;
+        if (length > 4 && !strcmp(name + length - 4, ".tmp"))
+            stale = now - status.st_mtime > CACHE_DAY;
+        else if (length > suffix_length && !strcmp(name + length - suffix_length, suffix))
+            stale = now - status.st_atime > CACHE_UNUSED_DAYS * CACHE_DAY;
+        else
+            stale = true;
+
+        if (stale && !remove(path))
+            removed++;
+    }
+
+    closedir(directory);
+    log_trace("Cache pruned (%zu entries removed)", removed);
+}
+
+void cache_init(const char *directory)
+{
+    free(cache_directory);
+    cache_directory = NULL;
+
+    if (directory == NULL || *directory == '\0')
+        return;
+
+    size_t length = strlen(directory);
+    cache_directory = malloc(length + 1);
+    if (cache_directory == NULL)
+        return;
+
+    memcpy(cache_directory, directory, length + 1);
+
+    // Create the missing parents as well
+    for (char *c = cache_directory + 1; *c != '\0'; c++) {
+        if (*c != '/')
+            continue;
+
+        *c = '\0';
+        mkdir(cache_directory, 0755);
+        *c = '/';
+    }
+
+    if (mkdir(cache_directory, 0755) && errno != EEXIST) {
+        log_warn("Cache disabled, failed to create %s", cache_directory);
+        free(cache_directory);
+        cache_directory = NULL;
+        return;
+    }
+
+    cache_prune();
+}
+
+bool cache_enabled()
+{
+    return cache_directory != NULL;
+}
+
+#define CACHE_HASH_PRIME 0x100000001b3
+
+uint64_t cache_hash_update(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= CACHE_HASH_PRIME;
+    }
+
+    return hash;
+}
+
+uint64_t cache_hash(const void *data, size_t length)
+{
+    return cache_hash_update(CACHE_HASH_BASIS, data, length);
+}
+
+bool cache_hash_file(const char *path, uint64_t *hash)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+
+    char buffer[64 * 1024];
+    size_t length;
+
+    *hash = CACHE_HASH_BASIS;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        *hash = cache_hash_update(*hash, buffer, length);
+
+    bool valid = !ferror(file);
+    fclose(file);
+    return valid;
+}
+
+static void cache_path(char *path, size_t length, uint64_t hash, bool temporary)
+{
+    if (temporary)
+        snprintf(path, length, "%s/%016" PRIx64 "-%d.%ld.tmp", cache_directory, hash, CACHE_VERSION, (long)getpid());
+    else
+        snprintf(path, length, "%s/%016" PRIx64 "-%d.sxb", cache_directory, hash, CACHE_VERSION);
+}
+
+FILE *cache_open(uint64_t hash)
+{
+    if (cache_directory == NULL)
+        return NULL;
+
+    char path[4096];
+    cache_path(path, sizeof(path), hash, false);
+    return fopen(path, "rb");
+}
+
+FILE *cache_create(uint64_t hash)
+{
+    if (cache_directory == NULL)
+        return NULL;
+
+    char path[4096];
+    cache_path(path, sizeof(path), hash, true);
+    return fopen(path, "wb");
+}
+
+bool cache_commit(FILE *file, uint64_t hash, bool valid)
+{
+    char temporary[4096], path[4096];
+    cache_path(temporary, sizeof(temporary), hash, true);
+    cache_path(path, sizeof(path), hash, false);
+
+    if (fclose(file) || !valid || rename(temporary, path)) {
+        remove(temporary);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Module cache
+//
+// Directory of the files included, already read and expanded (see
+// eval_include). An entry is named after the hash of the contents of the
+// source (with the macros defined before it) and CACHE_VERSION, so an
+// edited file gets a new entry, while the files it depends on are checked
+// by eval when the entry is opened.
+//
+// The entries are written to a temporary file and renamed, so a run never
+// reads an entry which is written by another one.
+//
+// The directory is pruned by cache_init, at most once a day: it removes the
+// entries of the other versions, the temporary files left by the runs which
+// stopped while writing, and the entries not read for CACHE_UNUSED_DAYS.
+
+// Increased when the expansion or the format of the entries change
+#define CACHE_VERSION 5
+
+#ifndef CACHE_UNUSED_DAYS
+#define CACHE_UNUSED_DAYS 30
+#endif
+
+// The cache is disabled until a directory is set, which is created if
+// missing and pruned
+void cache_init(const char *directory);
+
+bool cache_enabled();
+
+// FNV-1a, 64 bits, which can be continued with cache_hash_update from the
+// basis or from a previous hash
+#define CACHE_HASH_BASIS 0xcbf29ce484222325
+
+uint64_t cache_hash(const void *data, size_t length);
+
+uint64_t cache_hash_update(uint64_t hash, const void *data, size_t length);
+
+// Hash of the contents of a file, returns false if it can not be read
+bool cache_hash_file(const char *path, uint64_t *hash);
+
+// Returns the entry of a source, or NULL if missing
+FILE *cache_open(uint64_t hash);
+
+// Returns a new entry, which is visible only after cache_commit
+FILE *cache_create(uint64_t hash);
+
+// Closes the new entry, and keeps it if valid
+bool cache_commit(FILE *file, uint64_t hash, bool valid);
+
+#endif
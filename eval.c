@@ -1,44 +1,228 @@
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 
 #include "eval.h"
+#include "arena.h"
+#include "gc.h"
+#include "cache.h"
+#include "list.h"
+#include "bignum.h"
 #include "any_log.h"
 
+static int eval_write_object(any_sexp_writer_t *writer, any_sexp_t sexp);
+
+#define ANY_SEXP_MALLOC gc_malloc
+#define ANY_SEXP_FREE arena_free
+#define ANY_SEXP_INTERN_MALLOC malloc
+#define ANY_SEXP_INTERN_FREE free
+#define ANY_SEXP_WRITE_OBJECT eval_write_object
+#define ANY_SEXP_READ_BIG_NUMBER bignum_read
 #define ANY_SEXP_IMPLEMENT
 #include "any_sexp.h"
 
+// Builtins
+//
+// The symbols are interned by eval_init, so they can be compared by identity.
+// The dispatch table maps each builtin symbol to its opcode, so that a form
+// is classified with a single hash lookup instead of a chain of comparisons.
+// The opcodes are listed in eval.h (see eval_builtin_t).
+
+static const char *builtin_names[EVAL_BUILTIN_COUNT] = {
+    "include", "begin", "list", "list*",
+    "quote", "defmacro", "define",
+    "print", "eval", "tag?",
+    "if", "lambda", "let",
+    "error", "expand", "apply",
+    "car", "cdr", "cons",
+    "+", "*", "=", ">", "-", "/",
+    "<", ">=", "<=",
+    "gensym", "display", "letrec",
+    "length", "append", "reverse", "nth",
+    "assoc", "assq", "member",
+    "map", "filter", "foldl", "equal?",
+    "#local", "#lambda", "#let", "#letrec",
+};
+
+// NOTE: The nodes produced by the resolver are not interned, so that they
+//       can not be written in the source (see eval_resolve)
+#define EVAL_BUILTIN_INTERNAL EVAL_BUILTIN_LOCAL
+
+static any_sexp_t builtin_symbols[EVAL_BUILTIN_COUNT];
+
 static any_sexp_t builtins = ANY_SEXP_NIL;
 
+static any_sexp_t rest_symbol;
+
+// Global environment used to resolve the symbols not bound locally
+static eval_env_t *globals = NULL;
+
+// Name of the global being defined, which the lambdas in its value look up
+// when called instead of capturing it (see eval_run_toplevel)
+static any_sexp_t defining = ANY_SEXP_NIL;
+
+// Records of the files included, as (path . deps) (see eval_include)
+static any_sexp_t included = ANY_SEXP_NIL;
+
+static unsigned int gensym_id = 0;
+
+static inline bool eval_is_builtin(any_sexp_t sexp, eval_builtin_t builtin)
+{
+    return ANY_SEXP_IS_EQ(sexp, builtin_symbols[builtin]);
+}
+
+// NOTE: Must be a power of two and at least twice EVAL_BUILTIN_COUNT
+#define EVAL_DISPATCH_SIZE 128
+
+static struct {
+    const char *symbol;
+    eval_builtin_t builtin;
+} dispatch_table[EVAL_DISPATCH_SIZE];
+
+static inline size_t eval_symbol_hash(any_sexp_t symbol)
+{
+    // Fibonacci hashing of the (aligned) address
+    //
+    // NOTE: Any heap object can be used as key, as the hash does
+    //       not depend on the type of the pointer
+    //
+    uint64_t key = (uintptr_t)ANY_SEXP_GET_SYMBOL(symbol) >> 3;
+    return (key * 11400714819323198485llu) >> 32;
+}
+
+static void eval_dispatch_add(any_sexp_t symbol, eval_builtin_t builtin)
+{
+    size_t i = eval_symbol_hash(symbol) & (EVAL_DISPATCH_SIZE - 1);
+    while (dispatch_table[i].symbol != NULL)
+        i = (i + 1) & (EVAL_DISPATCH_SIZE - 1);
+
+    dispatch_table[i].symbol = ANY_SEXP_GET_SYMBOL(symbol);
+    dispatch_table[i].builtin = builtin;
+}
+
+// Returns EVAL_BUILTIN_COUNT if the sexp is not a builtin symbol
+eval_builtin_t eval_dispatch(any_sexp_t sexp)
+{
+    if (!ANY_SEXP_IS_SYMBOL(sexp))
+        return EVAL_BUILTIN_COUNT;
+
+    const char *symbol = ANY_SEXP_GET_SYMBOL(sexp);
+    size_t i = eval_symbol_hash(sexp) & (EVAL_DISPATCH_SIZE - 1);
+
+    while (dispatch_table[i].symbol != NULL) {
+        if (dispatch_table[i].symbol == symbol)
+            return dispatch_table[i].builtin;
+
+        i = (i + 1) & (EVAL_DISPATCH_SIZE - 1);
+    }
+
+    return EVAL_BUILTIN_COUNT;
+}
+
 // Environment
 //
+// The top level definitions are stored in a hash table (see eval_env_t),
+// while the local variables live in the frames of the calls (see eval_resolve).
+// Association lists are still used by the resolver for the scopes
+//
 // ((symbol value) (symbol value) ...)
 
-any_sexp_t eval_find_symbol(const char *symbol, any_sexp_t env)
+#define EVAL_ENV_CAPACITY 256
+
+any_sexp_t eval_find_symbol(any_sexp_t symbol, any_sexp_t env)
 {
-    if (ANY_SEXP_IS_NIL(env))
+    while (!ANY_SEXP_IS_NIL(env)) {
+        any_sexp_t car = any_sexp_car(env);
+
+        if (!ANY_SEXP_IS_CONS(car) || !ANY_SEXP_IS_SYMBOL(any_sexp_car(car)))
+            log_panic("Invalid environment");
+
+        if (ANY_SEXP_IS_EQ(symbol, any_sexp_car(car)))
+            return any_sexp_cdr(car);
+
+        env = any_sexp_cdr(env);
+    }
+
+    return ANY_SEXP_ERROR;
+}
+
+// Returns the slot where the symbol is (or should be) stored
+static size_t eval_env_slot(eval_env_t *env, any_sexp_t symbol)
+{
+    size_t mask = env->capacity - 1;
+    size_t i = eval_symbol_hash(symbol) & mask;
+
+    while (!ANY_SEXP_IS_NIL(env->symbols[i]) && !ANY_SEXP_IS_EQ(env->symbols[i], symbol))
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+static void eval_env_resize(eval_env_t *env, size_t capacity)
+{
+    eval_env_t resized = {
+        .symbols = malloc(capacity * sizeof(any_sexp_t)),
+        .values = malloc(capacity * sizeof(any_sexp_t)),
+        .capacity = capacity,
+        .count = env->count,
+    };
+
+    if (resized.symbols == NULL || resized.values == NULL)
+        log_panic("Failed to allocate the environment");
+
+    for (size_t i = 0; i < capacity; i++)
+        resized.symbols[i] = ANY_SEXP_NIL;
+
+    for (size_t i = 0; i < env->capacity; i++) {
+        if (ANY_SEXP_IS_NIL(env->symbols[i]))
+            continue;
+
+        size_t j = eval_env_slot(&resized, env->symbols[i]);
+        resized.symbols[j] = env->symbols[i];
+        resized.values[j] = env->values[i];
+    }
+
+    free(env->symbols);
+    free(env->values);
+    *env = resized;
+}
+
+any_sexp_t eval_env_find(eval_env_t *env, any_sexp_t symbol)
+{
+    if (env == NULL || env->count == 0)
         return ANY_SEXP_ERROR;
 
-    any_sexp_t car = any_sexp_car(env);
+    size_t i = eval_env_slot(env, symbol);
+    return ANY_SEXP_IS_NIL(env->symbols[i])
+         ? ANY_SEXP_ERROR
+         : env->values[i];
+}
 
-    if (!ANY_SEXP_IS_CONS(car) || !ANY_SEXP_IS_SYMBOL(any_sexp_car(car)))
-        log_panic("Invalid environment");
+any_sexp_t eval_env_list(eval_env_t *env)
+{
+    any_sexp_t list = ANY_SEXP_NIL;
 
-    if (!strcmp(symbol, ANY_SEXP_GET_SYMBOL(any_sexp_car(car))))
-        return any_sexp_cdr(car);
+    for (size_t i = 0; i < env->capacity; i++) {
+        if (!ANY_SEXP_IS_NIL(env->symbols[i]))
+            list = any_sexp_cons(any_sexp_cons(env->symbols[i], env->values[i]), list);
+    }
 
-    return eval_find_symbol(symbol, any_sexp_cdr(env));
+    return list;
 }
 
-any_sexp_t eval_symbol(const char *symbol, any_sexp_t env)
+any_sexp_t eval_symbol(any_sexp_t symbol)
 {
-    any_sexp_t value = eval_find_symbol(symbol, env);
+    any_sexp_t value = eval_env_find(globals, symbol);
 
-    log_value_trace("Symbol lookup",
-                    "s:symbol", symbol,
-                    "g:env", ANY_LOG_FORMATTER(any_sexp_fprint), env);
+    // NOTE: The level is checked here, since the lookups are frequent and
+    //       the arguments are passed even when the log is filtered
+    if (any_log_level >= ANY_LOG_TRACE)
+        log_value_trace("Symbol lookup",
+                        "s:symbol", ANY_SEXP_GET_SYMBOL(symbol));
 
     if (ANY_SEXP_IS_ERROR(value))
-        log_error("Symbol %s not bound in scope", symbol);
+        log_error("Symbol %s not bound in scope", ANY_SEXP_GET_SYMBOL(symbol));
 
     return value;
 }
@@ -61,8 +245,7 @@ bool eval_is_lambda(any_sexp_t sexp)
     any_sexp_t cadr = any_sexp_car(any_sexp_cdr(sexp));
     any_sexp_t cddr = any_sexp_cdr(any_sexp_cdr(sexp));
 
-    return ANY_SEXP_IS_SYMBOL(car)
-        && !strcmp(ANY_SEXP_GET_SYMBOL(car), "lambda")
+    return eval_is_builtin(car, EVAL_BUILTIN_LAMBDA)
         && ANY_SEXP_IS_NIL(any_sexp_cdr(cddr))
         && eval_is_symbol_list(cadr);
 }
@@ -81,7 +264,7 @@ bool eval_is_let_list(any_sexp_t sexp)
         && eval_is_let_list(any_sexp_cdr(sexp));
 }
 
-bool eval_is_let(any_sexp_t sexp)
+static bool eval_is_binding(any_sexp_t sexp, eval_builtin_t builtin)
 {
     // (cons 'let (cons (cons (cons (cons id (cons value nil)) ...)) (cons body nil)))
     //
@@ -89,13 +272,36 @@ bool eval_is_let(any_sexp_t sexp)
     any_sexp_t cadr = any_sexp_car(any_sexp_cdr(sexp));
     any_sexp_t cddr = any_sexp_cdr(any_sexp_cdr(sexp));
 
-    return ANY_SEXP_IS_SYMBOL(car)
-        && !strcmp(ANY_SEXP_GET_SYMBOL(car), "let")
+    return eval_is_builtin(car, builtin)
         && ANY_SEXP_IS_NIL(any_sexp_cdr(cddr))
         && ANY_SEXP_IS_CONS(cadr)
         && eval_is_let_list(cadr);
 }
 
+bool eval_is_let(any_sexp_t sexp)
+{
+    return eval_is_binding(sexp, EVAL_BUILTIN_LET);
+}
+
+bool eval_is_letrec(any_sexp_t sexp)
+{
+    return eval_is_binding(sexp, EVAL_BUILTIN_LETREC);
+}
+
+bool eval_is_named_let(any_sexp_t sexp)
+{
+    // (let name ((id value) ...) body)
+    //
+    any_sexp_t car = any_sexp_car(sexp);
+    any_sexp_t cadr = any_sexp_car(any_sexp_cdr(sexp));
+    any_sexp_t cddr = any_sexp_cdr(any_sexp_cdr(sexp));
+
+    return eval_is_builtin(car, EVAL_BUILTIN_LET)
+        && ANY_SEXP_IS_SYMBOL(cadr)
+        && ANY_SEXP_IS_NIL(any_sexp_cdr(any_sexp_cdr(cddr)))
+        && eval_is_let_list(any_sexp_car(cddr));
+}
+
 bool eval_is_quote(any_sexp_t sexp)
 {
     // (cons 'quote (cons x nil))
@@ -103,12 +309,11 @@ bool eval_is_quote(any_sexp_t sexp)
     any_sexp_t car = any_sexp_car(sexp);
     any_sexp_t cdr = any_sexp_cdr(sexp);
 
-    return ANY_SEXP_IS_SYMBOL(car)
-        && !strcmp(ANY_SEXP_GET_SYMBOL(car), "quote")
+    return eval_is_builtin(car, EVAL_BUILTIN_QUOTE)
         && ANY_SEXP_IS_NIL(any_sexp_cdr(cdr));
 }
 
-bool eval_find_fvs(const char *symbol, any_sexp_t fvs)
+bool eval_find_fvs(any_sexp_t symbol, any_sexp_t fvs)
 {
     if (ANY_SEXP_IS_NIL(fvs))
         return false;
@@ -118,7 +323,7 @@ bool eval_find_fvs(const char *symbol, any_sexp_t fvs)
     if (!ANY_SEXP_IS_SYMBOL(car))
         log_panic("Invalid fvs");
 
-    return !strcmp(symbol, ANY_SEXP_GET_SYMBOL(car))
+    return ANY_SEXP_IS_EQ(symbol, car)
         || eval_find_fvs(symbol, any_sexp_cdr(fvs));
 }
 
@@ -133,7 +338,7 @@ any_sexp_t eval_merge_fvs(any_sexp_t a, any_sexp_t b)
     if (!ANY_SEXP_IS_SYMBOL(any_sexp_car(a)))
         log_panic("Invalid fvs");
 
-    if (eval_find_fvs(ANY_SEXP_GET_SYMBOL(any_sexp_car(a)), b))
+    if (eval_find_fvs(any_sexp_car(a), b))
         return eval_merge_fvs(any_sexp_cdr(a), b);
 
     return any_sexp_cons(any_sexp_car(a), eval_merge_fvs(any_sexp_cdr(a), b));
@@ -160,8 +365,8 @@ any_sexp_t eval_get_let_fvs(any_sexp_t sexp, any_sexp_t pars)
 any_sexp_t eval_get_fvs(any_sexp_t sexp, any_sexp_t pars)
 {
     if (ANY_SEXP_IS_SYMBOL(sexp)) {
-        const char *symbol = ANY_SEXP_GET_SYMBOL(sexp);
-        return eval_find_fvs(symbol, pars) || eval_find_fvs(symbol, builtins)
+        return eval_find_fvs(sexp, pars) || eval_dispatch(sexp) != EVAL_BUILTIN_COUNT ||
+               ANY_SEXP_IS_EQ(sexp, defining)
              ? ANY_SEXP_NIL
              : any_sexp_cons(sexp, ANY_SEXP_NIL);
     }
@@ -185,6 +390,29 @@ any_sexp_t eval_get_fvs(any_sexp_t sexp, any_sexp_t pars)
                                   eval_get_fvs(body, eval_merge_fvs(any_sexp_cdr(fvs), pars)));
         }
 
+        // NOTE: The name of a named let is bound only in its body
+        if (eval_is_named_let(sexp)) {
+            any_sexp_t name = any_sexp_car(any_sexp_cdr(sexp));
+            any_sexp_t body = any_sexp_car(any_sexp_cdr(any_sexp_cdr(any_sexp_cdr(sexp))));
+            any_sexp_t fvs  = eval_get_let_fvs(any_sexp_car(any_sexp_cdr(any_sexp_cdr(sexp))), pars);
+
+            any_sexp_t sub_pars = any_sexp_cons(name, eval_merge_fvs(any_sexp_cdr(fvs), pars));
+            return eval_merge_fvs(any_sexp_car(fvs), eval_get_fvs(body, sub_pars));
+        }
+
+        // NOTE: The names of a letrec are bound in the values as well
+        if (eval_is_letrec(sexp)) {
+            any_sexp_t binds = any_sexp_car(any_sexp_cdr(sexp));
+            any_sexp_t body  = any_sexp_car(any_sexp_cdr(any_sexp_cdr(sexp)));
+
+            any_sexp_t sub_pars = pars;
+            for (any_sexp_t list = binds; !ANY_SEXP_IS_NIL(list); list = any_sexp_cdr(list))
+                sub_pars = any_sexp_cons(any_sexp_car(any_sexp_car(list)), sub_pars);
+
+            any_sexp_t fvs = eval_get_let_fvs(binds, sub_pars);
+            return eval_merge_fvs(any_sexp_car(fvs), eval_get_fvs(body, sub_pars));
+        }
+
         if (eval_is_quote(sexp))
             return ANY_SEXP_NIL;
 
@@ -199,320 +427,1397 @@ any_sexp_t eval_get_fvs(any_sexp_t sexp, any_sexp_t pars)
     return ANY_SEXP_NIL;
 }
 
-any_sexp_t eval_copy_fvs(any_sexp_t fvs, any_sexp_t env)
-{
-    if (ANY_SEXP_IS_NIL(fvs))
-        return ANY_SEXP_NIL;
-
-    if (!ANY_SEXP_IS_CONS(fvs) || !ANY_SEXP_IS_SYMBOL(any_sexp_car(fvs)))
-        return ANY_SEXP_ERROR;
+// Lexical addressing
+//
+// The body of a closure is resolved once when the closure is created, so that
+// every reference to a local variable becomes an index in the frame of the
+// call, instead of a lookup by name. The frame is laid out as
+//
+//     [captured values ...] [self] [parameters ...] [let bindings ...]
+//
+// and the resolved body uses the following nodes
+//
+//     (#local . index)
+//     (#lambda refs pars body)
+//     (#lambda refs name pars body)
+//     (#let ((index . value) ...) body)
+//     (#letrec ((index name . value) ...) body)
+//
+// where refs are the resolved references to the free variables of the inner
+// lambda, which are copied in the closure when it is created.
+//
+// The free variables and the resolved body depend only on the source form,
+// so they are computed once and cached in a template, keyed by the
+// (pars body) cons of the lambda
+//
+// (fvs . code)
+//
+// where code is the object shared by the closures (see eval.h).
+//
+// The lambdas bound by letrec (and so by named let) are keyed by
+// (name pars body) instead, and the name is not a free variable of their
+// body: the closure is stored in the self slot of the frame by the call, as
+// marked in the code. This way the recursive calls are plain calls, and the
+// closure does not reference itself.
+//
+// Symbols that are not bound in the scope are left as they are, and they are
+// looked up in the global environment.
 
-    any_sexp_t sexp = eval_symbol(ANY_SEXP_GET_SYMBOL(any_sexp_car(fvs)), env);
-    any_sexp_t rest = eval_copy_fvs(any_sexp_cdr(fvs), env);
+typedef struct {
+    any_sexp_t scope;
+    size_t slots;
+    size_t size;
+} eval_resolver_t;
 
-    if (ANY_SEXP_IS_ERROR(sexp) || ANY_SEXP_IS_ERROR(rest))
-        return ANY_SEXP_ERROR;
+any_sexp_t *eval_stack = NULL;
+size_t eval_stack_top = 0;
 
-    return any_sexp_cons(any_sexp_cons(any_sexp_car(fvs), sexp), rest);
-}
+static eval_env_t templates = { 0 };
 
-any_sexp_t eval_lambda(any_sexp_t lambda, any_sexp_t env)
+static size_t eval_resolve_slot(eval_resolver_t *resolver)
 {
-    any_sexp_t pars = any_sexp_car(lambda);
-    any_sexp_t body = any_sexp_car(any_sexp_cdr(lambda));
-
-    any_sexp_t fvs  = eval_get_fvs(body, pars);
-    any_sexp_t copy = eval_copy_fvs(fvs, env);
-
-    log_value_trace("Lambda creation",
-                    "g:pars", ANY_LOG_FORMATTER(any_sexp_fprint), pars,
-                    "g:fvs",  ANY_LOG_FORMATTER(any_sexp_fprint), fvs,
-                    "g:body", ANY_LOG_FORMATTER(any_sexp_fprint), body);
+    size_t slot = resolver->slots++;
+    if (resolver->slots > resolver->size)
+        resolver->size = resolver->slots;
 
-    return ANY_SEXP_IS_ERROR(fvs) || ANY_SEXP_IS_ERROR(copy)
-         ? ANY_SEXP_ERROR
-         : any_sexp_cons(copy, lambda);
+    return slot;
 }
 
-any_sexp_t eval_let_binds(any_sexp_t sexp, any_sexp_t env)
+static void eval_resolve_bind(eval_resolver_t *resolver, any_sexp_t symbol, size_t slot)
 {
-    if (ANY_SEXP_IS_NIL(sexp))
-        return env;
+    any_sexp_t bind = any_sexp_cons(symbol, any_sexp_number(slot));
+    resolver->scope = any_sexp_cons(bind, resolver->scope);
+}
 
+static any_sexp_t eval_resolve(any_sexp_t sexp, eval_resolver_t *resolver);
+
+static any_sexp_t eval_resolve_list(any_sexp_t sexp, eval_resolver_t *resolver)
+{
     if (!ANY_SEXP_IS_CONS(sexp))
-        return ANY_SEXP_ERROR;
+        return sexp;
 
-    any_sexp_t name  = any_sexp_car(any_sexp_car(sexp));
-    any_sexp_t value = eval(any_sexp_car(any_sexp_cdr(any_sexp_car(sexp))), env);
-    any_sexp_t rest  = eval_let_binds(any_sexp_cdr(sexp), env);
+    any_sexp_t car = eval_resolve(any_sexp_car(sexp), resolver);
+    any_sexp_t cdr = eval_resolve_list(any_sexp_cdr(sexp), resolver);
 
-    return ANY_SEXP_IS_ERROR(rest) || ANY_SEXP_IS_ERROR(value)
+    return ANY_SEXP_IS_ERROR(car) || ANY_SEXP_IS_ERROR(cdr)
          ? ANY_SEXP_ERROR
-         : any_sexp_cons(any_sexp_cons(name, value), rest);
+         : any_sexp_cons(car, cdr);
 }
 
-any_sexp_t eval_let(any_sexp_t let, any_sexp_t env)
+static any_sexp_t eval_resolve_let(any_sexp_t sexp, eval_resolver_t *resolver)
 {
-    any_sexp_t binds = any_sexp_car(let);
-    any_sexp_t body = any_sexp_car(any_sexp_cdr(let));
+    any_sexp_t scope = resolver->scope;
+    size_t slots = resolver->slots;
 
-    if (ANY_SEXP_IS_NIL(binds)) {
-        log_error("Let needs at least one binding");
-        return ANY_SEXP_ERROR;
+    // NOTE: The slots are reserved before resolving the values, so that
+    //       any let inside them will not overwrite the bindings
+    //
+    any_sexp_t binds = ANY_SEXP_NIL;
+    for (any_sexp_t list = CADR(sexp); !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        any_sexp_t slot = any_sexp_number(eval_resolve_slot(resolver));
+        any_sexp_t value = eval_resolve(CADR(CAR(list)), resolver);
+        if (ANY_SEXP_IS_ERROR(value))
+            return ANY_SEXP_ERROR;
+
+        binds = any_sexp_cons(any_sexp_cons(slot, value), binds);
     }
 
-    any_sexp_t body_env = eval_let_binds(binds, env);
-    return ANY_SEXP_IS_ERROR(body_env)
-         ? ANY_SEXP_ERROR
-         : eval(body, body_env);
-}
+    binds = any_sexp_reverse(binds);
 
-any_sexp_t eval_begin(any_sexp_t list, any_sexp_t env)
-{
-    if (ANY_SEXP_IS_NIL(list))
-        return ANY_SEXP_NIL;
+    any_sexp_t bind = binds;
+    for (any_sexp_t list = CADR(sexp); !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        eval_resolve_bind(resolver, CAAR(list), ANY_SEXP_GET_NUMBER(CAAR(bind)));
+        bind = CDR(bind);
+    }
+
+    any_sexp_t body = eval_resolve(CADDR(sexp), resolver);
 
-    if (ANY_SEXP_IS_NIL(any_sexp_cdr(list)))
-        return eval(any_sexp_car(list), env);
+    resolver->scope = scope;
+    resolver->slots = slots;
 
-    if (ANY_SEXP_IS_ERROR(eval(any_sexp_car(list), env)))
+    if (ANY_SEXP_IS_ERROR(body))
         return ANY_SEXP_ERROR;
 
-    return eval_begin(any_sexp_cdr(list), env);
+    any_sexp_t let = builtin_symbols[EVAL_BUILTIN_FRAME_LET];
+    return any_sexp_cons(let, any_sexp_cons(binds, any_sexp_cons(body, ANY_SEXP_NIL)));
 }
 
-any_sexp_t eval_append_env(any_sexp_t pars, any_sexp_t args, any_sexp_t fvs)
+// The key is (pars body), or (name pars body) for the named lambdas
+static any_sexp_t eval_resolve_closure(any_sexp_t key, eval_resolver_t *resolver)
 {
-    if (!ANY_SEXP_IS_NIL(pars) && ANY_SEXP_IS_NIL(args)) {
-        log_error("Too few arguments for parameters");
+    any_sexp_t template = eval_template(key);
+    if (ANY_SEXP_IS_ERROR(template))
         return ANY_SEXP_ERROR;
-    }
 
-    if (ANY_SEXP_IS_NIL(pars) && !ANY_SEXP_IS_NIL(args)) {
-        log_error("Too many arguments for parameters");
+    any_sexp_t refs = eval_resolve_list(CAR(template), resolver);
+    if (ANY_SEXP_IS_ERROR(refs))
         return ANY_SEXP_ERROR;
-    }
 
-    if (ANY_SEXP_IS_NIL(pars) && ANY_SEXP_IS_NIL(args))
-        return fvs;
-
-    if (!ANY_SEXP_IS_SYMBOL(any_sexp_car(pars))) {
-        log_error("Lambda parameter should be a symbol");
-        return ANY_SEXP_ERROR;
-    }
+    any_sexp_t lambda = builtin_symbols[EVAL_BUILTIN_CLOSURE];
+    return any_sexp_cons(lambda, any_sexp_cons(refs, key));
+}
 
-    if (!strcmp(ANY_SEXP_GET_SYMBOL(any_sexp_car(pars)), "&rest")) {
-        if (!ANY_SEXP_IS_NIL(any_sexp_cdr(pars))) {
-            log_error("Rest parameter should be the last");
-            return ANY_SEXP_ERROR;
-        }
+// (let name ((var init) ...) body) => ((#lambda refs name (var ...) body) init ...)
+static any_sexp_t eval_resolve_named_let(any_sexp_t sexp, eval_resolver_t *resolver)
+{
+    any_sexp_t pars = ANY_SEXP_NIL;
+    any_sexp_t inits = ANY_SEXP_NIL;
 
-        return any_sexp_cons(any_sexp_cons(any_sexp_car(pars), args), fvs);
+    for (any_sexp_t list = CADDR(sexp); !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        pars = any_sexp_cons(CAAR(list), pars);
+        inits = any_sexp_cons(CADR(CAR(list)), inits);
     }
 
-    any_sexp_t env = eval_append_env(any_sexp_cdr(pars), any_sexp_cdr(args), fvs);
-    if (ANY_SEXP_IS_ERROR(env))
-        return ANY_SEXP_ERROR;
+    // NOTE: The key is created once, since the body around is resolved once
+    any_sexp_t key = any_sexp_cons(CADR(sexp),
+                                   any_sexp_cons(any_sexp_reverse(pars), CDDR(CDR(sexp))));
 
-    return any_sexp_cons(any_sexp_cons(any_sexp_car(pars), any_sexp_car(args)), env);
+    any_sexp_t closure = eval_resolve_closure(key, resolver);
+    any_sexp_t args = eval_resolve_list(any_sexp_reverse(inits), resolver);
+
+    return ANY_SEXP_IS_ERROR(closure) || ANY_SEXP_IS_ERROR(args)
+         ? ANY_SEXP_ERROR
+         : any_sexp_cons(closure, args);
 }
 
-any_sexp_t eval_lambda_call(any_sexp_t fvs, any_sexp_t pars, any_sexp_t args, any_sexp_t body)
+// Returns true if one of the refs is a slot in [first, first + count)
+static bool eval_refers_slots(any_sexp_t refs, size_t first, size_t count)
 {
-    log_value_trace("Lambda call",
-                    "g:pars", ANY_LOG_FORMATTER(any_sexp_fprint), pars,
-                    "g:args", ANY_LOG_FORMATTER(any_sexp_fprint), args,
-                    "g:fvs",  ANY_LOG_FORMATTER(any_sexp_fprint), fvs,
-                    "g:body", ANY_LOG_FORMATTER(any_sexp_fprint), body);
+    for (; !ANY_SEXP_IS_NIL(refs); refs = CDR(refs)) {
+        any_sexp_t ref = CAR(refs);
 
-    // Update the environment with the arguments
-    any_sexp_t body_env = eval_append_env(pars, args, fvs);
-    if (ANY_SEXP_IS_ERROR(body_env))
-        return ANY_SEXP_ERROR;
+        if (ANY_SEXP_IS_CONS(ref) && eval_is_builtin(CAR(ref), EVAL_BUILTIN_LOCAL) &&
+            (size_t)ANY_SEXP_GET_NUMBER(CDR(ref)) - first < count)
+            return true;
+    }
 
-    // Eval lambda body with the new environment
-    return eval(body, body_env);
+    return false;
 }
 
-any_sexp_t eval_primitive(any_sexp_t sexp, any_sexp_t env, eval_primitive_t prim)
+// (letrec ((name value) ...) body) => (#let ((index . value) ...) body)
+//
+// The names are bound before resolving the values, and the lambdas are
+// resolved as named ones. When a value captures one of the other names,
+// which are not set yet, the node is a #letrec with the names instead
+// (see eval_frame_letrec)
+//
+static any_sexp_t eval_resolve_letrec(any_sexp_t sexp, eval_resolver_t *resolver)
 {
-    if (!ANY_SEXP_IS_CONS(sexp) || !ANY_SEXP_IS_NIL(any_sexp_cdr(any_sexp_cdr(sexp)))) {
-        log_value_error("Malformed primitive invocation", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-        return ANY_SEXP_ERROR;
+    any_sexp_t scope = resolver->scope;
+    size_t slots = resolver->slots;
+
+    size_t first = resolver->slots;
+    size_t count = 0;
+
+    for (any_sexp_t list = CADR(sexp); !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        eval_resolve_bind(resolver, CAAR(list), eval_resolve_slot(resolver));
+        count++;
     }
 
-    any_sexp_t a = eval(CAR(sexp), env);
-    any_sexp_t b = eval(CADR(sexp), env);
+    any_sexp_t binds = ANY_SEXP_NIL;
+    bool captures = false;
+    size_t slot = first;
 
-    return prim(a, b);
-}
+    for (any_sexp_t list = CADR(sexp); !ANY_SEXP_IS_NIL(list); list = CDR(list), slot++) {
+        any_sexp_t name = CAAR(list);
+        any_sexp_t value = CADR(CAR(list));
 
-static any_sexp_t eval_primitive_add(any_sexp_t a, any_sexp_t b)
-{
-    if (!ANY_SEXP_IS_NUMBER(a) || !ANY_SEXP_IS_NUMBER(b)) {
-        log_error("Add expects two numbers");
-        return ANY_SEXP_ERROR;
-    }
+        if (eval_is_lambda(value)) {
+            value = eval_resolve_closure(any_sexp_cons(name, CDR(value)), resolver);
+            captures = captures || (!ANY_SEXP_IS_ERROR(value) && eval_refers_slots(CADR(value), first, count));
+        } else {
+            value = eval_resolve(value, resolver);
+            captures = true;
+        }
 
-    return any_sexp_number(ANY_SEXP_GET_NUMBER(a) + ANY_SEXP_GET_NUMBER(b));
-}
+        if (ANY_SEXP_IS_ERROR(value))
+            return ANY_SEXP_ERROR;
 
-static any_sexp_t eval_primitive_multiply(any_sexp_t a, any_sexp_t b)
-{
-    if (!ANY_SEXP_IS_NUMBER(a) || !ANY_SEXP_IS_NUMBER(b)) {
-        log_error("Multiply expects two numbers");
-        return ANY_SEXP_ERROR;
+        binds = any_sexp_cons(any_sexp_cons(any_sexp_number(slot), any_sexp_cons(name, value)), binds);
     }
 
-    return any_sexp_number(ANY_SEXP_GET_NUMBER(a) * ANY_SEXP_GET_NUMBER(b));
-}
+    any_sexp_t body = eval_resolve(CADDR(sexp), resolver);
 
-static any_sexp_t eval_primitive_subtract(any_sexp_t a, any_sexp_t b)
-{
-    if (!ANY_SEXP_IS_NUMBER(a) || !ANY_SEXP_IS_NUMBER(b)) {
-        log_error("Subtract expects two numbers");
+    resolver->scope = scope;
+    resolver->slots = slots;
+
+    if (ANY_SEXP_IS_ERROR(body))
         return ANY_SEXP_ERROR;
+
+    // NOTE: The names are needed only to report the unassigned ones
+    if (!captures) {
+        for (any_sexp_t list = binds; !ANY_SEXP_IS_NIL(list); list = CDR(list))
+            ANY_SEXP_GET_CONS(CAR(list))->cdr = CDDR(CAR(list));
     }
 
-    return any_sexp_number(ANY_SEXP_GET_NUMBER(a) - ANY_SEXP_GET_NUMBER(b));
+    any_sexp_t let = builtin_symbols[captures ? EVAL_BUILTIN_FRAME_LETREC : EVAL_BUILTIN_FRAME_LET];
+    return any_sexp_cons(let, any_sexp_cons(any_sexp_reverse(binds), any_sexp_cons(body, ANY_SEXP_NIL)));
 }
 
-static any_sexp_t eval_primitive_divide(any_sexp_t a, any_sexp_t b)
+static any_sexp_t eval_resolve(any_sexp_t sexp, eval_resolver_t *resolver)
 {
-    if (!ANY_SEXP_IS_NUMBER(a) || !ANY_SEXP_IS_NUMBER(b)) {
-        log_error("Divide expects two numbers");
-        return ANY_SEXP_ERROR;
+    if (ANY_SEXP_IS_SYMBOL(sexp)) {
+        any_sexp_t slot = eval_find_symbol(sexp, resolver->scope);
+        return ANY_SEXP_IS_ERROR(slot)
+             ? sexp
+             : any_sexp_cons(builtin_symbols[EVAL_BUILTIN_LOCAL], slot);
     }
 
-    if (ANY_SEXP_GET_NUMBER(b) == 0) {
-        log_error("Division by zero");
-        return ANY_SEXP_ERROR;
-    }
+    if (!ANY_SEXP_IS_CONS(sexp))
+        return sexp;
+
+    any_sexp_t car = any_sexp_car(sexp);
+
+    switch (eval_dispatch(car)) {
+        // Not evaluated (or valid only at the top level)
+        //
+        case EVAL_BUILTIN_QUOTE:
+        case EVAL_BUILTIN_DEFINE:
+        case EVAL_BUILTIN_DEFMACRO:
+        case EVAL_BUILTIN_INCLUDE:
+        case EVAL_BUILTIN_EXPAND:
+            return sexp;
+
+        // (lambda (pars ...) body) => (#lambda refs pars body)
+        //
+        case EVAL_BUILTIN_LAMBDA:
+            return eval_is_lambda(sexp)
+                 ? eval_resolve_closure(CDR(sexp), resolver)
+                 : sexp;
+
+        // (let ((name value) ...) body) => (#let ((index . value) ...) body)
+        //
+        case EVAL_BUILTIN_LET:
+            if (eval_is_named_let(sexp))
+                return eval_resolve_named_let(sexp, resolver);
+
+            return eval_is_let(sexp)
+                 ? eval_resolve_let(sexp, resolver)
+                 : sexp;
+
+        case EVAL_BUILTIN_LETREC:
+            return eval_is_letrec(sexp)
+                 ? eval_resolve_letrec(sexp, resolver)
+                 : sexp;
+
+        // Not a builtin, the head is evaluated as well
+        //
+        case EVAL_BUILTIN_COUNT:
+            return eval_resolve_list(sexp, resolver);
 
-    return any_sexp_number(ANY_SEXP_GET_NUMBER(a) / ANY_SEXP_GET_NUMBER(b));
+        default: {
+            any_sexp_t cdr = eval_resolve_list(any_sexp_cdr(sexp), resolver);
+            return ANY_SEXP_IS_ERROR(cdr)
+                 ? ANY_SEXP_ERROR
+                 : any_sexp_cons(car, cdr);
+        }
+    }
 }
 
-static any_sexp_t eval_primitive_greater(any_sexp_t a, any_sexp_t b)
+// Closure
+//
+// Object with the code of the template and the values of the free variables
+// (see eval.h), so a call loads the layout of the frame and the resolved
+// body from the fields, without walking a list.
+
+// Removes the symbol from the free variables, returns true if it was there
+static bool eval_remove_fvs(any_sexp_t symbol, any_sexp_t *fvs)
 {
-    if (!ANY_SEXP_IS_NUMBER(a) || !ANY_SEXP_IS_NUMBER(b)) {
-        log_error("Greater expects two numbers");
-        return ANY_SEXP_ERROR;
+    for (any_sexp_t *list = fvs; !ANY_SEXP_IS_NIL(*list); list = &ANY_SEXP_GET_CONS(*list)->cdr) {
+        if (ANY_SEXP_IS_EQ(CAR(*list), symbol)) {
+            *list = CDR(*list);
+            return true;
+        }
     }
 
-    return any_sexp_number(ANY_SEXP_GET_NUMBER(a) > ANY_SEXP_GET_NUMBER(b));
+    return false;
 }
 
-static any_sexp_t eval_primitive_equal(any_sexp_t a, any_sexp_t b)
+any_sexp_t eval_template(any_sexp_t lambda)
 {
-    if (ANY_SEXP_IS_ERROR(a) || ANY_SEXP_IS_ERROR(b))
-        return ANY_SEXP_ERROR;
+    any_sexp_t template = eval_env_find(&templates, lambda);
+    if (!ANY_SEXP_IS_ERROR(template))
+        return template;
 
-    if (ANY_SEXP_IS_STRING(a) && ANY_SEXP_IS_STRING(b))
-        return !strcmp(ANY_SEXP_GET_STRING(a), ANY_SEXP_GET_STRING(b))
-             ? T
-             : ANY_SEXP_NIL;
+    // NOTE: The parameters are a list, so a symbol is the name
+    any_sexp_t name = ANY_SEXP_NIL;
+    any_sexp_t source = lambda;
 
-    if (ANY_SEXP_IS_SYMBOL(a) && ANY_SEXP_IS_SYMBOL(b))
-        return !strcmp(ANY_SEXP_GET_SYMBOL(a), ANY_SEXP_GET_SYMBOL(b))
-             ? T
-             : ANY_SEXP_NIL;
+    if (ANY_SEXP_IS_SYMBOL(CAR(source))) {
+        name = CAR(source);
+        source = CDR(source);
+    }
 
-    if (ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b))
-        return ANY_SEXP_GET_NUMBER(a) == ANY_SEXP_GET_NUMBER(b)
-             ? T
-             : ANY_SEXP_NIL;
+    any_sexp_t pars = CAR(source);
+    any_sexp_t body = CADR(source);
 
-    if (ANY_SEXP_IS_NIL(a) || ANY_SEXP_IS_NIL(b))
-        return T;
+    any_sexp_t fvs = eval_get_fvs(body, pars);
+    if (ANY_SEXP_IS_ERROR(fvs))
+        return ANY_SEXP_ERROR;
 
-    log_error("Incompatible arguments to =");
-    return ANY_SEXP_ERROR;
-}
+    bool self = !ANY_SEXP_IS_NIL(name) && eval_remove_fvs(name, &fvs);
 
-any_sexp_t eval_print(any_sexp_t sexp, any_sexp_t env)
-{
-    if (ANY_SEXP_IS_NIL(sexp))
-        return ANY_SEXP_NIL;
+    eval_resolver_t resolver = {
+        .scope = ANY_SEXP_NIL,
+        .slots = 0,
+        .size = 0,
+    };
 
-    if (!ANY_SEXP_IS_CONS(sexp)) {
-        log_value_error("Malformed print", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-        return ANY_SEXP_ERROR;
-    }
+    for (any_sexp_t list = fvs; !ANY_SEXP_IS_NIL(list); list = CDR(list))
+        eval_resolve_bind(&resolver, CAR(list), eval_resolve_slot(&resolver));
 
-    any_sexp_t value = eval(any_sexp_car(sexp), env);
-    if (ANY_SEXP_IS_ERROR(value))
+    if (self)
+        eval_resolve_bind(&resolver, name, eval_resolve_slot(&resolver));
+
+    for (any_sexp_t list = pars; !ANY_SEXP_IS_NIL(list); list = CDR(list))
+        eval_resolve_bind(&resolver, CAR(list), eval_resolve_slot(&resolver));
+
+    any_sexp_t resolved = eval_resolve(body, &resolver);
+    if (ANY_SEXP_IS_ERROR(resolved))
         return ANY_SEXP_ERROR;
 
-    any_sexp_print(value);
-    if (!ANY_SEXP_IS_NIL(any_sexp_cdr(sexp)))
-        putchar(' ');
+    log_value_trace("Lambda template",
+                    "g:pars", ANY_LOG_FORMATTER(any_sexp_fprint), pars,
+                    "g:fvs",  ANY_LOG_FORMATTER(any_sexp_fprint), fvs,
+                    "g:body", ANY_LOG_FORMATTER(any_sexp_fprint), resolved);
 
-    return eval_print(any_sexp_cdr(sexp), env);
-}
+    // NOTE: A rest parameter that is not the last fails at the call
+    size_t params = 0;
+    int rest = 0;
 
-any_sexp_t eval_display(any_sexp_t sexp, any_sexp_t env)
-{
-    if (ANY_SEXP_IS_NIL(sexp))
-        return ANY_SEXP_NIL;
+    for (any_sexp_t list = pars; !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        if (ANY_SEXP_IS_EQ(CAR(list), rest_symbol)) {
+            rest = ANY_SEXP_IS_NIL(CDR(list)) ? 1 : -1;
+            break;
+        }
 
-    if (!ANY_SEXP_IS_CONS(sexp)) {
-        log_value_error("Malformed print", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-        return ANY_SEXP_ERROR;
+        params++;
     }
 
-    any_sexp_t value = eval(any_sexp_car(sexp), env);
-    if (ANY_SEXP_IS_ERROR(value))
+    any_sexp_t code = any_sexp_object(EVAL_OBJECT_CODE, EVAL_CODE_LENGTH);
+    if (ANY_SEXP_IS_ERROR(code))
         return ANY_SEXP_ERROR;
 
-    any_sexp_writer_t writer;
-    any_sexp_writer_init(&writer, (any_sexp_putchar_t)fputc, stdout, ANY_SEXP_WRITER_BARE_STRING);
-    any_sexp_write(&writer, value);
+    EVAL_FIELD(code, EVAL_CODE_PARS) = pars;
+    EVAL_FIELD(code, EVAL_CODE_SIZE) = any_sexp_number(resolver.size);
+    EVAL_FIELD(code, EVAL_CODE_BODY) = resolved;
+    EVAL_FIELD(code, EVAL_CODE_PARAMS) = any_sexp_number(params);
+    EVAL_FIELD(code, EVAL_CODE_REST) = any_sexp_number(rest);
+    EVAL_FIELD(code, EVAL_CODE_SELF) = any_sexp_number(self);
 
-    if (!ANY_SEXP_IS_NIL(any_sexp_cdr(sexp)))
-        putchar(' ');
+    template = any_sexp_cons(fvs, code);
 
-    return eval_display(any_sexp_cdr(sexp), env);
+    eval_change_env(lambda, template, &templates);
+    return template;
 }
 
-any_sexp_t eval_list(any_sexp_t sexp, any_sexp_t env)
-{
-    if (ANY_SEXP_IS_NIL(sexp))
-        return ANY_SEXP_NIL;
+// Unassigned letrec names
+//
+// The slots of a #letrec hold a marker for each name (an object with the
+// name) until its value is evaluated. Reading a marker is an error, but a
+// closure can capture it, and the closures in the values can capture the
+// names of the values that follow. While a letrec runs, the captured
+// markers are recorded as pending, and when a value is set it replaces its
+// marker in the closures. This way the closures at any depth see the
+// values, and a closure that is called before a name is set fails.
+//
+// NOTE: The closures that captured a marker are cyclic once it is replaced,
+//       so they can not be saved in an image.
 
-    if (!ANY_SEXP_IS_CONS(sexp)) {
-        log_value_error("Malformed list", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-        return ANY_SEXP_ERROR;
-    }
+typedef struct {
+    any_sexp_t closure;
+    size_t index;
+} eval_pending_t;
 
-    any_sexp_t value = eval(any_sexp_car(sexp), env);
-    if (ANY_SEXP_IS_ERROR(value))
-        return ANY_SEXP_ERROR;
+static eval_pending_t *pending = NULL;
+static size_t pending_length = 0;
+static size_t pending_capacity = 0;
 
-    return any_sexp_cons(value, eval_list(any_sexp_cdr(sexp), env));
-}
+// Number of #letrec nodes running, the closures are not scanned without
+static size_t letrecs = 0;
 
-any_sexp_t eval_list2(any_sexp_t sexp, any_sexp_t env)
+static void eval_pend(any_sexp_t closure)
 {
-    if (ANY_SEXP_IS_NIL(sexp))
-        return ANY_SEXP_NIL;
+    any_sexp_t *values = EVAL_VALUES(closure) + 1;
 
-    if (!ANY_SEXP_IS_CONS(sexp)) {
-        log_value_error("Malformed list", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-        return ANY_SEXP_ERROR;
-    }
+    for (size_t i = 0; i < EVAL_CLOSURE_CAPTURED(closure); i++) {
+        if (!eval_is_unassigned(values[i]))
+            continue;
 
-    any_sexp_t value = eval(any_sexp_car(sexp), env);
-    if (ANY_SEXP_IS_ERROR(value))
-        return ANY_SEXP_ERROR;
+        if (pending_length == pending_capacity) {
+            pending_capacity = pending_capacity == 0 ? 16 : 2 * pending_capacity;
+            pending = realloc(pending, pending_capacity * sizeof(eval_pending_t));
+            if (pending == NULL)
+                log_panic("Failed to allocate the pending captures");
+        }
 
-    return ANY_SEXP_IS_NIL(any_sexp_cdr(sexp))
-        ? value
-        : any_sexp_cons(value, eval_list2(any_sexp_cdr(sexp), env));
+        pending[pending_length++] = (eval_pending_t) { closure, i };
+    }
 }
 
-any_sexp_t eval_if(any_sexp_t sexp, any_sexp_t env)
+any_sexp_t eval_unassigned(any_sexp_t name)
 {
-    any_sexp_t car = any_sexp_car(sexp);
+    any_sexp_t marker = any_sexp_object(EVAL_OBJECT_UNASSIGNED, 1);
+    if (!ANY_SEXP_IS_ERROR(marker))
+        EVAL_VALUES(marker)[0] = name;
+
+    return marker;
+}
+
+void eval_letrec_begin()
+{
+    letrecs++;
+}
+
+// Replaces the marker in the slot and in the closures that captured it
+void eval_letrec_assign(any_sexp_t *slot, any_sexp_t value)
+{
+    for (size_t i = 0; i < pending_length;) {
+        any_sexp_t *values = EVAL_VALUES(pending[i].closure) + 1;
+
+        if (ANY_SEXP_IS_EQ(values[pending[i].index], *slot)) {
+            values[pending[i].index] = value;
+            pending[i] = pending[--pending_length];
+        } else
+            i++;
+    }
+
+    *slot = value;
+}
+
+// NOTE: The pending captures of a letrec that fails are dropped with the
+//       outermost one, since the error fails it as well
+void eval_letrec_end()
+{
+    if (--letrecs == 0)
+        pending_length = 0;
+}
+
+any_sexp_t eval_closure(any_sexp_t code, const any_sexp_t *values, size_t count)
+{
+    any_sexp_t closure = any_sexp_object(EVAL_OBJECT_CLOSURE, count + 1);
+    if (ANY_SEXP_IS_ERROR(closure))
+        return ANY_SEXP_ERROR;
+
+    EVAL_CLOSURE_CODE(closure) = code;
+    if (values != NULL) {
+        memcpy(EVAL_VALUES(closure) + 1, values, count * sizeof(any_sexp_t));
+
+        if (letrecs > 0)
+            eval_pend(closure);
+    }
+
+    return closure;
+}
+
+static any_sexp_t eval_unassigned_error(any_sexp_t marker)
+{
+    log_value_error("Variable used before its definition",
+                    "g:name", ANY_LOG_FORMATTER(any_sexp_fprint), EVAL_VALUES(marker)[0]);
+    return ANY_SEXP_ERROR;
+}
+
+// Evaluates the references to the free variables straight in the closure
+//
+// NOTE: The locals are read as they are, since a letrec can capture its
+//       names before they are set (see eval_frame_letrec)
+static any_sexp_t eval_capture(any_sexp_t template, any_sexp_t refs, any_sexp_t *frame)
+{
+    size_t count = 0;
+    for (any_sexp_t list = refs; !ANY_SEXP_IS_NIL(list); list = CDR(list))
+        count++;
+
+    any_sexp_t closure = eval_closure(CDR(template), NULL, count);
+    if (ANY_SEXP_IS_ERROR(closure))
+        return ANY_SEXP_ERROR;
+
+    any_sexp_t *values = EVAL_VALUES(closure) + 1;
+    for (; !ANY_SEXP_IS_NIL(refs); refs = CDR(refs)) {
+        any_sexp_t ref = CAR(refs);
+        any_sexp_t value = ANY_SEXP_IS_CONS(ref)
+                         ? frame[ANY_SEXP_GET_NUMBER(CDR(ref))]
+                         : eval(ref, frame);
+        if (ANY_SEXP_IS_ERROR(value))
+            return ANY_SEXP_ERROR;
+
+        *values++ = value;
+    }
+
+    if (letrecs > 0)
+        eval_pend(closure);
+
+    return closure;
+}
+
+any_sexp_t eval_lambda(any_sexp_t lambda, any_sexp_t *frame)
+{
+    any_sexp_t template = eval_template(lambda);
+    if (ANY_SEXP_IS_ERROR(template))
+        return ANY_SEXP_ERROR;
+
+    // NOTE: Outside of a resolved body the free variables are all globals
+    return eval_capture(template, CAR(template), frame);
+}
+
+// Closures and code are written with their parameters, as their body is
+// resolved
+static int eval_write_object(any_sexp_writer_t *writer, any_sexp_t sexp)
+{
+    if (bignum_is_bignum(sexp)) {
+        size_t length;
+        char *digits = bignum_format(sexp, &length);
+        if (digits == NULL)
+            return EOF;
+
+        int written = any_sexp_writer_putn(writer, digits, length);
+        free(digits);
+        return written;
+    }
+
+    bool closure = eval_is_closure(sexp);
+    any_sexp_t code = closure ? EVAL_CLOSURE_CODE(sexp) : sexp;
+
+    int prefix = any_sexp_writer_puts(writer, closure ? "<lambda " : "<code ");
+    if (prefix == EOF)
+        return EOF;
+
+    int pars = any_sexp_write(writer, EVAL_FIELD(code, EVAL_CODE_PARS));
+    if (pars == EOF || any_sexp_writer_putc(writer, '>') == EOF)
+        return EOF;
+
+    return prefix + pars + 1;
+}
+
+any_sexp_t *eval_push_frame(size_t size)
+{
+    if (eval_stack_top + size > EVAL_STACK_SIZE) {
+        log_error("Stack overflow");
+        return NULL;
+    }
+
+    any_sexp_t *frame = eval_stack + eval_stack_top;
+    for (size_t i = 0; i < size; i++)
+        frame[i] = ANY_SEXP_NIL;
+
+    eval_stack_top += size;
+    return frame;
+}
+
+// Tail position
+//
+// The expressions in tail position are not evaluated with a nested call,
+// instead they are stored in the tail and the loop in eval continues with
+// them. This way tail calls run in constant C stack.
+//
+// NOTE: The return value is ignored when the tail is pending
+
+static inline any_sexp_t eval_tail(eval_tail_t *tail, any_sexp_t sexp, any_sexp_t *frame)
+{
+    tail->sexp = sexp;
+    tail->frame = frame;
+    tail->pending = true;
+    return ANY_SEXP_NIL;
+}
+
+any_sexp_t eval_resolve_toplevel(any_sexp_t sexp, size_t *size)
+{
+    eval_resolver_t resolver = {
+        .scope = ANY_SEXP_NIL,
+        .slots = 0,
+        .size = 0,
+    };
+
+    any_sexp_t resolved = eval_resolve(sexp, &resolver);
+    *size = resolver.size;
+    return resolved;
+}
+
+any_sexp_t eval_let(any_sexp_t let, any_sexp_t *frame, eval_tail_t *tail)
+{
+    // NOTE: A let or letrec outside of a resolved body gets its own frame
+    size_t size;
+    any_sexp_t resolved = eval_resolve_toplevel(let, &size);
+    if (ANY_SEXP_IS_ERROR(resolved))
+        return ANY_SEXP_ERROR;
+
+    // NOTE: The frame is released by eval
+    any_sexp_t *let_frame = eval_push_frame(size);
+    if (let_frame == NULL)
+        return ANY_SEXP_ERROR;
+
+    return eval_tail(tail, resolved, let_frame);
+}
+
+any_sexp_t eval_frame_let(any_sexp_t binds, any_sexp_t body, any_sexp_t *frame, eval_tail_t *tail)
+{
+    for (; !ANY_SEXP_IS_NIL(binds); binds = CDR(binds)) {
+        any_sexp_t value = eval(CDAR(binds), frame);
+        if (ANY_SEXP_IS_ERROR(value))
+            return ANY_SEXP_ERROR;
+
+        frame[ANY_SEXP_GET_NUMBER(CAAR(binds))] = value;
+    }
+
+    return eval_tail(tail, body, frame);
+}
+
+// NOTE: The slots hold the markers of the names until the values are set in
+//       order, so a value can use the names before it
+any_sexp_t eval_frame_letrec(any_sexp_t binds, any_sexp_t body, any_sexp_t *frame, eval_tail_t *tail)
+{
+    for (any_sexp_t list = binds; !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        any_sexp_t marker = eval_unassigned(CADR(CAR(list)));
+        if (ANY_SEXP_IS_ERROR(marker))
+            return ANY_SEXP_ERROR;
+
+        frame[ANY_SEXP_GET_NUMBER(CAAR(list))] = marker;
+    }
+
+    eval_letrec_begin();
+
+    for (any_sexp_t list = binds; !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        any_sexp_t value = eval(CDDR(CAR(list)), frame);
+        if (ANY_SEXP_IS_ERROR(value)) {
+            eval_letrec_end();
+            return ANY_SEXP_ERROR;
+        }
+
+        eval_letrec_assign(&frame[ANY_SEXP_GET_NUMBER(CAAR(list))], value);
+    }
+
+    eval_letrec_end();
+    return eval_tail(tail, body, frame);
+}
+
+any_sexp_t eval_begin(any_sexp_t list, any_sexp_t *frame, eval_tail_t *tail)
+{
+    if (ANY_SEXP_IS_NIL(list))
+        return ANY_SEXP_NIL;
+
+    while (!ANY_SEXP_IS_NIL(any_sexp_cdr(list))) {
+        if (ANY_SEXP_IS_ERROR(eval(any_sexp_car(list), frame)))
+            return ANY_SEXP_ERROR;
+
+        list = any_sexp_cdr(list);
+    }
+
+    return eval_tail(tail, any_sexp_car(list), frame);
+}
+
+// Fill the frame with the captured values and the closure itself if the
+// code refers to it, returns the slot of the first parameter
+static size_t eval_bind_closure(any_sexp_t *frame, any_sexp_t lambda)
+{
+    size_t captured = EVAL_CLOSURE_CAPTURED(lambda);
+    memcpy(frame, EVAL_VALUES(lambda) + 1, captured * sizeof(any_sexp_t));
+
+    if (!ANY_SEXP_GET_NUMBER(EVAL_FIELD(EVAL_CLOSURE_CODE(lambda), EVAL_CODE_SELF)))
+        return captured;
+
+    frame[captured] = lambda;
+    return captured + 1;
+}
+
+// Fill the frame of the closure with the arguments already evaluated in a
+// list, as for apply and the macros
+static bool eval_bind_args(any_sexp_t *frame, any_sexp_t lambda, any_sexp_t args)
+{
+    any_sexp_t code = EVAL_CLOSURE_CODE(lambda);
+    size_t params = ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_PARAMS));
+    intptr_t rest = ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_REST));
+
+    if (rest < 0) {
+        log_error("Rest parameter should be the last");
+        return false;
+    }
+
+    size_t i = eval_bind_closure(frame, lambda);
+
+    for (size_t end = i + params; i < end; i++) {
+        if (ANY_SEXP_IS_NIL(args)) {
+            log_error("Too few arguments for parameters");
+            return false;
+        }
+
+        frame[i] = CAR(args);
+        args = CDR(args);
+    }
+
+    if (rest) {
+        frame[i] = args;
+        return true;
+    }
+
+    if (!ANY_SEXP_IS_NIL(args)) {
+        log_error("Too many arguments for parameters");
+        return false;
+    }
+
+    return true;
+}
+
+static any_sexp_t eval_lambda_tail(any_sexp_t lambda, any_sexp_t args, eval_tail_t *tail)
+{
+    any_sexp_t code = EVAL_CLOSURE_CODE(lambda);
+    any_sexp_t size = EVAL_FIELD(code, EVAL_CODE_SIZE);
+    any_sexp_t body = EVAL_FIELD(code, EVAL_CODE_BODY);
+
+    log_value_trace("Lambda call",
+                    "g:lambda", ANY_LOG_FORMATTER(any_sexp_fprint), lambda,
+                    "g:args", ANY_LOG_FORMATTER(any_sexp_fprint), args,
+                    "g:body", ANY_LOG_FORMATTER(any_sexp_fprint), body);
+
+    // NOTE: The arguments are already evaluated, so the frames pushed by
+    //       the current evaluation are not needed anymore
+    //
+    eval_stack_top = tail->base;
+
+    any_sexp_t *frame = eval_push_frame(ANY_SEXP_GET_NUMBER(size));
+    if (frame == NULL)
+        return ANY_SEXP_ERROR;
+
+    // Eval lambda body with the new frame
+    return eval_bind_args(frame, lambda, args)
+         ? eval_tail(tail, body, frame)
+         : ANY_SEXP_ERROR;
+}
+
+any_sexp_t eval_lambda_call(any_sexp_t lambda, any_sexp_t args)
+{
+    eval_tail_t tail = {
+        .base = eval_stack_top,
+        .pending = false,
+    };
+
+    any_sexp_t value = eval_lambda_tail(lambda, args, &tail);
+    if (tail.pending)
+        value = eval(tail.sexp, tail.frame);
+
+    eval_stack_top = tail.base;
+    return value;
+}
+
+// Evaluates the arguments of a call straight in the frame of the callee,
+// which is pushed above the current one and then moved down to the base of
+// the tail, so that no list is built except for a rest parameter.
+//
+// NOTE: The frames never escape, since the closures copy the values they
+//       capture, so they can always live on the stack
+static any_sexp_t eval_call_tail(any_sexp_t lambda, any_sexp_t args, any_sexp_t *frame, eval_tail_t *tail)
+{
+    any_sexp_t code = EVAL_CLOSURE_CODE(lambda);
+    size_t size = ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_SIZE));
+    size_t params = ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_PARAMS));
+    intptr_t rest = ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_REST));
+    any_sexp_t body = EVAL_FIELD(code, EVAL_CODE_BODY);
+
+    if (rest < 0) {
+        log_error("Rest parameter should be the last");
+        return ANY_SEXP_ERROR;
+    }
+
+    any_sexp_t *callee = eval_push_frame(size);
+    if (callee == NULL)
+        return ANY_SEXP_ERROR;
+
+    // NOTE: The captured values and the closure are copied at the end, as
+    //       the arguments can refer to the slots of the current frame
+    size_t first = EVAL_CLOSURE_CAPTURED(lambda) + ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_SELF));
+
+    for (size_t i = first; i < first + params; i++) {
+        if (!ANY_SEXP_IS_CONS(args)) {
+            log_error("Too few arguments for parameters");
+            return ANY_SEXP_ERROR;
+        }
+
+        any_sexp_t value = eval(CAR(args), frame);
+        if (ANY_SEXP_IS_ERROR(value))
+            return ANY_SEXP_ERROR;
+
+        callee[i] = value;
+        args = CDR(args);
+    }
+
+    if (rest) {
+        any_sexp_t list = eval_list(args, frame);
+        if (ANY_SEXP_IS_ERROR(list))
+            return ANY_SEXP_ERROR;
+
+        callee[first + params] = list;
+    } else if (!ANY_SEXP_IS_NIL(args)) {
+        log_error("Too many arguments for parameters");
+        return ANY_SEXP_ERROR;
+    }
+
+    log_value_trace("Lambda call",
+                    "g:lambda", ANY_LOG_FORMATTER(any_sexp_fprint), lambda,
+                    "g:body", ANY_LOG_FORMATTER(any_sexp_fprint), body);
+
+    // NOTE: The arguments are evaluated, so the frames pushed by the
+    //       current evaluation are not needed anymore
+    //
+    any_sexp_t *base = eval_stack + tail->base;
+    memmove(base, callee, size * sizeof(any_sexp_t));
+    eval_stack_top = tail->base + size;
+
+    eval_bind_closure(base, lambda);
+    return eval_tail(tail, body, base);
+}
+
+// Caller of the tree-walker
+static any_sexp_t eval_call_values(any_sexp_t lambda, const any_sexp_t *args, size_t argc)
+{
+    any_sexp_t code = EVAL_CLOSURE_CODE(lambda);
+    size_t params = ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_PARAMS));
+    intptr_t rest = ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_REST));
+
+    if (rest < 0) {
+        log_error("Rest parameter should be the last");
+        return ANY_SEXP_ERROR;
+    }
+
+    if (argc < params) {
+        log_error("Too few arguments for parameters");
+        return ANY_SEXP_ERROR;
+    }
+
+    if (!rest && argc > params) {
+        log_error("Too many arguments for parameters");
+        return ANY_SEXP_ERROR;
+    }
+
+    size_t top = eval_stack_top;
+
+    any_sexp_t *frame = eval_push_frame(ANY_SEXP_GET_NUMBER(EVAL_FIELD(code, EVAL_CODE_SIZE)));
+    if (frame == NULL)
+        return ANY_SEXP_ERROR;
+
+    size_t first = eval_bind_closure(frame, lambda);
+    memcpy(frame + first, args, params * sizeof(any_sexp_t));
+
+    // NOTE: The rest list is built in the frame, where it is reachable
+    any_sexp_t value = ANY_SEXP_NIL;
+    for (size_t i = argc; i > params && !ANY_SEXP_IS_ERROR(value); i--)
+        value = frame[first + params] = any_sexp_cons(args[i - 1], frame[first + params]);
+
+    if (!ANY_SEXP_IS_ERROR(value))
+        value = eval(EVAL_FIELD(code, EVAL_CODE_BODY), frame);
+
+    eval_stack_top = top;
+    return value;
+}
+
+// Calls the closures of the native functions, the tree-walker unless changed
+static eval_caller_t caller = eval_call_values;
+
+void eval_set_caller(eval_caller_t new_caller)
+{
+    caller = new_caller;
+}
+
+any_sexp_t eval_call(any_sexp_t lambda, const any_sexp_t *args, size_t argc)
+{
+    return caller(lambda, args, argc);
+}
+
+any_sexp_t eval_native(eval_builtin_t builtin, const any_sexp_t *args, size_t argc)
+{
+    return list_is_native(builtin)
+         ? list_native(builtin, args, argc)
+         : eval_arithmetic(builtin, args, argc);
+}
+
+// Arithmetic
+//
+// The arithmetic and the comparisons take any number of arguments, as in
+// scheme: (- a) negates, (/ a) is the inverse, and the comparisons are
+// chained, so (< a b c) is (and (< a b) (< b c)). The arguments are checked
+// to be integers once each, then they are folded with the binary primitives.
+//
+// The binary primitives are the fast path for two numbers, used by the VM.
+// They check the overflow with the builtins of the compiler and the range of
+// the numbers, and the results that do not fit are computed as bignums (see
+// bignum.h), as well as the ones with a bignum argument. With a float
+// argument, the other one is converted and the result is a float, so the
+// division by zero gives an infinity or NaN instead of an error.
+
+static any_sexp_t eval_compare(eval_builtin_t builtin, intptr_t a, intptr_t b)
+{
+    bool holds;
+
+    switch (builtin) {
+        case EVAL_BUILTIN_GREATER:
+            holds = a > b;
+            break;
+
+        case EVAL_BUILTIN_LESS:
+            holds = a < b;
+            break;
+
+        case EVAL_BUILTIN_GREATER_EQUAL:
+            holds = a >= b;
+            break;
+
+        case EVAL_BUILTIN_EQUAL:
+            holds = a == b;
+            break;
+
+        default:
+            holds = a <= b;
+            break;
+    }
+
+    return holds ? T : ANY_SEXP_NIL;
+}
+
+static bool eval_is_number(any_sexp_t sexp)
+{
+    return bignum_is_integer(sexp) || ANY_SEXP_IS_FLOAT(sexp);
+}
+
+static double eval_float_value(any_sexp_t sexp)
+{
+    if (ANY_SEXP_IS_FLOAT(sexp))
+        return ANY_SEXP_GET_FLOAT(sexp);
+
+    return ANY_SEXP_IS_NUMBER(sexp)
+         ? (double)ANY_SEXP_GET_NUMBER(sexp)
+         : bignum_to_double(sexp);
+}
+
+static any_sexp_t eval_floats(eval_builtin_t builtin, double a, double b)
+{
+    bool holds;
+
+    switch (builtin) {
+        case EVAL_BUILTIN_ADD:
+            return any_sexp_float(a + b);
+
+        case EVAL_BUILTIN_SUBTRACT:
+            return any_sexp_float(a - b);
+
+        case EVAL_BUILTIN_MULTIPLY:
+            return any_sexp_float(a * b);
+
+        case EVAL_BUILTIN_DIVIDE:
+            return any_sexp_float(a / b);
+
+        case EVAL_BUILTIN_GREATER:
+            holds = a > b;
+            break;
+
+        case EVAL_BUILTIN_LESS:
+            holds = a < b;
+            break;
+
+        case EVAL_BUILTIN_GREATER_EQUAL:
+            holds = a >= b;
+            break;
+
+        case EVAL_BUILTIN_EQUAL:
+            holds = a == b;
+            break;
+
+        default:
+            holds = a <= b;
+            break;
+    }
+
+    return holds ? T : ANY_SEXP_NIL;
+}
+
+// Two integers, which are not both numbers or overflow
+static any_sexp_t eval_integers(eval_builtin_t builtin, any_sexp_t a, any_sexp_t b)
+{
+    switch (builtin) {
+        case EVAL_BUILTIN_ADD:
+            return bignum_add(a, b);
+
+        case EVAL_BUILTIN_SUBTRACT:
+            return bignum_subtract(a, b);
+
+        case EVAL_BUILTIN_MULTIPLY:
+            return bignum_multiply(a, b);
+
+        case EVAL_BUILTIN_DIVIDE:
+            if (ANY_SEXP_IS_NUMBER(b) && ANY_SEXP_GET_NUMBER(b) == 0) {
+                log_error("Division by zero");
+                return ANY_SEXP_ERROR;
+            }
+
+            return bignum_divide(a, b);
+
+        default:
+            return eval_compare(builtin, bignum_compare(a, b), 0);
+    }
+}
+
+// Two numbers of any type, which are not both numbers or overflow
+static any_sexp_t eval_numbers(eval_builtin_t builtin, any_sexp_t a, any_sexp_t b)
+{
+    return ANY_SEXP_IS_FLOAT(a) || ANY_SEXP_IS_FLOAT(b)
+         ? eval_floats(builtin, eval_float_value(a), eval_float_value(b))
+         : eval_integers(builtin, a, b);
+}
+
+any_sexp_t eval_arithmetic(eval_builtin_t builtin, const any_sexp_t *args, size_t argc)
+{
+    // NOTE: = compares the other types as well (see eval_primitive_equal)
+    if (builtin == EVAL_BUILTIN_EQUAL) {
+        for (size_t i = 1; i < argc; i++) {
+            any_sexp_t equal = eval_primitive_equal(args[i - 1], args[i]);
+            if (!ANY_SEXP_IS_EQ(equal, T))
+                return equal;
+        }
+
+        return T;
+    }
+
+    for (size_t i = 0; i < argc; i++) {
+        if (ANY_SEXP_IS_ERROR(args[i]))
+            return ANY_SEXP_ERROR;
+
+        if (!eval_is_number(args[i])) {
+            log_value_error("Expected number",
+                            "s:function", builtin_names[builtin],
+                            "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), args[i]);
+            return ANY_SEXP_ERROR;
+        }
+    }
+
+    if (argc == 0 && (builtin == EVAL_BUILTIN_SUBTRACT || builtin == EVAL_BUILTIN_DIVIDE)) {
+        log_value_error("Expected at least one number", "s:function", builtin_names[builtin]);
+        return ANY_SEXP_ERROR;
+    }
+
+    any_sexp_t result;
+    size_t i = 1;
+
+    switch (builtin) {
+        case EVAL_BUILTIN_ADD:
+            result = any_sexp_number(0);
+            for (i = 0; i < argc && !ANY_SEXP_IS_ERROR(result); i++)
+                result = eval_primitive_add(result, args[i]);
+            break;
+
+        case EVAL_BUILTIN_MULTIPLY:
+            result = any_sexp_number(1);
+            for (i = 0; i < argc && !ANY_SEXP_IS_ERROR(result); i++)
+                result = eval_primitive_multiply(result, args[i]);
+            break;
+
+        case EVAL_BUILTIN_SUBTRACT:
+            // NOTE: Negated as 0 - x, except the floats as 0.0 - 0.0 is not -0.0
+            if (argc == 1 && ANY_SEXP_IS_FLOAT(args[0]))
+                return any_sexp_float(-ANY_SEXP_GET_FLOAT(args[0]));
+
+            if (argc == 1)
+                return eval_primitive_subtract(any_sexp_number(0), args[0]);
+
+            for (result = args[0]; i < argc && !ANY_SEXP_IS_ERROR(result); i++)
+                result = eval_primitive_subtract(result, args[i]);
+            break;
+
+        case EVAL_BUILTIN_DIVIDE:
+            if (argc == 1)
+                return eval_primitive_divide(any_sexp_number(1), args[0]);
+
+            for (result = args[0]; i < argc && !ANY_SEXP_IS_ERROR(result); i++)
+                result = eval_primitive_divide(result, args[i]);
+            break;
+
+        default:
+            for (; i < argc; i++) {
+                any_sexp_t a = args[i - 1], b = args[i];
+                any_sexp_t holds = ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b)
+                                 ? eval_compare(builtin, ANY_SEXP_GET_NUMBER(a), ANY_SEXP_GET_NUMBER(b))
+                                 : eval_numbers(builtin, a, b);
+
+                if (ANY_SEXP_IS_NIL(holds))
+                    return ANY_SEXP_NIL;
+            }
+
+            return T;
+    }
+
+    return result;
+}
+
+// Falls back to eval_arithmetic for the errors
+static any_sexp_t eval_binary(eval_builtin_t builtin, any_sexp_t a, any_sexp_t b)
+{
+    if (eval_is_number(a) && eval_is_number(b))
+        return eval_numbers(builtin, a, b);
+
+    any_sexp_t args[2] = { a, b };
+    return eval_arithmetic(builtin, args, 2);
+}
+
+any_sexp_t eval_primitive_add(any_sexp_t a, any_sexp_t b)
+{
+    intptr_t result;
+
+    if (ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b) &&
+        !__builtin_add_overflow(ANY_SEXP_GET_NUMBER(a), ANY_SEXP_GET_NUMBER(b), &result) &&
+        ANY_SEXP_NUMBER_FITS(result))
+        return any_sexp_number(result);
+
+    return eval_binary(EVAL_BUILTIN_ADD, a, b);
+}
+
+any_sexp_t eval_primitive_multiply(any_sexp_t a, any_sexp_t b)
+{
+    intptr_t result;
+
+    if (ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b) &&
+        !__builtin_mul_overflow(ANY_SEXP_GET_NUMBER(a), ANY_SEXP_GET_NUMBER(b), &result) &&
+        ANY_SEXP_NUMBER_FITS(result))
+        return any_sexp_number(result);
+
+    return eval_binary(EVAL_BUILTIN_MULTIPLY, a, b);
+}
+
+any_sexp_t eval_primitive_subtract(any_sexp_t a, any_sexp_t b)
+{
+    intptr_t result;
+
+    if (ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b) &&
+        !__builtin_sub_overflow(ANY_SEXP_GET_NUMBER(a), ANY_SEXP_GET_NUMBER(b), &result) &&
+        ANY_SEXP_NUMBER_FITS(result))
+        return any_sexp_number(result);
+
+    return eval_binary(EVAL_BUILTIN_SUBTRACT, a, b);
+}
+
+// NOTE: The only quotient which overflows is the one of the minimum by -1
+any_sexp_t eval_primitive_divide(any_sexp_t a, any_sexp_t b)
+{
+    return ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b) && ANY_SEXP_GET_NUMBER(b) != 0 && ANY_SEXP_GET_NUMBER(b) != -1
+         ? any_sexp_number(ANY_SEXP_GET_NUMBER(a) / ANY_SEXP_GET_NUMBER(b))
+         : eval_binary(EVAL_BUILTIN_DIVIDE, a, b);
+}
+
+any_sexp_t eval_primitive_greater(any_sexp_t a, any_sexp_t b)
+{
+    return ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b)
+         ? eval_compare(EVAL_BUILTIN_GREATER, ANY_SEXP_GET_NUMBER(a), ANY_SEXP_GET_NUMBER(b))
+         : eval_binary(EVAL_BUILTIN_GREATER, a, b);
+}
+
+any_sexp_t eval_primitive_less(any_sexp_t a, any_sexp_t b)
+{
+    return ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b)
+         ? eval_compare(EVAL_BUILTIN_LESS, ANY_SEXP_GET_NUMBER(a), ANY_SEXP_GET_NUMBER(b))
+         : eval_binary(EVAL_BUILTIN_LESS, a, b);
+}
+
+any_sexp_t eval_primitive_greater_equal(any_sexp_t a, any_sexp_t b)
+{
+    return ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b)
+         ? eval_compare(EVAL_BUILTIN_GREATER_EQUAL, ANY_SEXP_GET_NUMBER(a), ANY_SEXP_GET_NUMBER(b))
+         : eval_binary(EVAL_BUILTIN_GREATER_EQUAL, a, b);
+}
+
+any_sexp_t eval_primitive_less_equal(any_sexp_t a, any_sexp_t b)
+{
+    return ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b)
+         ? eval_compare(EVAL_BUILTIN_LESS_EQUAL, ANY_SEXP_GET_NUMBER(a), ANY_SEXP_GET_NUMBER(b))
+         : eval_binary(EVAL_BUILTIN_LESS_EQUAL, a, b);
+}
+
+any_sexp_t eval_primitive_equal(any_sexp_t a, any_sexp_t b)
+{
+    if (ANY_SEXP_IS_ERROR(a) || ANY_SEXP_IS_ERROR(b))
+        return ANY_SEXP_ERROR;
+
+    if (ANY_SEXP_IS_NUMBER(a) && ANY_SEXP_IS_NUMBER(b))
+        return ANY_SEXP_GET_NUMBER(a) == ANY_SEXP_GET_NUMBER(b)
+             ? T
+             : ANY_SEXP_NIL;
+
+    if (eval_is_number(a) && eval_is_number(b))
+        return eval_numbers(EVAL_BUILTIN_EQUAL, a, b);
+
+    if (ANY_SEXP_IS_STRING(a) && ANY_SEXP_IS_STRING(b))
+        return !strcmp(ANY_SEXP_GET_STRING(a), ANY_SEXP_GET_STRING(b))
+             ? T
+             : ANY_SEXP_NIL;
+
+    if (ANY_SEXP_IS_SYMBOL(a) && ANY_SEXP_IS_SYMBOL(b))
+        return ANY_SEXP_IS_EQ(a, b)
+             ? T
+             : ANY_SEXP_NIL;
+
+    if (ANY_SEXP_IS_NIL(a) || ANY_SEXP_IS_NIL(b))
+        return T;
+
+    log_error("Incompatible arguments to =");
+    return ANY_SEXP_ERROR;
+}
+
+// The two arguments case of the arithmetic, which is the common one
+static any_sexp_t eval_primitive_binary(eval_builtin_t builtin, any_sexp_t a, any_sexp_t b)
+{
+    switch (builtin) {
+        case EVAL_BUILTIN_ADD:
+            return eval_primitive_add(a, b);
+
+        case EVAL_BUILTIN_MULTIPLY:
+            return eval_primitive_multiply(a, b);
+
+        case EVAL_BUILTIN_EQUAL:
+            return eval_primitive_equal(a, b);
+
+        case EVAL_BUILTIN_GREATER:
+            return eval_primitive_greater(a, b);
+
+        case EVAL_BUILTIN_SUBTRACT:
+            return eval_primitive_subtract(a, b);
+
+        case EVAL_BUILTIN_DIVIDE:
+            return eval_primitive_divide(a, b);
+
+        case EVAL_BUILTIN_LESS:
+            return eval_primitive_less(a, b);
+
+        case EVAL_BUILTIN_GREATER_EQUAL:
+            return eval_primitive_greater_equal(a, b);
+
+        case EVAL_BUILTIN_LESS_EQUAL:
+            return eval_primitive_less_equal(a, b);
+
+        default:
+            return list_native(builtin, (any_sexp_t[]) { a, b }, 2);
+    }
+}
+
+// NOTE: Must fit the arguments of the arithmetic in the common cases
+#define EVAL_NATIVE_ARGS 8
+
+// Evaluates the arguments of a native function in an array on the C stack,
+// or on the frame stack when they are more, where the collector finds them
+static any_sexp_t eval_native_form(eval_builtin_t builtin, any_sexp_t args, any_sexp_t *frame)
+{
+    size_t argc = 0;
+    for (any_sexp_t list = args; ANY_SEXP_IS_CONS(list); list = CDR(list))
+        argc++;
+
+    size_t top = eval_stack_top;
+    any_sexp_t local[EVAL_NATIVE_ARGS];
+    any_sexp_t *values = argc <= EVAL_NATIVE_ARGS ? local : eval_push_frame(argc);
+    if (values == NULL)
+        return ANY_SEXP_ERROR;
+
+    any_sexp_t value = ANY_SEXP_NIL;
+    for (size_t i = 0; i < argc && !ANY_SEXP_IS_ERROR(value); i++, args = CDR(args))
+        value = values[i] = eval(CAR(args), frame);
+
+    if (!ANY_SEXP_IS_ERROR(value))
+        value = argc == 2
+              ? eval_primitive_binary(builtin, values[0], values[1])
+              : eval_native(builtin, values, argc);
+
+    eval_stack_top = top;
+    return value;
+}
+
+
+void eval_write(any_sexp_t value, int flags, bool space)
+{
+    any_sexp_writer_t writer;
+    any_sexp_writer_file_init(&writer, stdout, flags);
+
+    any_sexp_write(&writer, value);
+    if (space)
+        any_sexp_writer_putc(&writer, ' ');
+
+    any_sexp_writer_flush(&writer);
+}
+
+any_sexp_t eval_print(any_sexp_t sexp, any_sexp_t *frame)
+{
+    if (ANY_SEXP_IS_NIL(sexp))
+        return ANY_SEXP_NIL;
+
+    if (!ANY_SEXP_IS_CONS(sexp)) {
+        log_value_error("Malformed print", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+        return ANY_SEXP_ERROR;
+    }
+
+    any_sexp_t value = eval(any_sexp_car(sexp), frame);
+    if (ANY_SEXP_IS_ERROR(value))
+        return ANY_SEXP_ERROR;
+
+    eval_write(value, ANY_SEXP_WRITER_DEFAULT, !ANY_SEXP_IS_NIL(any_sexp_cdr(sexp)));
+
+    return eval_print(any_sexp_cdr(sexp), frame);
+}
+
+any_sexp_t eval_display(any_sexp_t sexp, any_sexp_t *frame)
+{
+    if (ANY_SEXP_IS_NIL(sexp))
+        return ANY_SEXP_NIL;
+
+    if (!ANY_SEXP_IS_CONS(sexp)) {
+        log_value_error("Malformed print", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+        return ANY_SEXP_ERROR;
+    }
+
+    any_sexp_t value = eval(any_sexp_car(sexp), frame);
+    if (ANY_SEXP_IS_ERROR(value))
+        return ANY_SEXP_ERROR;
+
+    eval_write(value, ANY_SEXP_WRITER_BARE_STRING, !ANY_SEXP_IS_NIL(any_sexp_cdr(sexp)));
+
+    return eval_display(any_sexp_cdr(sexp), frame);
+}
+
+any_sexp_t eval_list(any_sexp_t sexp, any_sexp_t *frame)
+{
+    if (ANY_SEXP_IS_NIL(sexp))
+        return ANY_SEXP_NIL;
+
+    if (!ANY_SEXP_IS_CONS(sexp)) {
+        log_value_error("Malformed list", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+        return ANY_SEXP_ERROR;
+    }
+
+    any_sexp_t value = eval(any_sexp_car(sexp), frame);
+    if (ANY_SEXP_IS_ERROR(value))
+        return ANY_SEXP_ERROR;
+
+    any_sexp_t rest = eval_list(any_sexp_cdr(sexp), frame);
+    return ANY_SEXP_IS_ERROR(rest)
+         ? ANY_SEXP_ERROR
+         : any_sexp_cons(value, rest);
+}
+
+any_sexp_t eval_list2(any_sexp_t sexp, any_sexp_t *frame)
+{
+    if (ANY_SEXP_IS_NIL(sexp))
+        return ANY_SEXP_NIL;
+
+    if (!ANY_SEXP_IS_CONS(sexp)) {
+        log_value_error("Malformed list", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+        return ANY_SEXP_ERROR;
+    }
+
+    any_sexp_t value = eval(any_sexp_car(sexp), frame);
+    if (ANY_SEXP_IS_ERROR(value))
+        return ANY_SEXP_ERROR;
+
+    if (ANY_SEXP_IS_NIL(any_sexp_cdr(sexp)))
+        return value;
+
+    any_sexp_t rest = eval_list2(any_sexp_cdr(sexp), frame);
+    return ANY_SEXP_IS_ERROR(rest)
+         ? ANY_SEXP_ERROR
+         : any_sexp_cons(value, rest);
+}
+
+any_sexp_t eval_if(any_sexp_t sexp, any_sexp_t *frame, eval_tail_t *tail)
+{
+    any_sexp_t car = any_sexp_car(sexp);
     any_sexp_t cdr = any_sexp_cdr(sexp);
     any_sexp_t cadr = any_sexp_car(cdr);
 
@@ -525,26 +1830,24 @@ any_sexp_t eval_if(any_sexp_t sexp, any_sexp_t env)
         return ANY_SEXP_ERROR;
     }
 
-    any_sexp_t cond = eval(car, env);
+    any_sexp_t cond = eval(car, frame);
     if (ANY_SEXP_IS_ERROR(cond))
         return ANY_SEXP_ERROR;
 
-    if (!ANY_SEXP_IS_NIL(cond))
-        return eval(cadr, env);
-
-    return eval(caddr, env);
+    return eval_tail(tail, ANY_SEXP_IS_NIL(cond) ? caddr : cadr, frame);
 }
 
-any_sexp_t eval_cons(any_sexp_t sexp, any_sexp_t env)
+any_sexp_t eval_cons(any_sexp_t sexp, any_sexp_t *frame, eval_tail_t *tail)
 {
     any_sexp_cons_t *cons = ANY_SEXP_GET_CONS(sexp);
 
-    // Handle builtin functions
-    if (ANY_SEXP_IS_SYMBOL(cons->car)) {
+    eval_builtin_t builtin = eval_dispatch(cons->car);
 
+    // Handle builtin functions
+    switch (builtin) {
         // (quote exp) <=> (cons 'quote (cons exp nil))
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "quote")) {
+        case EVAL_BUILTIN_QUOTE: {
             if (!ANY_SEXP_IS_NIL(any_sexp_cdr(cons->cdr))) {
                 log_value_error("Malformed quote", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
                 return ANY_SEXP_ERROR;
@@ -556,128 +1859,107 @@ any_sexp_t eval_cons(any_sexp_t sexp, any_sexp_t env)
 
         // (gensym)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "gensym")) {
+        case EVAL_BUILTIN_GENSYM: {
             if (!ANY_SEXP_IS_NIL(cons->cdr)) {
                 log_value_error("Malformed gensym", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
                 return ANY_SEXP_ERROR;
             }
 
-            // NOTE: This is not particularly solid. Ideally symbols should be interned
-            //       and gensym'd symbols should not, so they are unique.
+            // NOTE: The symbol is not interned, so it is unique by identity.
+            //       The counter is there only to make the expansions readable.
             //
-            static unsigned int gensym_id = 0;
             char buffer[30];
             int length = snprintf(buffer, sizeof(buffer), "gensym(%u)", gensym_id++);
 
             log_trace("Gensym");
-            return any_sexp_symbol(buffer, length);
+            return any_sexp_symbol_uninterned(buffer, length);
         }
 
         // (eval exp)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "eval")) {
+        case EVAL_BUILTIN_EVAL: {
             if (!ANY_SEXP_IS_NIL(any_sexp_cdr(cons->cdr))) {
                 log_value_error("Malformed eval", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
                 return ANY_SEXP_ERROR;
             }
 
             log_trace("Eval");
-            any_sexp_t sexp = eval(any_sexp_car(cons->cdr), env);
-            return eval(sexp, ANY_SEXP_NIL);
-        }
-
-        // (+ a b)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "+")) {
-            log_trace("Add");
-            return eval_primitive(cons->cdr, env, eval_primitive_add);
-        }
-
-        // (- a b)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "-")) {
-            log_trace("Subtract");
-            return eval_primitive(cons->cdr, env, eval_primitive_subtract);
-        }
-
-        // (* a b)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "*")) {
-            log_trace("Multiply");
-            return eval_primitive(cons->cdr, env, eval_primitive_multiply);
-        }
-
-        // (/ a b)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "/")) {
-            log_trace("Divide");
-            return eval_primitive(cons->cdr, env, eval_primitive_divide);
-        }
+            any_sexp_t sexp = eval(any_sexp_car(cons->cdr), frame);
+            if (ANY_SEXP_IS_ERROR(sexp))
+                return ANY_SEXP_ERROR;
 
-        // (> a b)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), ">")) {
-            log_trace("Greater");
-            return eval_primitive(cons->cdr, env, eval_primitive_greater);
+            // NOTE: The expression is evaluated at the top level, so the
+            //       frames of the current evaluation can be released
+            //
+            eval_stack_top = tail->base;
+            return eval_tail(tail, sexp, NULL);
         }
 
-        // (= a b)
+        // (+ ...), (- a ...), (* ...), (/ a ...)
+        // (= a ...), (> a ...), (< a ...), (>= a ...), (<= a ...)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "=")) {
-            log_trace("Equal");
-            return eval_primitive(cons->cdr, env, eval_primitive_equal);
-        }
+        case EVAL_BUILTIN_ADD:
+        case EVAL_BUILTIN_SUBTRACT:
+        case EVAL_BUILTIN_MULTIPLY:
+        case EVAL_BUILTIN_DIVIDE:
+        case EVAL_BUILTIN_EQUAL:
+        case EVAL_BUILTIN_GREATER:
+        case EVAL_BUILTIN_LESS:
+        case EVAL_BUILTIN_GREATER_EQUAL:
+        case EVAL_BUILTIN_LESS_EQUAL:
+            log_trace("Arithmetic");
+            return eval_native_form(builtin, cons->cdr, frame);
 
         // (print ...)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "print")) {
+        case EVAL_BUILTIN_PRINT: {
             log_trace("Print");
-            return eval_print(cons->cdr, env);
+            return eval_print(cons->cdr, frame);
         }
 
         // (display ...)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "display")) {
+        case EVAL_BUILTIN_DISPLAY: {
             log_trace("Display");
-            return eval_display(cons->cdr, env);
+            return eval_display(cons->cdr, frame);
         }
 
         // (list ...)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "list")) {
+        case EVAL_BUILTIN_LIST: {
             log_trace("List");
-            return eval_list(cons->cdr, env);
+            return eval_list(cons->cdr, frame);
         }
 
         // (list* ...)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "list*")) {
+        case EVAL_BUILTIN_LIST_STAR: {
             log_trace("List*");
-            return eval_list2(cons->cdr, env);
+            return eval_list2(cons->cdr, frame);
         }
 
         // (tag? x)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "tag?")) {
+        case EVAL_BUILTIN_TAG: {
             if (!ANY_SEXP_IS_NIL(any_sexp_cdr(cons->cdr))) {
                 log_value_error("Malformed tag?", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
                 return ANY_SEXP_ERROR;
             }
 
             log_trace("Tag");
-            return any_sexp_number(ANY_SEXP_GET_TAG(eval(any_sexp_car(cons->cdr), env)));
+            return bignum_tag(eval(any_sexp_car(cons->cdr), frame));
         }
 
         // (car l)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "car")) {
+        case EVAL_BUILTIN_CAR: {
             if (!ANY_SEXP_IS_NIL(any_sexp_cdr(cons->cdr))) {
                 log_value_error("Malformed car", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
                 return ANY_SEXP_ERROR;
             }
 
             log_trace("Car");
-            any_sexp_t list = eval(any_sexp_car(cons->cdr), env);
+            any_sexp_t list = eval(any_sexp_car(cons->cdr), frame);
             if (!ANY_SEXP_IS_CONS(list)) {
                 log_value_error("Expected cons (car)", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), list);
                 return ANY_SEXP_ERROR;
@@ -688,14 +1970,14 @@ any_sexp_t eval_cons(any_sexp_t sexp, any_sexp_t env)
 
         // (cdr l)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "cdr")) {
+        case EVAL_BUILTIN_CDR: {
             if (!ANY_SEXP_IS_NIL(any_sexp_cdr(cons->cdr))) {
                 log_value_error("Malformed cdr", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
                 return ANY_SEXP_ERROR;
             }
 
             log_trace("Cdr");
-            any_sexp_t list = eval(any_sexp_car(cons->cdr), env);
+            any_sexp_t list = eval(any_sexp_car(cons->cdr), frame);
             if (!ANY_SEXP_IS_CONS(list)) {
                 log_value_error("Expected cons (cdr)", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), list);
                 return ANY_SEXP_ERROR;
@@ -706,14 +1988,14 @@ any_sexp_t eval_cons(any_sexp_t sexp, any_sexp_t env)
 
         // (cons a b)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "cons")) {
+        case EVAL_BUILTIN_CONS: {
             if (!ANY_SEXP_IS_NIL(any_sexp_cdr(any_sexp_cdr(cons->cdr)))) {
                 log_value_error("Malformed cons", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
                 return ANY_SEXP_ERROR;
             }
 
-            any_sexp_t a = eval(any_sexp_car(cons->cdr), env);
-            any_sexp_t b = eval(any_sexp_car(any_sexp_cdr(cons->cdr)), env);
+            any_sexp_t a = eval(any_sexp_car(cons->cdr), frame);
+            any_sexp_t b = eval(any_sexp_car(any_sexp_cdr(cons->cdr)), frame);
 
             log_value_trace("Making a cons",
                             "g:a", ANY_LOG_FORMATTER(any_sexp_fprint), a,
@@ -726,370 +2008,1145 @@ any_sexp_t eval_cons(any_sexp_t sexp, any_sexp_t env)
 
         // (if a b c)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "if")) {
+        case EVAL_BUILTIN_IF: {
             log_trace("If");
-            return eval_if(cons->cdr, env);
+            return eval_if(cons->cdr, frame, tail);
         }
 
         // (lambda (a b c ...) exp)
         //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "lambda")) {
+        case EVAL_BUILTIN_LAMBDA: {
             if (!eval_is_lambda(sexp)) {
                 log_value_error("Malformed lambda", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
                 return ANY_SEXP_ERROR;
             }
 
-            any_sexp_t value = eval_lambda(cons->cdr, env);
-            return ANY_SEXP_IS_ERROR(value)
-                 ? ANY_SEXP_ERROR
-                 : any_sexp_cons(cons->car, value);
+            return eval_lambda(cons->cdr, frame);
+        }
+
+        // (begin a b c ...)
+        //
+        case EVAL_BUILTIN_BEGIN: {
+            log_trace("Begin");
+            return eval_begin(cons->cdr, frame, tail);
+        }
+
+        // (let ((name value) ...) body)
+        // (let name ((name value) ...) body)
+        //
+        case EVAL_BUILTIN_LET: {
+            if (!eval_is_let(sexp) && !eval_is_named_let(sexp)) {
+                log_value_error("Malformed let", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+                return ANY_SEXP_ERROR;
+            }
+
+            log_trace("Let");
+            return eval_let(sexp, frame, tail);
+        }
+
+        // (letrec ((name value) ...) body)
+        //
+        case EVAL_BUILTIN_LETREC: {
+            if (!eval_is_letrec(sexp)) {
+                log_value_error("Malformed letrec", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+                return ANY_SEXP_ERROR;
+            }
+
+            log_trace("Letrec");
+            return eval_let(sexp, frame, tail);
+        }
+
+        // (error a)
+        //
+        case EVAL_BUILTIN_ERROR: {
+            log_trace("Error");
+
+            any_sexp_t value = eval_list(cons->cdr, frame);
+            log_value_error("Invoked error",
+                            "g:value", ANY_LOG_FORMATTER(any_sexp_fprint), value);
+
+            return ANY_SEXP_ERROR;
+        }
+
+        // (apply f l)
+        //
+        case EVAL_BUILTIN_APPLY: {
+
+            if (!ANY_SEXP_IS_CONS(cons->cdr) || !ANY_SEXP_IS_CONS(any_sexp_cdr(cons->cdr)) ||
+                !ANY_SEXP_IS_NIL(any_sexp_cdr(any_sexp_cdr(cons->cdr)))) {
+                log_value_error("Malformed apply", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+                return ANY_SEXP_ERROR;
+            }
+
+            log_trace("Apply");
+            any_sexp_t lambda = eval(any_sexp_car(cons->cdr), frame);
+            any_sexp_t list   = eval(any_sexp_car(any_sexp_cdr(cons->cdr)), frame);
+
+            if (!eval_is_closure(lambda) || !ANY_SEXP_IS_CONS(list)) {
+                log_error("Invalid arguments passed to apply");
+                return ANY_SEXP_ERROR;
+            }
+
+            return eval_lambda_tail(lambda, list, tail);
+        }
+
+        // (defmacro name (pars ...) body)
+        //
+        case EVAL_BUILTIN_DEFMACRO: {
+            log_error("Defmacro can be used only at the top level");
+            return ANY_SEXP_ERROR;
+        }
+
+        // (define name value)
+        //
+        case EVAL_BUILTIN_DEFINE: {
+            log_error("Define can be used only at the top level");
+            return ANY_SEXP_ERROR;
+        }
+
+        // (include file)
+        //
+        case EVAL_BUILTIN_INCLUDE: {
+            log_error("Include can be used only at the top level");
+            return ANY_SEXP_ERROR;
+        }
+
+        // (expand list)
+        //
+        case EVAL_BUILTIN_EXPAND: {
+            log_error("Expand can be used only at the top level");
+            return ANY_SEXP_ERROR;
+        }
+
+        // (#local . index)
+        //
+        case EVAL_BUILTIN_LOCAL: {
+            any_sexp_t value = frame[ANY_SEXP_GET_NUMBER(cons->cdr)];
+            return eval_is_unassigned(value)
+                 ? eval_unassigned_error(value)
+                 : value;
+        }
+
+        // (#lambda refs pars body)
+        // (#lambda refs name pars body)
+        //
+        case EVAL_BUILTIN_CLOSURE: {
+            any_sexp_t template = eval_template(CDR(cons->cdr));
+
+            log_trace("Closure");
+            return ANY_SEXP_IS_ERROR(template)
+                 ? ANY_SEXP_ERROR
+                 : eval_capture(template, CAR(cons->cdr), frame);
+        }
+
+        // (#let ((index . value) ...) body)
+        //
+        case EVAL_BUILTIN_FRAME_LET:
+            return eval_frame_let(CAR(cons->cdr), CADR(cons->cdr), frame, tail);
+
+        // (#letrec ((index name . value) ...) body)
+        //
+        case EVAL_BUILTIN_FRAME_LETREC:
+            return eval_frame_letrec(CAR(cons->cdr), CADR(cons->cdr), frame, tail);
+
+        // (length l), (map f l), ... (see list.h)
+        //
+        case EVAL_BUILTIN_LENGTH:
+        case EVAL_BUILTIN_APPEND:
+        case EVAL_BUILTIN_REVERSE:
+        case EVAL_BUILTIN_NTH:
+        case EVAL_BUILTIN_ASSOC:
+        case EVAL_BUILTIN_ASSQ:
+        case EVAL_BUILTIN_MEMBER:
+        case EVAL_BUILTIN_MAP:
+        case EVAL_BUILTIN_FILTER:
+        case EVAL_BUILTIN_FOLDL:
+        case EVAL_BUILTIN_IS_EQUAL:
+            log_trace("Native");
+            return eval_native_form(builtin, cons->cdr, frame);
+
+        default:
+            break;
+    }
+
+    any_sexp_t callee = eval(cons->car, frame);
+
+    // NOTE: Any lambda here has already been checked
+    //
+    if (eval_is_closure(callee))
+        return eval_call_tail(callee, cons->cdr, frame, tail);
+
+    if (!ANY_SEXP_IS_ERROR(callee))
+        log_error("Expected a function as a callee");
+
+    return ANY_SEXP_ERROR;
+}
+
+any_sexp_t eval(any_sexp_t sexp, any_sexp_t *frame)
+{
+    eval_tail_t tail = {
+        .base = eval_stack_top,
+        .pending = false,
+    };
+
+    any_sexp_t value;
+
+    while (true) {
+        switch (ANY_SEXP_GET_TAG(sexp)) {
+            case ANY_SEXP_TAG_ERROR:
+                value = ANY_SEXP_ERROR;
+                break;
+
+            case ANY_SEXP_TAG_NIL:
+                value = ANY_SEXP_NIL;
+                break;
+
+            case ANY_SEXP_TAG_CONS:
+                tail.pending = false;
+                value = eval_cons(sexp, frame, &tail);
+
+                // Continue with the expression in tail position
+                if (tail.pending) {
+                    sexp = tail.sexp;
+                    frame = tail.frame;
+                    continue;
+                }
+                break;
+
+            case ANY_SEXP_TAG_SYMBOL:
+                value = eval_symbol(sexp);
+                break;
+
+            case ANY_SEXP_TAG_STRING:
+                value = sexp;
+                break;
+
+            case ANY_SEXP_TAG_NUMBER:
+            case ANY_SEXP_TAG_FLOAT:
+            case ANY_SEXP_TAG_OBJECT:
+                value = sexp;
+                break;
+
+            default:
+                log_panic("Invalid tag (%lx)", ANY_SEXP_GET_TAG(sexp));
+        }
+
+        // Release the frames pushed by this evaluation
+        eval_stack_top = tail.base;
+        return value;
+    }
+}
+
+any_sexp_t eval_quote_list(any_sexp_t sexp)
+{
+    if (ANY_SEXP_IS_NIL(sexp))
+        return ANY_SEXP_NIL;
+
+    return any_sexp_cons(any_sexp_quote(any_sexp_car(sexp)),
+                         eval_quote_list(any_sexp_cdr(sexp)));
+}
+
+any_sexp_t eval_macro_list(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv)
+{
+    if (ANY_SEXP_IS_NIL(sexp))
+        return ANY_SEXP_NIL;
+
+    if (!ANY_SEXP_IS_CONS(sexp)) {
+        log_error("Invalid s-expression");
+        return ANY_SEXP_ERROR;
+    }
+
+    any_sexp_t car = eval_macro(any_sexp_car(sexp), env, menv);
+    any_sexp_t cdr = eval_macro_list(any_sexp_cdr(sexp), env, menv);
+
+    return ANY_SEXP_IS_ERROR(car) || ANY_SEXP_IS_ERROR(cdr)
+         ? ANY_SEXP_ERROR
+         : any_sexp_cons(car, cdr);
+}
+
+any_sexp_t eval_macro(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv)
+{
+    if (ANY_SEXP_IS_CONS(sexp)) {
+        any_sexp_t car = any_sexp_car(sexp);
+        any_sexp_t cdr = any_sexp_cdr(sexp);
+
+        if (ANY_SEXP_IS_SYMBOL(car)) {
+
+            if (eval_is_builtin(car, EVAL_BUILTIN_QUOTE))
+                return sexp;
+
+            any_sexp_t macro = eval_env_find(menv, car);
+
+            // Apply macro
+            // ((macro-body) (quote a) (quote b) ...)
+            //
+            if (!ANY_SEXP_IS_ERROR(macro)) {
+                log_value_trace("Applying macro",
+                                "s:name",  ANY_SEXP_GET_SYMBOL(car),
+                                "g:macro", ANY_LOG_FORMATTER(any_sexp_fprint), macro);
+
+                return eval_macro(eval_lambda_call(macro, cdr), env, menv);
+            }
+        }
+
+        return eval_macro_list(sexp, env, menv);
+    }
+
+    return sexp;
+}
+
+any_sexp_t eval_toplevel(any_sexp_t sexp)
+{
+    return eval(sexp, NULL);
+}
+
+// Evaluates the top level expressions, the tree-walker unless changed
+static eval_engine_t engine = eval_toplevel;
+
+void eval_set_engine(eval_engine_t new_engine)
+{
+    engine = new_engine;
+}
+
+void eval_change_env(any_sexp_t symbol, any_sexp_t value, eval_env_t *env)
+{
+    // Keep the load factor below 1/2
+    if (2 * (env->count + 1) > env->capacity)
+        eval_env_resize(env, env->capacity == 0 ? EVAL_ENV_CAPACITY : 2 * env->capacity);
+
+    size_t i = eval_env_slot(env, symbol);
+    if (ANY_SEXP_IS_NIL(env->symbols[i])) {
+        env->symbols[i] = symbol;
+        env->count++;
+    }
+
+    env->values[i] = value;
+}
+
+// Expands the macros of a top level expression, the forms handled by
+// eval_run_toplevel are checked and expanded in place
+any_sexp_t eval_expand_toplevel(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv)
+{
+    globals = env;
+
+    if (ANY_SEXP_IS_CONS(sexp)) {
+        any_sexp_t car = any_sexp_car(sexp);
+        any_sexp_t cdr = any_sexp_cdr(sexp);
+        any_sexp_t cadr = any_sexp_car(cdr);
+        any_sexp_t cddr = any_sexp_cdr(cdr);
+        any_sexp_t caddr = any_sexp_car(cddr);
+        any_sexp_t cdddr = any_sexp_cdr(cddr);
+
+        switch (eval_dispatch(car)) {
+            // (define name value)
+            //
+            case EVAL_BUILTIN_DEFINE: {
+                if (!ANY_SEXP_IS_CONS(cdr) || !ANY_SEXP_IS_CONS(cddr) ||
+                    !ANY_SEXP_IS_NIL(any_sexp_cdr(cddr)) || !ANY_SEXP_IS_SYMBOL(cadr)) {
+                    log_value_error("Malformed define", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+                    return ANY_SEXP_ERROR;
+                }
+
+                any_sexp_t value = eval_macro(caddr, env, menv);
+                if (ANY_SEXP_IS_ERROR(value))
+                    return ANY_SEXP_ERROR;
+
+                return any_sexp_cons(car, any_sexp_cons(cadr, any_sexp_cons(value, ANY_SEXP_NIL)));
+            }
+
+            // (defmacro name (pars ...) body)
+            //
+            case EVAL_BUILTIN_DEFMACRO: {
+                if (!ANY_SEXP_IS_CONS(cdr) || !ANY_SEXP_IS_CONS(cddr) ||
+                    !ANY_SEXP_IS_CONS(cdddr) || !ANY_SEXP_IS_NIL(any_sexp_cdr(cdddr)) ||
+                    !ANY_SEXP_IS_SYMBOL(cadr) || !eval_is_symbol_list(caddr)) {
+                    log_value_error("Malformed defmacro", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+                    return ANY_SEXP_ERROR;
+                }
+
+                any_sexp_t lambda = eval_macro(any_sexp_cons(caddr, cdddr), env, menv);
+                if (ANY_SEXP_IS_ERROR(lambda))
+                    return ANY_SEXP_ERROR;
+
+                return any_sexp_cons(car, any_sexp_cons(cadr, lambda));
+            }
+
+            // (include file)
+            //
+            case EVAL_BUILTIN_INCLUDE:
+                if (!ANY_SEXP_IS_STRING(cadr) || !ANY_SEXP_IS_NIL(cddr)) {
+                    log_value_error("Malformed include", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+                    return ANY_SEXP_ERROR;
+                }
+
+                return sexp;
+
+            // (expand list)
+            //
+            case EVAL_BUILTIN_EXPAND: {
+                if (!ANY_SEXP_IS_NIL(cddr)) {
+                    log_value_error("Malformed expand", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+                    return ANY_SEXP_ERROR;
+                }
+
+                any_sexp_t value = eval_macro(cadr, env, menv);
+                if (ANY_SEXP_IS_ERROR(value))
+                    return ANY_SEXP_ERROR;
+
+                return any_sexp_cons(car, any_sexp_cons(value, ANY_SEXP_NIL));
+            }
+
+            default:
+                break;
+        }
+    }
+
+    return eval_macro(sexp, env, menv);
+}
+
+// Runs a top level expression expanded by eval_expand_toplevel
+any_sexp_t eval_run_toplevel(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv)
+{
+    globals = env;
+
+    if (ANY_SEXP_IS_CONS(sexp)) {
+        any_sexp_t car = any_sexp_car(sexp);
+        any_sexp_t cdr = any_sexp_cdr(sexp);
+        any_sexp_t cadr = any_sexp_car(cdr);
+        any_sexp_t cddr = any_sexp_cdr(cdr);
+
+        switch (eval_dispatch(car)) {
+            // NOTE: The name is not a free variable of the lambdas in the
+            //       value, which are created before it is bound. It is left
+            //       as a global and looked up by the calls, so a lambda
+            //       nested in a let can refer to itself, and the closures
+            //       call the latest definition of the name.
+            case EVAL_BUILTIN_DEFINE: {
+                log_trace("Define (%s)", ANY_SEXP_GET_SYMBOL(cadr));
+                any_sexp_t outer = defining;
+
+                defining = cadr;
+                any_sexp_t value = engine(any_sexp_car(cddr));
+                defining = outer;
+
+                if (ANY_SEXP_IS_ERROR(value))
+                    return ANY_SEXP_ERROR;
+
+                eval_change_env(cadr, value, env);
+                return ANY_SEXP_NIL;
+            }
+
+            case EVAL_BUILTIN_DEFMACRO: {
+                log_trace("Defmacro (%s)", ANY_SEXP_GET_SYMBOL(cadr));
+                any_sexp_t lambda = eval_lambda(cddr, NULL);
+                if (ANY_SEXP_IS_ERROR(lambda))
+                    return ANY_SEXP_ERROR;
+
+                eval_change_env(cadr, lambda, menv);
+                return ANY_SEXP_NIL;
+            }
+
+            case EVAL_BUILTIN_INCLUDE:
+                return eval_include(ANY_SEXP_GET_STRING(cadr), env, menv);
+
+            case EVAL_BUILTIN_EXPAND: {
+                log_trace("Expand");
+                any_sexp_t value = engine(cadr);
+
+                return ANY_SEXP_IS_ERROR(value)
+                     ? ANY_SEXP_ERROR
+                     : eval_macro(value, env, menv);
+            }
+
+            default:
+                break;
+        }
+    }
+
+    return engine(sexp);
+}
+
+any_sexp_t eval_define(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv)
+{
+    any_sexp_t expanded = eval_expand_toplevel(sexp, env, menv);
+
+    return ANY_SEXP_IS_ERROR(expanded)
+         ? ANY_SEXP_ERROR
+         : eval_run_toplevel(expanded, env, menv);
+}
+
+// Loader of the binary file being evaluated, whose symbol table is marked
+static any_sexp_loader_t *loading = NULL;
+
+// NOTE: The internal builtins are not interned, so they are added to the
+//       symbol tables of the images and of the cache entries, which would
+//       copy them otherwise
+static int eval_dumper_init(any_sexp_dumper_t *dumper, any_sexp_writer_t *writer)
+{
+    if (any_sexp_dumper_init(dumper, writer) == EOF)
+        return EOF;
+
+    for (size_t i = 0; i < EVAL_BUILTIN_COUNT; i++) {
+        if (any_sexp_dumper_symbol(dumper, builtin_symbols[i]) == EOF)
+            return EOF;
+    }
+
+    return 0;
+}
+
+static bool eval_loader_open(any_sexp_loader_t *loader, FILE *file)
+{
+    if (!any_sexp_loader_open(loader, file))
+        return false;
+
+    for (size_t i = 0; i < EVAL_BUILTIN_COUNT; i++) {
+        if (!any_sexp_loader_symbol(loader, builtin_symbols[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static bool eval_file_is_binary(FILE *file)
+{
+    long offset = ftell(file);
+    if (offset < 0)
+        return false;
+
+    char magic[sizeof(ANY_SEXP_BINARY_MAGIC) - 1];
+    bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                  !memcmp(magic, ANY_SEXP_BINARY_MAGIC, sizeof(magic));
+
+    fseek(file, offset, SEEK_SET);
+    return binary;
+}
+
+// Runs the s-expressions of a loader, which are already expanded if they
+// come from the cache
+static any_sexp_t eval_loader(any_sexp_loader_t *loader, eval_env_t *env, eval_env_t *menv, bool expanded)
+{
+    any_sexp_loader_t *previous = loading;
+    loading = loader;
+
+    any_sexp_t result = ANY_SEXP_NIL;
+    while (!any_sexp_loader_end(loader)) {
+        any_sexp_t sexp = any_sexp_load(loader);
+
+        if (ANY_SEXP_IS_ERROR(sexp)) {
+            log_error("Failed to load s-expression");
+            result = ANY_SEXP_ERROR;
+            break;
         }
 
-        // (begin a b c ...)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "begin")) {
-            log_trace("Begin");
-            return eval_begin(cons->cdr, env);
+        if (!expanded) {
+            eval_define(sexp, env, menv);
+            continue;
         }
 
-        // (let ((name value) ...) body)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "let")) {
-            if (!eval_is_let(sexp)) {
-                log_value_error("Malformed let", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-                return ANY_SEXP_ERROR;
-            }
-
-            log_trace("Let");
-            return eval_let(cons->cdr, env);
+        // NOTE: The gensyms of the expansion are counted, so that the next
+        //       ones have the same names as without the cache
+        if (!ANY_SEXP_IS_CONS(sexp) || !ANY_SEXP_IS_NUMBER(any_sexp_car(sexp))) {
+            log_error("Invalid cache entry");
+            result = ANY_SEXP_ERROR;
+            break;
         }
 
-        // (error a)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "error")) {
-            log_trace("Error");
-
-            any_sexp_t value = eval_list(cons->cdr, env);
-            log_value_error("Invoked error",
-                            "g:value", ANY_LOG_FORMATTER(any_sexp_fprint), value);
+        gensym_id += ANY_SEXP_GET_NUMBER(any_sexp_car(sexp));
+        eval_run_toplevel(any_sexp_cdr(sexp), env, menv);
+    }
 
-            return ANY_SEXP_ERROR;
-        }
+    loading = previous;
+    return result;
+}
 
-        // (apply f l)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "apply")) {
+static any_sexp_t eval_file_binary(FILE *file, eval_env_t *env, eval_env_t *menv)
+{
+    any_sexp_loader_t loader;
+    if (!any_sexp_loader_open(&loader, file)) {
+        log_error("Invalid binary file");
+        any_sexp_loader_close(&loader);
+        return ANY_SEXP_ERROR;
+    }
 
-            if (!ANY_SEXP_IS_CONS(cons->cdr) || !ANY_SEXP_IS_CONS(any_sexp_cdr(cons->cdr)) ||
-                !ANY_SEXP_IS_NIL(any_sexp_cdr(any_sexp_cdr(cons->cdr)))) {
-                log_value_error("Malformed apply", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-                return ANY_SEXP_ERROR;
-            }
+    any_sexp_t result = eval_loader(&loader, env, menv, false);
+    any_sexp_loader_close(&loader);
+    return result;
+}
 
-            log_trace("Apply");
-            any_sexp_t lambda = eval(any_sexp_car(cons->cdr), env);
-            any_sexp_t list   = eval(any_sexp_car(any_sexp_cdr(cons->cdr)), env);
+// Expands and runs the s-expressions of a reader, the expanded ones are
+// appended to forms (as (gensyms . sexp)) unless it is NULL, which is set to
+// an error if one of them can not be expanded
+static any_sexp_t eval_reader(any_sexp_reader_t *reader, eval_env_t *env, eval_env_t *menv, any_sexp_t *forms)
+{
+    any_sexp_t *next = forms;
 
-            if (!ANY_SEXP_IS_CONS(lambda) || !ANY_SEXP_IS_SYMBOL(any_sexp_car(lambda)) ||
-                strcmp(ANY_SEXP_GET_SYMBOL(any_sexp_car(lambda)), "lambda") || !ANY_SEXP_IS_CONS(list)) {
-                log_error("Invalid arguments passed to apply");
-                return ANY_SEXP_ERROR;
-            }
+    while (true) {
+        any_sexp_t sexp = any_sexp_read(reader);
 
-            any_sexp_t fvs  = any_sexp_car(any_sexp_cdr(lambda));
-            any_sexp_t pars = any_sexp_car(any_sexp_cdr(any_sexp_cdr(lambda)));
-            any_sexp_t body = any_sexp_car(any_sexp_cdr(any_sexp_cdr(any_sexp_cdr(lambda))));
-            return eval_lambda_call(fvs, pars, list, body);
-        }
+        if (ANY_SEXP_IS_ERROR(sexp)) {
+            if (any_sexp_reader_end(reader))
+                return ANY_SEXP_NIL;
 
-        // (defmacro name (pars ...) body)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "defmacro")) {
-            log_error("Defmacro can be used only at the top level");
+            log_error("Failed to read s-expression");
             return ANY_SEXP_ERROR;
         }
 
-        // (define name value)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "define")) {
-            log_error("Define can be used only at the top level");
-            return ANY_SEXP_ERROR;
-        }
+        unsigned int gensyms = gensym_id;
+        any_sexp_t expanded = eval_expand_toplevel(sexp, env, menv);
 
-        // (include file)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "include")) {
-            log_error("Include can be used only at the top level");
-            return ANY_SEXP_ERROR;
+        if (next != NULL && ANY_SEXP_IS_ERROR(expanded)) {
+            *forms = ANY_SEXP_ERROR;
+            next = NULL;
+        } else if (next != NULL) {
+            any_sexp_t cell = any_sexp_cons(any_sexp_cons(any_sexp_number(gensym_id - gensyms), expanded), ANY_SEXP_NIL);
+            *next = cell;
+            next = &ANY_SEXP_GET_CDR(cell);
         }
 
-        // (expand list)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), "expand")) {
-            log_error("Expand can be used only at the top level");
-            return ANY_SEXP_ERROR;
-        }
+        if (!ANY_SEXP_IS_ERROR(expanded))
+            eval_run_toplevel(expanded, env, menv);
     }
+}
 
-    any_sexp_t callee = eval(cons->car, env);
+any_sexp_t eval_file(FILE *file, eval_env_t *env, eval_env_t *menv)
+{
+    if (eval_file_is_binary(file))
+        return eval_file_binary(file, env, menv);
 
-    // NOTE: Any lambda here has already been checked
-    //
-    if (ANY_SEXP_IS_CONS(callee) && ANY_SEXP_IS_SYMBOL(any_sexp_car(callee)) &&
-        !strcmp(ANY_SEXP_GET_SYMBOL(any_sexp_car(callee)), "lambda")) {
+    // NOTE: Regular files are mapped in memory (see any_sexp_reader_open)
+    any_sexp_reader_t reader;
+    any_sexp_reader_open(&reader, file);
 
-        any_sexp_t fvs  = any_sexp_car(any_sexp_cdr(callee));
-        any_sexp_t pars = any_sexp_car(any_sexp_cdr(any_sexp_cdr(callee)));
-        any_sexp_t body = any_sexp_car(any_sexp_cdr(any_sexp_cdr(any_sexp_cdr(callee))));
-        any_sexp_t args = eval_list(cons->cdr, env);
+    any_sexp_t result = eval_reader(&reader, env, menv, NULL);
 
-        return ANY_SEXP_IS_ERROR(args)
-             ? ANY_SEXP_ERROR
-             : eval_lambda_call(fvs, pars, args, body);
-    }
+    any_sexp_reader_close(&reader);
+    return result;
+}
 
-    if (!ANY_SEXP_IS_ERROR(callee))
-        log_error("Expected a function as a callee");
+// Includes
+//
+// The files are included once, by their canonical path. A file being
+// included is a frame of the including stack, which collects the files it
+// depends on: itself and the ones it includes, even the ones skipped since
+// they were included before. Each dependency is (path . hash), where hash
+// is the hex string of the hash of the contents.
+//
+// The expanded s-expressions of the files are kept in the cache (see
+// cache.h), after a first entry
+//
+// (version count max deps macros)
+//
+// where count is the number of builtins and max is ANY_SEXP_NUMBER_MAX, since
+// the builds with another representation of the values share the cache but
+// not the range of the numbers. macros is the digest of the macros defined
+// before the include, in the including files or in the REPL, since they
+// expand the file as well, with the globals they use (see eval_hash_macro).
+// An entry is valid only while the hashes of the dependencies and the digest
+// are the same. The other definitions given before the include are not
+// dependencies.
+//
+// NOTE: The output of the macros while expanding is not kept in the cache
+//
+typedef struct eval_include {
+    any_sexp_t path;
+    any_sexp_t deps;
+    struct eval_include *parent;
+} eval_include_t;
+
+static eval_include_t *including = NULL;
+
+static any_sexp_t eval_assoc(any_sexp_t list, const char *path)
+{
+    for (; ANY_SEXP_IS_CONS(list); list = any_sexp_cdr(list)) {
+        if (!strcmp(ANY_SEXP_GET_STRING(CAAR(list)), path))
+            return any_sexp_car(list);
+    }
 
     return ANY_SEXP_ERROR;
 }
 
-any_sexp_t eval(any_sexp_t sexp, any_sexp_t env)
+static bool eval_is_included(const char *path)
 {
-    switch (ANY_SEXP_GET_TAG(sexp)) {
-        case ANY_SEXP_TAG_ERROR:
-            return ANY_SEXP_ERROR;
-
-        case ANY_SEXP_TAG_NIL:
-            return ANY_SEXP_NIL;
+    for (eval_include_t *frame = including; frame != NULL; frame = frame->parent) {
+        if (!strcmp(ANY_SEXP_GET_STRING(frame->path), path))
+            return true;
+    }
 
-        case ANY_SEXP_TAG_CONS:
-            return eval_cons(sexp, env);
+    return !ANY_SEXP_IS_ERROR(eval_assoc(included, path));
+}
 
-        case ANY_SEXP_TAG_SYMBOL:
-            return eval_symbol(ANY_SEXP_GET_SYMBOL(sexp), env);
+// Adds the dependencies to the files being included
+static void eval_depend(any_sexp_t deps)
+{
+    for (eval_include_t *frame = including; frame != NULL; frame = frame->parent) {
+        for (any_sexp_t dep = deps; ANY_SEXP_IS_CONS(dep); dep = any_sexp_cdr(dep)) {
+            if (ANY_SEXP_IS_ERROR(eval_assoc(frame->deps, ANY_SEXP_GET_STRING(CAAR(dep)))))
+                frame->deps = any_sexp_cons(any_sexp_car(dep), frame->deps);
+        }
+    }
+}
 
-        case ANY_SEXP_TAG_STRING:
-            return sexp;
+static any_sexp_t eval_hash_string(uint64_t hash)
+{
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016" PRIx64, hash);
+    return any_sexp_string(buffer, 16);
+}
 
-        case ANY_SEXP_TAG_NUMBER:
-            return sexp;
+// Hash of the current contents of a dependency
+static any_sexp_t eval_hash_file(const char *path)
+{
+    any_sexp_t record = eval_assoc(included, path);
+    if (!ANY_SEXP_IS_ERROR(record)) {
+        any_sexp_t dep = eval_assoc(any_sexp_cdr(record), path);
+        if (!ANY_SEXP_IS_ERROR(dep))
+            return any_sexp_cdr(dep);
     }
 
-    log_panic("Invalid tag (%lx)", ANY_SEXP_GET_TAG(sexp));
+    uint64_t hash;
+    return cache_hash_file(path, &hash)
+         ? eval_hash_string(hash)
+         : ANY_SEXP_ERROR;
 }
 
-any_sexp_t eval_quote_list(any_sexp_t sexp)
+static int eval_hash_char(int c, FILE *stream)
 {
-    if (ANY_SEXP_IS_NIL(sexp))
-        return ANY_SEXP_NIL;
+    unsigned char byte = c;
+    uint64_t *hash = (uint64_t *)stream;
+    *hash = cache_hash_update(*hash, &byte, 1);
+    return byte;
+}
 
-    return any_sexp_cons(any_sexp_quote(any_sexp_car(sexp)),
-                         eval_quote_list(any_sexp_cdr(sexp)));
+static size_t eval_hash_data(const void *data, size_t size, size_t count, FILE *stream)
+{
+    uint64_t *hash = (uint64_t *)stream;
+    *hash = cache_hash_update(*hash, data, size * count);
+    return count;
 }
 
-any_sexp_t eval_macro_list(any_sexp_t sexp, any_sexp_t env, any_sexp_t menv)
+// Hash of a macro, with the values it can use while expanding: the values
+// captured by its closure and the globals named in its code, followed
+// through the closures and the values of these globals. The compiled code
+// of the closures is left out, as it is numbered by each run.
+//
+// NOTE: The writer hashes the atoms instead of writing them to a file. The
+//       closures and the globals are hashed once, since the closures of
+//       letrec capture themselves.
+//
+// NOTE: A macro which expands with eval or include can still use other
+//       globals, which are not in the hash
+static uint64_t eval_hash_macro(any_sexp_t name, any_sexp_t macro, eval_env_t *env)
 {
-    if (ANY_SEXP_IS_NIL(sexp))
-        return ANY_SEXP_NIL;
+    uint64_t hash = CACHE_HASH_BASIS;
 
-    if (!ANY_SEXP_IS_CONS(sexp)) {
-        log_error("Invalid s-expression");
-        return ANY_SEXP_ERROR;
+    any_sexp_writer_t writer;
+    any_sexp_writer_init(&writer, eval_hash_char, &hash, ANY_SEXP_WRITER_DEFAULT);
+    writer.putdata = eval_hash_data;
+
+    eval_env_t seen = { 0 };
+    size_t length = 0, capacity = 64;
+    any_sexp_t *stack = malloc(capacity * sizeof(any_sexp_t));
+    if (stack == NULL)
+        log_panic("Out of memory");
+
+    stack[length++] = macro;
+    stack[length++] = name;
+
+    while (length > 0) {
+        any_sexp_t sexp = stack[--length];
+
+        // A closure or a cons pushes at most all its values
+        size_t needed = ANY_SEXP_IS_OBJECT(sexp) ? ANY_SEXP_GET_OBJECT(sexp)->length : 2;
+        if (length + needed > capacity) {
+            while (length + needed > capacity)
+                capacity *= 2;
+
+            stack = realloc(stack, capacity * sizeof(any_sexp_t));
+            if (stack == NULL)
+                log_panic("Out of memory");
+        }
+
+        if (ANY_SEXP_IS_CONS(sexp)) {
+            eval_hash_char('(', (FILE *)&hash);
+            stack[length++] = any_sexp_cdr(sexp);
+            stack[length++] = any_sexp_car(sexp);
+        } else if (ANY_SEXP_IS_OBJECT(sexp)) {
+            any_sexp_object_t *object = ANY_SEXP_GET_OBJECT(sexp);
+            if (object->kind == EVAL_OBJECT_CLOSURE) {
+                if (!ANY_SEXP_IS_ERROR(eval_env_find(&seen, sexp))) {
+                    eval_hash_char('@', (FILE *)&hash);
+                    continue;
+                }
+
+                eval_change_env(sexp, ANY_SEXP_NIL, &seen);
+            }
+
+            uint64_t header[2] = { object->kind, object->length };
+            eval_hash_data(header, sizeof(header), 1, (FILE *)&hash);
+
+            for (size_t i = object->length; i-- > 0;) {
+                if (object->kind != EVAL_OBJECT_CODE || i != EVAL_CODE_COMPILED)
+                    stack[length++] = object->values[i];
+            }
+        } else {
+            any_sexp_write(&writer, sexp);
+            any_sexp_writer_flush(&writer);
+            eval_hash_char(' ', (FILE *)&hash);
+
+            if (ANY_SEXP_IS_SYMBOL(sexp) && ANY_SEXP_IS_ERROR(eval_env_find(&seen, sexp))) {
+                eval_change_env(sexp, ANY_SEXP_NIL, &seen);
+
+                any_sexp_t value = eval_env_find(env, sexp);
+                if (!ANY_SEXP_IS_ERROR(value))
+                    stack[length++] = value;
+            }
+        }
     }
 
-    any_sexp_t car = eval_macro(any_sexp_car(sexp), env, menv);
-    any_sexp_t cdr = eval_macro_list(any_sexp_cdr(sexp), env, menv);
+    free(stack);
+    free(seen.symbols);
+    free(seen.values);
+    return hash;
+}
 
-    return ANY_SEXP_IS_ERROR(car) || ANY_SEXP_IS_ERROR(cdr)
-         ? ANY_SEXP_ERROR
-         : any_sexp_cons(car, cdr);
+// Digest of the macros, as the sum of their hashes, so that it does not
+// depend on the order of the table
+static any_sexp_t eval_hash_macros(eval_env_t *env, eval_env_t *menv)
+{
+    uint64_t digest = 0;
+
+    for (size_t i = 0; i < menv->capacity; i++) {
+        if (!ANY_SEXP_IS_NIL(menv->symbols[i]))
+            digest += eval_hash_macro(menv->symbols[i], menv->values[i], env);
+    }
+
+    return eval_hash_string(digest);
 }
 
-any_sexp_t eval_macro(any_sexp_t sexp, any_sexp_t env, any_sexp_t menv)
+// Runs the cache entry, returns false if it is not valid
+static bool eval_cache_load(FILE *entry, any_sexp_t macros, eval_env_t *env, eval_env_t *menv, any_sexp_t *result)
 {
-    if (ANY_SEXP_IS_CONS(sexp)) {
-        any_sexp_t car = any_sexp_car(sexp);
-        any_sexp_t cdr = any_sexp_cdr(sexp);
+    any_sexp_loader_t loader;
+    any_sexp_t header = eval_loader_open(&loader, entry)
+                      ? any_sexp_load(&loader)
+                      : ANY_SEXP_ERROR;
+
+    bool valid = ANY_SEXP_IS_CONS(header) &&
+                 ANY_SEXP_IS_NUMBER(CAR(header)) && ANY_SEXP_GET_NUMBER(CAR(header)) == CACHE_VERSION &&
+                 ANY_SEXP_IS_NUMBER(CADR(header)) && ANY_SEXP_GET_NUMBER(CADR(header)) == EVAL_BUILTIN_COUNT &&
+                 ANY_SEXP_IS_NUMBER(CADDR(header)) && ANY_SEXP_GET_NUMBER(CADDR(header)) == ANY_SEXP_NUMBER_MAX &&
+                 ANY_SEXP_IS_STRING(CADR(CDDDR(header))) &&
+                 !strcmp(ANY_SEXP_GET_STRING(CADR(CDDDR(header))), ANY_SEXP_GET_STRING(macros));
+
+    any_sexp_t deps = valid ? CADDDR(header) : ANY_SEXP_NIL;
+    for (any_sexp_t dep = deps; valid && ANY_SEXP_IS_CONS(dep); dep = any_sexp_cdr(dep)) {
+        any_sexp_t hash = eval_hash_file(ANY_SEXP_GET_STRING(CAAR(dep)));
+
+        valid = !ANY_SEXP_IS_ERROR(hash) &&
+                !strcmp(ANY_SEXP_GET_STRING(hash), ANY_SEXP_GET_STRING(CDAR(dep)));
+    }
 
-        if (ANY_SEXP_IS_SYMBOL(car)) {
+    if (valid) {
+        log_trace("Include from the cache");
+        eval_depend(deps);
+        *result = eval_loader(&loader, env, menv, true);
+    }
 
-            if (!strcmp(ANY_SEXP_GET_SYMBOL(car), "quote"))
-                return sexp;
+    any_sexp_loader_close(&loader);
+    return valid;
+}
 
-            any_sexp_t macro = eval_find_symbol(ANY_SEXP_GET_SYMBOL(car), menv);
+static void eval_cache_save(uint64_t hash, any_sexp_t deps, any_sexp_t macros, any_sexp_t forms)
+{
+    FILE *entry = cache_create(hash);
+    if (entry == NULL)
+        return;
 
-            // Apply macro
-            // ((macro-body) (quote a) (quote b) ...)
-            //
-            if (!ANY_SEXP_IS_ERROR(macro)) {
-                log_value_trace("Applying macro",
-                                "s:name",  ANY_SEXP_GET_SYMBOL(car),
-                                "g:macro", ANY_LOG_FORMATTER(any_sexp_fprint), macro,
-                                "g:menv",  ANY_LOG_FORMATTER(any_sexp_fprint), menv);
+    any_sexp_writer_t writer;
+    any_sexp_dumper_t dumper;
+    any_sexp_writer_file_init(&writer, entry, ANY_SEXP_WRITER_DEFAULT);
 
-                any_sexp_t fvs  = any_sexp_car(macro);
-                any_sexp_t pars = any_sexp_car(any_sexp_cdr(macro));
-                any_sexp_t body = any_sexp_car(any_sexp_cdr(any_sexp_cdr(macro)));
+    any_sexp_t header = any_sexp_cons(any_sexp_number(CACHE_VERSION),
+                        any_sexp_cons(any_sexp_number(EVAL_BUILTIN_COUNT),
+                        any_sexp_cons(any_sexp_number(ANY_SEXP_NUMBER_MAX),
+                        any_sexp_cons(deps,
+                        any_sexp_cons(macros, ANY_SEXP_NIL)))));
 
-                return eval_macro(eval_lambda_call(fvs, pars, cdr, body), env, menv);
-            }
-        }
+    bool valid = eval_dumper_init(&dumper, &writer) != EOF &&
+                 any_sexp_dump(&dumper, header) != EOF;
 
-        return eval_macro_list(sexp, env, menv);
-    }
+    for (; valid && ANY_SEXP_IS_CONS(forms); forms = any_sexp_cdr(forms))
+        valid = any_sexp_dump(&dumper, any_sexp_car(forms)) != EOF;
 
-    return sexp;
+    valid = any_sexp_writer_flush(&writer) != EOF && valid;
+
+    any_sexp_dumper_free(&dumper);
+    cache_commit(entry, hash, valid);
 }
 
-void eval_change_env(any_sexp_t symbol, any_sexp_t value, any_sexp_t *env)
+static any_sexp_t eval_source(FILE *file, eval_env_t *env, eval_env_t *menv)
 {
-    if (ANY_SEXP_IS_NIL(*env)) {
-        *env = any_sexp_cons(any_sexp_cons(symbol, value), ANY_SEXP_NIL);
-        return;
+    const char *path = ANY_SEXP_GET_STRING(including->path);
+
+    if (eval_file_is_binary(file)) {
+        uint64_t hash;
+        if (cache_hash_file(path, &hash))
+            eval_depend(any_sexp_cons(any_sexp_cons(including->path, eval_hash_string(hash)), ANY_SEXP_NIL));
+
+        return eval_file_binary(file, env, menv);
+    }
+
+    any_sexp_reader_t reader;
+    any_sexp_reader_open(&reader, file);
+
+    // NOTE: Only the mapped files are hashed, as the others are read once.
+    //       The mapping is the whole file, as cache_hash_file reads it.
+    bool cached = reader.mapping != NULL && cache_enabled();
+    uint64_t hash = 0;
+
+    if (reader.mapping != NULL) {
+        hash = cache_hash(reader.mapping, reader.mapping_length);
+        eval_depend(any_sexp_cons(any_sexp_cons(including->path, eval_hash_string(hash)), ANY_SEXP_NIL));
+    }
+
+    // NOTE: The macros are the ones before the file, which can define more.
+    //       Their digest is part of the name of the entry as well, so the
+    //       expansions with other macros are kept side by side.
+    any_sexp_t result = ANY_SEXP_NIL;
+    any_sexp_t macros = ANY_SEXP_NIL;
+    uint64_t key = 0;
+
+    if (cached) {
+        macros = eval_hash_macros(env, menv);
+        key = cache_hash_update(hash, ANY_SEXP_GET_STRING(macros), 16);
     }
 
-    if (!ANY_SEXP_IS_CONS(*env) || !ANY_SEXP_IS_CONS(any_sexp_car(*env)))
-        log_panic("Invalid environment");
+    FILE *entry = cached ? cache_open(key) : NULL;
+
+    if (entry != NULL) {
+        bool valid = eval_cache_load(entry, macros, env, menv, &result);
+        fclose(entry);
 
-    any_sexp_cons_t *cons = ANY_SEXP_GET_CONS(any_sexp_car(*env));
-    if (!strcmp(ANY_SEXP_GET_SYMBOL(cons->car), ANY_SEXP_GET_SYMBOL(symbol)))
-        cons->cdr = value;
-    else {
-        cons = ANY_SEXP_GET_CONS(*env);
-        eval_change_env(symbol, value, &cons->cdr);
+        if (valid) {
+            any_sexp_reader_close(&reader);
+            return result;
+        }
     }
+
+    any_sexp_t forms = ANY_SEXP_NIL;
+    result = eval_reader(&reader, env, menv, cached ? &forms : NULL);
+
+    if (cached && !ANY_SEXP_IS_ERROR(result) && !ANY_SEXP_IS_ERROR(forms))
+        eval_cache_save(key, including->deps, macros, forms);
+
+    any_sexp_reader_close(&reader);
+    return result;
 }
 
-any_sexp_t eval_define(any_sexp_t sexp, any_sexp_t *env, any_sexp_t *menv)
+any_sexp_t eval_include(const char *path, eval_env_t *env, eval_env_t *menv)
 {
-    if (ANY_SEXP_IS_CONS(sexp) && ANY_SEXP_IS_SYMBOL(any_sexp_car(sexp))) {
-        any_sexp_t car = any_sexp_car(sexp);
-        any_sexp_t cdr = any_sexp_cdr(sexp);
-        any_sexp_t cadr = any_sexp_car(cdr);
-        any_sexp_t cddr = any_sexp_cdr(cdr);
-        any_sexp_t caddr = any_sexp_car(cddr);
-        any_sexp_t cdddr = any_sexp_cdr(cddr);
+    // NOTE: The path is kept as it is if it can not be resolved, as for
+    //       /dev/stdin
+    char *canonical = realpath(path, NULL);
+    if (canonical == NULL)
+        canonical = strdup(path);
 
-        // (define name value)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(car), "define")) {
+    if (eval_is_included(canonical)) {
+        log_trace("Include (%s) skipped", canonical);
 
-            if (!ANY_SEXP_IS_CONS(cdr) || !ANY_SEXP_IS_CONS(cddr) ||
-                !ANY_SEXP_IS_NIL(any_sexp_cdr(cddr)) || !ANY_SEXP_IS_SYMBOL(cadr)) {
-                log_value_error("Malformed define", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-                return ANY_SEXP_ERROR;
-            }
+        any_sexp_t record = eval_assoc(included, canonical);
+        if (!ANY_SEXP_IS_ERROR(record))
+            eval_depend(any_sexp_cdr(record));
 
-            log_trace("Define (%s)", ANY_SEXP_GET_SYMBOL(cadr));
-            any_sexp_t value = eval(eval_macro(caddr, *env, *menv), *env);
-            if (ANY_SEXP_IS_ERROR(value))
-                return ANY_SEXP_ERROR;
+        free(canonical);
+        return ANY_SEXP_NIL;
+    }
 
-            eval_change_env(cadr, value, env);
-            return ANY_SEXP_NIL;
-        }
+    FILE *file = fopen(canonical, "rb");
+    if (file == NULL) {
+        log_error("Failed to open file %s", canonical);
+        free(canonical);
+        return ANY_SEXP_ERROR;
+    }
 
-        // (defmacro name (pars ...) body)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(car), "defmacro")) {
+    log_trace("Include (%s)", canonical);
 
-            if (!ANY_SEXP_IS_CONS(cdr) || !ANY_SEXP_IS_CONS(cddr) ||
-                !ANY_SEXP_IS_CONS(cdddr) || !ANY_SEXP_IS_NIL(any_sexp_cdr(cdddr)) ||
-                !ANY_SEXP_IS_SYMBOL(cadr) || !eval_is_symbol_list(caddr)) {
-                log_value_error("Malformed defmacro", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-                return ANY_SEXP_ERROR;
-            }
+    eval_include_t frame = {
+        .path = any_sexp_string(canonical, strlen(canonical)),
+        .deps = ANY_SEXP_NIL,
+        .parent = including,
+    };
 
-            log_trace("Defmacro (%s)", ANY_SEXP_GET_SYMBOL(cadr));
-            any_sexp_t lambda = eval_lambda(eval_macro(any_sexp_cons(caddr, cdddr), *env, *menv), *env);
-            if (ANY_SEXP_IS_ERROR(lambda))
-                return ANY_SEXP_ERROR;
+    free(canonical);
+    including = &frame;
 
-            eval_change_env(cadr, lambda, menv);
-            return ANY_SEXP_NIL;
-        }
+    any_sexp_t result = eval_source(file, env, menv);
+    fclose(file);
 
-        // (include file)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(car), "include")) {
+    including = frame.parent;
 
-            if (!ANY_SEXP_IS_STRING(cadr) || !ANY_SEXP_IS_NIL(cddr)) {
-                log_value_error("Malformed include", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-                return ANY_SEXP_ERROR;
-            }
+    if (ANY_SEXP_IS_ERROR(result))
+        return ANY_SEXP_ERROR;
 
-            const char *path = ANY_SEXP_GET_STRING(cadr);
-            FILE *file = fopen(path, "rb");
-            if (file == NULL) {
-                log_error("Failed to open file %s", path);
-                return ANY_SEXP_ERROR;
+    included = any_sexp_cons(any_sexp_cons(frame.path, frame.deps), included);
+    eval_depend(frame.deps);
+    return ANY_SEXP_NIL;
+}
+
+any_sexp_t eval_dump(FILE *file, FILE *output)
+{
+    any_sexp_reader_t reader;
+    any_sexp_writer_t writer;
+    any_sexp_dumper_t dumper;
+
+    any_sexp_reader_open(&reader, file);
+    any_sexp_writer_file_init(&writer, output, ANY_SEXP_WRITER_DEFAULT);
+
+    any_sexp_t result = ANY_SEXP_NIL;
+    if (any_sexp_dumper_init(&dumper, &writer) == EOF)
+        result = ANY_SEXP_ERROR;
+
+    while (!ANY_SEXP_IS_ERROR(result)) {
+        any_sexp_t sexp = any_sexp_read(&reader);
+
+        if (ANY_SEXP_IS_ERROR(sexp)) {
+            if (!any_sexp_reader_end(&reader)) {
+                log_error("Failed to read s-expression");
+                result = ANY_SEXP_ERROR;
             }
+            break;
+        }
 
-            log_trace("Include (%s)", path);
-            return ANY_SEXP_IS_ERROR(eval_file(file, env, menv))
-                 ? ANY_SEXP_ERROR
-                 : ANY_SEXP_NIL;
+        if (any_sexp_dump(&dumper, sexp) == EOF) {
+            log_value_error("Failed to dump s-expression", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
+            result = ANY_SEXP_ERROR;
         }
+    }
 
-        // (expand list)
-        //
-        if (!strcmp(ANY_SEXP_GET_SYMBOL(car), "expand")) {
-            if (!ANY_SEXP_IS_NIL(cddr)) {
-                log_value_error("Malformed expand", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sexp);
-                return ANY_SEXP_ERROR;
-            }
+    if (any_sexp_writer_flush(&writer) == EOF)
+        result = ANY_SEXP_ERROR;
 
-            log_trace("Expand");
-            any_sexp_t value = eval(eval_macro(cadr, *env, *menv), *env);
+    any_sexp_dumper_free(&dumper);
+    any_sexp_reader_close(&reader);
+    return result;
+}
 
-            return ANY_SEXP_IS_ERROR(value)
-                 ? ANY_SEXP_ERROR
-                 : eval_macro(value, *env, *menv);
-        }
+// The image is the s-expression
+//
+// (count gensym included env menv)
+//
+// in the binary format, where count is the number of builtins, gensym the
+// counter of the symbols generated (see EVAL_BUILTIN_GENSYM) and the
+// environments are lists of (symbol . value). The files included are the
+// records of eval_include, so they are not included again.
+//
+any_sexp_t eval_image_save(FILE *output, eval_env_t *env, eval_env_t *menv)
+{
+    any_sexp_writer_t writer;
+    any_sexp_dumper_t dumper;
+    any_sexp_writer_file_init(&writer, output, ANY_SEXP_WRITER_DEFAULT);
+
+    any_sexp_t image = any_sexp_cons(any_sexp_number(EVAL_BUILTIN_COUNT),
+                       any_sexp_cons(any_sexp_number(gensym_id),
+                       any_sexp_cons(included,
+                       any_sexp_cons(eval_env_list(env),
+                       any_sexp_cons(eval_env_list(menv), ANY_SEXP_NIL)))));
+
+    any_sexp_t result = ANY_SEXP_NIL;
+    if (eval_dumper_init(&dumper, &writer) == EOF)
+        result = ANY_SEXP_ERROR;
+
+    if (!ANY_SEXP_IS_ERROR(result) && any_sexp_dump(&dumper, image) == EOF) {
+        log_error("Failed to dump the environments");
+        result = ANY_SEXP_ERROR;
     }
 
-    return eval(eval_macro(sexp, *env, *menv), *env);
+    if (any_sexp_writer_flush(&writer) == EOF)
+        result = ANY_SEXP_ERROR;
+
+    any_sexp_dumper_free(&dumper);
+    return result;
 }
 
-any_sexp_t eval_file(FILE *file, any_sexp_t *env, any_sexp_t *menv)
+static void eval_image_env(any_sexp_t list, eval_env_t *env)
 {
-    any_sexp_reader_t reader;
-    any_sexp_reader_file_init(&reader, file);
+    for (; ANY_SEXP_IS_CONS(list); list = any_sexp_cdr(list))
+        eval_change_env(CAAR(list), CDAR(list), env);
+}
 
-    any_sexp_t sexp;
-    do {
-        sexp = any_sexp_read(&reader);
+any_sexp_t eval_image_load(FILE *file, eval_env_t *env, eval_env_t *menv)
+{
+    // NOTE: Regular files are mapped in memory (see any_sexp_loader_open)
+    any_sexp_loader_t loader;
+    any_sexp_t image = eval_loader_open(&loader, file)
+                     ? any_sexp_load(&loader)
+                     : ANY_SEXP_ERROR;
 
-        if (ANY_SEXP_IS_ERROR(sexp)) {
-            if (any_sexp_reader_end(&reader))
-                return ANY_SEXP_NIL;
+    any_sexp_loader_close(&loader);
 
-            log_error("Failed to read s-expression");
-            break;
-        }
+    any_sexp_t fields[5];
+    size_t count = 0;
 
-        eval_define(sexp, env, menv);
-    } while (!ANY_SEXP_IS_ERROR(sexp));
+    for (; ANY_SEXP_IS_CONS(image) && count < 5; image = CDR(image))
+        fields[count++] = CAR(image);
 
-    return ANY_SEXP_ERROR;
+    if (count != 5 || !ANY_SEXP_IS_NIL(image) ||
+        !ANY_SEXP_IS_NUMBER(fields[0]) || ANY_SEXP_GET_NUMBER(fields[0]) != EVAL_BUILTIN_COUNT ||
+        !ANY_SEXP_IS_NUMBER(fields[1])) {
+        log_error("Invalid image");
+        return ANY_SEXP_ERROR;
+    }
+
+    gensym_id = ANY_SEXP_GET_NUMBER(fields[1]);
+    included = fields[2];
+    eval_image_env(fields[3], env);
+    eval_image_env(fields[4], menv);
+
+    return ANY_SEXP_NIL;
+}
+
+static void eval_mark_stack()
+{
+    for (size_t i = 0; i < eval_stack_top; i++)
+        gc_mark(eval_stack[i]);
+
+    for (size_t i = 0; i < pending_length; i++)
+        gc_mark(pending[i].closure);
+
+    // NOTE: The uninterned symbols can be referenced by the next expressions
+    if (loading != NULL) {
+        for (size_t i = 0; i < loading->symbols_length; i++)
+            gc_mark(loading->symbols[i]);
+    }
 }
 
 void eval_init()
 {
-    static const char *symbols[] = {
-        "include", "begin", "list", "list*",
-        "quote", "defmacro", "define",
-        "print", "eval", "tag?",
-        "if", "lambda", "let",
-        "error", "expand", "apply",
-        "car", "cdr", "cons",
-        "+", "*", "=", ">", "-", "/",
-        "gensym", "display",
-    };
+    for (size_t i = 0; i < EVAL_BUILTIN_COUNT; i++) {
+        const char *name = builtin_names[i];
+
+        if (i < EVAL_BUILTIN_INTERNAL) {
+            builtin_symbols[i] = any_sexp_symbol(name, strlen(name));
+            builtins = any_sexp_cons(builtin_symbols[i], builtins);
+        } else
+            builtin_symbols[i] = any_sexp_symbol_uninterned(name, strlen(name));
+
+        eval_dispatch_add(builtin_symbols[i], i);
+    }
+
+    eval_stack = malloc(EVAL_STACK_SIZE * sizeof(any_sexp_t));
+    if (eval_stack == NULL)
+        log_panic("Failed to allocate the stack");
+
+    rest_symbol = any_sexp_symbol("&rest", 5);
+
+    gc_root(builtin_symbols, EVAL_BUILTIN_COUNT);
+    gc_root(&builtins, 1);
+    gc_root(&included, 1);
+    gc_add_marker(eval_mark_stack);
 
-    for (size_t i = 0; i < sizeof(symbols) / sizeof(*symbols); i++)
-        builtins = any_sexp_cons(any_sexp_symbol(symbols[i], strlen(symbols[i])), builtins);
+    // NOTE: A template is kept while its source form is
+    gc_weak_env(&templates, NULL, NULL);
 
     log_value_trace("Initialized evaluator",
                     "g:builtins", ANY_LOG_FORMATTER(any_sexp_fprint), builtins);
@@ -6,33 +6,271 @@
 #define CAR(l)   (any_sexp_car(l))
 #define CDR(l)   (any_sexp_cdr(l))
 #define CAAR(l)  (CAR(CAR(l)))
+#define CDAR(l)  (CDR(CAR(l)))
 #define CADR(l)  (CAR(CDR(l)))
 #define CDDR(l)  (CDR(CDR(l)))
 #define CADDR(l) (CAR(CDR(CDR(l))))
+#define CDDDR(l) (CDR(CDR(CDR(l))))
+#define CADDDR(l) (CAR(CDDDR(l)))
 
 #define T (any_sexp_number(1))
 
-typedef any_sexp_t (*eval_primitive_t)(any_sexp_t a, any_sexp_t b);
+// Builtins, in the order of the names in eval.c
+//
+typedef enum {
+    EVAL_BUILTIN_INCLUDE,
+    EVAL_BUILTIN_BEGIN,
+    EVAL_BUILTIN_LIST,
+    EVAL_BUILTIN_LIST_STAR,
+    EVAL_BUILTIN_QUOTE,
+    EVAL_BUILTIN_DEFMACRO,
+    EVAL_BUILTIN_DEFINE,
+    EVAL_BUILTIN_PRINT,
+    EVAL_BUILTIN_EVAL,
+    EVAL_BUILTIN_TAG,
+    EVAL_BUILTIN_IF,
+    EVAL_BUILTIN_LAMBDA,
+    EVAL_BUILTIN_LET,
+    EVAL_BUILTIN_ERROR,
+    EVAL_BUILTIN_EXPAND,
+    EVAL_BUILTIN_APPLY,
+    EVAL_BUILTIN_CAR,
+    EVAL_BUILTIN_CDR,
+    EVAL_BUILTIN_CONS,
+    EVAL_BUILTIN_ADD,
+    EVAL_BUILTIN_MULTIPLY,
+    EVAL_BUILTIN_EQUAL,
+    EVAL_BUILTIN_GREATER,
+    EVAL_BUILTIN_SUBTRACT,
+    EVAL_BUILTIN_DIVIDE,
+    EVAL_BUILTIN_LESS,
+    EVAL_BUILTIN_GREATER_EQUAL,
+    EVAL_BUILTIN_LESS_EQUAL,
+    EVAL_BUILTIN_GENSYM,
+    EVAL_BUILTIN_DISPLAY,
+    EVAL_BUILTIN_LETREC,
+    EVAL_BUILTIN_LENGTH,
+    EVAL_BUILTIN_APPEND,
+    EVAL_BUILTIN_REVERSE,
+    EVAL_BUILTIN_NTH,
+    EVAL_BUILTIN_ASSOC,
+    EVAL_BUILTIN_ASSQ,
+    EVAL_BUILTIN_MEMBER,
+    EVAL_BUILTIN_MAP,
+    EVAL_BUILTIN_FILTER,
+    EVAL_BUILTIN_FOLDL,
+    EVAL_BUILTIN_IS_EQUAL,
+    EVAL_BUILTIN_LOCAL,
+    EVAL_BUILTIN_CLOSURE,
+    EVAL_BUILTIN_FRAME_LET,
+    EVAL_BUILTIN_FRAME_LETREC,
+    EVAL_BUILTIN_COUNT,
+} eval_builtin_t;
 
-any_sexp_t eval_primitive(any_sexp_t sexp, any_sexp_t env, eval_primitive_t prim);
+eval_builtin_t eval_dispatch(any_sexp_t sexp);
+
+// Global environment
+//
+// Open addressing hash table from interned symbols to values, used for the
+// top level definitions and the macros. Lookup and update are O(1).
+//
+typedef struct {
+    any_sexp_t *symbols;
+    any_sexp_t *values;
+    size_t capacity;
+    size_t count;
+} eval_env_t;
+
+any_sexp_t eval_env_find(eval_env_t *env, any_sexp_t symbol);
+
+any_sexp_t eval_env_list(eval_env_t *env);
+
+// Native functions, called with their arguments evaluated: the arithmetic,
+// the comparisons and the list functions (see list.h)
+any_sexp_t eval_native(eval_builtin_t builtin, const any_sexp_t *args, size_t argc);
+
+any_sexp_t eval_arithmetic(eval_builtin_t builtin, const any_sexp_t *args, size_t argc);
+
+any_sexp_t eval_primitive_add(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t eval_primitive_multiply(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t eval_primitive_subtract(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t eval_primitive_divide(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t eval_primitive_greater(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t eval_primitive_less(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t eval_primitive_greater_equal(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t eval_primitive_less_equal(any_sexp_t a, any_sexp_t b);
+
+any_sexp_t eval_primitive_equal(any_sexp_t a, any_sexp_t b);
 
 any_sexp_t eval_get_fvs(any_sexp_t sexp, any_sexp_t pars);
 
-any_sexp_t eval_symbol(const char *symbol, any_sexp_t env);
+any_sexp_t eval_symbol(any_sexp_t symbol);
+
+// Output of print and display, flags are the ones of any_sexp_writer_t
+//
+// The value is written through a buffer and flushed to stdout before
+// returning, since the next argument can print or log as well.
+//
+void eval_write(any_sexp_t value, int flags, bool space);
+
+// Frames and closures
+//
+// The frames of the calls are pushed on a single stack, which is shared
+// with the VM (see vm.h). A closure is an object (see any_sexp_object_t)
+// with the values
+//
+// [code captured ...]
+//
+// where code is the object shared by all the closures created from the
+// same template, with the values
+//
+// [pars size body params rest self compiled]
+//
+// params is the number of parameters before &rest, rest is 1 if there is a
+// rest parameter (-1 if it is not the last) and self is 1 if the closure is
+// stored in the frame after the captured values. compiled is the index of
+// the bytecode in the VM, or nil before the first call from the VM.
+//
+#define EVAL_STACK_SIZE (1 << 20)
+
+// NOTE: The bignums are objects as well (see bignum.h), and so are the
+//       markers of the unassigned slots of a letrec (see eval_frame_letrec)
+typedef enum {
+    EVAL_OBJECT_CODE,
+    EVAL_OBJECT_CLOSURE,
+    EVAL_OBJECT_BIGNUM,
+    EVAL_OBJECT_UNASSIGNED,
+} eval_object_t;
+
+typedef enum {
+    EVAL_CODE_PARS,
+    EVAL_CODE_SIZE,
+    EVAL_CODE_BODY,
+    EVAL_CODE_PARAMS,
+    EVAL_CODE_REST,
+    EVAL_CODE_SELF,
+    EVAL_CODE_COMPILED,
+    EVAL_CODE_LENGTH,
+} eval_code_field_t;
+
+#define EVAL_VALUES(object)           (ANY_SEXP_GET_OBJECT(object)->values)
+#define EVAL_FIELD(code, field)       (EVAL_VALUES(code)[field])
+#define EVAL_CLOSURE_CODE(lambda)     (EVAL_VALUES(lambda)[0])
+#define EVAL_CLOSURE_CAPTURED(lambda) ((size_t)ANY_SEXP_GET_OBJECT(lambda)->length - 1)
+
+extern any_sexp_t *eval_stack;
+
+extern size_t eval_stack_top;
+
+any_sexp_t *eval_push_frame(size_t size);
+
+any_sexp_t eval_resolve_toplevel(any_sexp_t sexp, size_t *size);
+
+any_sexp_t eval_template(any_sexp_t lambda);
+
+// Copies count captured values in the closure, or leaves them nil if values
+// is NULL
+any_sexp_t eval_closure(any_sexp_t code, const any_sexp_t *values, size_t count);
+
+static inline bool eval_is_closure(any_sexp_t sexp)
+{
+    return ANY_SEXP_IS_OBJECT(sexp) && ANY_SEXP_GET_OBJECT(sexp)->kind == EVAL_OBJECT_CLOSURE;
+}
+
+// Returns true for the value of a letrec name before it is set, which can be
+// captured but not read (the name is the only value of the marker)
+static inline bool eval_is_unassigned(any_sexp_t sexp)
+{
+    return ANY_SEXP_IS_OBJECT(sexp) && ANY_SEXP_GET_OBJECT(sexp)->kind == EVAL_OBJECT_UNASSIGNED;
+}
+
+// A #letrec run by the VM, as in eval_frame_letrec: the slots are set to
+// the markers of the names, then the values are assigned in order between
+// begin and end, which is called even if a value fails
+any_sexp_t eval_unassigned(any_sexp_t name);
+
+void eval_letrec_begin();
+
+void eval_letrec_assign(any_sexp_t *slot, any_sexp_t value);
+
+void eval_letrec_end();
+
+any_sexp_t eval_lambda_call(any_sexp_t lambda, any_sexp_t args);
+
+// Calls a closure with argc values, through the engine that runs the top
+// level (see eval_set_caller)
+any_sexp_t eval_call(any_sexp_t lambda, const any_sexp_t *args, size_t argc);
+
+// Expression in tail position, see eval_cons
+//
+// base is the top of the frame stack when the evaluation started, so that
+// tail calls can reuse the frames pushed after it.
+//
+typedef struct {
+    any_sexp_t sexp;
+    any_sexp_t *frame;
+    size_t base;
+    bool pending;
+} eval_tail_t;
+
+any_sexp_t eval_cons(any_sexp_t sexp, any_sexp_t *frame, eval_tail_t *tail);
+
+any_sexp_t eval_list(any_sexp_t sexp, any_sexp_t *frame);
+
+any_sexp_t eval(any_sexp_t sexp, any_sexp_t *frame);
+
+any_sexp_t eval_macro(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv);
+
+// Engine used to evaluate the top level expressions
+typedef any_sexp_t (*eval_engine_t)(any_sexp_t sexp);
+
+any_sexp_t eval_toplevel(any_sexp_t sexp);
+
+void eval_set_engine(eval_engine_t engine);
+
+typedef any_sexp_t (*eval_caller_t)(any_sexp_t lambda, const any_sexp_t *args, size_t argc);
+
+void eval_set_caller(eval_caller_t caller);
+
+void eval_change_env(any_sexp_t symbol, any_sexp_t value, eval_env_t *env);
+
+// Expands and runs a top level expression, in two steps so that the
+// expanded ones can be kept in the cache (see eval_include)
+any_sexp_t eval_define(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv);
 
-any_sexp_t eval_cons(any_sexp_t sexp, any_sexp_t env);
+any_sexp_t eval_expand_toplevel(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv);
 
-any_sexp_t eval_list(any_sexp_t sexp, any_sexp_t env);
+any_sexp_t eval_run_toplevel(any_sexp_t sexp, eval_env_t *env, eval_env_t *menv);
 
-any_sexp_t eval(any_sexp_t sexp, any_sexp_t env);
+// Evaluates a file unless it was already included, with the expanded
+// s-expressions from the cache if valid
+any_sexp_t eval_include(const char *path, eval_env_t *env, eval_env_t *menv);
 
-any_sexp_t eval_macro(any_sexp_t sexp, any_sexp_t env, any_sexp_t menv);
+// Evaluates the s-expressions of a file, in the text or the binary format
+// (see any_sexp_load)
+any_sexp_t eval_file(FILE *file, eval_env_t *env, eval_env_t *menv);
 
-void eval_change_env(any_sexp_t symbol, any_sexp_t value, any_sexp_t *env);
+// Writes the s-expressions of a text file in the binary format, without
+// evaluating them
+any_sexp_t eval_dump(FILE *file, FILE *output);
 
-any_sexp_t eval_define(any_sexp_t sexp, any_sexp_t *env, any_sexp_t *menv);
+// Heap image
+//
+// Snapshot of the environments and of the files included, so that the
+// prelude is not evaluated again by every script. The image is saved in the
+// binary format (see any_sexp_dump) and it is loaded from a mapping of the
+// file, then the files in the image are not included again.
+//
+any_sexp_t eval_image_save(FILE *output, eval_env_t *env, eval_env_t *menv);
 
-any_sexp_t eval_file(FILE *file, any_sexp_t *env, any_sexp_t *menv);
+any_sexp_t eval_image_load(FILE *file, eval_env_t *env, eval_env_t *menv);
 
 void eval_init();
 
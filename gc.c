@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+#include "gc.h"
+#include "arena.h"
+#include "any_log.h"
+
+typedef struct {
+    any_sexp_t *roots;
+    size_t count;
+} gc_root_t;
+
+typedef struct {
+    eval_env_t *env;
+    gc_entry_t live;
+    gc_entry_t dead;
+} gc_weak_t;
+
+// NOTE: The roots are registered once, when the modules are initialized
+#define GC_REGISTRY_SIZE 16
+
+static gc_root_t roots[GC_REGISTRY_SIZE];
+static size_t roots_count = 0;
+
+static eval_env_t *envs[GC_REGISTRY_SIZE];
+static size_t envs_count = 0;
+
+static gc_weak_t weaks[GC_REGISTRY_SIZE];
+static size_t weaks_count = 0;
+
+static gc_marker_t markers[GC_REGISTRY_SIZE];
+static size_t markers_count = 0;
+
+static void *stack_base = NULL;
+
+static size_t threshold = GC_MIN_THRESHOLD;
+
+static bool collecting = false;
+
+static gc_stats_t stats = { 0 };
+
+// Objects to trace, the cons cells and the vectors of values (closures and
+// code) reached through a value, and the objects reached through a word of
+// unknown type (which are scanned conservatively)
+static struct {
+    void **objects;
+    size_t length;
+    size_t capacity;
+} gray, vectors, conservative;
+
+#define GC_ADDRESS_MASK (((uintptr_t)1 << 48) - 1)
+
+static void gc_push(typeof(gray) *stack, void *object)
+{
+    if (stack->length == stack->capacity) {
+        stack->capacity = stack->capacity == 0 ? 1024 : 2 * stack->capacity;
+        stack->objects = realloc(stack->objects, stack->capacity * sizeof(void *));
+        if (stack->objects == NULL)
+            log_panic("Failed to allocate the mark stack");
+    }
+
+    stack->objects[stack->length++] = object;
+}
+
+void gc_mark(any_sexp_t sexp)
+{
+    void *ptr;
+
+    switch (ANY_SEXP_GET_TAG(sexp)) {
+        case ANY_SEXP_TAG_CONS:
+            ptr = ANY_SEXP_GET_CONS(sexp);
+            break;
+
+        case ANY_SEXP_TAG_SYMBOL:
+        case ANY_SEXP_TAG_STRING:
+            ptr = ANY_SEXP_GET_SYMBOL(sexp);
+            break;
+
+        case ANY_SEXP_TAG_OBJECT:
+            ptr = ANY_SEXP_GET_OBJECT(sexp);
+            break;
+
+#ifdef ANY_SEXP_FLOAT_BOXED
+        case ANY_SEXP_TAG_FLOAT:
+            ptr = &ANY_SEXP_GET_FLOAT(sexp);
+            break;
+#endif
+
+        default:
+            return;
+    }
+
+    // NOTE: The interned symbols are not in the heap
+    void *object = arena_find(ptr);
+    if (object == NULL || !arena_mark(object))
+        return;
+
+    if (ANY_SEXP_IS_CONS(sexp))
+        gc_push(&gray, object);
+    else if (ANY_SEXP_IS_OBJECT(sexp))
+        gc_push(&vectors, object);
+}
+
+static void gc_mark_word(uintptr_t word)
+{
+    void *object = arena_find((void *)word);
+
+    // The word may also be a tagged value
+    if (object == NULL)
+        object = arena_find((void *)(word & GC_ADDRESS_MASK));
+
+    if (object != NULL && arena_mark(object))
+        gc_push(&conservative, object);
+}
+
+// NOTE: The scan reads the whole stack, including the red zones of ASan
+__attribute__((no_sanitize_address))
+static void gc_mark_range(void *start, void *end)
+{
+    uintptr_t *word = (uintptr_t *)(((uintptr_t)start + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1));
+
+    for (; (void *)word < end; word++)
+        gc_mark_word(*word);
+}
+
+static bool gc_is_marked(any_sexp_t sexp)
+{
+    bool allocated = ANY_SEXP_IS_CONS(sexp) || ANY_SEXP_IS_SYMBOL(sexp) || ANY_SEXP_IS_STRING(sexp) || ANY_SEXP_IS_OBJECT(sexp);
+#ifdef ANY_SEXP_FLOAT_BOXED
+    allocated = allocated || ANY_SEXP_IS_FLOAT(sexp);
+#endif
+
+    if (!allocated)
+        return true;
+
+    void *object = arena_find(ANY_SEXP_GET_SYMBOL(sexp));
+    return object == NULL || arena_is_marked(object);
+}
+
+static void gc_drain()
+{
+    while (gray.length > 0 || vectors.length > 0 || conservative.length > 0) {
+        while (gray.length > 0) {
+            any_sexp_cons_t *cons = gray.objects[--gray.length];
+            gc_mark(cons->car);
+            gc_mark(cons->cdr);
+        }
+
+        while (vectors.length > 0) {
+            any_sexp_object_t *vector = vectors.objects[--vectors.length];
+            for (size_t i = 0; i < vector->length; i++)
+                gc_mark(vector->values[i]);
+        }
+
+        while (conservative.length > 0) {
+            void *object = conservative.objects[--conservative.length];
+            gc_mark_range(object, (char *)object + arena_object_size(object));
+        }
+    }
+}
+
+// NOTE: Not inlined, so that the registers saved by setjmp are in a frame
+//       below the ones of the evaluator
+__attribute__((noinline))
+static void gc_mark_stack()
+{
+    jmp_buf registers;
+    setjmp(registers);
+
+    gc_mark_range(&registers, stack_base);
+}
+
+static void gc_mark_env(eval_env_t *env)
+{
+    for (size_t i = 0; i < env->capacity; i++) {
+        if (ANY_SEXP_IS_NIL(env->symbols[i]))
+            continue;
+
+        gc_mark(env->symbols[i]);
+        gc_mark(env->values[i]);
+    }
+}
+
+// Marks the entries of the weak tables with a reachable key, until no new
+// key is reached
+static void gc_mark_weaks()
+{
+    size_t reached, previous = 0;
+
+    while (true) {
+        reached = 0;
+
+        for (size_t w = 0; w < weaks_count; w++) {
+            eval_env_t *env = weaks[w].env;
+
+            for (size_t i = 0; i < env->capacity; i++) {
+                if (ANY_SEXP_IS_NIL(env->symbols[i]) || !gc_is_marked(env->symbols[i]))
+                    continue;
+
+                gc_mark(env->values[i]);
+                if (weaks[w].live != NULL)
+                    weaks[w].live(env->symbols[i], env->values[i]);
+
+                reached++;
+            }
+        }
+
+        gc_drain();
+
+        if (reached == previous)
+            break;
+
+        previous = reached;
+    }
+}
+
+static void gc_prune_weaks()
+{
+    for (size_t w = 0; w < weaks_count; w++) {
+        eval_env_t *env = weaks[w].env;
+        eval_env_t pruned = { 0 };
+
+        // NOTE: The table is rebuilt, as removing the entries would break
+        //       the probing of the others
+        for (size_t i = 0; i < env->capacity; i++) {
+            any_sexp_t key = env->symbols[i];
+            any_sexp_t value = env->values[i];
+
+            if (ANY_SEXP_IS_NIL(key))
+                continue;
+
+            if (gc_is_marked(key))
+                eval_change_env(key, value, &pruned);
+            else if (weaks[w].dead != NULL)
+                weaks[w].dead(key, value);
+        }
+
+        free(env->symbols);
+        free(env->values);
+        *env = pruned;
+    }
+}
+
+size_t gc_collect()
+{
+    if (collecting || stack_base == NULL)
+        return 0;
+
+    collecting = true;
+
+    for (size_t i = 0; i < roots_count; i++) {
+        for (size_t j = 0; j < roots[i].count; j++)
+            gc_mark(roots[i].roots[j]);
+    }
+
+    for (size_t i = 0; i < envs_count; i++)
+        gc_mark_env(envs[i]);
+
+    for (size_t i = 0; i < markers_count; i++)
+        markers[i]();
+
+    gc_mark_stack();
+    gc_drain();
+
+    gc_mark_weaks();
+    gc_prune_weaks();
+
+    size_t reclaimed = arena_sweep();
+    size_t live = arena_allocated(NULL);
+
+    threshold = GC_GROWTH * live > GC_MIN_THRESHOLD
+              ? GC_GROWTH * live
+              : GC_MIN_THRESHOLD;
+
+    stats.collections++;
+    stats.reclaimed += reclaimed;
+    stats.live = live;
+
+    log_value_debug("Garbage collection",
+                    "l:reclaimed", (long)reclaimed,
+                    "l:live", (long)live,
+                    "l:threshold", (long)threshold);
+
+    collecting = false;
+    return reclaimed;
+}
+
+void *gc_malloc(size_t size)
+{
+    if (arena_allocated(NULL) >= threshold)
+        gc_collect();
+
+    return arena_malloc(size);
+}
+
+void gc_init(void *base)
+{
+    stack_base = base;
+}
+
+void gc_root(any_sexp_t *array, size_t count)
+{
+    if (roots_count == GC_REGISTRY_SIZE)
+        log_panic("Too many roots");
+
+    roots[roots_count++] = (gc_root_t) { array, count };
+}
+
+void gc_root_env(eval_env_t *env)
+{
+    if (envs_count == GC_REGISTRY_SIZE)
+        log_panic("Too many environments");
+
+    envs[envs_count++] = env;
+}
+
+void gc_weak_env(eval_env_t *env, gc_entry_t live, gc_entry_t dead)
+{
+    if (weaks_count == GC_REGISTRY_SIZE)
+        log_panic("Too many weak tables");
+
+    weaks[weaks_count++] = (gc_weak_t) { env, live, dead };
+}
+
+void gc_add_marker(gc_marker_t marker)
+{
+    if (markers_count == GC_REGISTRY_SIZE)
+        log_panic("Too many markers");
+
+    markers[markers_count++] = marker;
+}
+
+gc_stats_t gc_stats()
+{
+    return stats;
+}
@@ -0,0 +1,66 @@
+#ifndef GC_H
+#define GC_H
+
+#include "eval.h"
+
+// Garbage collector
+//
+// Mark and sweep collector for the s-expressions allocated in the arenas
+// (see arena.h). The values reachable from the registered roots are traced
+// precisely, while the C stack and the registers are scanned conservatively,
+// so that the temporaries of the evaluator do not need to be registered.
+//
+// A collection starts when an allocation finds the heap grown past the
+// threshold, which is set after each collection to GC_GROWTH times the
+// bytes that survived it.
+//
+// The weak tables keep an entry only while its key is reachable, and they
+// are used for the caches keyed by source forms (the templates of eval and
+// the code of the VM).
+
+#ifndef GC_MIN_THRESHOLD
+#define GC_MIN_THRESHOLD (8 * 1024 * 1024)
+#endif
+
+#ifndef GC_GROWTH
+#define GC_GROWTH 2
+#endif
+
+typedef void (*gc_marker_t)();
+
+typedef void (*gc_entry_t)(any_sexp_t key, any_sexp_t value);
+
+typedef struct {
+    size_t collections;
+    size_t reclaimed;
+    size_t live;
+} gc_stats_t;
+
+// Enables the collector, base is the bottom of the C stack to scan
+void gc_init(void *base);
+
+// Used as ANY_SEXP_MALLOC
+void *gc_malloc(size_t size);
+
+void gc_root(any_sexp_t *roots, size_t count);
+
+void gc_root_env(eval_env_t *env);
+
+// The live function is called for the entries whose key is reachable, and
+// should mark what the entry keeps alive besides its value, while the dead
+// one is called before removing the others (both can be NULL)
+void gc_weak_env(eval_env_t *env, gc_entry_t live, gc_entry_t dead);
+
+// The markers are called to mark the roots that are not registered
+void gc_add_marker(gc_marker_t marker);
+
+void gc_mark(any_sexp_t sexp);
+
+// Returns the number of bytes reclaimed
+size_t gc_collect();
+
+// Totals of the collections so far, live is the size of the heap after the
+// last one
+gc_stats_t gc_stats();
+
+#endif
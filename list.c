@@ -0,0 +1,295 @@
+#include <string.h>
+
+#include "list.h"
+#include "bignum.h"
+#include "any_log.h"
+
+#define LIST_VARIADIC -1
+
+static const struct {
+    const char *name;
+    int arity;
+} natives[] = {
+    [EVAL_BUILTIN_LENGTH - EVAL_BUILTIN_LENGTH]   = { "length",  1 },
+    [EVAL_BUILTIN_APPEND - EVAL_BUILTIN_LENGTH]   = { "append",  LIST_VARIADIC },
+    [EVAL_BUILTIN_REVERSE - EVAL_BUILTIN_LENGTH]  = { "reverse", 1 },
+    [EVAL_BUILTIN_NTH - EVAL_BUILTIN_LENGTH]      = { "nth",     2 },
+    [EVAL_BUILTIN_ASSOC - EVAL_BUILTIN_LENGTH]    = { "assoc",   2 },
+    [EVAL_BUILTIN_ASSQ - EVAL_BUILTIN_LENGTH]     = { "assq",    2 },
+    [EVAL_BUILTIN_MEMBER - EVAL_BUILTIN_LENGTH]   = { "member",  2 },
+    [EVAL_BUILTIN_MAP - EVAL_BUILTIN_LENGTH]      = { "map",     2 },
+    [EVAL_BUILTIN_FILTER - EVAL_BUILTIN_LENGTH]   = { "filter",  2 },
+    [EVAL_BUILTIN_FOLDL - EVAL_BUILTIN_LENGTH]    = { "foldl",   3 },
+    [EVAL_BUILTIN_IS_EQUAL - EVAL_BUILTIN_LENGTH] = { "equal?",  2 },
+};
+
+// Returns false if the list does not end with nil
+static bool list_check_end(any_sexp_t tail, const char *name)
+{
+    if (ANY_SEXP_IS_NIL(tail))
+        return true;
+
+    log_value_error("Expected list", "s:function", name, "g:tail", ANY_LOG_FORMATTER(any_sexp_fprint), tail);
+    return false;
+}
+
+static bool list_check_function(any_sexp_t f, const char *name)
+{
+    if (eval_is_closure(f))
+        return true;
+
+    log_value_error("Expected a function", "s:function", name, "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), f);
+    return false;
+}
+
+// Appends a value to the list from head to last, which is built in order
+static bool list_push(any_sexp_t *head, any_sexp_t *last, any_sexp_t value)
+{
+    any_sexp_t cons = any_sexp_cons(value, ANY_SEXP_NIL);
+    if (ANY_SEXP_IS_ERROR(cons))
+        return false;
+
+    if (ANY_SEXP_IS_NIL(*head))
+        *head = cons;
+    else
+        ANY_SEXP_GET_CONS(*last)->cdr = cons;
+
+    *last = cons;
+    return true;
+}
+
+static bool list_equal(any_sexp_t a, any_sexp_t b)
+{
+    // NOTE: Only the cars are compared recursively, so long lists do not
+    //       grow the C stack
+    while (ANY_SEXP_IS_CONS(a) && ANY_SEXP_IS_CONS(b)) {
+        if (!list_equal(ANY_SEXP_GET_CAR(a), ANY_SEXP_GET_CAR(b)))
+            return false;
+
+        a = ANY_SEXP_GET_CDR(a);
+        b = ANY_SEXP_GET_CDR(b);
+    }
+
+    if (ANY_SEXP_GET_TAG(a) != ANY_SEXP_GET_TAG(b))
+        return false;
+
+    switch (ANY_SEXP_GET_TAG(a)) {
+        case ANY_SEXP_TAG_STRING:
+            return !strcmp(ANY_SEXP_GET_STRING(a), ANY_SEXP_GET_STRING(b));
+
+        case ANY_SEXP_TAG_NUMBER:
+            return ANY_SEXP_GET_NUMBER(a) == ANY_SEXP_GET_NUMBER(b);
+
+        case ANY_SEXP_TAG_FLOAT:
+            return ANY_SEXP_GET_FLOAT(a) == ANY_SEXP_GET_FLOAT(b);
+
+        case ANY_SEXP_TAG_OBJECT:
+            return bignum_is_bignum(a) && bignum_is_bignum(b)
+                 ? bignum_compare(a, b) == 0
+                 : ANY_SEXP_IS_EQ(a, b);
+
+        default:
+            return ANY_SEXP_IS_EQ(a, b);
+    }
+}
+
+static any_sexp_t list_length(any_sexp_t l)
+{
+    intptr_t length = 0;
+    for (; ANY_SEXP_IS_CONS(l); l = ANY_SEXP_GET_CDR(l))
+        length++;
+
+    return list_check_end(l, "length")
+         ? any_sexp_number(length)
+         : ANY_SEXP_ERROR;
+}
+
+// The last list is shared, the others are copied
+static any_sexp_t list_append(const any_sexp_t *args, size_t argc)
+{
+    if (argc == 0)
+        return ANY_SEXP_NIL;
+
+    any_sexp_t head = ANY_SEXP_NIL;
+    any_sexp_t last = ANY_SEXP_NIL;
+
+    for (size_t i = 0; i < argc - 1; i++) {
+        any_sexp_t l = args[i];
+        for (; ANY_SEXP_IS_CONS(l); l = ANY_SEXP_GET_CDR(l)) {
+            if (!list_push(&head, &last, ANY_SEXP_GET_CAR(l)))
+                return ANY_SEXP_ERROR;
+        }
+
+        if (!list_check_end(l, "append"))
+            return ANY_SEXP_ERROR;
+    }
+
+    if (ANY_SEXP_IS_NIL(head))
+        return args[argc - 1];
+
+    ANY_SEXP_GET_CONS(last)->cdr = args[argc - 1];
+    return head;
+}
+
+static any_sexp_t list_reverse(any_sexp_t l)
+{
+    any_sexp_t reversed = ANY_SEXP_NIL;
+    for (; ANY_SEXP_IS_CONS(l); l = ANY_SEXP_GET_CDR(l)) {
+        reversed = any_sexp_cons(ANY_SEXP_GET_CAR(l), reversed);
+        if (ANY_SEXP_IS_ERROR(reversed))
+            return ANY_SEXP_ERROR;
+    }
+
+    return list_check_end(l, "reverse")
+         ? reversed
+         : ANY_SEXP_ERROR;
+}
+
+// Returns nil past the end of the list
+static any_sexp_t list_nth(any_sexp_t n, any_sexp_t l)
+{
+    if (!ANY_SEXP_IS_NUMBER(n) || ANY_SEXP_GET_NUMBER(n) < 0) {
+        log_value_error("Expected an index (nth)", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), n);
+        return ANY_SEXP_ERROR;
+    }
+
+    for (intptr_t i = ANY_SEXP_GET_NUMBER(n); ANY_SEXP_IS_CONS(l); l = ANY_SEXP_GET_CDR(l), i--) {
+        if (i == 0)
+            return ANY_SEXP_GET_CAR(l);
+    }
+
+    return list_check_end(l, "nth")
+         ? ANY_SEXP_NIL
+         : ANY_SEXP_ERROR;
+}
+
+static any_sexp_t list_assoc(any_sexp_t key, any_sexp_t alist, bool identity)
+{
+    for (; ANY_SEXP_IS_CONS(alist); alist = ANY_SEXP_GET_CDR(alist)) {
+        any_sexp_t entry = ANY_SEXP_GET_CAR(alist);
+        if (!ANY_SEXP_IS_CONS(entry))
+            continue;
+
+        any_sexp_t car = ANY_SEXP_GET_CAR(entry);
+        if (identity ? ANY_SEXP_IS_EQ(car, key) : list_equal(car, key))
+            return entry;
+    }
+
+    return list_check_end(alist, identity ? "assq" : "assoc")
+         ? ANY_SEXP_NIL
+         : ANY_SEXP_ERROR;
+}
+
+static any_sexp_t list_member(any_sexp_t x, any_sexp_t l)
+{
+    for (; ANY_SEXP_IS_CONS(l); l = ANY_SEXP_GET_CDR(l)) {
+        if (list_equal(ANY_SEXP_GET_CAR(l), x))
+            return l;
+    }
+
+    return list_check_end(l, "member")
+         ? ANY_SEXP_NIL
+         : ANY_SEXP_ERROR;
+}
+
+// Map, or filter when keep is true
+static any_sexp_t list_map(any_sexp_t f, any_sexp_t l, bool keep)
+{
+    const char *name = keep ? "filter" : "map";
+    if (!list_check_function(f, name))
+        return ANY_SEXP_ERROR;
+
+    any_sexp_t head = ANY_SEXP_NIL;
+    any_sexp_t last = ANY_SEXP_NIL;
+
+    for (; ANY_SEXP_IS_CONS(l); l = ANY_SEXP_GET_CDR(l)) {
+        any_sexp_t x = ANY_SEXP_GET_CAR(l);
+
+        any_sexp_t value = eval_call(f, &x, 1);
+        if (ANY_SEXP_IS_ERROR(value))
+            return ANY_SEXP_ERROR;
+
+        if (keep) {
+            if (ANY_SEXP_IS_NIL(value))
+                continue;
+
+            value = x;
+        }
+
+        if (!list_push(&head, &last, value))
+            return ANY_SEXP_ERROR;
+    }
+
+    return list_check_end(l, name)
+         ? head
+         : ANY_SEXP_ERROR;
+}
+
+static any_sexp_t list_foldl(any_sexp_t f, any_sexp_t init, any_sexp_t l)
+{
+    if (!list_check_function(f, "foldl"))
+        return ANY_SEXP_ERROR;
+
+    any_sexp_t args[2] = { init, ANY_SEXP_NIL };
+
+    for (; ANY_SEXP_IS_CONS(l); l = ANY_SEXP_GET_CDR(l)) {
+        args[1] = ANY_SEXP_GET_CAR(l);
+
+        args[0] = eval_call(f, args, 2);
+        if (ANY_SEXP_IS_ERROR(args[0]))
+            return ANY_SEXP_ERROR;
+    }
+
+    return list_check_end(l, "foldl")
+         ? args[0]
+         : ANY_SEXP_ERROR;
+}
+
+any_sexp_t list_native(eval_builtin_t builtin, const any_sexp_t *args, size_t argc)
+{
+    int arity = natives[builtin - EVAL_BUILTIN_LENGTH].arity;
+    if (arity != LIST_VARIADIC && (size_t)arity != argc) {
+        log_value_error("Wrong number of arguments",
+                        "s:function", natives[builtin - EVAL_BUILTIN_LENGTH].name,
+                        "l:count", (long)argc);
+        return ANY_SEXP_ERROR;
+    }
+
+    switch (builtin) {
+        case EVAL_BUILTIN_LENGTH:
+            return list_length(args[0]);
+
+        case EVAL_BUILTIN_APPEND:
+            return list_append(args, argc);
+
+        case EVAL_BUILTIN_REVERSE:
+            return list_reverse(args[0]);
+
+        case EVAL_BUILTIN_NTH:
+            return list_nth(args[0], args[1]);
+
+        case EVAL_BUILTIN_ASSOC:
+            return list_assoc(args[0], args[1], false);
+
+        case EVAL_BUILTIN_ASSQ:
+            return list_assoc(args[0], args[1], true);
+
+        case EVAL_BUILTIN_MEMBER:
+            return list_member(args[0], args[1]);
+
+        case EVAL_BUILTIN_MAP:
+            return list_map(args[0], args[1], false);
+
+        case EVAL_BUILTIN_FILTER:
+            return list_map(args[0], args[1], true);
+
+        case EVAL_BUILTIN_FOLDL:
+            return list_foldl(args[0], args[1], args[2]);
+
+        case EVAL_BUILTIN_IS_EQUAL:
+            return list_equal(args[0], args[1]) ? T : ANY_SEXP_NIL;
+
+        default:
+            log_panic("Not a native function (%d)", builtin);
+    }
+}
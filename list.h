@@ -0,0 +1,37 @@
+#ifndef LIST_H
+#define LIST_H
+
+#include "eval.h"
+
+// Native list functions
+//
+// The list functions of the prelude, implemented in C. They are builtins
+// (from EVAL_BUILTIN_LENGTH to EVAL_BUILTIN_IS_EQUAL), but their arguments
+// are evaluated as the ones of a call, and both engines pass the values in
+// an array (see eval_native and VM_NATIVE).
+//
+//     (length l)
+//     (append l ... tail)
+//     (reverse l)
+//     (nth n l)
+//     (assoc key alist)      compared with equal?
+//     (assq key alist)       compared by identity
+//     (member x l)           the tail of l starting with x, or nil
+//     (map f l)
+//     (filter f l)
+//     (foldl f init l)       (f (f init x1) x2) ...
+//     (equal? a b)
+//
+// The lists are walked with loops, and the results are built in order by
+// appending to the last cell, so only the cells of the result are
+// allocated. The closures are called through eval_call, without consing
+// their arguments.
+
+static inline bool list_is_native(eval_builtin_t builtin)
+{
+    return builtin >= EVAL_BUILTIN_LENGTH && builtin <= EVAL_BUILTIN_IS_EQUAL;
+}
+
+any_sexp_t list_native(eval_builtin_t builtin, const any_sexp_t *args, size_t argc);
+
+#endif
@@ -29,38 +29,21 @@
 (defmacro cadddr (l)
   (list 'car (list 'cdddr l)))
 
-(define map
-  (lambdarec m (f l)
-    (if (nil? l)
-      '()
-      (cons
-        (f (car l))
-        (m f (cdr l))))))
-
-(define length
-  (lambdarec f (l)
-    (if (nil? l)
-      0
-      (+ 1 (f (cdr l))))))
-
-(define append
-  (lambdarec f (a b)
-    (if (nil? a)
-      b
-      (cons (car a) (f (cdr a) b)))))
+; NOTE: length, append, reverse, nth, assoc, assq, member, map, filter,
+;       foldl and equal? are native
 
 (define find
-  (lambdarec f (l x)
+  (lambda (l x)
     (if (nil? l)
       '()
       (if (and (= (tag? x) (tag? (car l))) (= x (car l)))
         1
-        (f (cdr l) x)))))
+        (find (cdr l) x)))))
 
 (define get
-  (lambdarec f (l n)
+  (lambda (l n)
     (if (nil? l)
       '()
       (if (= n 0)
         (car l)
-        (f (cdr l) (+ n -1))))))
+        (get (cdr l) (+ n -1))))))
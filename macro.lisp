@@ -13,67 +13,12 @@
 ;       body))
 
 (defmacro let* (vs body)
-  ((lambdarec f (vs)
-     (if (nil? vs)
-       body
-       (list 'let
-             (list (car vs))
-             (f (cdr vs)))))
-   vs))
-
-;; Multivariate Y combinator
-(define Y*
-  (lambda (&rest)
-    ((lambda (u) (u u))
-     (lambda (p)
-       (map (lambda (li) (lambda (&rest) (apply (apply li (p p)) &rest))) &rest)))))
-
-;; Letrec
-
-; NOTE: Works only with lambdas as values
-;
-; (letrec ((a av) (b bv) ...) body)
-; ==>
-; (let tmp (Y*
-;            (lambda (a b ...) av)
-;            (lambda (a b ...) bv))
-;   (let ((a (car tmp)) (b (cadr tmp)) ...)
-;        body)
-
-(define letrec-bindings
-  (lambdarec f (vs)
+  (let f ((vs vs))
     (if (nil? vs)
-      (cons '() '())
-      (if (and (symbol? (caar vs)) (nil? (cddar vs)))
-        (let ((bs (f (cdr vs))))
-          (cons (cons (caar vs) (car bs)) (cons (cadar vs) (cdr bs))))
-        (error "Invalid letrec bindings")))))
-
-(define letrec-lambdas
-  (lambdarec f (ss es)
-    (if (nil? es)
-      '()
-      (cons
-        (list 'lambda ss (car es))
-        (f ss (cdr es))))))
-
-(define letrec-vars
-  (lambdarec f (ss n tmp)
-    (if (nil? ss)
-      '()
-      (cons
-        (list (car ss) (list 'get tmp n))
-        (f (cdr ss) (+ 1 n) tmp)))))
-
-
-(defmacro letrec (vs body)
-  (let ((bs (letrec-bindings vs))
-        (tmp (gensym)))
-    (list 'let
-          (list
-            (list tmp
-                  (cons 'Y* (letrec-lambdas (car bs) (cdr bs)))))
-          (list 'let (letrec-vars (car bs) 0 tmp) body))))
+      body
+      (list 'let
+            (list (car vs))
+            (f (cdr vs))))))
 
 ;; Quasiquote
 
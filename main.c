@@ -1,30 +1,36 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "eval.h"
+#include "vm.h"
+#include "arena.h"
+#include "gc.h"
+#include "cache.h"
 
 #define ANY_LOG_IMPLEMENT
 #include "any_log.h"
 
-// TODO: Actually handle memory...
-
-void repl_loop(any_sexp_t *env, any_sexp_t *menv)
+void repl_loop(eval_env_t *env, eval_env_t *menv)
 {
     any_sexp_reader_t reader;
     any_sexp_reader_string_t string;
-    char buffer[ANY_SEXP_READER_BUFFER_LENGTH];
+
+    // NOTE: The line grows as needed, so there is no limit on its length
+    char *line = NULL;
+    size_t capacity = 0;
 
     while (true) {
         printf("\n> ");
         fflush(stdout);
 
-        if (!fgets(buffer, ANY_SEXP_READER_BUFFER_LENGTH, stdin))
+        ssize_t length = getline(&line, &capacity, stdin);
+        if (length < 0)
             break;
 
-        size_t length = strlen(buffer);
         if (length == 1) continue; // newline
 
-        any_sexp_reader_string_init(&reader, &string, buffer, length);
+        any_sexp_reader_string_init(&reader, &string, line, length);
 
         any_sexp_t sexp = any_sexp_read(&reader);
         if (ANY_SEXP_IS_ERROR(sexp)) {
@@ -40,25 +46,95 @@ void repl_loop(any_sexp_t *env, any_sexp_t *menv)
         eval_change_env(any_sexp_symbol("?", 1), value, env);
     }
 
+    free(line);
+
     log_value_info("Eval state",
-                   "g:env", ANY_LOG_FORMATTER(any_sexp_fprint), *env,
-                   "g:menv", ANY_LOG_FORMATTER(any_sexp_fprint), *menv);
+                   "g:env", ANY_LOG_FORMATTER(any_sexp_fprint), eval_env_list(env),
+                   "g:menv", ANY_LOG_FORMATTER(any_sexp_fprint), eval_env_list(menv));
     //any_sexp_free_list(env);
 }
 
-void repl_start()
+bool image_load(const char *path, eval_env_t *env, eval_env_t *menv)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        log_error("Failed to open image %s", path);
+        return false;
+    }
+
+    any_sexp_t result = eval_image_load(file, env, menv);
+    fclose(file);
+    return !ANY_SEXP_IS_ERROR(result);
+}
+
+bool image_save(const char *path, eval_env_t *env, eval_env_t *menv)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        log_error("Failed to open image %s", path);
+        return false;
+    }
+
+    any_sexp_t result = eval_image_save(file, env, menv);
+    return !fclose(file) && !ANY_SEXP_IS_ERROR(result);
+}
+
+void repl_start(const char *image)
 {
     printf("My own little lisp :)\n");
 
-    eval_init();
+    eval_env_t env = { 0 }, menv = { 0 };
+    gc_root_env(&env);
+    gc_root_env(&menv);
+
+    if (image != NULL && !image_load(image, &env, &menv))
+        return;
 
-    any_sexp_t env = ANY_SEXP_NIL, menv = ANY_SEXP_NIL;
     repl_loop(&env, &menv);
 }
 
+// The cache is in SCHEMEFUL_CACHE, or else in the cache directory of the
+// user, and it is disabled if SCHEMEFUL_CACHE is empty
+void cache_start()
+{
+    const char *directory = getenv("SCHEMEFUL_CACHE");
+    if (directory != NULL) {
+        cache_init(directory);
+        return;
+    }
+
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = "/schemeful";
+
+    if (base == NULL || *base == '\0') {
+        base = getenv("HOME");
+        suffix = "/.cache/schemeful";
+    }
+
+    if (base == NULL || *base == '\0')
+        return;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%s", base, suffix);
+    cache_init(path);
+}
+
+// Called at exit when --gc-stats is given
+void gc_stats_print()
+{
+    gc_stats_t stats = gc_stats();
+
+    log_value_info("Garbage collector",
+                   "l:collections", (long)stats.collections,
+                   "l:reclaimed", (long)stats.reclaimed,
+                   "l:live", (long)stats.live);
+}
+
 void usage()
 {
-    printf("Usage: schemeful [--trace] [file]\n");
+    printf("Usage: schemeful [--trace] [--gc-stats] [--vm] [--repl]\n"
+           "                 [--dump output] [--image input]\n"
+           "                 [--save-image output] [file]\n");
 }
 
 int main(int argc, char **argv)
@@ -66,39 +142,106 @@ int main(int argc, char **argv)
     any_log_level_t level = ANY_LOG_INFO;
     int argb = 1;
 
-    if (argc > 1 && !strcmp(argv[argb], "--trace")) {
+    if (argb < argc && !strcmp(argv[argb], "--trace")) {
         argb++;
         level = ANY_LOG_TRACE;
     }
 
     any_log_init(stdout, level);
 
+    if (argb < argc && !strcmp(argv[argb], "--gc-stats")) {
+        argb++;
+        atexit(gc_stats_print);
+    }
+
+    bool use_vm = false;
+    if (argb < argc && !strcmp(argv[argb], "--vm")) {
+        argb++;
+        use_vm = true;
+    }
+
     bool use_repl = false;
-    if (argc > 1 && !strcmp(argv[argb], "--repl")) {
+    if (argb < argc && !strcmp(argv[argb], "--repl")) {
         argb++;
         use_repl = true;
     }
 
+    // Write the file in the binary format instead of running it
+    const char *dump = NULL;
+    if (argb + 1 < argc && !strcmp(argv[argb], "--dump")) {
+        dump = argv[argb + 1];
+        argb += 2;
+    }
+
+    // Start from the environments of an image, instead of including the
+    // prelude again
+    const char *image = NULL;
+    if (argb + 1 < argc && !strcmp(argv[argb], "--image")) {
+        image = argv[argb + 1];
+        argb += 2;
+    }
+
+    // Save the environments after running the file
+    const char *save_image = NULL;
+    if (argb + 1 < argc && !strcmp(argv[argb], "--save-image")) {
+        save_image = argv[argb + 1];
+        argb += 2;
+    }
+
+    cache_start();
+
+    // NOTE: The stack is scanned from the frame of main
+    gc_init(__builtin_frame_address(0));
+
+    eval_init();
+
+    // Run the top level expressions with the bytecode VM
+    if (use_vm)
+        vm_init();
+
     if ((argc - argb) == 0) {
-        repl_start();
+        repl_start(image);
         return 0;
     }
 
-    if ((argc - argb) == 1) {
+    if ((argc - argb) == 1 && dump != NULL) {
         FILE *file = fopen(argv[argb], "rb");
         if (file == NULL) {
             log_error("Failed to open file %s", argv[argb]);
             return 1;
         }
 
-        eval_init();
-        any_sexp_t env = ANY_SEXP_NIL, menv = ANY_SEXP_NIL;
+        FILE *output = fopen(dump, "wb");
+        if (output == NULL) {
+            log_error("Failed to open file %s", dump);
+            return 1;
+        }
+
+        any_sexp_t result = eval_dump(file, output);
+        return fclose(output) || ANY_SEXP_IS_ERROR(result);
+    }
+
+    if ((argc - argb) == 1) {
+        eval_env_t env = { 0 }, menv = { 0 };
+        gc_root_env(&env);
+        gc_root_env(&menv);
+
+        if (image != NULL && !image_load(image, &env, &menv))
+            return 1;
+
+        // NOTE: The objects of the script are released all at once
+        arena_t *arena = arena_create();
+        arena_select(arena);
 
-        eval_file(file, &env, &menv);
+        eval_include(argv[argb], &env, &menv);
 
         if (use_repl)
             repl_loop(&env, &menv);
-        return 0;
+
+        bool saved = save_image == NULL || image_save(save_image, &env, &menv);
+
+        arena_destroy(arena);
+        return !saved;
     }
 
     usage();
@@ -150,3 +150,50 @@
 ;(print (quasiquote a))
 ;
 ;(letrec ((a (lambda (n) n)) (b (lambda (x) x))) a)
+
+;; Recursive defines
+(define countdown
+  (let ((last 'liftoff))
+    (lambda (n) (if (= n 0) last (countdown (- n 1))))))
+
+(print (list "Countdown" (countdown 3)))
+
+; NOTE: The recursive call looks up the latest definition of the name
+(define old-countdown countdown)
+(define countdown (lambda (n) 'aborted))
+
+(print (list "Redefined" (old-countdown 0) (old-countdown 3)))
+
+;; Bignums
+(print (list "Factorial 25" (fac 25)))
+(print (list "Factorial 100" (fac 100)))
+
+; NOTE: The fixnums end at 2^47, 2^59, 2^62 or 2^63 depending on the layout
+; of the values, so every boundary is crossed and only the comparisons are
+; printed
+(define boundaries
+  '(140737488355328 576460752303423488 4611686018427387904 9223372036854775808))
+
+(print (list "Overflow up"
+  (map (lambda (b) (= (+ (+ b -1) 1) b)) boundaries)
+  (map (lambda (b) (= (* (+ b -1) 2) (+ b b -2))) boundaries)))
+
+(print (list "Overflow down"
+  (map (lambda (b) (= (+ (- 0 b) -1) (- 0 (+ b 1)))) boundaries)
+  (map (lambda (b) (= (* (- 0 b) 2) (- 0 b b))) boundaries)))
+
+; NOTE: nth takes only fixnums, so the results must have been demoted
+(print (list "Back to fixnums"
+  (map (lambda (b) (nth (- (+ b 5) (+ b 3)) '(a b c))) boundaries)
+  (map (lambda (b) (nth (/ (* b 2) b) '(a b c))) boundaries)
+  (nth (/ (fac 25) (fac 24)) '(a b c d e f g h i j k l m n o p q r s t u v w x y z))))
+
+(print (list "Literals"
+  123456789012345678901234567890
+  -123456789012345678901234567890
+  (= 18446744073709551616 (* 4294967296 4294967296))))
+
+;; Floats
+; NOTE: The shortest form that reads back is printed, the subnormals included
+(print (list "Short decimals" 0.1 0.3 (+ 0.1 0.2) 1.5 100.0 1e21 1e-7 (/ 1.0 3.0)))
+(print (list "Subnormals" 5e-324 1e-310 2.2250738585072014e-308 (* 5e-324 3) (/ 5e-324 2)))
@@ -0,0 +1,1424 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+#include "eval.h"
+#include "gc.h"
+#include "bignum.h"
+#include "any_log.h"
+
+// Instructions
+//
+// Each instruction is a 32 bit word, with the opcode in the low byte and the
+// argument in the others. Some instructions are followed by operand words
+//
+//     CONST index         push constants[index]
+//     NIL                 push nil
+//     LOCAL index         push frame[index]
+//     LOCAL_CHECKED index as LOCAL for a value that can be unassigned (see
+//                         eval_frame_letrec), which then fails the run
+//     SET_LOCAL index     pop into frame[index]
+//     GLOBAL index        push the global value of the symbol constants[index]
+//     POP                 drop the top
+//     JUMP target         (the target is in the operand word)
+//     BRANCH else end     pop the condition and jump to else if it is nil,
+//                         or jump to end without popping if it is an error
+//     CHECK end depth     if the top is an error, unwind the operands to depth,
+//                         push the error and jump to end
+//     CALLABLE end depth  as CHECK, but fails if the top is not a closure
+//     CALL argc           call the closure below the arguments
+//     TAIL_CALL argc      as CALL, reusing the current frame
+//     APPLY               call the closure below the top with the top as list
+//     TAIL_APPLY
+//     RETURN              return the top to the caller
+//     CLOSURE index count create a closure of the code constants[index]
+//                         capturing the top count values
+//     CAR, CDR, CONS, TAG
+//     ADD, SUBTRACT, MULTIPLY, DIVIDE, GREATER, LESS, GREATER_EQUAL,
+//     LESS_EQUAL, EQUAL   the binary forms of the arithmetic
+//     LIST count          pop count values into a list
+//     LIST_STAR count     as LIST, with the last value as the tail
+//     PRINT flags         pop and print (see VM_PRINT_*)
+//     EVAL                pop and evaluate at the top level
+//     NATIVE builtin argc call the native function with the top argc
+//                         values (see eval_native)
+//     UNASSIGNED index name
+//                         set frame[index] to the marker of constants[name]
+//     LETREC, LETREC_END  bound the values of a letrec (see eval_letrec_begin)
+//     ASSIGN index        pop into frame[index], and into the closures that
+//                         captured its marker
+//     FALLBACK index      evaluate constants[index] with the tree-walker
+//
+// The operands of the instructions live on the frame stack, just above the
+// frame of the current call. The depth is the number of operands, which is
+// known at each point of the code.
+//
+// The error handling follows the one of eval: when a subexpression fails,
+// the enclosing form evaluates to an error (without evaluating the rest),
+// and the error is then handled by the form around it. The CHECK
+// instructions jump to the end of the form that fails.
+//
+// NOTE: Since no form handles an error other than by failing, a read of an
+//       unassigned value returns the error from the run straight away,
+//       without a CHECK after each read of a captured value.
+
+#define VM_OPCODES(X) \
+    X(CONST) X(NIL) X(LOCAL) X(LOCAL_CHECKED) X(SET_LOCAL) X(GLOBAL) X(POP) \
+    X(JUMP) X(BRANCH) X(CHECK) X(CALLABLE) \
+    X(CALL) X(TAIL_CALL) X(APPLY) X(TAIL_APPLY) X(RETURN) X(CLOSURE) \
+    X(CAR) X(CDR) X(CONS) X(TAG) \
+    X(ADD) X(SUBTRACT) X(MULTIPLY) X(DIVIDE) \
+    X(GREATER) X(LESS) X(GREATER_EQUAL) X(LESS_EQUAL) X(EQUAL) \
+    X(LIST) X(LIST_STAR) X(PRINT) X(EVAL) X(NATIVE) \
+    X(UNASSIGNED) X(LETREC) X(ASSIGN) X(LETREC_END) X(FALLBACK)
+
+typedef enum {
+#define VM_OPCODE_ENUM(op) VM_##op,
+    VM_OPCODES(VM_OPCODE_ENUM)
+#undef VM_OPCODE_ENUM
+    VM_OPCODE_COUNT,
+} vm_opcode_t;
+
+#define VM_OPCODE(word) ((word) & 0xff)
+#define VM_ARG(word)    ((word) >> 8)
+#define VM_ARG_MAX      0xffffff
+
+// Terminates the chains of jumps to be patched
+#define VM_CHAIN_END UINT32_MAX
+
+#define VM_PRINT_SPACE   1
+#define VM_PRINT_DISPLAY 2
+
+// NOTE: Computed goto is a GNU extension, otherwise a switch is used
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO
+#endif
+
+typedef struct {
+    uint32_t *code;
+    size_t length;
+    size_t capacity;
+
+    any_sexp_t *constants;
+    size_t constants_length;
+    size_t constants_capacity;
+
+    // Layout of the frame (see eval_resolve)
+    size_t size;
+    size_t captured;
+    size_t self; // 1 if the closure is stored after the captured values
+    size_t params;
+    int rest; // 1 if there is a rest parameter, -1 if it is not the last
+
+    // Maximum number of operands
+    size_t depth;
+
+    // The code object of the closures (see eval.h), or nil at the top level
+    any_sexp_t key;
+} vm_code_t;
+
+typedef struct {
+    vm_code_t *code;
+    size_t depth;
+
+    // The slots that can be unassigned: the captured values, and the slots
+    // from the first one of the letrecs whose values are being compiled
+    size_t captured;
+    size_t unassigned;
+} vm_compiler_t;
+
+typedef struct {
+    vm_code_t *code;
+    uint32_t *ip;
+    any_sexp_t *fp;
+} vm_call_t;
+
+// The runs are nested when the VM is entered again from eval or the
+// tree-walker, and they are kept on the C stack. letrecs is the number of
+// letrecs begun by the run and not ended yet.
+typedef struct vm_run {
+    vm_code_t *code;
+    size_t letrecs;
+    struct vm_run *prev;
+} vm_run_t;
+
+#define VM_CALLS_SIZE (1 << 18)
+
+static vm_call_t *calls = NULL;
+static size_t calls_top = 0;
+
+static vm_run_t *runs = NULL;
+
+// The code of each closure is compiled on the first call, and its index is
+// stored in the code object shared by the closures of the same template. The
+// weak table keeps the bytecode while the code object is reachable.
+static eval_env_t code_index = { 0 };
+
+static vm_code_t **codes = NULL;
+static size_t codes_length = 0;
+static size_t codes_capacity = 0;
+
+// Compiler
+
+static vm_code_t *vm_code_new()
+{
+    vm_code_t *code = calloc(1, sizeof(vm_code_t));
+    if (code == NULL)
+        log_panic("Failed to allocate the code");
+
+    return code;
+}
+
+static void vm_code_free(vm_code_t *code)
+{
+    free(code->code);
+    free(code->constants);
+    free(code);
+}
+
+// NOTE: The constants are parts of the body, but the body of the top level
+//       is not referenced anywhere else while it runs
+static void vm_code_mark(vm_code_t *code)
+{
+    gc_mark(code->key);
+
+    for (size_t i = 0; i < code->constants_length; i++)
+        gc_mark(code->constants[i]);
+}
+
+static size_t vm_emit(vm_compiler_t *compiler, uint32_t word)
+{
+    vm_code_t *code = compiler->code;
+
+    if (code->length == code->capacity) {
+        code->capacity = code->capacity == 0 ? 64 : 2 * code->capacity;
+        code->code = realloc(code->code, code->capacity * sizeof(uint32_t));
+        if (code->code == NULL)
+            log_panic("Failed to allocate the code");
+    }
+
+    code->code[code->length] = word;
+    return code->length++;
+}
+
+static size_t vm_emit_op(vm_compiler_t *compiler, vm_opcode_t op, size_t arg)
+{
+    if (arg > VM_ARG_MAX)
+        log_panic("Bytecode argument too large (%zu)", arg);
+
+    return vm_emit(compiler, op | (uint32_t)arg << 8);
+}
+
+static size_t vm_constant(vm_compiler_t *compiler, any_sexp_t sexp)
+{
+    vm_code_t *code = compiler->code;
+
+    if (code->constants_length == code->constants_capacity) {
+        code->constants_capacity = code->constants_capacity == 0 ? 16 : 2 * code->constants_capacity;
+        code->constants = realloc(code->constants, code->constants_capacity * sizeof(any_sexp_t));
+        if (code->constants == NULL)
+            log_panic("Failed to allocate the constants");
+    }
+
+    code->constants[code->constants_length] = sexp;
+    return code->constants_length++;
+}
+
+static void vm_push(vm_compiler_t *compiler, size_t count)
+{
+    compiler->depth += count;
+    if (compiler->depth > compiler->code->depth)
+        compiler->code->depth = compiler->depth;
+}
+
+// Emits a jump to the end of the current form, which is linked in the chain
+static void vm_emit_check(vm_compiler_t *compiler, vm_opcode_t op, uint32_t *chain, size_t depth)
+{
+    vm_emit_op(compiler, op, 0);
+    *chain = vm_emit(compiler, *chain);
+    vm_emit(compiler, depth);
+}
+
+static void vm_patch_chain(vm_compiler_t *compiler, uint32_t chain)
+{
+    uint32_t *code = compiler->code->code;
+    uint32_t target = compiler->code->length;
+
+    while (chain != VM_CHAIN_END) {
+        uint32_t next = code[chain];
+        code[chain] = target;
+        chain = next;
+    }
+}
+
+// Returns the length of a proper list, or -1
+static long vm_length(any_sexp_t list)
+{
+    long length = 0;
+    for (; ANY_SEXP_IS_CONS(list); list = CDR(list))
+        length++;
+
+    return ANY_SEXP_IS_NIL(list) ? length : -1;
+}
+
+// The value of constants and locals is never an error
+static bool vm_can_fail(any_sexp_t sexp)
+{
+    if (ANY_SEXP_IS_SYMBOL(sexp))
+        return true;
+
+    if (!ANY_SEXP_IS_CONS(sexp))
+        return false;
+
+    switch (eval_dispatch(CAR(sexp))) {
+        case EVAL_BUILTIN_LOCAL:
+            return false;
+
+        case EVAL_BUILTIN_QUOTE:
+            return vm_length(CDR(sexp)) != 1;
+
+        default:
+            return true;
+    }
+}
+
+static void vm_compile(vm_compiler_t *compiler, any_sexp_t sexp, bool tail);
+
+// Compiles the values, checking each of them for errors
+static void vm_compile_values(vm_compiler_t *compiler, any_sexp_t list, uint32_t *chain, size_t depth)
+{
+    for (; !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        vm_compile(compiler, CAR(list), false);
+
+        if (vm_can_fail(CAR(list)))
+            vm_emit_check(compiler, VM_CHECK, chain, depth);
+    }
+}
+
+static void vm_compile_fallback(vm_compiler_t *compiler, any_sexp_t sexp)
+{
+    vm_emit_op(compiler, VM_FALLBACK, vm_constant(compiler, sexp));
+    vm_push(compiler, 1);
+}
+
+static void vm_compile_unary(vm_compiler_t *compiler, any_sexp_t sexp, vm_opcode_t op)
+{
+    if (vm_length(CDR(sexp)) != 1) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    vm_compile(compiler, CADR(sexp), false);
+    vm_emit_op(compiler, op, 0);
+}
+
+static void vm_compile_binary(vm_compiler_t *compiler, any_sexp_t sexp, vm_opcode_t op)
+{
+    if (vm_length(CDR(sexp)) != 2) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    vm_compile(compiler, CADR(sexp), false);
+    vm_compile(compiler, CADDR(sexp), false);
+    vm_emit_op(compiler, op, 0);
+    compiler->depth--;
+}
+
+static void vm_compile_if(vm_compiler_t *compiler, any_sexp_t sexp, bool tail)
+{
+    if (vm_length(CDR(sexp)) != 3) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    size_t depth = compiler->depth;
+    uint32_t chain = VM_CHAIN_END;
+
+    vm_compile(compiler, CADR(sexp), false);
+    vm_emit_op(compiler, VM_BRANCH, 0);
+    size_t otherwise = vm_emit(compiler, 0);
+    chain = vm_emit(compiler, chain);
+    compiler->depth = depth;
+
+    vm_compile(compiler, CADDR(sexp), tail);
+
+    // NOTE: Both the error of the condition and the end of the consequent
+    //       jump after the alternative
+    //
+    if (tail)
+        vm_emit_op(compiler, VM_RETURN, 0);
+    else {
+        vm_emit_op(compiler, VM_JUMP, 0);
+        chain = vm_emit(compiler, chain);
+    }
+
+    compiler->code->code[otherwise] = compiler->code->length;
+    compiler->depth = depth;
+
+    vm_compile(compiler, CADDR(CDR(sexp)), tail);
+    vm_patch_chain(compiler, chain);
+}
+
+static void vm_compile_begin(vm_compiler_t *compiler, any_sexp_t sexp, bool tail)
+{
+    any_sexp_t list = CDR(sexp);
+
+    if (vm_length(list) < 0) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    if (ANY_SEXP_IS_NIL(list)) {
+        vm_emit_op(compiler, VM_NIL, 0);
+        vm_push(compiler, 1);
+        return;
+    }
+
+    size_t depth = compiler->depth;
+    uint32_t chain = VM_CHAIN_END;
+
+    for (; !ANY_SEXP_IS_NIL(CDR(list)); list = CDR(list)) {
+        vm_compile(compiler, CAR(list), false);
+
+        if (vm_can_fail(CAR(list)))
+            vm_emit_check(compiler, VM_CHECK, &chain, depth);
+
+        vm_emit_op(compiler, VM_POP, 0);
+        compiler->depth--;
+    }
+
+    vm_compile(compiler, CAR(list), tail);
+    vm_patch_chain(compiler, chain);
+}
+
+static void vm_compile_let(vm_compiler_t *compiler, any_sexp_t sexp, bool tail)
+{
+    size_t depth = compiler->depth;
+    uint32_t chain = VM_CHAIN_END;
+
+    for (any_sexp_t binds = CADR(sexp); !ANY_SEXP_IS_NIL(binds); binds = CDR(binds)) {
+        vm_compile(compiler, CDAR(binds), false);
+
+        if (vm_can_fail(CDAR(binds)))
+            vm_emit_check(compiler, VM_CHECK, &chain, depth);
+
+        vm_emit_op(compiler, VM_SET_LOCAL, ANY_SEXP_GET_NUMBER(CAAR(binds)));
+        compiler->depth--;
+    }
+
+    vm_compile(compiler, CADDR(sexp), tail);
+    vm_patch_chain(compiler, chain);
+}
+
+// The values are compiled as in vm_compile_let, but the reads of the slots
+// of the letrec are checked while they can be unassigned
+//
+// NOTE: The slots are allocated in order, so the slots of the letrecs in
+//       the values come after the first one as well
+static void vm_compile_letrec(vm_compiler_t *compiler, any_sexp_t sexp, bool tail)
+{
+    size_t depth = compiler->depth;
+    size_t unassigned = compiler->unassigned;
+    uint32_t chain = VM_CHAIN_END;
+
+    any_sexp_t binds = CADR(sexp);
+    for (any_sexp_t list = binds; !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        size_t index = ANY_SEXP_GET_NUMBER(CAAR(list));
+
+        vm_emit_op(compiler, VM_UNASSIGNED, index);
+        vm_emit(compiler, vm_constant(compiler, CADR(CAR(list))));
+
+        if (index < compiler->unassigned)
+            compiler->unassigned = index;
+    }
+
+    vm_emit_op(compiler, VM_LETREC, 0);
+
+    for (any_sexp_t list = binds; !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        vm_compile(compiler, CDDR(CAR(list)), false);
+
+        if (vm_can_fail(CDDR(CAR(list))))
+            vm_emit_check(compiler, VM_CHECK, &chain, depth);
+
+        vm_emit_op(compiler, VM_ASSIGN, ANY_SEXP_GET_NUMBER(CAAR(list)));
+        compiler->depth--;
+    }
+
+    compiler->unassigned = unassigned;
+    vm_emit_op(compiler, VM_LETREC_END, 0);
+    vm_compile(compiler, CADDR(sexp), tail);
+
+    if (chain == VM_CHAIN_END)
+        return;
+
+    // NOTE: A value that fails jumps to the end of the letrec here
+    vm_emit_op(compiler, VM_JUMP, 0);
+    size_t end = vm_emit(compiler, 0);
+
+    vm_patch_chain(compiler, chain);
+    vm_emit_op(compiler, VM_LETREC_END, 0);
+    compiler->code->code[end] = compiler->code->length;
+}
+
+static void vm_compile_closure(vm_compiler_t *compiler, any_sexp_t sexp)
+{
+    any_sexp_t template = eval_template(CDDR(sexp));
+    if (ANY_SEXP_IS_ERROR(template)) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    size_t depth = compiler->depth;
+    uint32_t chain = VM_CHAIN_END;
+
+    // NOTE: The locals are captured as they are, even if unassigned
+    any_sexp_t refs = CADR(sexp);
+    for (any_sexp_t list = refs; !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        if (ANY_SEXP_IS_CONS(CAR(list))) {
+            vm_emit_op(compiler, VM_LOCAL, ANY_SEXP_GET_NUMBER(CDAR(list)));
+            vm_push(compiler, 1);
+        } else {
+            vm_compile(compiler, CAR(list), false);
+            vm_emit_check(compiler, VM_CHECK, &chain, depth);
+        }
+    }
+
+    vm_emit_op(compiler, VM_CLOSURE, vm_constant(compiler, CDR(template)));
+    vm_emit(compiler, vm_length(refs));
+
+    compiler->depth = depth;
+    vm_push(compiler, 1);
+    vm_patch_chain(compiler, chain);
+}
+
+static void vm_compile_list(vm_compiler_t *compiler, any_sexp_t sexp, vm_opcode_t op)
+{
+    long length = vm_length(CDR(sexp));
+    if (length < 0) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    if (length == 0) {
+        vm_emit_op(compiler, VM_NIL, 0);
+        vm_push(compiler, 1);
+        return;
+    }
+
+    size_t depth = compiler->depth;
+    uint32_t chain = VM_CHAIN_END;
+
+    vm_compile_values(compiler, CDR(sexp), &chain, depth);
+    vm_emit_op(compiler, op, length);
+
+    compiler->depth = depth + 1;
+    vm_patch_chain(compiler, chain);
+}
+
+static void vm_compile_native(vm_compiler_t *compiler, any_sexp_t sexp, eval_builtin_t builtin)
+{
+    long length = vm_length(CDR(sexp));
+    if (length < 0) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    size_t depth = compiler->depth;
+    uint32_t chain = VM_CHAIN_END;
+
+    vm_compile_values(compiler, CDR(sexp), &chain, depth);
+    vm_emit_op(compiler, VM_NATIVE, builtin);
+    vm_emit(compiler, length);
+
+    compiler->depth = depth;
+    vm_push(compiler, 1);
+    vm_patch_chain(compiler, chain);
+}
+
+// The binary forms get their own instruction, the others are native calls
+static void vm_compile_arithmetic(vm_compiler_t *compiler, any_sexp_t sexp, vm_opcode_t op)
+{
+    if (vm_length(CDR(sexp)) == 2)
+        vm_compile_binary(compiler, sexp, op);
+    else
+        vm_compile_native(compiler, sexp, eval_dispatch(CAR(sexp)));
+}
+
+static void vm_compile_print(vm_compiler_t *compiler, any_sexp_t sexp, uint32_t flags)
+{
+    if (vm_length(CDR(sexp)) < 0) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    size_t depth = compiler->depth;
+    uint32_t chain = VM_CHAIN_END;
+
+    for (any_sexp_t list = CDR(sexp); !ANY_SEXP_IS_NIL(list); list = CDR(list)) {
+        vm_compile(compiler, CAR(list), false);
+
+        if (vm_can_fail(CAR(list)))
+            vm_emit_check(compiler, VM_CHECK, &chain, depth);
+
+        vm_emit_op(compiler, VM_PRINT, ANY_SEXP_IS_NIL(CDR(list)) ? flags : flags | VM_PRINT_SPACE);
+        compiler->depth--;
+    }
+
+    vm_emit_op(compiler, VM_NIL, 0);
+    vm_push(compiler, 1);
+    vm_patch_chain(compiler, chain);
+}
+
+static void vm_compile_apply(vm_compiler_t *compiler, any_sexp_t sexp, bool tail)
+{
+    if (vm_length(CDR(sexp)) != 2) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    vm_compile(compiler, CADR(sexp), false);
+    vm_compile(compiler, CADDR(sexp), false);
+    vm_emit_op(compiler, tail ? VM_TAIL_APPLY : VM_APPLY, 0);
+    compiler->depth--;
+}
+
+static void vm_compile_call(vm_compiler_t *compiler, any_sexp_t sexp, bool tail)
+{
+    long argc = vm_length(CDR(sexp));
+    if (argc < 0) {
+        vm_compile_fallback(compiler, sexp);
+        return;
+    }
+
+    size_t depth = compiler->depth;
+    uint32_t chain = VM_CHAIN_END;
+
+    vm_compile(compiler, CAR(sexp), false);
+    vm_emit_check(compiler, VM_CALLABLE, &chain, depth);
+
+    vm_compile_values(compiler, CDR(sexp), &chain, depth);
+    vm_emit_op(compiler, tail ? VM_TAIL_CALL : VM_CALL, argc);
+
+    compiler->depth = depth + 1;
+    vm_patch_chain(compiler, chain);
+}
+
+static void vm_compile(vm_compiler_t *compiler, any_sexp_t sexp, bool tail)
+{
+    if (ANY_SEXP_IS_NIL(sexp)) {
+        vm_emit_op(compiler, VM_NIL, 0);
+        vm_push(compiler, 1);
+        return;
+    }
+
+    if (ANY_SEXP_IS_SYMBOL(sexp)) {
+        vm_emit_op(compiler, VM_GLOBAL, vm_constant(compiler, sexp));
+        vm_push(compiler, 1);
+        return;
+    }
+
+    if (!ANY_SEXP_IS_CONS(sexp)) {
+        vm_emit_op(compiler, VM_CONST, vm_constant(compiler, sexp));
+        vm_push(compiler, 1);
+        return;
+    }
+
+    switch (eval_dispatch(CAR(sexp))) {
+        case EVAL_BUILTIN_LOCAL: {
+            size_t index = ANY_SEXP_GET_NUMBER(CDR(sexp));
+            bool checked = index < compiler->captured || index >= compiler->unassigned;
+            vm_emit_op(compiler, checked ? VM_LOCAL_CHECKED : VM_LOCAL, index);
+            vm_push(compiler, 1);
+            break;
+        }
+
+        case EVAL_BUILTIN_QUOTE:
+            if (vm_length(CDR(sexp)) != 1) {
+                vm_compile_fallback(compiler, sexp);
+                break;
+            }
+
+            vm_emit_op(compiler, VM_CONST, vm_constant(compiler, CADR(sexp)));
+            vm_push(compiler, 1);
+            break;
+
+        case EVAL_BUILTIN_IF:
+            vm_compile_if(compiler, sexp, tail);
+            break;
+
+        case EVAL_BUILTIN_BEGIN:
+            vm_compile_begin(compiler, sexp, tail);
+            break;
+
+        case EVAL_BUILTIN_FRAME_LET:
+            vm_compile_let(compiler, sexp, tail);
+            break;
+
+        case EVAL_BUILTIN_FRAME_LETREC:
+            vm_compile_letrec(compiler, sexp, tail);
+            break;
+
+        case EVAL_BUILTIN_CLOSURE:
+            vm_compile_closure(compiler, sexp);
+            break;
+
+        case EVAL_BUILTIN_CAR:
+            vm_compile_unary(compiler, sexp, VM_CAR);
+            break;
+
+        case EVAL_BUILTIN_CDR:
+            vm_compile_unary(compiler, sexp, VM_CDR);
+            break;
+
+        case EVAL_BUILTIN_TAG:
+            vm_compile_unary(compiler, sexp, VM_TAG);
+            break;
+
+        case EVAL_BUILTIN_CONS:
+            vm_compile_binary(compiler, sexp, VM_CONS);
+            break;
+
+        case EVAL_BUILTIN_ADD:
+            vm_compile_arithmetic(compiler, sexp, VM_ADD);
+            break;
+
+        case EVAL_BUILTIN_SUBTRACT:
+            vm_compile_arithmetic(compiler, sexp, VM_SUBTRACT);
+            break;
+
+        case EVAL_BUILTIN_MULTIPLY:
+            vm_compile_arithmetic(compiler, sexp, VM_MULTIPLY);
+            break;
+
+        case EVAL_BUILTIN_DIVIDE:
+            vm_compile_arithmetic(compiler, sexp, VM_DIVIDE);
+            break;
+
+        case EVAL_BUILTIN_GREATER:
+            vm_compile_arithmetic(compiler, sexp, VM_GREATER);
+            break;
+
+        case EVAL_BUILTIN_LESS:
+            vm_compile_arithmetic(compiler, sexp, VM_LESS);
+            break;
+
+        case EVAL_BUILTIN_GREATER_EQUAL:
+            vm_compile_arithmetic(compiler, sexp, VM_GREATER_EQUAL);
+            break;
+
+        case EVAL_BUILTIN_LESS_EQUAL:
+            vm_compile_arithmetic(compiler, sexp, VM_LESS_EQUAL);
+            break;
+
+        case EVAL_BUILTIN_EQUAL:
+            vm_compile_arithmetic(compiler, sexp, VM_EQUAL);
+            break;
+
+        case EVAL_BUILTIN_LIST:
+            vm_compile_list(compiler, sexp, VM_LIST);
+            break;
+
+        case EVAL_BUILTIN_LIST_STAR:
+            vm_compile_list(compiler, sexp, VM_LIST_STAR);
+            break;
+
+        case EVAL_BUILTIN_PRINT:
+            vm_compile_print(compiler, sexp, 0);
+            break;
+
+        case EVAL_BUILTIN_DISPLAY:
+            vm_compile_print(compiler, sexp, VM_PRINT_DISPLAY);
+            break;
+
+        case EVAL_BUILTIN_EVAL: {
+            if (vm_length(CDR(sexp)) != 1) {
+                vm_compile_fallback(compiler, sexp);
+                break;
+            }
+
+            size_t depth = compiler->depth;
+            uint32_t chain = VM_CHAIN_END;
+
+            vm_compile_values(compiler, CDR(sexp), &chain, depth);
+            vm_emit_op(compiler, VM_EVAL, 0);
+            vm_patch_chain(compiler, chain);
+            break;
+        }
+
+        case EVAL_BUILTIN_APPLY:
+            vm_compile_apply(compiler, sexp, tail);
+            break;
+
+        case EVAL_BUILTIN_LENGTH:
+        case EVAL_BUILTIN_APPEND:
+        case EVAL_BUILTIN_REVERSE:
+        case EVAL_BUILTIN_NTH:
+        case EVAL_BUILTIN_ASSOC:
+        case EVAL_BUILTIN_ASSQ:
+        case EVAL_BUILTIN_MEMBER:
+        case EVAL_BUILTIN_MAP:
+        case EVAL_BUILTIN_FILTER:
+        case EVAL_BUILTIN_FOLDL:
+        case EVAL_BUILTIN_IS_EQUAL:
+            vm_compile_native(compiler, sexp, eval_dispatch(CAR(sexp)));
+            break;
+
+        case EVAL_BUILTIN_COUNT:
+            vm_compile_call(compiler, sexp, tail);
+            break;
+
+        // Rare or malformed, see vm.h
+        //
+        default:
+            vm_compile_fallback(compiler, sexp);
+            break;
+    }
+}
+
+static vm_code_t *vm_compile_body(any_sexp_t body, size_t size, size_t captured)
+{
+    vm_compiler_t compiler = {
+        .code = vm_code_new(),
+        .depth = 0,
+        .captured = captured,
+        .unassigned = SIZE_MAX,
+    };
+
+    compiler.code->size = size;
+
+    vm_compile(&compiler, body, true);
+    vm_emit_op(&compiler, VM_RETURN, 0);
+
+    log_value_trace("Compiled bytecode",
+                    "g:body", ANY_LOG_FORMATTER(any_sexp_fprint), body,
+                    "l:length", (long)compiler.code->length,
+                    "l:depth", (long)compiler.code->depth);
+
+    return compiler.code;
+}
+
+// Returns the code of the closure, compiling it on the first call
+static vm_code_t *vm_closure_code(any_sexp_t closure)
+{
+    any_sexp_t key = EVAL_CLOSURE_CODE(closure);
+
+    // NOTE: The index is checked, since the code may come from an image
+    any_sexp_t index = EVAL_FIELD(key, EVAL_CODE_COMPILED);
+    if (ANY_SEXP_IS_NUMBER(index)) {
+        size_t i = ANY_SEXP_GET_NUMBER(index);
+        if (i < codes_length && codes[i] != NULL && ANY_SEXP_IS_EQ(codes[i]->key, key))
+            return codes[i];
+    }
+
+    vm_code_t *code = vm_compile_body(EVAL_FIELD(key, EVAL_CODE_BODY),
+                                      ANY_SEXP_GET_NUMBER(EVAL_FIELD(key, EVAL_CODE_SIZE)),
+                                      EVAL_CLOSURE_CAPTURED(closure));
+    code->key = key;
+    code->captured = EVAL_CLOSURE_CAPTURED(closure);
+    code->self = ANY_SEXP_GET_NUMBER(EVAL_FIELD(key, EVAL_CODE_SELF));
+    code->params = ANY_SEXP_GET_NUMBER(EVAL_FIELD(key, EVAL_CODE_PARAMS));
+    code->rest = ANY_SEXP_GET_NUMBER(EVAL_FIELD(key, EVAL_CODE_REST));
+
+    if (codes_length == codes_capacity) {
+        codes_capacity = codes_capacity == 0 ? 64 : 2 * codes_capacity;
+        codes = realloc(codes, codes_capacity * sizeof(vm_code_t *));
+        if (codes == NULL)
+            log_panic("Failed to allocate the code table");
+    }
+
+    codes[codes_length] = code;
+    EVAL_FIELD(key, EVAL_CODE_COMPILED) = any_sexp_number(codes_length);
+    eval_change_env(key, any_sexp_number(codes_length++), &code_index);
+    return code;
+}
+
+// Interpreter
+
+// Moves the arguments of the call at base into the frame of the closure,
+// which starts at base itself
+static bool vm_bind_args(any_sexp_t *base, size_t argc, any_sexp_t closure, vm_code_t *code)
+{
+    if (argc < code->params) {
+        log_error("Too few arguments for parameters");
+        return false;
+    }
+
+    if (code->rest < 0) {
+        log_error("Rest parameter should be the last");
+        return false;
+    }
+
+    if (code->rest == 0 && argc > code->params) {
+        log_error("Too many arguments for parameters");
+        return false;
+    }
+
+    // NOTE: The rest list is built before moving the arguments
+    any_sexp_t rest = ANY_SEXP_NIL;
+    for (size_t i = argc; i > code->params; i--)
+        rest = any_sexp_cons(base[i], rest);
+
+    // NOTE: The frames are a few slots, which are copied in loops rather
+    //       than by memmove, in the direction of the move
+    any_sexp_t *params = base + code->captured + code->self;
+    if (params > base + 1) {
+        for (size_t j = code->params; j-- > 0;)
+            params[j] = base[j + 1];
+    } else {
+        for (size_t j = 0; j < code->params; j++)
+            params[j] = base[j + 1];
+    }
+
+    any_sexp_t *captured = EVAL_VALUES(closure) + 1;
+    for (size_t j = 0; j < code->captured; j++)
+        base[j] = captured[j];
+
+    size_t i = code->captured;
+
+    if (code->self)
+        base[i++] = closure;
+
+    i += code->params;
+    if (code->rest)
+        base[i++] = rest;
+
+    for (; i < code->size; i++)
+        base[i] = ANY_SEXP_NIL;
+
+    return true;
+}
+
+static inline bool vm_stack_fits(any_sexp_t *fp, vm_code_t *code)
+{
+    return fp + code->size + code->depth <= eval_stack + EVAL_STACK_SIZE;
+}
+
+static any_sexp_t vm_run(vm_code_t *code, any_sexp_t *fp)
+{
+    if (!vm_stack_fits(fp, code)) {
+        log_error("Stack overflow");
+        return ANY_SEXP_ERROR;
+    }
+
+    size_t entry = calls_top;
+    vm_run_t run = { code, 0, runs };
+    runs = &run;
+
+    any_sexp_t *sp = fp + code->size;
+    any_sexp_t *constants = code->constants;
+    uint32_t *ip = code->code;
+
+    // Registers of the calls
+    any_sexp_t *base, closure, value;
+    vm_code_t *callee;
+    size_t argc;
+    uint32_t word;
+
+// NOTE: The operands are roots only up to eval_stack_top, so it is moved
+//       before the instructions that can collect
+#define VM_SYNC() (eval_stack_top = sp - eval_stack)
+
+// The fixnums are handled in place, the other operands and the results out
+// of range by the primitives of eval
+#define VM_ARITHMETIC(overflow, primitive) \
+    do { \
+        intptr_t result; \
+        sp--; \
+        if (ANY_SEXP_IS_NUMBER(sp[-1]) && ANY_SEXP_IS_NUMBER(sp[0]) && \
+            !overflow(ANY_SEXP_GET_NUMBER(sp[-1]), ANY_SEXP_GET_NUMBER(sp[0]), &result) && \
+            ANY_SEXP_NUMBER_FITS(result)) \
+            sp[-1] = any_sexp_number(result); \
+        else { \
+            VM_SYNC(); \
+            sp[-1] = primitive(sp[-1], sp[0]); \
+        } \
+    } while (0)
+
+#define VM_COMPARE(op, primitive) \
+    do { \
+        sp--; \
+        if (ANY_SEXP_IS_NUMBER(sp[-1]) && ANY_SEXP_IS_NUMBER(sp[0])) \
+            sp[-1] = ANY_SEXP_GET_NUMBER(sp[-1]) op ANY_SEXP_GET_NUMBER(sp[0]) \
+                   ? T \
+                   : ANY_SEXP_NIL; \
+        else \
+            sp[-1] = primitive(sp[-1], sp[0]); \
+    } while (0)
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_OPCODE_LABEL(op) &&op_##op,
+    static void *labels[VM_OPCODE_COUNT] = { VM_OPCODES(VM_OPCODE_LABEL) };
+#undef VM_OPCODE_LABEL
+
+#define VM_CASE(op) op_##op
+#define VM_DISPATCH() do { word = *ip++; goto *labels[VM_OPCODE(word)]; } while (0)
+
+    VM_DISPATCH();
+    {
+#else
+#define VM_CASE(op) case VM_##op
+#define VM_DISPATCH() goto dispatch
+
+dispatch:
+    word = *ip++;
+    switch (VM_OPCODE(word)) {
+#endif
+        VM_CASE(CONST):
+            *sp++ = constants[VM_ARG(word)];
+            VM_DISPATCH();
+
+        VM_CASE(NIL):
+            *sp++ = ANY_SEXP_NIL;
+            VM_DISPATCH();
+
+        VM_CASE(LOCAL):
+            *sp++ = fp[VM_ARG(word)];
+            VM_DISPATCH();
+
+        VM_CASE(LOCAL_CHECKED):
+            value = fp[VM_ARG(word)];
+            if (eval_is_unassigned(value)) {
+                log_value_error("Variable used before its definition",
+                                "g:name", ANY_LOG_FORMATTER(any_sexp_fprint), EVAL_VALUES(value)[0]);
+                for (; run.letrecs > 0; run.letrecs--)
+                    eval_letrec_end();
+
+                calls_top = entry;
+                runs = run.prev;
+                return ANY_SEXP_ERROR;
+            }
+
+            *sp++ = value;
+            VM_DISPATCH();
+
+        VM_CASE(SET_LOCAL):
+            fp[VM_ARG(word)] = *--sp;
+            VM_DISPATCH();
+
+        VM_CASE(GLOBAL):
+            *sp++ = eval_symbol(constants[VM_ARG(word)]);
+            VM_DISPATCH();
+
+        VM_CASE(POP):
+            sp--;
+            VM_DISPATCH();
+
+        VM_CASE(JUMP):
+            ip = code->code + ip[0];
+            VM_DISPATCH();
+
+        VM_CASE(BRANCH):
+            if (ANY_SEXP_IS_ERROR(sp[-1])) {
+                ip = code->code + ip[1];
+                VM_DISPATCH();
+            }
+
+            ip = ANY_SEXP_IS_NIL(*--sp)
+               ? code->code + ip[0]
+               : ip + 2;
+            VM_DISPATCH();
+
+        VM_CASE(CHECK):
+            if (ANY_SEXP_IS_ERROR(sp[-1])) {
+                sp = fp + code->size + ip[1];
+                *sp++ = ANY_SEXP_ERROR;
+                ip = code->code + ip[0];
+                VM_DISPATCH();
+            }
+
+            ip += 2;
+            VM_DISPATCH();
+
+        VM_CASE(CALLABLE):
+            if (!eval_is_closure(sp[-1])) {
+                if (!ANY_SEXP_IS_ERROR(sp[-1]))
+                    log_error("Expected a function as a callee");
+
+                sp = fp + code->size + ip[1];
+                *sp++ = ANY_SEXP_ERROR;
+                ip = code->code + ip[0];
+                VM_DISPATCH();
+            }
+
+            ip += 2;
+            VM_DISPATCH();
+
+        VM_CASE(CALL):
+            argc = VM_ARG(word);
+            goto call;
+
+        VM_CASE(TAIL_CALL):
+            argc = VM_ARG(word);
+            goto tail_call;
+
+        VM_CASE(APPLY):
+        VM_CASE(TAIL_APPLY): {
+            any_sexp_t list = *--sp;
+
+            if (!eval_is_closure(sp[-1]) || !ANY_SEXP_IS_CONS(list)) {
+                log_error("Invalid arguments passed to apply");
+                sp[-1] = ANY_SEXP_ERROR;
+                VM_DISPATCH();
+            }
+
+            // NOTE: The binding of an improper list is left to the tree-walker
+            if (vm_length(list) < 0) {
+                VM_SYNC();
+                sp[-1] = eval_lambda_call(sp[-1], list);
+                VM_DISPATCH();
+            }
+
+            for (argc = 0; ANY_SEXP_IS_CONS(list); list = CDR(list), argc++) {
+                if (sp == eval_stack + EVAL_STACK_SIZE) {
+                    log_error("Stack overflow");
+                    sp -= argc;
+                    sp[-1] = ANY_SEXP_ERROR;
+                    VM_DISPATCH();
+                }
+
+                *sp++ = CAR(list);
+            }
+
+            if (VM_OPCODE(word) == VM_TAIL_APPLY)
+                goto tail_call;
+
+            goto call;
+        }
+
+        VM_CASE(RETURN):
+            value = sp[-1];
+            goto ret;
+
+        VM_CASE(CLOSURE): {
+            size_t count = *ip++;
+
+            VM_SYNC();
+            closure = eval_closure(constants[VM_ARG(word)], sp - count, count);
+
+            sp -= count;
+            *sp++ = closure;
+            VM_DISPATCH();
+        }
+
+        VM_CASE(CAR):
+            if (!ANY_SEXP_IS_CONS(sp[-1])) {
+                log_value_error("Expected cons (car)", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sp[-1]);
+                sp[-1] = ANY_SEXP_ERROR;
+                VM_DISPATCH();
+            }
+
+            sp[-1] = CAR(sp[-1]);
+            VM_DISPATCH();
+
+        VM_CASE(CDR):
+            if (!ANY_SEXP_IS_CONS(sp[-1])) {
+                log_value_error("Expected cons (cdr)", "g:sexp", ANY_LOG_FORMATTER(any_sexp_fprint), sp[-1]);
+                sp[-1] = ANY_SEXP_ERROR;
+                VM_DISPATCH();
+            }
+
+            sp[-1] = CDR(sp[-1]);
+            VM_DISPATCH();
+
+        VM_CASE(CONS):
+            VM_SYNC();
+            sp--;
+            sp[-1] = ANY_SEXP_IS_ERROR(sp[-1]) || ANY_SEXP_IS_ERROR(sp[0])
+                   ? ANY_SEXP_ERROR
+                   : any_sexp_cons(sp[-1], sp[0]);
+            VM_DISPATCH();
+
+        VM_CASE(TAG):
+            sp[-1] = bignum_tag(sp[-1]);
+            VM_DISPATCH();
+
+        VM_CASE(ADD):
+            VM_ARITHMETIC(__builtin_add_overflow, eval_primitive_add);
+            VM_DISPATCH();
+
+        VM_CASE(SUBTRACT):
+            VM_ARITHMETIC(__builtin_sub_overflow, eval_primitive_subtract);
+            VM_DISPATCH();
+
+        VM_CASE(MULTIPLY):
+            VM_ARITHMETIC(__builtin_mul_overflow, eval_primitive_multiply);
+            VM_DISPATCH();
+
+        VM_CASE(DIVIDE):
+            sp--;
+            VM_SYNC();
+            sp[-1] = eval_primitive_divide(sp[-1], sp[0]);
+            VM_DISPATCH();
+
+        VM_CASE(GREATER):
+            VM_COMPARE(>, eval_primitive_greater);
+            VM_DISPATCH();
+
+        VM_CASE(LESS):
+            VM_COMPARE(<, eval_primitive_less);
+            VM_DISPATCH();
+
+        VM_CASE(GREATER_EQUAL):
+            VM_COMPARE(>=, eval_primitive_greater_equal);
+            VM_DISPATCH();
+
+        VM_CASE(LESS_EQUAL):
+            VM_COMPARE(<=, eval_primitive_less_equal);
+            VM_DISPATCH();
+
+        VM_CASE(EQUAL):
+            sp--;
+            sp[-1] = eval_primitive_equal(sp[-1], sp[0]);
+            VM_DISPATCH();
+
+        VM_CASE(LIST): {
+            size_t count = VM_ARG(word);
+
+            VM_SYNC();
+            any_sexp_t list = ANY_SEXP_NIL;
+            while (count-- > 0)
+                list = any_sexp_cons(*--sp, list);
+
+            *sp++ = list;
+            VM_DISPATCH();
+        }
+
+        VM_CASE(LIST_STAR): {
+            size_t count = VM_ARG(word);
+
+            VM_SYNC();
+            any_sexp_t list = *--sp;
+            while (--count > 0)
+                list = any_sexp_cons(*--sp, list);
+
+            *sp++ = list;
+            VM_DISPATCH();
+        }
+
+        VM_CASE(PRINT): {
+            any_sexp_t value = *--sp;
+
+            eval_write(value,
+                       VM_ARG(word) & VM_PRINT_DISPLAY ? ANY_SEXP_WRITER_BARE_STRING : ANY_SEXP_WRITER_DEFAULT,
+                       VM_ARG(word) & VM_PRINT_SPACE);
+            VM_DISPATCH();
+        }
+
+        VM_CASE(EVAL):
+            VM_SYNC();
+            sp[-1] = vm_eval(sp[-1]);
+            VM_DISPATCH();
+
+        VM_CASE(NATIVE): {
+            size_t count = *ip++;
+
+            VM_SYNC();
+            value = eval_native(VM_ARG(word), sp - count, count);
+
+            sp -= count;
+            *sp++ = value;
+            VM_DISPATCH();
+        }
+
+        VM_CASE(UNASSIGNED):
+            VM_SYNC();
+            fp[VM_ARG(word)] = eval_unassigned(constants[*ip++]);
+            VM_DISPATCH();
+
+        VM_CASE(LETREC):
+            run.letrecs++;
+            eval_letrec_begin();
+            VM_DISPATCH();
+
+        VM_CASE(ASSIGN):
+            eval_letrec_assign(&fp[VM_ARG(word)], *--sp);
+            VM_DISPATCH();
+
+        VM_CASE(LETREC_END):
+            run.letrecs--;
+            eval_letrec_end();
+            VM_DISPATCH();
+
+        VM_CASE(FALLBACK):
+            VM_SYNC();
+            value = eval(constants[VM_ARG(word)], fp);
+            *sp++ = value;
+            VM_DISPATCH();
+
+#ifndef VM_COMPUTED_GOTO
+        default:
+            log_panic("Invalid opcode (%x)", VM_OPCODE(word));
+#endif
+    }
+
+call:
+    VM_SYNC();
+    base = sp - argc - 1;
+    closure = base[0];
+    callee = vm_closure_code(closure);
+
+    if (!vm_stack_fits(base, callee) || calls_top == VM_CALLS_SIZE) {
+        log_error("Stack overflow");
+        sp = base;
+        *sp++ = ANY_SEXP_ERROR;
+        VM_DISPATCH();
+    }
+
+    if (!vm_bind_args(base, argc, closure, callee)) {
+        sp = base;
+        *sp++ = ANY_SEXP_ERROR;
+        VM_DISPATCH();
+    }
+
+    calls[calls_top++] = (vm_call_t) {
+        .code = code,
+        .ip = ip,
+        .fp = fp,
+    };
+
+    goto enter;
+
+tail_call:
+    // NOTE: The arguments are already evaluated, so the frame of the
+    //       current call is replaced by the frame of the callee
+    //
+    base = sp - argc - 1;
+    memmove(fp, base, (argc + 1) * sizeof(any_sexp_t));
+
+    base = fp;
+    sp = fp + argc + 1;
+    VM_SYNC();
+    closure = base[0];
+    callee = vm_closure_code(closure);
+
+    if (!vm_stack_fits(base, callee)) {
+        log_error("Stack overflow");
+        value = ANY_SEXP_ERROR;
+        goto ret;
+    }
+
+    if (!vm_bind_args(base, argc, closure, callee)) {
+        value = ANY_SEXP_ERROR;
+        goto ret;
+    }
+
+enter:
+    code = callee;
+    run.code = code;
+    constants = code->constants;
+    ip = code->code;
+    fp = base;
+    sp = fp + code->size;
+    VM_DISPATCH();
+
+ret:
+    if (calls_top == entry) {
+        runs = run.prev;
+        return value;
+    }
+
+    vm_call_t *call = &calls[--calls_top];
+
+    // NOTE: The frame starts where the callee was, so the value replaces it
+    sp = fp;
+    *sp++ = value;
+
+    code = call->code;
+    run.code = code;
+    constants = code->constants;
+    ip = call->ip;
+    fp = call->fp;
+    VM_DISPATCH();
+
+#undef VM_SYNC
+#undef VM_ARITHMETIC
+#undef VM_COMPARE
+#undef VM_CASE
+#undef VM_DISPATCH
+}
+
+any_sexp_t vm_eval(any_sexp_t sexp)
+{
+    size_t size;
+    any_sexp_t resolved = eval_resolve_toplevel(sexp, &size);
+    if (ANY_SEXP_IS_ERROR(resolved))
+        return ANY_SEXP_ERROR;
+
+    size_t top = eval_stack_top;
+
+    any_sexp_t *frame = eval_push_frame(size);
+    if (frame == NULL)
+        return ANY_SEXP_ERROR;
+
+    // NOTE: The code of the top level is used only once
+    vm_code_t *code = vm_compile_body(resolved, size, 0);
+    any_sexp_t value = vm_run(code, frame);
+    vm_code_free(code);
+
+    eval_stack_top = top;
+    return value;
+}
+
+// Caller of the native functions (see eval_call), the arguments are copied
+// above the frame stack as for a call from the bytecode
+static any_sexp_t vm_call(any_sexp_t closure, const any_sexp_t *args, size_t argc)
+{
+    size_t top = eval_stack_top;
+    any_sexp_t *base = eval_stack + top;
+
+    if (top + argc + 1 > EVAL_STACK_SIZE) {
+        log_error("Stack overflow");
+        return ANY_SEXP_ERROR;
+    }
+
+    base[0] = closure;
+    memcpy(base + 1, args, argc * sizeof(any_sexp_t));
+    eval_stack_top += argc + 1;
+
+    vm_code_t *code = vm_closure_code(closure);
+
+    any_sexp_t value = ANY_SEXP_ERROR;
+    if (!vm_stack_fits(base, code))
+        log_error("Stack overflow");
+    else if (vm_bind_args(base, argc, closure, code))
+        value = vm_run(code, base);
+
+    eval_stack_top = top;
+    return value;
+}
+
+static void vm_mark()
+{
+    for (vm_run_t *run = runs; run != NULL; run = run->prev)
+        vm_code_mark(run->code);
+
+    for (size_t i = 0; i < calls_top; i++)
+        vm_code_mark(calls[i].code);
+}
+
+static void vm_mark_entry(any_sexp_t key, any_sexp_t index)
+{
+    vm_code_mark(codes[ANY_SEXP_GET_NUMBER(index)]);
+}
+
+static void vm_free_entry(any_sexp_t key, any_sexp_t index)
+{
+    vm_code_free(codes[ANY_SEXP_GET_NUMBER(index)]);
+    codes[ANY_SEXP_GET_NUMBER(index)] = NULL;
+}
+
+void vm_init()
+{
+    calls = malloc(VM_CALLS_SIZE * sizeof(vm_call_t));
+    if (calls == NULL)
+        log_panic("Failed to allocate the call stack");
+
+    gc_add_marker(vm_mark);
+    gc_weak_env(&code_index, vm_mark_entry, vm_free_entry);
+
+    eval_set_engine(vm_eval);
+    eval_set_caller(vm_call);
+}
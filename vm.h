@@ -0,0 +1,23 @@
+#ifndef VM_H
+#define VM_H
+
+#include "any_sexp.h"
+
+// Bytecode VM
+//
+// Alternative engine to the tree-walker of eval.c. The expressions are
+// resolved as in eval (see eval_resolve), compiled once to a compact bytecode
+// and run by a dispatch loop, so the syntax of a form is checked only when it
+// is compiled. The closures, the frame stack and the global environment are
+// shared with the tree-walker, so the two engines can call each other.
+//
+// The forms that are rare or malformed are left to the tree-walker, which
+// evaluates them in the frame of the VM, so the results and the errors are
+// the same of eval.
+
+any_sexp_t vm_eval(any_sexp_t sexp);
+
+// Selects the VM as the engine of the top level expressions
+void vm_init();
+
+#endif